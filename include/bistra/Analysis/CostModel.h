@@ -0,0 +1,58 @@
+#ifndef BISTRA_ANALYSIS_COSTMODEL_H
+#define BISTRA_ANALYSIS_COSTMODEL_H
+
+#include <cstdint>
+#include <vector>
+
+namespace bistra {
+
+class Program;
+
+/// Describes the parts of the processor that the cost model depends on.
+struct MachineModel {
+  /// The number of vector registers.
+  unsigned numRegisters{16};
+  /// The number of 32-bit lanes in a vector register.
+  unsigned vectorWidth{8};
+  /// The number of cores that execute parallel loops.
+  unsigned numCores{1};
+  /// The size of the cache line, in bytes.
+  unsigned lineSize{64};
+  /// The sizes of the L1, L2 and L3 data caches, in bytes.
+  uint64_t cacheSize[3] = {32 << 10, 1 << 20, 8 << 20};
+  /// The number of bytes per cycle that are transferred into the L1, L2 and L3
+  /// caches from the next level of the memory hierarchy.
+  double bandwidth[3] = {64, 32, 8};
+  /// The number of vector arithmetic instructions that execute per cycle.
+  double arithPerCycle{2};
+  /// The number of vector loads and stores that execute per cycle.
+  double memPerCycle{2};
+  /// The number of cycles that the control flow of a loop iteration takes.
+  double loopOverhead{1};
+  /// The latency of an accumulation, which limits the speed of loops that
+  /// accumulate into the same location in every iteration.
+  double accumulateLatency{4};
+
+  /// \returns the model of the host, with the cache sizes and the number of
+  /// cores of the processor, if they can be detected.
+  static MachineModel getHost();
+};
+
+/// \returns the estimated number of cycles that it takes to execute the
+/// program \p p on the machine \p M. The estimate considers the throughput of
+/// the vector instructions, the register pressure of the innermost loops, and
+/// the traffic between the levels of the memory hierarchy, based on the data
+/// that each loop nest touches.
+double estimateCycles(Program *p, const MachineModel &M);
+
+/// \returns a list of features that describe the program \p p, for learning
+/// the execution time of programs. The features are the analytical estimate,
+/// the counts of estimateCompute, the trip counts and the strides of the
+/// loops, the vector width, the bytes that the loop nests touch at each level
+/// and the register pressure. Counts that span many orders of magnitude are
+/// logarithmic. All programs have the same number of features.
+std::vector<double> getProgramFeatures(Program *p, const MachineModel &M);
+
+} // end namespace bistra
+
+#endif
@@ -24,6 +24,7 @@ class LocalVar;
 class Argument;
 class StoreStmt;
 class LoadExpr;
+class BinaryExpr;
 struct ExprType;
 
 /// Collect and return the list of statements in \p s.
@@ -109,6 +110,17 @@ bool areLoadsStoresDisjoint(const std::vector<LoadExpr *> &loads,
 bool computeKnownIntegerRange(Expr *e, std::pair<int, int> &range,
                               const std::set<Loop *> *liveLoops = nullptr);
 
+/// \returns \p e if it is a floating-point multiplication that can be fused
+/// into an addition that uses it (a multiply-add), or nullptr.
+BinaryExpr *getFusableMul(Expr *e);
+
+/// \returns the alignment in bytes that is known for the address of the
+/// element \p indices in the argument \p arg. The alignment is computed from
+/// the alignment of the buffer and from the values that the indices can take.
+/// For example, A[i * 8] in a 64-byte aligned float buffer is 32-byte aligned.
+unsigned getKnownAlignment(const Argument *arg,
+                           const std::vector<ExprHandle> &indices);
+
 /// \returns True if \e is a constant (int or fp).
 bool isConst(Expr *e);
 
@@ -1,10 +1,14 @@
 #ifndef BISTRA_BACKENDS_BACKEND_H
 #define BISTRA_BACKENDS_BACKEND_H
 
+#include "bistra/Backends/Measure.h"
 #include "bistra/Program/Program.h"
 
 namespace bistra {
 
+class DynamicKernel;
+class KernelLibrary;
+
 class Backend {
 public:
   virtual ~Backend() = default;
@@ -16,15 +20,52 @@ public:
   virtual void emitProgramCode(Program *p, const std::string &path, bool isSrc,
                                int iter) = 0;
 
+  /// Generate code for the dynamic kernel \p K and save it at path \p path.
+  /// The kernel is a function that takes the tensors, followed by the size of
+  /// the dynamic dimension, and calls the specialized programs of the kernel.
+  /// Emit an object file, or source if \p isSrc is set.
+  virtual void emitDynamicCode(DynamicKernel &K, const std::string &path,
+                               bool isSrc) = 0;
+
+  /// Generate code for all of the kernels of the library \p L, and the
+  /// registry that describes them, and save it at path \p path.
+  /// Emit an object file, or source if \p isSrc is set.
+  /// \returns false if some kernel could not be emitted.
+  virtual bool emitLibraryCode(KernelLibrary &L, const std::string &path,
+                               bool isSrc) = 0;
+
   /// Compile and evaluate the performance of the program \p p.
-  /// Execute \p iter number of iterations.
-  /// \returns the time in seconds it took to execute the proogram.
+  /// Execute \p iter number of iterations in each measurement.
+  /// \returns the median time in seconds it took to execute the proogram.
   virtual double evaluateCode(Program *p, unsigned iter) = 0;
 
+  /// Compile the program \p p into a benchmark that executes \p iter
+  /// iterations. This method is thread safe and can be used to compile a
+  /// number of programs concurrently.
+  /// \returns an opaque binary that can be passed to evaluateBinary.
+  virtual std::string compileBenchmark(Program *p, unsigned iter) = 0;
+
+  /// Evaluate the performance of the \p binary that was compiled from the
+  /// program \p p by compileBenchmark with \p iter iterations. The
+  /// measurement is controlled by \p opts. The tensors are allocated with the
+  /// alignment and the padding of the arguments.
+  /// \returns the statistics of the time it took to execute the proogram.
+  virtual Measurement evaluateBinary(Program *p, const std::string &binary,
+                                     unsigned iter,
+                                     const MeasureOptions &opts) = 0;
+
   /// Compile and run the program \p p on the tensors that are stored
   /// consecutively in \p mem.
   virtual void runOnce(Program *p, void *mem) = 0;
 
+  /// Compile and run the dynamic kernel \p K with the size \p size on the
+  /// tensors that are stored consecutively in \p mem.
+  virtual void runOnce(DynamicKernel &K, unsigned size, void *mem) = 0;
+
+  /// \returns a string that describes the target and the features of the
+  /// processor that the code is generated for.
+  virtual std::string getTargetDescription() const = 0;
+
   /// \returns the number of machine registers.
   virtual unsigned getNumRegisters() const = 0;
 
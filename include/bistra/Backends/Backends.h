@@ -10,8 +10,11 @@ namespace bistra {
 class Backend;
 
 /// \returns a compiler backend that is defined by \p name. The name of the
-/// compiler backend must be valid.
-std::unique_ptr<Backend> getBackend(const std::string &name);
+/// compiler backend must be valid. The optional \p cpu and \p features
+/// select the target CPU. The backend targets the host CPU by default.
+std::unique_ptr<Backend> getBackend(const std::string &name,
+                                    const std::string &cpu = "",
+                                    const std::string &features = "");
 
 } // namespace bistra
 
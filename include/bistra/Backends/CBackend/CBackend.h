@@ -11,10 +11,39 @@ public:
   virtual void emitProgramCode(Program *p, const std::string &path, bool isSrc,
                                int iter) override;
 
+  virtual void emitDynamicCode(DynamicKernel &K, const std::string &path,
+                               bool isSrc) override {
+    assert(false);
+  }
+
+  virtual bool emitLibraryCode(KernelLibrary &L, const std::string &path,
+                               bool isSrc) override {
+    assert(false);
+    return false;
+  }
+
   virtual double evaluateCode(Program *p, unsigned iter) override;
 
+  virtual std::string compileBenchmark(Program *p, unsigned iter) override {
+    assert(false);
+    return "";
+  }
+
+  virtual Measurement evaluateBinary(Program *p, const std::string &binary,
+                                     unsigned iter,
+                                     const MeasureOptions &opts) override {
+    assert(false);
+    return Measurement();
+  }
+
   virtual void runOnce(Program *p, void *mem) override { assert(false); }
 
+  virtual void runOnce(DynamicKernel &K, unsigned size, void *mem) override {
+    assert(false);
+  }
+
+  virtual std::string getTargetDescription() const override { return "C"; }
+
   virtual unsigned getNumRegisters() const override { return 16; }
 
   virtual unsigned getRegisterWidth() const override { return 8; }
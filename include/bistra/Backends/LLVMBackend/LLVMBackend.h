@@ -16,18 +16,41 @@ class TargetMachine;
 namespace bistra {
 
 class LLVMBackend : public Backend {
-  /// An instance of the ORC JIT. Notice that we don't use unique_ptr here
-  /// to work around and create the rtti barrier between our code and LLVM.
+  /// An instance of the ORC JIT that is shared by all of the evaluations.
+  /// Notice that we don't use unique_ptr here to work around and create the
+  /// rtti barrier between our code and LLVM.
   llvm::orc::SimpleJIT *JIT;
 
+  /// The name of the target CPU.
+  std::string cpu_;
+  /// The features of the target CPU, such as "+avx2,-avx512f".
+  std::string features_;
+  /// The number of vector registers of the target.
+  unsigned numRegisters_;
+  /// The number of floats in a vector register of the target.
+  unsigned registerWidth_;
+
+  /// Query the target for the number and the width of the vector registers.
+  void detectRegisters();
+
   /// Optimize the module \p M.
   void optimize(llvm::TargetMachine &TM, llvm::Module *M);
 
-  /// \returns the native target machine.
+  /// \returns the target machine of the current thread. Threads take the
+  /// machines out of a pool and return them when they exit, so each machine
+  /// is created once and reused by the threads that follow.
   llvm::TargetMachine &getTargetMachine();
 
+  /// Compile the program \p p into a benchmark that executes \p iter
+  /// iterations. If \p packed is set then the benchmark expects the tensors
+  /// to be stored consecutively in memory, and otherwise in the aligned and
+  /// padded layout of evaluateBinary.
+  std::string compile(Program *p, unsigned iter, bool packed);
+
 public:
-  LLVMBackend();
+  /// Create a backend for the CPU \p cpu with the features \p features.
+  /// Target the host CPU if both are empty.
+  LLVMBackend(const std::string &cpu = "", const std::string &features = "");
   ~LLVMBackend();
 
   void emitObject(llvm::Module *M, const std::string &path);
@@ -35,16 +58,39 @@ public:
   virtual void emitProgramCode(Program *p, const std::string &path, bool isSrc,
                                int iter) override;
 
-  double run(std::unique_ptr<llvm::Module> M,
-             std::unique_ptr<llvm::LLVMContext> ctx, void *mem, unsigned iter);
+  virtual void emitDynamicCode(DynamicKernel &K, const std::string &path,
+                               bool isSrc) override;
+
+  virtual bool emitLibraryCode(KernelLibrary &L, const std::string &path,
+                               bool isSrc) override;
+
+  /// Generate an object file for the module \p M in memory.
+  /// \returns the content of the object file.
+  std::string emitObjectBuffer(llvm::Module *M);
+
+  /// Load the object file \p binary into a JIT, and measure the benchmark
+  /// function on the memory \p mem according to \p opts.
+  /// \returns the time it took to run one of the \p iter iterations.
+  Measurement runBinary(const std::string &binary, void *mem, unsigned iter,
+                        const MeasureOptions &opts);
 
   virtual double evaluateCode(Program *p, unsigned iter) override;
 
+  virtual std::string compileBenchmark(Program *p, unsigned iter) override;
+
+  virtual Measurement evaluateBinary(Program *p, const std::string &binary,
+                                     unsigned iter,
+                                     const MeasureOptions &opts) override;
+
   virtual void runOnce(Program *p, void *mem) override;
 
-  virtual unsigned getNumRegisters() const override { return 16; }
+  virtual void runOnce(DynamicKernel &K, unsigned size, void *mem) override;
+
+  virtual std::string getTargetDescription() const override;
+
+  virtual unsigned getNumRegisters() const override { return numRegisters_; }
 
-  virtual unsigned getRegisterWidth() const override { return 8; }
+  virtual unsigned getRegisterWidth() const override { return registerWidth_; }
 };
 
 } // namespace bistra
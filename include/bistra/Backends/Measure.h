@@ -0,0 +1,57 @@
+#ifndef BISTRA_BACKENDS_MEASURE_H
+#define BISTRA_BACKENDS_MEASURE_H
+
+#include <functional>
+#include <vector>
+
+namespace bistra {
+
+/// Options that control the measurement of the execution time of some code.
+struct MeasureOptions {
+  /// The number of runs that warm up the caches before the measurement.
+  unsigned warmup{2};
+  /// The minimal number of measured runs.
+  unsigned minReps{5};
+  /// The maximal number of measured runs.
+  unsigned maxReps{100};
+  /// Stop measuring when the 95% confidence interval of the mean is narrower
+  /// than this fraction of the mean.
+  double relativeError{0.02};
+  /// Stop measuring after this number of seconds, even if the confidence
+  /// interval was not reached.
+  double maxSeconds{2.0};
+  /// Use the time-stamp counter of the processor, when it is available,
+  /// instead of the monotonic clock.
+  bool useTSC{false};
+};
+
+/// Statistics about the execution time of some code, in seconds.
+struct Measurement {
+  /// The median of the samples.
+  double median{0};
+  /// The fastest sample.
+  double min{0};
+  /// The mean of the samples that were not rejected as outliers.
+  double mean{0};
+  /// The standard deviation of the samples that were not rejected.
+  double stddev{0};
+  /// The number of measured samples.
+  unsigned samples{0};
+  /// The number of samples that were rejected as outliers.
+  unsigned outliers{0};
+
+  /// \returns the measurement, where all times are divided by \p n.
+  Measurement scale(unsigned n) const;
+};
+
+/// Compute the statistics for the samples \p samples. Samples that are far
+/// from the median are rejected as outliers.
+Measurement computeStatistics(std::vector<double> samples);
+
+/// Measure the execution time of \p fn according to the options \p opts.
+Measurement measure(const std::function<void()> &fn,
+                    const MeasureOptions &opts);
+
+} // namespace bistra
+
+#endif // BISTRA_BACKENDS_MEASURE_H
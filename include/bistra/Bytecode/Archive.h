@@ -0,0 +1,90 @@
+#ifndef BISTRA_BYTECODE_ARCHIVE_H
+#define BISTRA_BYTECODE_ARCHIVE_H
+
+#include "bistra/Bytecode/Bytecode.h"
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace bistra {
+
+class Program;
+
+/// An entry in the table of contents of a bytecode archive.
+struct ArchiveEntry {
+  /// The name of the program.
+  std::string name_;
+  /// The shapes of the arguments of the program (see getShapeSignature).
+  std::string shape_;
+  /// The target that the program was tuned for.
+  std::string target_;
+  /// The offset of the bytecode in the archive.
+  uint64_t offset_;
+  /// The size of the bytecode.
+  uint64_t size_;
+};
+
+/// A file that holds many serialized programs. The archive starts with a
+/// signature and is followed by records, and each record holds the key of
+/// the program (name, shape signature and target) and its bytecode. New
+/// records are appended to the end of the file, and the last record with some
+/// key replaces the earlier ones. The table of contents is built by reading
+/// the keys of the records when the archive is opened, and the programs are
+/// deserialized from the memory-mapped file when they are loaded.
+class BytecodeArchive {
+  /// The path of the archive.
+  std::string path_;
+  /// The mapping of the archive file.
+  std::unique_ptr<MappedFile> file_;
+  /// The table of contents, in the order of the records.
+  std::vector<ArchiveEntry> entries_;
+  /// The end of the last complete record, or zero if the file is missing or
+  /// is not an archive.
+  uint64_t end_{0};
+
+  /// Map the archive file and read the table of contents.
+  void reload();
+
+public:
+  /// The signature of the archive.
+  static constexpr uint32_t kMagic = 0x42534152;
+
+  /// Open the archive at \p path. The file is created when the first program
+  /// is appended.
+  BytecodeArchive(const std::string &path);
+
+  /// \returns the shape signature of \p p, which lists the element types and
+  /// the dimensions of the arguments, such as "float<64,32>,float<32>".
+  static std::string getShapeSignature(Program *p);
+
+  /// \returns all of the records of the archive, including the records that
+  /// were replaced by later records.
+  const std::vector<ArchiveEntry> &getEntries() const { return entries_; }
+
+  /// \returns the last record of the archive with the key \p name, \p shape
+  /// and \p target, or nullptr.
+  const ArchiveEntry *find(const std::string &name, const std::string &shape,
+                           const std::string &target) const;
+
+  /// \returns the records of the programs for the target \p target, without
+  /// the records that were replaced by later records.
+  std::vector<const ArchiveEntry *>
+  getLatestEntries(const std::string &target) const;
+
+  /// \returns the program of the record \p entry, or nullptr if the bytecode
+  /// is not valid.
+  Program *load(const ArchiveEntry &entry) const;
+
+  /// Appends the program \p p, which was tuned for \p target, to the end of
+  /// the archive. A record that was not written completely is discarded.
+  /// \returns False if the archive could not be written, or if the file
+  /// exists and is not an archive. The entries that were returned before are
+  /// invalidated.
+  bool append(Program *p, const std::string &target);
+};
+
+} // namespace bistra
+
+#endif // BISTRA_BYTECODE_ARCHIVE_H
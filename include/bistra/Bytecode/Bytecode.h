@@ -4,7 +4,9 @@
 #include "bistra/Program/Types.h"
 
 #include <cstdint>
+#include <functional>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 namespace bistra {
@@ -13,10 +15,41 @@ class Program;
 class Stmt;
 class Expr;
 
+/// Hashes the elements of an IdTable.
+template <typename ElemTy> struct IdTableHash {
+  size_t operator()(const ElemTy &T) const { return std::hash<ElemTy>()(T); }
+};
+
+template <> struct IdTableHash<Type> {
+  size_t operator()(const Type &T) const { return T.hash(); }
+};
+
+template <> struct IdTableHash<ExprType> {
+  size_t operator()(const ExprType &T) const { return T.hash(); }
+};
+
+/// Compares the elements of an IdTable.
+template <typename ElemTy> struct IdTableEqual {
+  bool operator()(const ElemTy &LHS, const ElemTy &RHS) const {
+    return LHS == RHS;
+  }
+};
+
+/// Tensor types with different dimension names are different entries.
+template <> struct IdTableEqual<Type> {
+  bool operator()(const Type &LHS, const Type &RHS) const {
+    return LHS == RHS && LHS.getNames() == RHS.getNames();
+  }
+};
+
 /// A class for handling a list of resources that are indexed by ID.
 template <typename ElemTy> class IdTable {
   /// Stores the elements.
   std::vector<ElemTy> table_;
+  /// Maps the elements to their IDs.
+  std::unordered_map<ElemTy, unsigned, IdTableHash<ElemTy>,
+                     IdTableEqual<ElemTy>>
+      ids_;
   /// If True then the table must not grow.
   bool locked_{false};
 
@@ -33,11 +66,11 @@ public:
   /// \returns the ID that saves \p T.
   /// The table may add a new entry to contain \p T.
   unsigned getIdFor(const ElemTy &T) {
-    for (unsigned i = 0; i < table_.size(); i++) {
-      if (table_[i] == T)
-        return i;
-    }
+    auto it = ids_.find(T);
+    if (it != ids_.end())
+      return it->second;
     assert(!locked_ && "Table must be unlocked");
+    ids_.emplace(T, table_.size());
     table_.push_back(T);
     return table_.size() - 1;
   }
@@ -57,44 +90,113 @@ class StreamWriter {
 public:
   /// Write to the backing string \p str.
   StreamWriter(std::string &str);
-  /// Write a word.
+  /// Write a word, as an unsigned LEB128 varint.
   void write(uint32_t num);
 
+  /// Write a word in four bytes, most significant byte first.
+  void writeFixed32(uint32_t num);
+
   /// Write a float.
   void write(float num);
 
   /// Write byte.
   void write(uint8_t num);
 
-  /// Write a null terminated string.
+  /// Write a length-prefixed string.
   void write(const std::string &s);
+
+  /// \returns the number of bytes that were written to the stream.
+  size_t size() const { return stream_.size(); }
 };
 
-/// Wraps an input stream.
+/// Wraps an input stream. The stream is either a string, which may grow
+/// while it is read, or a buffer that the reader does not own, such as a
+/// memory-mapped file.
 class StreamReader {
-  /// The backing stream.
-  const std::string &stream_;
+  /// The backing string, or null if reading from a buffer.
+  const std::string *str_{nullptr};
+  /// The backing buffer, if reading from a buffer.
+  const char *data_{nullptr};
+  /// The size of the backing buffer.
+  size_t size_{0};
   /// The position in the stream.
-  size_t pos_;
+  size_t pos_{0};
+
+  /// \returns the start of the stream.
+  const char *data() const { return str_ ? str_->data() : data_; }
+
+  /// \returns the size of the stream.
+  size_t size() const { return str_ ? str_->size() : size_; }
 
 public:
   /// Read from the backing string \p str.
   StreamReader(const std::string &str);
 
-  /// read a word.
+  /// Read from the \p size bytes at \p data, without copying them.
+  StreamReader(const char *data, size_t size);
+
+  /// read a word that was written as a varint.
   uint32_t readU32();
 
+  /// read a word that was written in four bytes.
+  uint32_t readFixed32();
+
   /// read a float.
   float readF32();
 
   /// read a byte.
   uint8_t readU8();
 
-  /// Read a null-terminated string.
+  /// Read a length-prefixed string.
   std::string readStr();
 
+  /// Read a word that was written as a varint into \p val.
+  /// \returns False if the varint ends past the end of the stream, or is
+  /// longer than five bytes.
+  bool tryReadU32(uint32_t &val);
+
+  /// Read a length-prefixed string into \p s.
+  /// \returns False if the string ends past the end of the stream.
+  bool tryReadStr(std::string &s);
+
   /// \return true if the stream has more data to read.
   bool hasMore() const;
+
+  /// \return true if reading \p n more bytes stays in the stream.
+  bool hasBytes(size_t n) const { return size() - pos_ >= n; }
+
+  /// \returns the position in the stream.
+  size_t getPos() const { return pos_; }
+
+  /// Skip the next \p n bytes.
+  void skip(size_t n) {
+    assert(hasBytes(n) && "Skipping past the end of the stream");
+    pos_ += n;
+  }
+};
+
+/// A read-only memory mapping of a file.
+class MappedFile {
+  /// The start of the mapping, or null if the file could not be mapped.
+  const char *data_{nullptr};
+  /// The size of the file.
+  size_t size_{0};
+
+public:
+  /// Map the file at \p path.
+  MappedFile(const std::string &path);
+  ~MappedFile();
+  MappedFile(const MappedFile &) = delete;
+  MappedFile &operator=(const MappedFile &) = delete;
+
+  /// \returns True if the file was mapped.
+  bool isValid() const { return data_ != nullptr; }
+
+  /// \returns the content of the file.
+  const char *data() const { return data_; }
+
+  /// \returns the size of the file.
+  size_t size() const { return size_; }
 };
 
 /// Sarializes and deserializes bytecode header.
@@ -122,8 +224,31 @@ struct DeserializeContext;
 struct SerializeContext;
 
 /// Sarializes and deserializes bytecode.
+/// The media starts with a signature, the version of the format, the features
+/// that the program uses, and a table of the offsets and the sizes of the
+/// sections. The tables section holds the strings and the types, and the
+/// program section holds the declaration and the body of the program.
+/// Numbers are written as varints.
 class Bytecode {
 public:
+  /// The signature of the media.
+  static constexpr uint32_t kMagic = 0x03070102;
+  /// The version of the format.
+  static constexpr uint32_t kVersion = 2;
+
+  /// Features of programs that readers must support to load the program.
+  enum Feature : uint32_t {
+    LocalTensors = 1 << 0,
+    NonTemporalStores = 1 << 1,
+    Prefetch = 1 << 2,
+  };
+  /// The features that this reader supports.
+  static constexpr uint32_t kKnownFeatures =
+      LocalTensors | NonTemporalStores | Prefetch;
+
+  /// The kinds of the sections. Readers skip sections that they don't know.
+  enum Section : uint8_t { TablesSection = 1, ProgramSection = 2 };
+
   static std::string serialize(Program *p);
 
   static void serialize(StreamWriter &SW, BytecodeHeader &BH,
@@ -138,7 +263,17 @@ public:
   static void deserializeStmt(StreamReader &SR, BytecodeHeader &BH,
                               DeserializeContext &BC, Program *p);
 
+  /// \returns the program in \p media, or nullptr if the media is not valid
+  /// or was written by a newer version of the format.
   static Program *deserialize(const std::string &media);
+
+  /// \returns the program in the \p size bytes at \p data, or nullptr (see
+  /// above). The data is not copied.
+  static Program *deserialize(const char *data, size_t size);
+
+  /// \returns the program in the file at \p path, which is mapped to memory,
+  /// or nullptr (see above).
+  static Program *deserializeFile(const std::string &path);
 };
 
 } // namespace bistra
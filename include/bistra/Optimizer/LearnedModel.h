@@ -0,0 +1,54 @@
+#ifndef BISTRA_OPTIMIZER_LEARNEDMODEL_H
+#define BISTRA_OPTIMIZER_LEARNEDMODEL_H
+
+#include <string>
+#include <vector>
+
+namespace bistra {
+
+/// A linear model that predicts the execution time of programs from their
+/// features (see getProgramFeatures). The model is trained with ridge
+/// regression on the logarithm of the measured times, which are recorded in a
+/// log of tuning results. Each line in the log holds the measured time and the
+/// features of one candidate.
+class LearnedModel {
+  /// The mean of each feature in the training set.
+  std::vector<double> mean_;
+  /// The standard deviation of each feature in the training set.
+  std::vector<double> scale_;
+  /// The weights of the standardized features.
+  std::vector<double> weights_;
+  /// The mean of the logarithm of the times in the training set.
+  double bias_{0};
+
+public:
+  /// The minimal number of samples that the model is trained on.
+  static constexpr unsigned minSamples = 16;
+
+  /// Train the model on the samples \p features that executed in \p times
+  /// seconds. Large values of \p lambda make the model more conservative.
+  /// \returns True if there were enough samples to train the model.
+  bool train(const std::vector<std::vector<double>> &features,
+             const std::vector<double> &times, double lambda = 1.0);
+
+  /// Train the model on the samples in the log file \p path. Samples that
+  /// don't have \p numFeatures features are ignored.
+  /// \returns the number of samples, or zero if the model was not trained.
+  unsigned trainFromLog(const std::string &path, unsigned numFeatures);
+
+  /// \returns True if the model was trained.
+  bool isTrained() const { return !weights_.empty(); }
+
+  /// \returns the predicted execution time in seconds of a program with the
+  /// features \p features.
+  double predict(const std::vector<double> &features) const;
+
+  /// Append the sample \p features that executed in \p time seconds to the
+  /// log file \p path.
+  static void appendToLog(const std::string &path, double time,
+                          const std::vector<double> &features);
+};
+
+} // namespace bistra
+
+#endif // BISTRA_OPTIMIZER_LEARNEDMODEL_H
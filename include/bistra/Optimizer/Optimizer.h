@@ -1,6 +1,8 @@
 #ifndef BISTRA_OPTIMIZER_OPTIMIZER_H
 #define BISTRA_OPTIMIZER_OPTIMIZER_H
 
+#include "bistra/Analysis/CostModel.h"
+#include "bistra/Backends/Measure.h"
 #include "bistra/Program/Program.h"
 
 #include <string>
@@ -10,12 +12,57 @@ namespace bistra {
 class Program;
 class Backend;
 
+/// The strategies that explore the space of candidates of the auto-tuner.
+enum class SearchKind {
+  Exhaustive, // Evaluate all of the candidates.
+  Random,     // Evaluate random candidates.
+  Beam,       // Evaluate the candidates that the cost model prefers.
+  Genetic,    // Evolve the candidates that run fastest.
+};
+
+/// Options that control the auto-tuner.
+struct TuningOptions {
+  /// The number of threads that compile the candidates. The candidates are
+  /// timed one at a time. Use all of the cores if zero.
+  unsigned numThreads{0};
+  /// A directory that contains a persistent database of tuning results.
+  /// The database is not used if the path is empty.
+  std::string cacheDir;
+  /// Controls the measurement of the candidates. Candidates are ranked by
+  /// their median execution time.
+  MeasureOptions measure;
+  /// Measure only the candidates with the best predicted execution time.
+  /// Measure all of the candidates if zero.
+  unsigned topK{0};
+  /// The machine that the cost model predicts the execution time for. The
+  /// registers are taken from the backend.
+  MachineModel machine = MachineModel::getHost();
+  /// The strategy that explores the search space.
+  SearchKind search{SearchKind::Exhaustive};
+  /// The number of programs that the beam search keeps at each stage.
+  unsigned beamWidth{8};
+  /// Stop the search after this number of candidates. No limit if zero.
+  unsigned maxCandidates{0};
+  /// Stop the search after this number of seconds. No limit if zero.
+  double maxSeconds{0};
+  /// Stop the search after this number of results that don't improve the best
+  /// result. No limit if zero.
+  unsigned patience{0};
+  /// Append the features and the execution time of every measured candidate
+  /// to this file, if not empty.
+  std::string featureLog;
+  /// Rank the candidates with a model that is trained on the feature log,
+  /// instead of the analytical model. Requires the feature log.
+  bool useLearnedModel{false};
+};
+
 /// Construct an optimization pipeline and evaluate different configurations for
 /// the program \p. Save intermediate results to \p filename.
 /// \returns the best program.
 Program *optimizeEvaluate(Backend &backend, Program *p,
                           const std::string &filename, bool isTextual,
-                          bool isBytecode);
+                          bool isBytecode,
+                          const TuningOptions &options = TuningOptions());
 
 /// Try to statically optimize the program \p P based on heuristics.
 /// \return the owned optimized program.
@@ -0,0 +1,53 @@
+#ifndef BISTRA_OPTIMIZER_TUNINGCACHE_H
+#define BISTRA_OPTIMIZER_TUNINGCACHE_H
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+
+namespace bistra {
+
+class Program;
+
+/// A persistent database of tuning results that is stored in a directory on
+/// disk. The results of one tuning session are keyed by the hash of the input
+/// program and by a description of the target (the backend and the CPU).
+/// The database records the execution time of every candidate that was
+/// measured, and the best program that was found so far. This allows the
+/// tuner to resume an interrupted session and to return immediately when the
+/// session was already completed.
+class TuningCache {
+  /// The directory that contains the database.
+  std::string dir_;
+  /// The key of the current tuning session.
+  uint64_t key_;
+  /// Maps the hash of measured candidates to their execution time.
+  std::unordered_map<uint64_t, double> times_;
+
+  /// \returns the path of a database file with the suffix \p suffix.
+  std::string getPath(const std::string &suffix) const;
+
+public:
+  /// Open the database in the directory \p dir for the program \p p that is
+  /// tuned for the target \p target. Load the results of previous sessions.
+  TuningCache(const std::string &dir, Program *p, const std::string &target);
+
+  /// \returns True if the candidate with the hash \p hash was measured in a
+  /// previous session, and set \p time to the measured time.
+  bool lookupTime(uint64_t hash, double &time) const;
+
+  /// Record that the candidate with the hash \p hash took \p time seconds.
+  void recordTime(uint64_t hash, double time);
+
+  /// Save the best program \p p that executes in \p time seconds. If
+  /// \p complete is set then the tuning session is marked as completed.
+  void saveBest(Program *p, double time, bool complete);
+
+  /// \returns the best program of a completed session, or nullptr if the
+  /// session was not completed. Set \p time to the time of the program.
+  Program *loadCompletedBest(double &time) const;
+};
+
+} // namespace bistra
+
+#endif // BISTRA_OPTIMIZER_TUNINGCACHE_H
@@ -101,6 +101,14 @@ private:
   /// returns true.
   bool parseNamedType(Type &T, std::string &name);
 
+  /// Parse the dimension list of a tensor with elements of the type
+  /// \p scalarsTy into \p T. Example: <I:512,J:512>
+  bool parseDimList(ElemKind scalarsTy, Type &T);
+
+  /// \returns the argument or the local tensor with the name \p name or
+  /// nullptr.
+  Argument *getBufferByName(const std::string &name);
+
   /// Parse a single integer literal.
   bool parseIntegerLiteral(int &val);
 
@@ -125,6 +133,10 @@ private:
   /// Parse and store the Let statement.
   bool parseLetStmt();
 
+  /// Parse the decleration of the dynamic dimension and the sizes that it is
+  /// specialized for.
+  bool parseDynamicDecl();
+
   /// Parse the var decl. Write initialization statements into \p s.
   bool parseVarDecl(Scope *s);
 
@@ -72,6 +72,9 @@ public:
     map_.push_back(arg);
   }
 
+  /// Removes all of the values.
+  void clear() { map_.clear(); }
+
   /// \returns the argument with the name \p name or nullptr.
   ElemTy *getByName(const std::string &name) const {
     for (auto *a : map_) {
@@ -89,8 +92,8 @@ class ParserContext {
   /// The base pointer for the parsed buffer.
   const char *buffer_;
 
-  /// The parsed program.
-  Program *prog_{nullptr};
+  /// The parsed programs, in the order of their declerations.
+  std::vector<Program *> progs_;
 
   /// Counts the number of errors that were emitted.
   unsigned numErrors_{0};
@@ -99,8 +102,8 @@ class ParserContext {
   /// Counts the number of notes that were emitted.
   unsigned numNotes_{0};
 
-  /// A list of pragma declerations.
-  std::vector<PragmaCommand> pragmas_;
+  /// The pragma declerations of each of the parsed programs.
+  std::vector<std::vector<PragmaCommand>> pragmas_;
 
   /// Indexes arguments by name.
   NamedValueMap<Argument> argMap_;
@@ -108,6 +111,9 @@ class ParserContext {
   /// Indexes variables by name.
   NamedValueMap<LocalVar> varMap_;
 
+  /// Indexes local tensors by name.
+  NamedValueMap<Argument> tensorMap_;
+
   /// Contains the next of loops while parsing.
   std::vector<Loop *> loopNextStack_;
 
@@ -117,6 +123,14 @@ class ParserContext {
   /// Contains the stack of local variables.
   ScopedNamedValueStack<LocalVar> varStack_;
 
+  /// The name of the dynamic dimension, or empty if all of the dimensions
+  /// are fixed.
+  std::string dynamicName_;
+
+  /// The sizes of the dynamic dimension that are compiled into specialized
+  /// programs.
+  std::vector<unsigned> dynamicSizes_;
+
 public:
   ParserContext(const char *buffer, const std::string &filename = "")
       : filename_(filename), buffer_(buffer) {}
@@ -144,21 +158,54 @@ public:
   /// \returns the Var stack.
   NamedValueMap<Argument> &getArgMap() { return argMap_; }
 
+  /// \returns the local tensor map.
+  NamedValueMap<Argument> &getTensorMap() { return tensorMap_; }
+
   /// Saves the parsed program when done.
   void registerProgram(Program *p);
 
-  /// \returns the parsed program or nullptr.
-  Program *getProgram() { return prog_; }
+  /// Forgets the arguments, variables and local tensors of the function that
+  /// was parsed, before parsing the next function.
+  void clearFunctionState();
+
+  /// \returns the first parsed program or nullptr.
+  Program *getProgram() { return progs_.empty() ? nullptr : progs_[0]; }
+
+  /// \returns all of the parsed programs.
+  const std::vector<Program *> &getPrograms() const { return progs_; }
+
+  /// \returns the parsed program with the name \p name or nullptr.
+  Program *getProgramByName(const std::string &name) const;
 
   /// \returns the number of errors.
   unsigned getNumErrors() { return numErrors_; }
 
-  /// \returns the pragma declerations that were applied to loops.
-  std::vector<PragmaCommand> &getPragmaDecls() { return pragmas_; }
+  /// \returns the pragma declerations that were applied to the loops of the
+  /// program at index \p idx.
+  std::vector<PragmaCommand> &getPragmaDecls(unsigned idx = 0) {
+    assert(idx < pragmas_.size() && "Invalid program index");
+    return pragmas_[idx];
+  }
 
-  /// Adds the pragma to the list of applied pragmas.
+  /// Adds the pragma to the list of pragmas of the last parsed program.
   void addPragma(PragmaCommand &pc);
 
+  /// Declares the dimension \p name as a dynamic dimension with the
+  /// specialized sizes \p sizes.
+  void setDynamicDim(const std::string &name,
+                     const std::vector<unsigned> &sizes) {
+    dynamicName_ = name;
+    dynamicSizes_ = sizes;
+  }
+
+  /// \returns the name of the dynamic dimension, or an empty string.
+  const std::string &getDynamicName() const { return dynamicName_; }
+
+  /// \returns the specialized sizes of the dynamic dimension.
+  const std::vector<unsigned> &getDynamicSizes() const {
+    return dynamicSizes_;
+  }
+
   /// \returns the line and column for the position \p pos.
   std::pair<unsigned, unsigned> getLineCol(DebugLoc pos);
 
@@ -0,0 +1,42 @@
+#ifndef BISTRA_PROGRAM_ALLOCATOR_H
+#define BISTRA_PROGRAM_ALLOCATOR_H
+
+#include <cstddef>
+
+namespace bistra {
+
+/// Allocates the memory of the nodes of the AST. The optimizer clones whole
+/// programs many times, and allocating every node with malloc dominates the
+/// cost of cloning. The allocator carves nodes out of large slabs, and keeps
+/// the memory of deleted nodes in free lists, one for each size class, that
+/// serve the next allocations of the same size. Each thread has its own slab
+/// and free lists, so allocations don't take locks. When a thread exits it
+/// hands its memory over to the threads that start later. The slabs are never
+/// returned to the system, so the allocator holds on to the memory of the peak
+/// number of live nodes of each size class. The tuner reaches that peak early
+/// and then keeps reusing the same nodes. The benchmark tool reports the cost
+/// of cloning programs.
+class NodeAllocator final {
+public:
+  /// The granularity of the size classes, which is also the alignment of the
+  /// allocated memory.
+  static constexpr size_t kGranule = 16;
+
+  /// Nodes that are larger than this are allocated with the global operator
+  /// new.
+  static constexpr size_t kMaxNodeSize = 256;
+
+  /// The size of the slabs that nodes are carved out of.
+  static constexpr size_t kSlabSize = 64 * 1024;
+
+  /// \returns memory for a node of \p size bytes.
+  static void *allocate(size_t size);
+
+  /// Releases the memory \p ptr of a node of \p size bytes. The memory may be
+  /// released by a different thread than the one that allocated it.
+  static void deallocate(void *ptr, size_t size);
+};
+
+} // namespace bistra
+
+#endif // BISTRA_PROGRAM_ALLOCATOR_H
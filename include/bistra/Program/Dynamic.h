@@ -0,0 +1,84 @@
+#ifndef BISTRA_PROGRAM_DYNAMIC_H
+#define BISTRA_PROGRAM_DYNAMIC_H
+
+#include "bistra/Program/Program.h"
+
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace bistra {
+
+/// A kernel with a dimension whose size is only known when the kernel is
+/// called, such as the batch size. The kernel consists of programs that are
+/// specialized for some sizes of the dimension. A call with one of these sizes
+/// executes the specialized program, and other sizes are split into chunks
+/// that the specialized programs process one after the other. The program for
+/// size 1 is the generic kernel that processes the remainder.
+/// The dynamic dimension must be the outermost dimension of the arguments that
+/// have it, and the kernel must write only arguments that have it. Every access
+/// to these arguments must use the index of a loop over the whole dimension as
+/// the outermost subscript, so that the chunks are independent.
+class DynamicKernel final {
+  /// The name of the kernel.
+  std::string name_;
+  /// The name of the dynamic dimension.
+  std::string dimName_;
+  /// The specialized programs, sorted by size.
+  std::vector<std::pair<unsigned, std::unique_ptr<Program>>> variants_;
+  /// Marks the arguments that have the dynamic dimension.
+  std::vector<bool> dynamicArgs_;
+
+public:
+  DynamicKernel(const std::string &name, const std::string &dimName)
+      : name_(name), dimName_(dimName) {}
+
+  /// \returns the name of the kernel.
+  const std::string &getName() const { return name_; }
+
+  /// \returns the name of the dynamic dimension.
+  const std::string &getDimName() const { return dimName_; }
+
+  /// Adds the program \p p that is specialized for the size \p size, and takes
+  /// ownership of it. The program is renamed after the kernel and the size.
+  void addVariant(unsigned size, Program *p);
+
+  /// \returns the specialized programs, sorted by size.
+  const std::vector<std::pair<unsigned, std::unique_ptr<Program>>> &
+  getVariants() const {
+    return variants_;
+  }
+
+  /// Replaces the program that is specialized for \p size with \p p, and
+  /// takes ownership of it. The new program must have the same arguments.
+  /// \returns the previous program, which is now owned by the caller.
+  Program *replaceVariant(unsigned size, Program *p);
+
+  /// \returns the program that is specialized for \p size or nullptr.
+  Program *getVariant(unsigned size) const;
+
+  /// \returns True if the argument at index \p idx has the dynamic dimension.
+  bool isDynamicArg(unsigned idx) const { return dynamicArgs_[idx]; }
+
+  /// \returns the number of bytes of the argument at index \p idx for one
+  /// element of the dynamic dimension, or the size of the argument if it does
+  /// not have the dynamic dimension.
+  uint64_t getArgRowSize(unsigned idx) const;
+
+  /// Finds the arguments that have the dynamic dimension, by comparing the
+  /// types of the variants, and checks that the kernel can be split into
+  /// chunks. Lowers the alignment of the dynamic arguments to the alignment
+  /// of the chunks. The accesses are checked in the form that the parser
+  /// creates, so the kernel must be analyzed before the variants are
+  /// optimized.
+  /// \returns True if the kernel is valid.
+  bool analyze();
+
+  /// Prints the kernel.
+  void dump() const;
+};
+
+} // namespace bistra
+
+#endif // BISTRA_PROGRAM_DYNAMIC_H
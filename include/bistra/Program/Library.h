@@ -0,0 +1,71 @@
+#ifndef BISTRA_PROGRAM_LIBRARY_H
+#define BISTRA_PROGRAM_LIBRARY_H
+
+#include "bistra/Program/Program.h"
+
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace bistra {
+
+/// A collection of kernels that are compiled ahead of time into one object
+/// file. Each kernel is an exported function with a C calling convention that
+/// takes pointers to its tensors. The object also contains a registry, which is
+/// a table that describes the name, the tensor shapes and the alignment of
+/// every kernel, and the library comes with a C header that declares the
+/// kernels and the registry.
+class KernelLibrary final {
+  /// The name of the library, which prefixes the symbols of the registry.
+  std::string name_;
+  /// The kernels of the library and the names that they are registered
+  /// with. Kernels with the same name and different shapes are exported with
+  /// different symbols.
+  std::vector<std::pair<std::string, std::unique_ptr<Program>>> kernels_;
+
+public:
+  KernelLibrary(const std::string &name) : name_(name) {}
+
+  /// \returns the name of the library.
+  const std::string &getName() const { return name_; }
+
+  /// \returns the name of the symbol of the registry table.
+  std::string getRegistryName() const { return name_ + "_kernels"; }
+
+  /// \returns the name of the symbol that holds the number of kernels.
+  std::string getNumKernelsName() const { return name_ + "_num_kernels"; }
+
+  /// Adds the kernel \p p to the library, and takes ownership of it. The
+  /// kernel is registered with the name of the program. If the name is taken
+  /// then the program is renamed to a unique symbol.
+  /// \returns False if the library already has a kernel with the same name
+  /// and the same argument types, and then \p p is not added.
+  bool addKernel(Program *p);
+
+  /// \returns the kernels of the library and their registered names.
+  const std::vector<std::pair<std::string, std::unique_ptr<Program>>> &
+  getKernels() const {
+    return kernels_;
+  }
+
+  /// \returns the kernel that is registered with the name \p name and whose
+  /// arguments have the types \p types, or nullptr. The types must have the
+  /// same element kinds and dimensions.
+  Program *getKernel(const std::string &name,
+                     const std::vector<Type> &types) const;
+
+  /// \returns the kernel that is registered with the name \p name and whose
+  /// arguments have the dimensions \p dims, or nullptr. The dimensions of
+  /// all of the arguments are concatenated.
+  Program *getKernel(const std::string &name,
+                     const std::vector<unsigned> &dims) const;
+
+  /// \returns the content of the C header that declares the kernels, the
+  /// registry and the function that looks up kernels in the registry.
+  std::string emitHeader() const;
+};
+
+} // namespace bistra
+
+#endif // BISTRA_PROGRAM_LIBRARY_H
@@ -20,13 +20,18 @@ struct PragmaCommand {
     sink,
     fuse,
     distribute,
+    parallelize,
+    pack,
+    prefetch,
+    stream,
     other
   };
 
   PragmaCommand(PragmaKind kind, const std::string &loopName,
-                const std::string &newName, int param, DebugLoc loc)
+                const std::string &newName, int param, DebugLoc loc,
+                const std::string &argName = "")
       : kind_(kind), loopName_(loopName), newName_(newName), param_(param),
-        loc_(loc) {}
+        loc_(loc), argName_(argName) {}
 
   /// The kind of the pragma.
   PragmaKind kind_;
@@ -38,6 +43,10 @@ struct PragmaCommand {
   int param_;
   /// The location of the pragma.
   DebugLoc loc_;
+  /// The name of the argument that the pragma refers to, if any.
+  std::string argName_;
+  /// Set if the vectorized loop handles the remaining iterations with masks.
+  bool masked_{false};
 };
 
 } // namespace bistra
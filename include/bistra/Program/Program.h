@@ -33,6 +33,13 @@ class Argument final {
   /// The type of the argument.
   Type type_;
 
+  /// The alignment of the buffer, in bytes, that the caller guarantees. Zero
+  /// means the natural alignment of the element type.
+  unsigned alignment_{0};
+
+  /// The number of bytes to reserve after the buffer when allocating it.
+  unsigned padding_{0};
+
 public:
   Argument(const std::string &name, const Type &t) : name_(name), type_(t) {}
 
@@ -45,6 +52,24 @@ public:
   /// \returns the name of the argument.
   const std::string &getName() const { return name_; }
 
+  /// \returns the alignment of the buffer in bytes.
+  unsigned getAlignment() const {
+    return std::max(alignment_,
+                    Type::getElementSizeInBytes(type_.getElementType()));
+  }
+
+  /// Sets the alignment of the buffer to \p alignment bytes.
+  void setAlignment(unsigned alignment) {
+    assert((alignment & (alignment - 1)) == 0 && "Must be a power of two");
+    alignment_ = alignment;
+  }
+
+  /// \returns the number of bytes to reserve after the buffer.
+  unsigned getPadding() const { return padding_; }
+
+  /// Sets the number of bytes to reserve after the buffer to \p padding.
+  void setPadding(unsigned padding) { padding_ = padding; }
+
   /// Prints the argument.
   void dump() const;
 
@@ -228,6 +253,9 @@ class Loop final : public Scope {
   // Vectorization factor.
   unsigned stride_{1};
 
+  /// Set if the iterations of the loop may execute in parallel.
+  bool parallel_{false};
+
 public:
   Loop(std::string name, DebugLoc loc, unsigned end, unsigned stride = 1)
       : Scope(loc), indexName_(name), end_(end), stride_(stride) {}
@@ -250,6 +278,12 @@ public:
   /// Updated the loop stride.
   void setStride(unsigned s) { stride_ = s; }
 
+  /// \returns True if the iterations of the loop may execute in parallel.
+  bool isParallel() const { return parallel_; }
+
+  /// Marks the loop as a parallel loop.
+  void setParallel(bool parallel) { parallel_ = parallel; }
+
   virtual bool compare(const Stmt *other) const override;
   virtual uint64_t hash() const override;
   virtual void dump(unsigned indent) const override;
@@ -261,6 +295,9 @@ public:
 /// Represents an if-in-range construct with the half-open range.
 /// The range must be a valid non-zero length range (start <= end).
 /// Example:  if (x in 0 .. 15).
+/// Vectorized checks test the \p width consecutive values that start at the
+/// index, and mask the vector loads and stores in the body instead of
+/// branching. Example:  if (x in 0 .. 15, 8).
 class IfRange final : public Scope {
   /// The numeric value to evaluate.
   ExprHandle val_;
@@ -271,6 +308,9 @@ class IfRange final : public Scope {
   /// The end of the range.
   int end_;
 
+  /// The number of lanes that are checked.
+  unsigned width_{1};
+
 public:
   IfRange(Expr *val, int start, int end, DebugLoc loc)
       : Scope(loc), val_(val, this), start_(start), end_(end) {}
@@ -290,6 +330,12 @@ public:
   /// \returns the if-range range.
   std::pair<int, int> getRange() const { return {start_, end_}; }
 
+  /// \returns the number of lanes that are checked.
+  unsigned getWidth() const { return width_; }
+
+  /// Sets the number of lanes that are checked.
+  void setWidth(unsigned width) { width_ = width; }
+
   virtual bool compare(const Stmt *other) const override;
   virtual uint64_t hash() const override;
   virtual void dump(unsigned indent) const override;
@@ -306,6 +352,8 @@ class Program final : public Scope {
   std::vector<Argument *> args_;
   /// \represents the list of local variables.
   std::vector<LocalVar *> vars_;
+  /// \represents the list of local tensors.
+  std::vector<Argument *> tensors_;
 
 public:
   ~Program();
@@ -315,6 +363,9 @@ public:
   /// \returns the name of the program.
   const std::string &getName() const { return name_; }
 
+  /// Sets the name of the program to \p name.
+  void setName(const std::string &name) { name_ = name; }
+
   /// Construct a new program with the body \p body and arguments \p args.
   Program(const std::string &name, const std::vector<Stmt *> &body,
           const std::vector<Argument *> &args,
@@ -330,6 +381,16 @@ public:
   /// Vars getter.
   const std::vector<LocalVar *> &getVars() const { return vars_; }
 
+  /// Local tensors getter.
+  std::vector<Argument *> &getTensors() { return tensors_; }
+  /// Local tensors getter.
+  const std::vector<Argument *> &getTensors() const { return tensors_; }
+
+  /// \returns True if \p arg is a local tensor of the program.
+  bool isLocalTensor(const Argument *arg) const {
+    return std::find(tensors_.begin(), tensors_.end(), arg) != tensors_.end();
+  }
+
   /// \return the variable with the name \p name or nullptr if there is no
   /// variable with this name.
   LocalVar *getVar(const std::string &name);
@@ -383,12 +444,32 @@ public:
   /// \returns the newly created variable.
   LocalVar *addTempVar(const std::string &nameHint, ExprType Ty);
 
+  /// Create a new local tensor. Local tensors are allocated by the program
+  /// and are not visible to the caller.
+  /// \returns the newly created tensor.
+  Argument *addLocalTensor(const std::string &name,
+                           const std::vector<unsigned> &dims,
+                           const std::vector<std::string> &names, ElemKind Ty);
+
+  /// Create a new local tensor of the type \p Ty with a unique name that is
+  /// similar to \p nameHint. Local tensors are allocated by the program and
+  /// are not visible to the caller.
+  /// \returns the newly created tensor.
+  Argument *addTempTensor(const std::string &nameHint, const Type &Ty);
+
+  /// \returns True if an argument, a variable or a local tensor is named
+  /// \p name.
+  bool isNameInUse(const std::string &name) const;
+
   /// Adds a new argument;
   void addArgument(Argument *arg);
 
   /// Adds a new argument;
   void addVar(LocalVar *arg);
 
+  /// Adds a new local tensor. Local tensors are aligned to cache lines.
+  void addTensor(Argument *tensor);
+
   Program *clone();
 
   virtual bool compare(const Stmt *other) const override;
@@ -576,6 +657,28 @@ public:
   virtual void visit(NodeVisitor *visitor) override;
 };
 
+/// Converts a value to a different element type. For example, sign-extends
+/// int8 to int32, or truncates a float to bfloat16.
+class CastExpr : public Expr {
+  /// The value to convert.
+  ExprHandle val_;
+
+public:
+  CastExpr(Expr *val, ElemKind kind, DebugLoc loc)
+      : Expr(ExprType(kind, val->getType().getWidth()), loc), val_(val, this) {
+  }
+
+  Expr *getVal() const { return val_.get(); }
+  void setVal(Expr *e) { return val_.setReference(e); }
+
+  virtual bool compare(const Expr *other) const override;
+  virtual uint64_t hash() const override;
+  virtual void dump() const override;
+  virtual Expr *clone(CloneCtx &map) override;
+  virtual void verify() const override;
+  virtual void visit(NodeVisitor *visitor) override;
+};
+
 /// Broadcasts a value from scalar to vector.
 class BroadcastExpr : public Expr {
   /// The value to broadcast.
@@ -602,6 +705,34 @@ public:
   virtual void visit(NodeVisitor *visitor) override;
 };
 
+/// Reduces the lanes of a vector into a scalar with an associative operator.
+/// For example, computes the sum or the maximum of the lanes.
+class ReduceExpr : public Expr {
+  /// The vector to reduce.
+  ExprHandle val_;
+  /// The operator that combines the lanes: Add, Max or Min.
+  BinaryExpr::BinOpKind kind_;
+
+public:
+  ReduceExpr(Expr *val, BinaryExpr::BinOpKind kind, DebugLoc loc)
+      : Expr(ExprType(val->getType().getElementType()), loc), val_(val, this),
+        kind_(kind) {}
+
+  /// \returns the reduced vector.
+  Expr *getVal() const { return val_.get(); }
+  void setVal(Expr *e) { return val_.setReference(e); }
+
+  /// \returns the operator that combines the lanes.
+  BinaryExpr::BinOpKind getKind() const { return kind_; }
+
+  virtual bool compare(const Expr *other) const override;
+  virtual uint64_t hash() const override;
+  virtual void dump() const override;
+  virtual Expr *clone(CloneCtx &map) override;
+  virtual void verify() const override;
+  virtual void visit(NodeVisitor *visitor) override;
+};
+
 /// Get the pointer to the array expression.
 class GEPExpr final : public Expr {
   /// The buffer to access.
@@ -749,6 +880,8 @@ class StoreStmt final : public Stmt {
   ExprHandle value_;
   /// Accumulate the resule into the destination.
   bool accumulate_;
+  /// Write the value to memory without bringing it into the cache.
+  bool nontemporal_{false};
 
 public:
   /// \returns the GEP expression.
@@ -781,6 +914,12 @@ public:
   /// destination.
   bool isAccumulate() { return accumulate_; }
 
+  /// \returns true if this store bypasses the cache (a streaming store).
+  bool isNonTemporal() const { return nontemporal_; }
+
+  /// Sets the non-temporal property of the store to \p nt.
+  void setNonTemporal(bool nt) { nontemporal_ = nt; }
+
   StoreStmt(GEPExpr *gep, Expr *value, bool accumulate, DebugLoc loc);
 
   StoreStmt(Argument *arg, const std::vector<Expr *> &indices, Expr *value,
@@ -797,6 +936,40 @@ public:
   virtual void visit(NodeVisitor *visitor) override;
 };
 
+/// Prefetches the cache line of some element of a buffer into the cache.
+/// Prefetches don't change the behavior of the program, and the address does
+/// not need to be inside the buffer.
+class PrefetchStmt final : public Stmt {
+  /// The address to prefetch.
+  ExprHandle gep_;
+
+public:
+  /// \returns the GEP expression.
+  GEPExpr *getGep() const { return gep_.as<GEPExpr>(); }
+
+  /// \returns the prefetched buffer.
+  Argument *getDest() const { return gep_.as<GEPExpr>()->getDest(); }
+
+  /// \returns the indices indexing into the array.
+  const std::vector<ExprHandle> &getIndices() const {
+    return gep_.as<GEPExpr>()->getIndices();
+  }
+
+  /// \returns the indices indexing into the array.
+  std::vector<ExprHandle> &getIndices() {
+    return gep_.as<GEPExpr>()->getIndices();
+  }
+
+  PrefetchStmt(GEPExpr *gep, DebugLoc loc) : Stmt(loc), gep_(gep, this) {}
+
+  virtual bool compare(const Stmt *other) const override;
+  virtual uint64_t hash() const override;
+  virtual void dump(unsigned indent) const override;
+  virtual Stmt *clone(CloneCtx &map) override;
+  virtual void verify() const override;
+  virtual void visit(NodeVisitor *visitor) override;
+};
+
 /// Saves some value to a local.
 class StoreLocalStmt final : public Stmt {
   /// The variable to access.
@@ -21,6 +21,9 @@ enum class ElemKind : unsigned char {
   IndexTy,   // The type of an index.
   PtrTy,     // The type is a pointer.
   StringTy,  // A pointer to some string.
+  Int32Ty,   // 32-bit type (int32_t)
+  Float16Ty, // 16-bit IEEE half precision float (_Float16)
+  BFloat16Ty // 16-bit brain float (__bf16)
 };
 
 /// A class that represents a type of a tensor.
@@ -121,9 +124,14 @@ struct Type final {
   /// \return the textual name of the element \p Ty.
   static const char *getElementName(ElemKind Ty) {
     static const char *names[] = {
-        "float",
-        "int8_t",
-        "size_t",
+        "float",    // Float32Ty
+        "int8_t",   // Int8Ty
+        "size_t",   // IndexTy
+        "void*",    // PtrTy
+        "char*",    // StringTy
+        "int32_t",  // Int32Ty
+        "_Float16", // Float16Ty
+        "__bf16",   // BFloat16Ty
     };
     return names[(int)Ty];
   }
@@ -134,6 +142,11 @@ struct Type final {
         4, // float
         1, // int8_t
         8, // size_t
+        8, // void*
+        8, // char*
+        4, // int32_t
+        2, // _Float16
+        2, // __bf16
     };
     return sizes[(int)Ty];
   }
@@ -155,14 +168,30 @@ struct ExprType final {
 
   ExprType(ElemKind elemTy, unsigned width = 1)
       : elementType_(elemTy), width_(width) {
-    assert(width > 0 && width < 64 && "Invalid vector width");
+    assert(width > 0 && width <= 64 && "Invalid vector width");
   }
 
   /// \returns true if this type is an index/pointer type.
   bool isIndexTy() const { return elementType_ == ElemKind::IndexTy; }
 
   /// \returns true if this type is an floating point type.
-  bool isFPTy() const { return elementType_ == ElemKind::Float32Ty; }
+  bool isFPTy() const {
+    return elementType_ == ElemKind::Float32Ty ||
+           elementType_ == ElemKind::Float16Ty ||
+           elementType_ == ElemKind::BFloat16Ty;
+  }
+
+  /// \returns true if this type is an integer type that holds data (and not
+  /// an index).
+  bool isIntTy() const {
+    return elementType_ == ElemKind::Int8Ty ||
+           elementType_ == ElemKind::Int32Ty;
+  }
+
+  /// \returns the size of the element in bytes.
+  unsigned getElementSizeInBytes() const {
+    return Type::getElementSizeInBytes(elementType_);
+  }
 
   /// \returns true if \p other is the same type.
   bool isEqual(const ExprType &other) const {
@@ -2,6 +2,7 @@
 #define BISTRA_PROGRAM_USEDEF_H
 
 #include "bistra/Base/Base.h"
+#include "bistra/Program/Allocator.h"
 
 #include <cassert>
 
@@ -111,6 +112,16 @@ public:
   DebugLoc getLoc() const { return loc_; }
 
   ASTNode(DebugLoc loc) : loc_(loc) {}
+  virtual ~ASTNode() = default;
+
+  /// Nodes are allocated by the node allocator, which makes cloning cheap.
+  static void *operator new(size_t size) {
+    return NodeAllocator::allocate(size);
+  }
+  static void operator delete(void *ptr, size_t size) {
+    NodeAllocator::deallocate(ptr, size);
+  }
+
   /// \returns the parent expression that holds the node of this expression.
   virtual ASTNode *getParent() const = 0;
   /// Crash if the program is in an invalid state.
@@ -4,6 +4,7 @@
 #include <cassert>
 #include <cstddef>
 #include <cstdint>
+#include <functional>
 #include <string>
 #include <type_traits>
 #include <unordered_map>
@@ -37,6 +38,11 @@ uint64_t hashJoin(uint64_t one, uint64_t two, uint64_t three);
 
 uint64_t hashString(const std::string &str);
 
+/// Execute \p fn(i) for every i in the range 0 .. \p n on \p numThreads
+/// threads.
+void parallelFor(unsigned n, unsigned numThreads,
+                 const std::function<void(unsigned)> &fn);
+
 } // namespace bistra
 
 #endif // BISTRA_PROGRAM_UTILS_H
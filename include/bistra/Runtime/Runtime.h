@@ -0,0 +1,23 @@
+#ifndef BISTRA_RUNTIME_RUNTIME_H
+#define BISTRA_RUNTIME_RUNTIME_H
+
+#include <cstdint>
+
+/// The runtime library that the generated code calls into. Programs that
+/// contain parallel loops must be linked with this library.
+extern "C" {
+
+/// Executes the iterations [begin .. end) of a parallel loop. The parameter
+/// \p ctx is the context that was passed to bistra_parallel_for.
+typedef void (*bistra_task_t)(void *ctx, int64_t begin, int64_t end);
+
+/// Splits the loop range [0 .. end) that advances in steps of \p stride into
+/// chunks, and executes \p task on the chunks in parallel. Every chunk starts
+/// at a multiple of \p stride. Returns when all of the chunks are done.
+/// The number of threads is controlled by the environment variable
+/// BISTRA_NUM_THREADS, and defaults to the number of cores.
+void bistra_parallel_for(bistra_task_t task, void *ctx, int64_t end,
+                         int64_t stride);
+}
+
+#endif // BISTRA_RUNTIME_RUNTIME_H
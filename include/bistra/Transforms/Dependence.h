@@ -15,11 +15,13 @@ enum class DepRelationKind {
 
 /// \returns True if the first subscript depends on the second subscript for the
 /// inices \p I1 and \p I2, and arguments \p A1, and \p A2, for the indices
-/// \p indices1, \p indices2.
+/// \p indices1, \p indices2. The accesses touch \p width1 and \p width2
+/// consecutive elements.
 DepRelationKind
 checkWeakSIVDependenceForIndex(Loop *I1, Loop *I2, Argument *A1, Argument *A2,
                                std::vector<ExprHandle> &indices1,
-                               std::vector<ExprHandle> &indices2);
+                               std::vector<ExprHandle> &indices2,
+                               unsigned width1 = 1, unsigned width2 = 1);
 
 /// \returns True if the store \p W1 and the load \p R2 depend on one another
 /// for the indices \p I1 and I2, that match the load/store order.
@@ -29,6 +31,25 @@ DepRelationKind depends(Loop *I1, Loop *I2, StoreStmt *W1, LoadExpr *R2);
 /// for the indices \p I1 and I2, that match the store order.
 DepRelationKind depends(Loop *I1, Loop *I2, StoreStmt *W1, StoreStmt *W2);
 
+/// \returns True if the iterations of the loop \p L are independent and can
+/// execute in parallel. Every buffer that the loop writes must be partitioned
+/// between the iterations of the loop, and every local and local tensor that
+/// the loop uses must be private to the loop.
+bool isParallelLoop(Loop *L);
+
+/// \returns True if the loop \p L2, which follows the loop \p L1, can be
+/// merged into \p L1. The loops must have the same range, and every element
+/// that both loops access must be accessed in the same iteration of the two
+/// loops, so that the order of the accesses to each element is preserved.
+bool isFusionLegal(Loop *L1, Loop *L2);
+
+/// \returns True if the argument \p arg of the program \p p is an output that
+/// the program only writes: the program never reads the argument or
+/// accumulates into it, and some store provably writes every element of the
+/// argument. The stores to such arguments don't need to bring the written
+/// cache lines into the cache.
+bool isWriteOnlyOutput(Program *p, Argument *arg);
+
 } // namespace bistra
 
 #endif // BISTRA_TRANSFORMS_DEPENDENCE_H
@@ -47,9 +47,15 @@ bool unrollLoop(Loop *L, unsigned maxTripCount);
 Loop *peelLoop(Loop *L, int k);
 
 /// Try to vectorize the loop \p L for the vectorization factor \p vf.
+/// Reductions into locals or into a single element, such as "sum += A[i]" or
+/// "mx = max(mx, A[i])", are accumulated into vectors that are reduced after
+/// the loop. Range checks on the index of \p L mask the vector loads and
+/// stores in their body. If \p masked is set then the iterations that don't
+/// fill a vector execute in one masked vector iteration instead of a scalar
+/// loop.
 /// \returns NULL if the transformation failed. Or the new tail loop, if one was
 /// created, or the original loop if it was modified.
-Loop *vectorize(Loop *L, unsigned vf);
+Loop *vectorize(Loop *L, unsigned vf, bool masked = false);
 
 /// Widen the loop by the factor \p wf. Widening is similar to vectorization
 /// because we perform more work on each iteration. It is also similar unrolling
@@ -64,6 +70,8 @@ Loop *widen(Loop *L, unsigned wf);
 ///   for (j in 0..100) {B[j] = 9;}
 /// becomes
 ///   for (i in 0..100) {A[i] = 3; A[j] = 9;}
+/// The inner loops are fused recursively, up to \p levels levels. If L was
+/// tiled then the following loop is tiled in the same way before it is fused.
 /// \returns True if the loop was modified.
 bool fuse(Loop *L, unsigned levels);
 
@@ -71,6 +79,36 @@ bool fuse(Loop *L, unsigned levels);
 /// \returns true if the program was modified.
 bool promoteLICM(Program *p);
 
+/// Prefetch the elements that the loads in the loop \p L access \p distance
+/// iterations later, for the loads that don't access consecutive elements in
+/// consecutive iterations, such as the columns of a matrix. The hardware
+/// prefetcher handles consecutive loads.
+/// \returns True if some prefetch was inserted.
+bool prefetch(Loop *L, unsigned distance);
+
+/// Make the stores in the loop \p L to the argument \p arg non-temporal, if
+/// the program only writes the argument (see isWriteOnlyOutput). Non-temporal
+/// stores don't read the written cache lines and don't evict other data from
+/// the cache.
+/// \returns True if some store was changed.
+bool streamStores(Loop *L, Argument *arg);
+
+/// Mark the outermost loop \p L as a parallel loop, if the iterations of the
+/// loop are independent.
+/// \returns True if the transform worked.
+bool parallelize(Loop *L);
+
+/// Copy the tile of the argument \p arg that the loop \p L reads into a new
+/// contiguous and aligned local tensor before the loop, and rewrite the loads
+/// in the loop to read from the local tensor. The subscripts of the loads must
+/// be affine and the loop must not write into \p arg.
+/// \returns the new local tensor if the transform worked or nullptr.
+Argument *pack(Loop *L, Argument *arg);
+
+/// \returns True if pack(L, arg) would work, without changing the program.
+/// Sets \p packedTy to the type of the local tensor that pack would create.
+bool canPack(Loop *L, Argument *arg, Type &packedTy);
+
 /// Change the layout of the input tensor at \p argIndex in program \p p, using
 /// the shuffle \p shuffle.
 bool changeLayout(Program *p, unsigned argIndex,
@@ -0,0 +1,370 @@
+#include "bistra/Analysis/CostModel.h"
+#include "bistra/Analysis/Value.h"
+#include "bistra/Program/Program.h"
+#include "bistra/Program/Utils.h"
+
+#include <algorithm>
+#include <cmath>
+#include <map>
+#include <set>
+#include <thread>
+#include <unordered_map>
+
+#ifdef __linux__
+#include <unistd.h>
+#endif
+
+using namespace bistra;
+
+MachineModel MachineModel::getHost() {
+  MachineModel M;
+  M.numCores = std::max(1u, std::thread::hardware_concurrency());
+#if defined(__linux__) && defined(_SC_LEVEL1_DCACHE_SIZE)
+  long sizes[3] = {sysconf(_SC_LEVEL1_DCACHE_SIZE),
+                   sysconf(_SC_LEVEL2_CACHE_SIZE),
+                   sysconf(_SC_LEVEL3_CACHE_SIZE)};
+  for (unsigned i = 0; i < 3; i++) {
+    if (sizes[i] > 0)
+      M.cacheSize[i] = sizes[i];
+  }
+  long line = sysconf(_SC_LEVEL1_DCACHE_LINESIZE);
+  if (line > 0)
+    M.lineSize = line;
+#endif
+  return M;
+}
+
+namespace {
+
+/// \returns the number of vector instructions that process a value of type
+/// \p ty on the machine \p M.
+double getNumInstrs(const ExprType &ty, const MachineModel &M) {
+  double bytes = ty.getWidth() * ty.getElementSizeInBytes();
+  return std::ceil(bytes / (M.vectorWidth * 4));
+}
+
+/// The number of instructions that some code executes.
+struct InstrCount {
+  double mem{0};
+  double arith{0};
+};
+
+/// Add the instructions that the statement \p s executes to \p cnt.
+void countInstrs(Stmt *s, const MachineModel &M, InstrCount &cnt) {
+  for (auto *E : collectExprs(s)) {
+    if (dynamic_cast<LoadExpr *>(E)) {
+      cnt.mem += getNumInstrs(E->getType(), M);
+      continue;
+    }
+    if (auto *BE = dynamic_cast<BinaryExpr *>(E)) {
+      // Index arithmetic is folded into the address computation, and additions
+      // are fused into the multiplications that feed them.
+      if (BE->getLHS()->getType().isIndexTy())
+        continue;
+      if (BE->getKind() == BinaryExpr::Add &&
+          (getFusableMul(BE->getLHS()) || getFusableMul(BE->getRHS())))
+        continue;
+      cnt.arith += getNumInstrs(E->getType(), M);
+      continue;
+    }
+    if (dynamic_cast<UnaryExpr *>(E) || dynamic_cast<CastExpr *>(E) ||
+        dynamic_cast<BroadcastExpr *>(E)) {
+      cnt.arith += getNumInstrs(E->getType(), M);
+    }
+    // A reduction takes a shuffle and an operation for each halving of the
+    // vector.
+    if (auto *RE = dynamic_cast<ReduceExpr *>(E)) {
+      unsigned width = RE->getVal()->getType().getWidth();
+      cnt.arith += 2 * std::ceil(std::log2(std::max(width, 2u)));
+    }
+  }
+
+  // Accumulation is a load, an addition and a store.
+  if (auto *SS = dynamic_cast<StoreStmt *>(s)) {
+    auto *val = SS->getValue().get();
+    double n = getNumInstrs(val->getType(), M);
+    cnt.mem += SS->isAccumulate() ? 2 * n : n;
+    if (SS->isAccumulate() && !getFusableMul(val))
+      cnt.arith += n;
+  }
+  if (auto *SL = dynamic_cast<StoreLocalStmt *>(s)) {
+    auto *val = SL->getValue().get();
+    if (SL->isAccumulate() && !getFusableMul(val))
+      cnt.arith += getNumInstrs(val->getType(), M);
+  }
+  if (dynamic_cast<CallStmt *>(s)) {
+    cnt.arith += 1;
+  }
+  if (dynamic_cast<PrefetchStmt *>(s)) {
+    cnt.mem += 1;
+  }
+}
+
+/// \returns True if \p s accumulates into the same location in every
+/// iteration of the loop \p L.
+bool isCarriedAccumulation(Stmt *s, Loop *L) {
+  if (auto *SL = dynamic_cast<StoreLocalStmt *>(s))
+    return SL->isAccumulate();
+  if (auto *SS = dynamic_cast<StoreStmt *>(s)) {
+    if (!SS->isAccumulate())
+      return false;
+    for (auto &idx : SS->getIndices()) {
+      if (dependsOnLoop(idx.get(), L))
+        return false;
+    }
+    return true;
+  }
+  return false;
+}
+
+/// \returns the number of vector registers that the loop \p L uses.
+double getRegisterPressure(Loop *L, const MachineModel &M) {
+  std::vector<LoadLocalExpr *> loads;
+  std::vector<StoreLocalStmt *> stores;
+  collectLocals(L, loads, stores);
+  std::set<LocalVar *> vars;
+  for (auto *ld : loads) {
+    vars.insert(ld->getDest());
+  }
+  for (auto *st : stores) {
+    vars.insert(st->getDest());
+  }
+
+  // Reserve a few registers for the temporary values of the expressions.
+  double regs = 2;
+  for (auto *v : vars) {
+    regs += getNumInstrs(v->getType(), M);
+  }
+  return regs;
+}
+
+/// \returns the number of cycles that it takes to execute the instructions of
+/// the scope \p S, assuming that all of the data is in the L1 cache.
+double getComputeCycles(Scope *S, const MachineModel &M) {
+  auto *L = dynamic_cast<Loop *>(S);
+  InstrCount cnt;
+  double nested = 0;
+  bool carried = false;
+  for (auto &s : S->getBody()) {
+    if (auto *inner = dynamic_cast<Scope *>(s.get())) {
+      nested += getComputeCycles(inner, M);
+      continue;
+    }
+    countInstrs(s.get(), M, cnt);
+    carried |= L && isCarriedAccumulation(s.get(), L);
+  }
+
+  double cycles =
+      std::max(cnt.mem / M.memPerCycle, cnt.arith / M.arithPerCycle);
+  if (!L)
+    return cycles + nested;
+
+  if (carried)
+    cycles = std::max(cycles, M.accumulateLatency);
+
+  // Registers that don't fit in the register file are stored and reloaded in
+  // every iteration, on the critical path of the computation.
+  if (isInnermostLoop(L)) {
+    double spills = std::max<double>(0, getRegisterPressure(L, M) -
+                                            M.numRegisters);
+    cycles += 2 * spills / M.memPerCycle;
+  }
+
+  double tripcount = L->getEnd() / L->getStride();
+  // The iterations of parallel loops are split between the cores.
+  if (L->isParallel() && tripcount > 0)
+    tripcount =
+        std::ceil(tripcount / std::min<double>(M.numCores, tripcount));
+  return tripcount * (cycles + nested + M.loopOverhead);
+}
+
+/// \returns the number of bytes that the access to the element \p indices of
+/// the argument \p arg touches, with a vector of \p width elements, while the
+/// loops in \p live iterate. Whole cache lines are touched.
+double getAccessedBytes(Argument *arg, const std::vector<ExprHandle> &indices,
+                        unsigned width, std::set<Loop *> *live,
+                        const MachineModel &M) {
+  double total = arg->getType()->getSizeInBytes();
+  unsigned elemSize =
+      Type::getElementSizeInBytes(arg->getType()->getElementType());
+
+  // The number of rows, and the number of elements in the last dimension.
+  double rows = 1;
+  double cols = 1;
+  for (unsigned i = 0; i < indices.size(); i++) {
+    std::pair<int, int> range;
+    if (!computeKnownIntegerRange(indices[i].get(), range, live))
+      return total;
+    double span = range.second - range.first + 1;
+    if (i + 1 < indices.size()) {
+      rows *= span;
+    } else {
+      cols = span + width - 1;
+    }
+  }
+
+  double rowBytes = std::ceil(cols * elemSize / M.lineSize) * M.lineSize;
+  return std::min(total, rows * rowBytes);
+}
+
+/// Computes the number of bytes that statements touch, and the traffic
+/// between the levels of the memory hierarchy.
+class FootprintCalculator {
+  const MachineModel &M_;
+  /// Maps statements to the number of bytes that they touch.
+  std::unordered_map<Stmt *, double> footprint_;
+
+public:
+  FootprintCalculator(const MachineModel &M) : M_(M) {}
+
+  /// \returns the number of bytes that a single execution of \p s touches.
+  double getFootprint(Stmt *s) {
+    auto it = footprint_.find(s);
+    if (it != footprint_.end())
+      return it->second;
+
+    // All of the loops in the statement iterate.
+    std::vector<Loop *> loops = collectLoops(s);
+    std::set<Loop *> live(loops.begin(), loops.end());
+    if (auto *L = dynamic_cast<Loop *>(s))
+      live.insert(L);
+
+    // Accesses with the same subscript touch the same memory, and accesses
+    // can't touch more than the whole buffer.
+    std::map<Argument *, std::map<uint64_t, double>> accesses;
+    auto addAccess = [&](Argument *arg, const std::vector<ExprHandle> &indices,
+                         unsigned width) {
+      uint64_t key = width;
+      for (auto &idx : indices) {
+        key = hashJoin(key, idx->hash());
+      }
+      accesses[arg][key] = getAccessedBytes(arg, indices, width, &live, M_);
+    };
+
+    std::vector<LoadExpr *> loads;
+    std::vector<StoreStmt *> stores;
+    collectLoadStores(s, loads, stores);
+    for (auto *ld : loads) {
+      addAccess(ld->getDest(), ld->getIndices(), ld->getType().getWidth());
+    }
+    for (auto *st : stores) {
+      addAccess(st->getDest(), st->getIndices(),
+                st->getValue()->getType().getWidth());
+    }
+
+    double total = 0;
+    for (auto &arg : accesses) {
+      double bytes = 0;
+      for (auto &acc : arg.second) {
+        bytes += acc.second;
+      }
+      total += std::min<double>(bytes, arg.first->getType()->getSizeInBytes());
+    }
+
+    footprint_[s] = total;
+    return total;
+  }
+
+  /// \returns the number of bytes that are transferred into a cache of \p size
+  /// bytes when \p s is executed. The data of statements that fit in the
+  /// cache is transferred once, and the data of the rest is transferred for
+  /// every iteration of the loops that don't fit.
+  double getTraffic(Stmt *s, double size) {
+    double bytes = getFootprint(s);
+    auto *S = dynamic_cast<Scope *>(s);
+    if (bytes <= size || !S)
+      return bytes;
+
+    double traffic = 0;
+    for (auto &inner : S->getBody()) {
+      traffic += getTraffic(inner.get(), size);
+    }
+    if (auto *L = dynamic_cast<Loop *>(s))
+      traffic *= L->getEnd() / L->getStride();
+    return traffic;
+  }
+};
+
+} // namespace
+
+double bistra::estimateCycles(Program *p, const MachineModel &M) {
+  double cycles = getComputeCycles(p, M);
+
+  // The program is bound by the slowest level of the memory hierarchy. The
+  // program is executed repeatedly, so data that fits in a cache stays there.
+  FootprintCalculator FC(M);
+  for (unsigned i = 0; i < 3; i++) {
+    if (FC.getFootprint(p) <= M.cacheSize[i])
+      break;
+    double traffic = FC.getTraffic(p, M.cacheSize[i]);
+    cycles = std::max(cycles, traffic / M.bandwidth[i]);
+  }
+  return cycles;
+}
+
+std::vector<double> bistra::getProgramFeatures(Program *p,
+                                               const MachineModel &M) {
+  auto lg = [](double v) { return std::log2(1 + v); };
+  std::vector<double> features;
+
+  // The analytical estimate and the roofline counts.
+  std::unordered_map<ASTNode *, ComputeCostTy> heatmap;
+  estimateCompute(p, heatmap);
+  features.push_back(lg(estimateCycles(p, M)));
+  features.push_back(lg(heatmap[p].first));
+  features.push_back(lg(heatmap[p].second));
+
+  // The shape of the loop nests. Levels are counted from the innermost loops.
+  FootprintCalculator FC(M);
+  std::vector<Loop *> loops = collectLoops(p);
+  unsigned depth = 0;
+  unsigned numParallel = 0;
+  double innerTrips = 0, innerStride = 0;
+  double bytes[4] = {0, 0, 0, 0};
+  double registers = 0, locals = 0;
+  std::vector<Loop *> innermost;
+  for (auto *L : loops) {
+    numParallel += L->isParallel();
+    if (!isInnermostLoop(L))
+      continue;
+    innermost.push_back(L);
+    innerTrips += L->getEnd() / L->getStride();
+    innerStride += L->getStride();
+    registers = std::max(registers, getRegisterPressure(L, M));
+
+    // The local registers that are written in the loop.
+    double numLocals = 0;
+    for (auto &s : L->getBody()) {
+      numLocals += (bool)dynamic_cast<StoreLocalStmt *>(s.get());
+    }
+    locals = std::max(locals, numLocals);
+
+    unsigned level = 0;
+    for (Loop *P = L; P; P = getContainingLoop(P), level++) {
+      if (level < 4)
+        bytes[level] = std::max(bytes[level], FC.getFootprint(P));
+    }
+    depth = std::max(depth, level);
+  }
+  double numInner = std::max<size_t>(1, innermost.size());
+  features.push_back(loops.size());
+  features.push_back(depth);
+  features.push_back(numParallel);
+  features.push_back(lg(innerTrips / numInner));
+  features.push_back(lg(innerStride / numInner));
+
+  // The widest vector in the program.
+  unsigned width = 1;
+  for (auto *E : collectExprs(p)) {
+    if (!E->getType().isIndexTy())
+      width = std::max(width, E->getType().getWidth());
+  }
+  features.push_back(lg(width));
+
+  for (auto b : bytes) {
+    features.push_back(lg(b));
+  }
+  features.push_back(registers);
+  features.push_back(locals);
+  return features;
+}
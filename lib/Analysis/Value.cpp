@@ -4,6 +4,7 @@
 #include "bistra/Program/Utils.h"
 
 #include <array>
+#include <numeric>
 #include <set>
 
 using namespace bistra;
@@ -321,6 +322,11 @@ Expr *bistra::getZeroExpr(ExprType &T) {
     ret = new ConstantFPExpr(0.0);
   }
 
+  // Convert the zero to narrow types.
+  if (ret->getType().getElementType() != T.getElementType()) {
+    ret = new CastExpr(ret, T.getElementType(), DebugLoc::npos());
+  }
+
   // Widen if we are requested a vector.
   if (T.isVector()) {
     ret = new BroadcastExpr(ret, T.getWidth());
@@ -370,6 +376,13 @@ bool bistra::isZero(Expr *e) {
   return false;
 }
 
+BinaryExpr *bistra::getFusableMul(Expr *e) {
+  auto *BE = dynamic_cast<BinaryExpr *>(e);
+  if (!BE || BE->getKind() != BinaryExpr::Mul || !BE->getType().isFPTy())
+    return nullptr;
+  return BE;
+}
+
 bool bistra::computeKnownIntegerRange(Expr *e, std::pair<int, int> &range,
                                       const std::set<Loop *> *liveLoops) {
   // Estimate the range of constants expressions.
@@ -459,6 +472,59 @@ bool bistra::computeKnownIntegerRange(Expr *e, std::pair<int, int> &range,
   return false;
 }
 
+/// \returns a number that the integer expression \p e is always a multiple
+/// of, or zero if \p e is always zero.
+static uint64_t getKnownMultiple(Expr *e) {
+  if (auto *CE = dynamic_cast<ConstantExpr *>(e))
+    return std::abs(CE->getValue());
+
+  // Loops start at zero and jump in steps of the stride.
+  if (auto *IE = dynamic_cast<IndexExpr *>(e))
+    return IE->getLoop()->getStride();
+
+  if (auto *BE = dynamic_cast<BinaryExpr *>(e)) {
+    uint64_t L = getKnownMultiple(BE->getLHS());
+    uint64_t R = getKnownMultiple(BE->getRHS());
+    switch (BE->getKind()) {
+    case BinaryExpr::Mul:
+      return L * R;
+    case BinaryExpr::Add:
+    case BinaryExpr::Sub:
+    case BinaryExpr::Min:
+    case BinaryExpr::Max:
+      return std::gcd(L, R);
+    default:
+      return 1;
+    }
+  }
+
+  return 1;
+}
+
+unsigned bistra::getKnownAlignment(const Argument *arg,
+                                   const std::vector<ExprHandle> &indices) {
+  auto *ty = arg->getType();
+  assert(ty->getNumDims() == indices.size() && "Invalid number of indices");
+
+  // Find a number that the byte offset of the element is a multiple of. The
+  // offset is the sum of the indices, scaled by the size of the dimensions
+  // that follow them.
+  uint64_t multiple = 0;
+  uint64_t scale = Type::getElementSizeInBytes(ty->getElementType());
+  for (int i = indices.size() - 1; i >= 0; i--) {
+    multiple = std::gcd(multiple, getKnownMultiple(indices[i].get()) * scale);
+    scale *= ty->getDims()[i];
+  }
+
+  // The offset is always zero.
+  unsigned align = arg->getAlignment();
+  if (multiple == 0)
+    return align;
+
+  // The largest power of two that divides the offset.
+  return std::min<uint64_t>(align, multiple & -multiple);
+}
+
 RangeRelation bistra::getRangeRelation(std::pair<int, int> A,
                                        std::pair<int, int> B) {
   // A is contained inside B.
@@ -476,6 +542,13 @@ RangeRelation bistra::getRangeRelation(std::pair<int, int> A,
 }
 
 namespace {
+/// \returns the number of memory ops that it takes to load or store a value
+/// of type \p ty. Memory ops are counted in 32-bit words, so vectors of narrow
+/// elements take fewer memory ops.
+int getNumMemoryOps(const ExprType &ty) {
+  return std::max(1u, ty.getWidth() * ty.getElementSizeInBytes() / 4);
+}
+
 /// Calculates the roofline model for the program.
 struct ComputeEstimator : public NodeVisitor {
   std::unordered_map<ASTNode *, ComputeCostTy> &heatmap_;
@@ -486,8 +559,7 @@ struct ComputeEstimator : public NodeVisitor {
   virtual void leave(Expr *E) override {
     // Loads count as one memory op and zero compute.
     if (auto *LE = dynamic_cast<LoadExpr *>(E)) {
-      int width = LE->getType().getWidth();
-      heatmap_[LE] = {width, 0};
+      heatmap_[LE] = {getNumMemoryOps(LE->getType()), 0};
       return;
     }
     // Load locals count as zeo memory op and zero compute.
@@ -504,6 +576,10 @@ struct ComputeEstimator : public NodeVisitor {
       int width = BE->getType().getWidth();
       // Don't count index arithmetic as arithmetic.
       int cost = BE->getLHS()->getType().isIndexTy() ? 0 : width;
+      // The addition is fused into the multiplication that feeds it.
+      if (BE->getKind() == BinaryExpr::Add &&
+          (getFusableMul(BE->getLHS()) || getFusableMul(BE->getRHS())))
+        cost = 0;
       heatmap_[BE] = {LHS.first + RHS.first, cost + LHS.second + RHS.second};
       return;
     }
@@ -518,6 +594,24 @@ struct ComputeEstimator : public NodeVisitor {
       return;
     }
 
+    // Conversions add one arithmetic unit.
+    if (auto *CE = dynamic_cast<CastExpr *>(E)) {
+      assert(heatmap_.count(CE->getVal()));
+      auto VV = heatmap_[CE->getVal()];
+      VV.second += CE->getType().getWidth();
+      heatmap_[CE] = VV;
+      return;
+    }
+
+    // Reductions combine all of the lanes of the vector.
+    if (auto *RE = dynamic_cast<ReduceExpr *>(E)) {
+      assert(heatmap_.count(RE->getVal()));
+      auto VV = heatmap_[RE->getVal()];
+      VV.second += RE->getVal()->getType().getWidth();
+      heatmap_[RE] = VV;
+      return;
+    }
+
     // Broadcast counts as one arithmetic op.
     if (auto *BE = dynamic_cast<BroadcastExpr *>(E)) {
       assert(heatmap_.count(BE->getValue()));
@@ -586,14 +680,17 @@ struct ComputeEstimator : public NodeVisitor {
     if (auto *SS = dynamic_cast<StoreStmt *>(E)) {
       auto val = SS->getValue().get();
       int width = val->getType().getWidth();
+      int memOps = getNumMemoryOps(val->getType());
       assert(heatmap_.count(val));
       ComputeCostTy total = heatmap_[val];
       if (SS->isAccumulate()) {
-        // Accumulate is load+add+store.
-        total.first += 2 * width;
-        total.second += 1 * width;
+        // Accumulate is load+add+store. The addition is fused into the
+        // multiplication that feeds it.
+        total.first += 2 * memOps;
+        if (!getFusableMul(val))
+          total.second += 1 * width;
       } else {
-        total.first += 1 * width;
+        total.first += 1 * memOps;
       }
       heatmap_[SS] = total;
       return;
@@ -605,13 +702,19 @@ struct ComputeEstimator : public NodeVisitor {
       int width = val->getType().getWidth();
       assert(heatmap_.count(val));
       ComputeCostTy total = heatmap_[val];
-      if (SL->isAccumulate()) {
+      if (SL->isAccumulate() && !getFusableMul(val)) {
         total.second += width;
       }
       heatmap_[SL] = total;
       return;
     }
 
+    // Prefetches are considered as one memory op.
+    if (auto *PS = dynamic_cast<PrefetchStmt *>(E)) {
+      heatmap_[PS] = {1, 0};
+      return;
+    }
+
     assert(false && "Unknown statement");
   }
 };
@@ -4,9 +4,11 @@
 #include "bistra/Backends/LLVMBackend/LLVMBackend.h"
 using namespace bistra;
 
-std::unique_ptr<Backend> bistra::getBackend(const std::string &name) {
+std::unique_ptr<Backend> bistra::getBackend(const std::string &name,
+                                            const std::string &cpu,
+                                            const std::string &features) {
   if (name == "llvm") {
-    return std::make_unique<LLVMBackend>();
+    return std::make_unique<LLVMBackend>(cpu, features);
   } else {
     assert(false && "Unknown backend");
   }
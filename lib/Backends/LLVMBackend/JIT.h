@@ -1,26 +1,71 @@
 #ifndef BISTRA_BACKENDS_LLVMBACKEND_JIT_H
 #define BISTRA_BACKENDS_LLVMBACKEND_JIT_H
 
-#include "llvm/ExecutionEngine/ExecutionEngine.h"
 #include "llvm/ExecutionEngine/JITSymbol.h"
-#include "llvm/ExecutionEngine/Orc/CompileUtils.h"
-#include "llvm/ExecutionEngine/Orc/IRCompileLayer.h"
-#include "llvm/ExecutionEngine/Orc/RTDyldObjectLinkingLayer.h"
-#include "llvm/ExecutionEngine/RTDyldMemoryManager.h"
-#include "llvm/ExecutionEngine/SectionMemoryManager.h"
-#include "llvm/IR/DataLayout.h"
-#include "llvm/IR/Mangler.h"
-#include "llvm/Support/DynamicLibrary.h"
-#include "llvm/Target/TargetMachine.h"
-
-#include <algorithm>
-#include <map>
+#include "llvm/ExecutionEngine/Orc/Core.h"
+#include "llvm/ExecutionEngine/Orc/LLJIT.h"
+#include "llvm/Support/Error.h"
+#include "llvm/Support/MemoryBuffer.h"
+
+#include <atomic>
 #include <memory>
 #include <string>
-#include <vector>
 
 namespace llvm {
-namespace orc {} // end namespace orc
+namespace orc {
+
+/// A long-lived JIT session. Each object file is loaded into its own dylib,
+/// which is removed when the code is no longer needed. This allows the tuner
+/// to evaluate thousands of candidates without creating a new JIT for each
+/// candidate, and without accumulating the code of old candidates.
+class SimpleJIT {
+  /// The JIT instance.
+  std::unique_ptr<LLJIT> J_;
+  /// Used to generate unique dylib names.
+  std::atomic<unsigned> counter_{0};
+
+  SimpleJIT(std::unique_ptr<LLJIT> J) : J_(std::move(J)) {}
+
+public:
+  static Expected<std::unique_ptr<SimpleJIT>> Create() {
+    auto J = LLJITBuilder().create();
+    if (!J)
+      return J.takeError();
+    return std::unique_ptr<SimpleJIT>(new SimpleJIT(std::move(*J)));
+  }
+
+  /// Define the symbol \p name at the address \p addr. The symbol is visible
+  /// to all of the object files.
+  template <typename T> Error addSymbol(StringRef name, T *addr) {
+    SymbolMap symbols;
+    symbols[J_->mangleAndIntern(name)] = {ExecutorAddr::fromPtr(addr),
+                                          JITSymbolFlags::Exported};
+    return J_->getMainJITDylib().define(absoluteSymbols(std::move(symbols)));
+  }
+
+  /// Load the object file \p obj into a new dylib. The dylib links against
+  /// the main dylib, which defines the symbols of addSymbol.
+  /// \returns the new dylib.
+  Expected<JITDylib &> addObject(std::unique_ptr<MemoryBuffer> obj) {
+    auto JD = J_->createJITDylib("object" + std::to_string(counter_++));
+    if (!JD)
+      return JD.takeError();
+    JD->addToLinkOrder(J_->getMainJITDylib());
+    if (auto err = J_->addObjectFile(*JD, std::move(obj)))
+      return std::move(err);
+    return *JD;
+  }
+
+  /// \returns the address of the symbol \p name in the dylib \p JD.
+  auto lookup(JITDylib &JD, StringRef name) { return J_->lookup(JD, name); }
+
+  /// Remove the dylib \p JD and release the memory of its code.
+  Error remove(JITDylib &JD) {
+    return J_->getExecutionSession().removeJITDylib(JD);
+  }
+};
+
+} // end namespace orc
 } // end namespace llvm
 
 #endif // BISTRA_BACKENDS_LLVMBACKEND_JIT_H
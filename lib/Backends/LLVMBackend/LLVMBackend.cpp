@@ -1,9 +1,14 @@
 #include "bistra/Backends/LLVMBackend/LLVMBackend.h"
+#include "bistra/Analysis/Value.h"
 #include "bistra/Backends/Backend.h"
+#include "bistra/Program/Dynamic.h"
+#include "bistra/Program/Library.h"
 #include "bistra/Program/Program.h"
 #include "bistra/Program/Utils.h"
 
 #include "llvm/Analysis/Passes.h"
+#include "llvm/Bitcode/BitcodeReader.h"
+#include "llvm/Bitcode/BitcodeWriter.h"
 #include "llvm/IR/BasicBlock.h"
 #include "llvm/IR/Constants.h"
 #include "llvm/IR/DataLayout.h"
@@ -13,9 +18,14 @@
 #include "llvm/IR/Module.h"
 #include "llvm/IR/Type.h"
 #include "llvm/IR/Verifier.h"
+#include "llvm/Linker/Linker.h"
+#include "llvm/Support/MathExtras.h"
 #include "llvm/Support/raw_ostream.h"
+#include "llvm/Target/TargetMachine.h"
 
+#include <cstdlib>
 #include <map>
+#include <thread>
 
 using namespace bistra;
 
@@ -27,6 +37,20 @@ class LLVMEmitter {
   std::map<std::string, std::pair<llvm::Value *, llvm::Type *>> namedValues_;
   std::map<Loop *, llvm::Value *> loopIndices_;
   llvm::Function *func_;
+  /// The program that is being emitted.
+  Program *prog_;
+  /// The width of the vector registers of the target, in bits.
+  unsigned vectorBits_;
+  /// The heap buffer that holds the large local tensors of the current
+  /// function, or null.
+  llvm::Value *scratch_{nullptr};
+  /// The mask of the vector lanes that pass the enclosing range checks, or
+  /// null if all of the lanes are active.
+  llvm::Value *mask_{nullptr};
+
+  /// Local tensors that are larger than this number of bytes are allocated on
+  /// the heap, to keep the stack frames of the parallel tasks small.
+  static constexpr uint64_t kMaxStackTensorSize = 64 << 10;
 
   llvm::Type *int64Ty_;
   llvm::Type *int32Ty_;
@@ -34,7 +58,9 @@ class LLVMEmitter {
   llvm::Constant *int32Zero_;
 
 public:
-  LLVMEmitter() : ctx_(std::make_unique<llvm::LLVMContext>()), builder_(*ctx_) {
+  LLVMEmitter(unsigned vectorBits)
+      : ctx_(std::make_unique<llvm::LLVMContext>()), builder_(*ctx_),
+        vectorBits_(vectorBits) {
     int64Ty_ = llvm::Type::getInt64Ty(*ctx_);
     int64Zero_ = llvm::Constant::getNullValue(int64Ty_);
     int32Ty_ = llvm::Type::getInt32Ty(*ctx_);
@@ -46,20 +72,41 @@ public:
   std::unique_ptr<llvm::Module> &getModule() { return M_; }
   std::unique_ptr<llvm::LLVMContext> &getContext() { return ctx_; }
 
+  /// Allow the code generator to use the full width of the vector registers
+  /// in the function \p F, because the program is already vectorized to this
+  /// width.
+  void setVectorWidth(llvm::Function *F) {
+    auto width = std::to_string(vectorBits_);
+    F->addFnAttr("min-legal-vector-width", width);
+    F->addFnAttr("prefer-vector-width", width);
+  }
+
+  /// Set the name and the attributes of the parameter \p param that holds
+  /// the argument \p arg.
+  void setParamAttrs(llvm::Argument *param, Argument *arg) {
+    param->addAttr(llvm::Attribute::AttrKind::NoAlias);
+    auto align = llvm::Align(arg->getAlignment());
+    param->addAttr(llvm::Attribute::getWithAlignment(*ctx_, align));
+    param->setName(arg->getName());
+  }
+
+  /// \returns the type of the elements of the argument \p arg.
+  llvm::Type *getElementType(const Argument *arg) {
+    return getLLVMTypeForType(ExprType(arg->getType()->getElementType()));
+  }
+
+  /// \returns the alignment of the address \p gep.
+  llvm::Align getAlignment(const GEPExpr *gep) {
+    return llvm::Align(getKnownAlignment(gep->getDest(), gep->getIndices()));
+  }
+
   llvm::Function *emitPrototype(Program *p) {
     std::vector<llvm::Type *> argListType;
 
-    // Construct the types for the argument list.
-    for (auto *arg : p->getArgs()) {
-      switch (arg->getType()->getElementType()) {
-      case ElemKind::Float32Ty: {
-        auto *ptrTy = llvm::PointerType::get(llvm::Type::getFloatTy(*ctx_), 0);
-        argListType.push_back(ptrTy);
-        break;
-      }
-      default:
-        assert(false && "Invalid parameter");
-      }
+    // Construct the types for the argument list. All of the tensors are
+    // passed as pointers.
+    for (unsigned i = 0; i < p->getArgs().size(); i++) {
+      argListType.push_back(llvm::PointerType::get(*ctx_, 0));
     }
 
     // Make the function type:  double(double,double) etc.
@@ -68,16 +115,13 @@ public:
 
     llvm::Function *F = llvm::Function::Create(
         FT, llvm::Function::ExternalLinkage, p->getName(), M_.get());
+    setVectorWidth(F);
 
-    // Mark the arguments to the function as no-alias.
-    for (auto &arg : F->args()) {
-      arg.addAttr(llvm::Attribute::AttrKind::NoAlias);
-    }
-
-    // Set names for all arguments.
+    // Mark the arguments to the function as no-alias and aligned, and set
+    // their names.
     unsigned idx = 0;
     for (auto &arg : F->args())
-      arg.setName(p->getArg(idx++)->getName());
+      setParamAttrs(&arg, p->getArg(idx++));
 
     return F;
   }
@@ -135,7 +179,16 @@ public:
 
     // Handle binary expressions.
     if (auto *bin = dynamic_cast<const BinaryExpr *>(e)) {
-      bool isFP = !bin->getType().isIndexTy();
+      bool isFP = bin->getType().isFPTy();
+
+      // Fuse the multiplication into the addition: (a * b) + c.
+      if (isFP && bin->getKind() == BinaryExpr::BinOpKind::Add) {
+        if (auto *mul = getFusableMul(bin->getLHS()))
+          return emitMulAdd(mul, generate(bin->getRHS()));
+        if (auto *mul = getFusableMul(bin->getRHS()))
+          return emitMulAdd(mul, generate(bin->getLHS()));
+      }
+
       auto *LHS = generate(bin->getLHS());
       auto *RHS = generate(bin->getRHS());
 
@@ -162,11 +215,15 @@ public:
         return builder_.CreateSDiv(LHS, RHS);
 
       case bistra::BinaryExpr::Max: {
-        auto *cond = builder_.CreateFCmp(llvm::CmpInst::FCMP_OGE, LHS, RHS);
+        auto *cond =
+            isFP ? builder_.CreateFCmp(llvm::CmpInst::FCMP_OGE, LHS, RHS)
+                 : builder_.CreateICmp(llvm::CmpInst::ICMP_SGE, LHS, RHS);
         return builder_.CreateSelect(cond, LHS, RHS);
       }
       case bistra::BinaryExpr::Min: {
-        auto *cond = builder_.CreateFCmp(llvm::CmpInst::FCMP_OLT, LHS, RHS);
+        auto *cond =
+            isFP ? builder_.CreateFCmp(llvm::CmpInst::FCMP_OLT, LHS, RHS)
+                 : builder_.CreateICmp(llvm::CmpInst::ICMP_SLT, LHS, RHS);
         return builder_.CreateSelect(cond, LHS, RHS);
       }
       case bistra::BinaryExpr::Pow:
@@ -191,6 +248,35 @@ public:
       }
     }
 
+    // Handle conversions.
+    if (auto *CE = dynamic_cast<const CastExpr *>(e)) {
+      return emitCast(generate(CE->getVal()), llvmTy);
+    }
+
+    // Handle horizontal reductions.
+    if (auto *RE = dynamic_cast<const ReduceExpr *>(e)) {
+      auto *val = generate(RE->getVal());
+      bool isFP = val->getType()->getScalarType()->isFloatingPointTy();
+      switch (RE->getKind()) {
+      case BinaryExpr::Add:
+        if (isFP)
+          return builder_.CreateFAddReduce(
+              llvm::ConstantFP::getNegativeZero(llvmTy), val);
+        return builder_.CreateAddReduce(val);
+      case BinaryExpr::Max:
+        if (isFP)
+          return builder_.CreateFPMaxReduce(val);
+        return builder_.CreateIntMaxReduce(val, true);
+      case BinaryExpr::Min:
+        if (isFP)
+          return builder_.CreateFPMinReduce(val);
+        return builder_.CreateIntMinReduce(val, true);
+      default:
+        assert(false && "Invalid reduction operator");
+        return nullptr;
+      }
+    }
+
     // Handle broadcast expressions.
     if (auto *bb = dynamic_cast<const BroadcastExpr *>(e)) {
       auto *val = generate(bb->getValue());
@@ -229,41 +315,158 @@ public:
         auto *vecTy = llvm::VectorType::get(arg.second, width, false);
         auto *vecPTy = llvm::PointerType::get(vecTy, 0);
         auto *vt = builder_.CreateBitCast(ptr, vecPTy, "vload_expr_cast");
-        auto *ld = builder_.CreateLoad(vecTy, vt, "ld");
-        ld->setAlignment(llvm::Align(1));
-        return ld;
+        if (mask_) {
+          return builder_.CreateMaskedLoad(
+              vecTy, vt, getAlignment(ld->getGep()), getMask(width),
+              llvm::Constant::getNullValue(vecTy), "ld");
+        }
+        auto *load = builder_.CreateLoad(vecTy, vt, "ld");
+        load->setAlignment(getAlignment(ld->getGep()));
+        return load;
       }
 
-      return builder_.CreateLoad(arg.second, ptr, "ld");
+      auto *load = builder_.CreateLoad(arg.second, ptr, "ld");
+      load->setAlignment(getAlignment(ld->getGep()));
+      return load;
     }
 
     assert(false && "unhandled expression");
   }
 
+  /// \returns the multiply-add (a * b) + \p addend, where \p mul is the
+  /// multiplication (a * b).
+  llvm::Value *emitMulAdd(BinaryExpr *mul, llvm::Value *addend) {
+    auto *LHS = generate(mul->getLHS());
+    auto *RHS = generate(mul->getRHS());
+    return builder_.CreateIntrinsic(llvm::Intrinsic::fmuladd,
+                                    {addend->getType()}, {LHS, RHS, addend});
+  }
+
+  /// \returns the value \p val added to the previous value \p prev. If
+  /// the value is a multiplication then the two are fused to a multiply-add.
+  llvm::Value *emitAccumulate(Expr *val, llvm::Value *prev) {
+    if (auto *mul = getFusableMul(val))
+      return emitMulAdd(mul, prev);
+    if (val->getType().isFPTy())
+      return builder_.CreateFAdd(prev, generate(val));
+    return builder_.CreateAdd(prev, generate(val));
+  }
+
+  /// \returns the type \p scalarTy, or a vector of \p scalarTy with the
+  /// same number of elements as the type \p like.
+  llvm::Type *getTypeLike(llvm::Type *scalarTy, llvm::Type *like) {
+    if (auto *VT = llvm::dyn_cast<llvm::VectorType>(like))
+      return llvm::VectorType::get(scalarTy, VT->getElementCount());
+    return scalarTy;
+  }
+
+  /// \returns the value \p val converted to the type \p ty. Integers are
+  /// signed. Conversions to and from bfloat16 are emitted as integer
+  /// operations, because most processors don't support bfloat16 arithmetic and
+  /// the conversions would otherwise become a library call per element.
+  llvm::Value *emitCast(llvm::Value *val, llvm::Type *ty) {
+    auto *floatTy = getTypeLike(llvm::Type::getFloatTy(*ctx_), ty);
+    auto *i16Ty = getTypeLike(llvm::Type::getInt16Ty(*ctx_), ty);
+    auto *i32Ty = getTypeLike(int32Ty_, ty);
+
+    // A bfloat16 is the upper half of a float.
+    if (val->getType()->getScalarType()->isBFloatTy()) {
+      val = builder_.CreateZExt(builder_.CreateBitCast(val, i16Ty), i32Ty);
+      val = builder_.CreateBitCast(builder_.CreateShl(val, 16), floatTy);
+    }
+
+    if (ty->getScalarType()->isBFloatTy()) {
+      val = emitCast(val, floatTy);
+      // Round the float to the nearest even bfloat16:
+      // (bits + 0x7fff + ((bits >> 16) & 1)) >> 16.
+      auto *bits = builder_.CreateBitCast(val, i32Ty);
+      auto *lsb = builder_.CreateAnd(builder_.CreateLShr(bits, 16), 1);
+      auto *half = llvm::ConstantInt::get(i32Ty, 0x7fff);
+      auto *bias = builder_.CreateAdd(lsb, half);
+      bits = builder_.CreateLShr(builder_.CreateAdd(bits, bias), 16);
+      return builder_.CreateBitCast(builder_.CreateTrunc(bits, i16Ty), ty);
+    }
+
+    if (val->getType() == ty)
+      return val;
+    auto op = llvm::CastInst::getCastOpcode(val, true, ty, true);
+    return builder_.CreateCast(op, val, ty);
+  }
+
   void emit(StoreLocalStmt *SL) {
     auto varAlloca = namedValues_[SL->getDest()->getName()];
-    llvm::Value *storedVal = generate(SL->getValue());
     if (SL->isAccumulate()) {
       auto *prev = builder_.CreateLoad(varAlloca.second, varAlloca.first);
-      storedVal = builder_.CreateFAdd(prev, storedVal);
+      auto *sum = emitAccumulate(SL->getValue().get(), prev);
+      builder_.CreateStore(sum, varAlloca.first);
+      return;
     }
+    llvm::Value *storedVal = generate(SL->getValue());
     builder_.CreateStore(storedVal, varAlloca.first);
   }
 
   void emit(StoreStmt *SS) {
     auto *ptr = generate(SS->getGep());
-    auto *storedVal = generate(SS->getValue());
-    auto *ptelem = llvm::PointerType::get(storedVal->getType(), 0);
+    auto align = getAlignment(SS->getGep());
+    auto *valTy = getLLVMTypeForType(SS->getValue()->getType());
+    auto *ptelem = llvm::PointerType::get(valTy, 0);
     auto *vt = builder_.CreateBitCast(ptr, ptelem, "store_cast");
 
+    // Vector stores in range checks only write the active lanes.
+    if (mask_ && valTy->isVectorTy()) {
+      auto *mask = getMask(SS->getValue()->getType().getWidth());
+      llvm::Value *storedVal;
+      if (SS->isAccumulate()) {
+        auto *ld = builder_.CreateMaskedLoad(
+            valTy, vt, align, mask, llvm::Constant::getNullValue(valTy));
+        storedVal = emitAccumulate(SS->getValue().get(), ld);
+      } else {
+        storedVal = generate(SS->getValue());
+      }
+      builder_.CreateMaskedStore(storedVal, vt, align, mask);
+      return;
+    }
+
+    llvm::Value *storedVal;
     if (SS->isAccumulate()) {
-      auto *ld = builder_.CreateLoad(storedVal->getType(), vt);
-      ld->setAlignment(llvm::Align(1));
-      storedVal = builder_.CreateFAdd(ld, storedVal);
+      auto *ld = builder_.CreateLoad(valTy, vt);
+      ld->setAlignment(align);
+      storedVal = emitAccumulate(SS->getValue().get(), ld);
+    } else {
+      storedVal = generate(SS->getValue());
     }
 
     auto *st = builder_.CreateStore(storedVal, vt);
-    st->setAlignment(llvm::Align(1));
+    st->setAlignment(align);
+    // Streaming stores don't read the cache line of the destination.
+    if (SS->isNonTemporal()) {
+      auto *one = llvm::ConstantInt::get(int32Ty_, 1);
+      auto *node = llvm::MDNode::get(*ctx_, llvm::ConstantAsMetadata::get(one));
+      st->setMetadata(llvm::LLVMContext::MD_nontemporal, node);
+    }
+  }
+
+  /// Non-temporal stores are weakly ordered on some targets. Emit a fence
+  /// after the stores in \p s, if any of them is non-temporal, to make the
+  /// written data visible to the caller and to the other threads.
+  void emitStreamingFence(Stmt *s) {
+    for (auto *st : collectStmts(s)) {
+      auto *SS = dynamic_cast<StoreStmt *>(st);
+      if (SS && SS->isNonTemporal()) {
+        builder_.CreateFence(llvm::AtomicOrdering::SequentiallyConsistent);
+        return;
+      }
+    }
+  }
+
+  void emit(PrefetchStmt *PS) {
+    auto *ptr = generate(PS->getGep());
+    // Prefetch for reading, into all levels of the data cache.
+    auto *read = llvm::ConstantInt::get(int32Ty_, 0);
+    auto *locality = llvm::ConstantInt::get(int32Ty_, 3);
+    auto *dataCache = llvm::ConstantInt::get(int32Ty_, 1);
+    builder_.CreateIntrinsic(llvm::Intrinsic::prefetch, {ptr->getType()},
+                             {ptr, read, locality, dataCache});
   }
 
   void emit(CallStmt *SS) {
@@ -275,8 +478,11 @@ public:
       // Promote floats to doubles before calling some function.
       // See section 6.5.2.2 in the C99 standard and section 5.2.2 in the C++
       // standard.
-      if (val->getType()->isFloatTy()) {
+      if (val->getType()->isFloatingPointTy()) {
         val = builder_.CreateFPCast(val, llvm::Type::getDoubleTy(*ctx_));
+      } else if (val->getType()->isIntegerTy() &&
+                 val->getType()->getIntegerBitWidth() < 32) {
+        val = builder_.CreateSExt(val, int32Ty_);
       }
       params.push_back(val);
       argListType.push_back(params.back()->getType());
@@ -290,7 +496,54 @@ public:
     return;
   }
 
+  /// \returns the mask of the active lanes, for accesses of \p width lanes.
+  llvm::Value *getMask(unsigned width) {
+    assert(mask_ && "No active mask");
+    assert(llvm::cast<llvm::FixedVectorType>(mask_->getType())
+                   ->getNumElements() == width &&
+           "The access and the mask have different widths");
+    return mask_;
+  }
+
+  /// Emit the vectorized range check \p IR, which masks the lanes of the
+  /// vector loads and stores in its body.
+  void emitMasked(IfRange *IR) {
+    unsigned width = IR->getWidth();
+    llvm::Value *indexVal = generate(IR->getIndex());
+    auto range = IR->getRange();
+
+    // Compute the indices of the lanes: index + <0, 1, 2, ...>.
+    std::vector<llvm::Constant *> lanes;
+    for (unsigned i = 0; i < width; i++) {
+      lanes.push_back(llvm::ConstantInt::get(int64Ty_, i));
+    }
+    auto *lanesVal = builder_.CreateAdd(
+        builder_.CreateVectorSplat(width, indexVal),
+        llvm::ConstantVector::get(lanes));
+
+    auto *startVal = builder_.CreateVectorSplat(
+        width, llvm::ConstantInt::get(int64Ty_, range.first));
+    auto *endVal = builder_.CreateVectorSplat(
+        width, llvm::ConstantInt::get(int64Ty_, range.second));
+    auto *a = builder_.CreateICmp(llvm::CmpInst::Predicate::ICMP_SGE,
+                                  lanesVal, startVal);
+    auto *b = builder_.CreateICmp(llvm::CmpInst::Predicate::ICMP_SLT,
+                                  lanesVal, endVal);
+    auto *savedMask = mask_;
+    mask_ = builder_.CreateAnd(a, b);
+    if (savedMask)
+      mask_ = builder_.CreateAnd(getMask(width), savedMask);
+
+    for (auto &s : IR->getBody()) {
+      emit(s);
+    }
+    mask_ = savedMask;
+  }
+
   void emit(IfRange *IR) {
+    if (IR->getWidth() > 1)
+      return emitMasked(IR);
+
     llvm::Value *indexVal = generate(IR->getIndex());
     auto range = IR->getRange();
 
@@ -304,9 +557,9 @@ public:
         builder_.CreateICmp(llvm::CmpInst::Predicate::ICMP_SLT, indexVal,
                             llvm::ConstantInt::get(int64Ty_, range.second));
 
-    auto *orr = builder_.CreateOr(a, b);
+    auto *cond = builder_.CreateAnd(a, b);
 
-    builder_.CreateCondBr(orr, inrng, cont);
+    builder_.CreateCondBr(cond, inrng, cont);
 
     builder_.SetInsertPoint(inrng);
     for (auto &s : IR->getBody()) {
@@ -316,9 +569,98 @@ public:
     builder_.SetInsertPoint(cont);
   }
 
-  void emit(Loop *L) {
-    auto *index = builder_.CreateAlloca(int64Ty_, 0, L->getName());
-    builder_.CreateStore(int64Zero_, index);
+  /// \returns a new stack slot of type \p ty in the entry block of the
+  /// current function. Allocas in the entry block are not executed in loops
+  /// and are promoted to registers.
+  llvm::AllocaInst *createEntryAlloca(llvm::Type *ty, const std::string &name) {
+    auto &entry = func_->getEntryBlock();
+    llvm::IRBuilder<> B(&entry, entry.begin());
+    return B.CreateAlloca(ty, 0, name);
+  }
+
+  /// Allocate the local tensors of the program in the current function.
+  /// Small tensors are allocated on the stack, and large tensors share a
+  /// scratch buffer that is allocated on the heap when the function is
+  /// entered and is released by releaseTensors. The function aborts if the
+  /// scratch buffer can't be allocated. Parallel tasks allocate their own copy
+  /// of the tensors.
+  void allocateTensors() {
+    scratch_ = nullptr;
+    uint64_t scratchSize = 0;
+    uint64_t scratchAlign = 1;
+    std::vector<std::pair<Argument *, uint64_t>> large;
+    for (auto *tensor : prog_->getTensors()) {
+      auto *elemTy = getElementType(tensor);
+      uint64_t size = tensor->getType()->getSizeInBytes();
+      uint64_t align = tensor->getAlignment();
+      if (size > kMaxStackTensorSize) {
+        uint64_t offset = llvm::alignTo(scratchSize, align);
+        large.push_back({tensor, offset});
+        scratchSize = offset + size;
+        scratchAlign = std::max(scratchAlign, align);
+        continue;
+      }
+      auto *ty = llvm::ArrayType::get(elemTy, tensor->getType()->size());
+      auto *alloca = createEntryAlloca(ty, tensor->getName());
+      alloca->setAlignment(llvm::Align(align));
+      namedValues_[tensor->getName()] = std::make_pair(alloca, elemTy);
+    }
+
+    if (large.empty())
+      return;
+
+    // void *aligned_alloc(size_t alignment, size_t size), where the size is a
+    // multiple of the alignment.
+    auto *ptrTy = llvm::PointerType::get(*ctx_, 0);
+    auto *allocTy = llvm::FunctionType::get(ptrTy, {int64Ty_, int64Ty_}, false);
+    auto allocFn = M_->getOrInsertFunction("aligned_alloc", allocTy);
+    scratchSize = llvm::alignTo(scratchSize, scratchAlign);
+    scratch_ = builder_.CreateCall(
+        allocFn,
+        {llvm::ConstantInt::get(int64Ty_, scratchAlign),
+         llvm::ConstantInt::get(int64Ty_, scratchSize)},
+        "scratch");
+
+    // Abort if the buffer could not be allocated, instead of writing the
+    // tensors through a null pointer: void abort().
+    auto *voidTy = llvm::Type::getVoidTy(*ctx_);
+    auto *abortTy = llvm::FunctionType::get(voidTy, false);
+    auto abortFn = M_->getOrInsertFunction("abort", abortTy);
+    if (auto *F = llvm::dyn_cast<llvm::Function>(abortFn.getCallee()))
+      F->setDoesNotReturn();
+    auto *failed = llvm::BasicBlock::Create(*ctx_, "alloc_failed", func_);
+    auto *allocated = llvm::BasicBlock::Create(*ctx_, "allocated", func_);
+    builder_.CreateCondBr(builder_.CreateIsNull(scratch_), failed, allocated);
+    builder_.SetInsertPoint(failed);
+    builder_.CreateCall(abortFn);
+    builder_.CreateUnreachable();
+    builder_.SetInsertPoint(allocated);
+
+    auto *int8Ty = llvm::Type::getInt8Ty(*ctx_);
+    for (auto &entry : large) {
+      auto *tensor = entry.first;
+      auto *ptr = builder_.CreateConstGEP1_64(int8Ty, scratch_, entry.second,
+                                              tensor->getName());
+      namedValues_[tensor->getName()] =
+          std::make_pair(ptr, getElementType(tensor));
+    }
+  }
+
+  /// Release the scratch buffer of the current function, if it has one.
+  void releaseTensors() {
+    if (!scratch_)
+      return;
+    auto *ptrTy = llvm::PointerType::get(*ctx_, 0);
+    auto *voidTy = llvm::Type::getVoidTy(*ctx_);
+    auto *freeTy = llvm::FunctionType::get(voidTy, {ptrTy}, false);
+    auto freeFn = M_->getOrInsertFunction("free", freeTy);
+    builder_.CreateCall(freeFn, {scratch_});
+  }
+
+  /// Emit the loop \p L that iterates in the range [start .. end).
+  void emitLoop(Loop *L, llvm::Value *start, llvm::Value *end) {
+    auto *index = createEntryAlloca(int64Ty_, L->getName());
+    builder_.CreateStore(start, index);
 
     // Record the loop index for expressions that need to reference it.
     loopIndices_[L] = index;
@@ -332,9 +674,7 @@ public:
     builder_.SetInsertPoint(header);
     auto *idxVal = builder_.CreateLoad(int64Ty_, index, L->getName());
 
-    auto upperBoundAP = llvm::APInt(64, L->getEnd());
-    auto upperBound = llvm::Constant::getIntegerValue(int64Ty_, upperBoundAP);
-    auto *cmp = builder_.CreateICmpSLT(idxVal, upperBound);
+    auto *cmp = builder_.CreateICmpSLT(idxVal, end);
     builder_.CreateCondBr(cmp, body, exit);
 
     builder_.SetInsertPoint(nextIter);
@@ -353,6 +693,117 @@ public:
     builder_.SetInsertPoint(exit);
   }
 
+  /// Outline the parallel loop \p L into a task that the runtime library
+  /// executes on chunks of the iteration space. The task has the signature:
+  ///   void task(void **args, int64 begin, int64 end).
+  /// The task unpacks the arguments and calls the body of the loop, which has
+  /// a private copy of all of the locals.
+  llvm::Function *emitParallelTask(Loop *L) {
+    auto *ptrTy = llvm::PointerType::get(*ctx_, 0);
+    auto *voidTy = llvm::Type::getVoidTy(*ctx_);
+    auto name = func_->getName().str() + "_" + L->getName();
+
+    // Save the state of the enclosing function.
+    auto *parentFunc = func_;
+    auto savedIP = builder_.saveIP();
+    auto savedValues = namedValues_;
+    auto *savedScratch = scratch_;
+
+    // Create the body function: void body(float *A, ..., int64 b, int64 e).
+    std::vector<llvm::Type *> bodyArgs;
+    for (unsigned i = 0; i < prog_->getArgs().size(); i++) {
+      bodyArgs.push_back(ptrTy);
+    }
+    bodyArgs.push_back(int64Ty_);
+    bodyArgs.push_back(int64Ty_);
+    auto *bodyTy = llvm::FunctionType::get(voidTy, bodyArgs, false);
+    func_ = llvm::Function::Create(bodyTy, llvm::Function::InternalLinkage,
+                                   name + "_body", M_.get());
+    setVectorWidth(func_);
+    builder_.SetInsertPoint(llvm::BasicBlock::Create(*ctx_, "entry", func_));
+
+    unsigned idx = 0;
+    for (auto *arg : prog_->getArgs()) {
+      auto *param = func_->getArg(idx++);
+      setParamAttrs(param, arg);
+      namedValues_[arg->getName()] = std::make_pair(param, getElementType(arg));
+    }
+    for (auto *var : prog_->getVars()) {
+      auto *ty = getLLVMTypeForType(var->getType());
+      auto *alloca = builder_.CreateAlloca(ty, 0, var->getName());
+      namedValues_[var->getName()] = std::make_pair(alloca, ty);
+    }
+    allocateTensors();
+
+    emitLoop(L, func_->getArg(idx), func_->getArg(idx + 1));
+    emitStreamingFence(L);
+    releaseTensors();
+    builder_.CreateRetVoid();
+    enableFastMath(func_);
+    auto *body = func_;
+
+    // Create the task function that unpacks the arguments.
+    auto *taskTy =
+        llvm::FunctionType::get(voidTy, {ptrTy, int64Ty_, int64Ty_}, false);
+    func_ = llvm::Function::Create(taskTy, llvm::Function::InternalLinkage,
+                                   name + "_task", M_.get());
+    builder_.SetInsertPoint(llvm::BasicBlock::Create(*ctx_, "entry", func_));
+    std::vector<llvm::Value *> params;
+    for (unsigned i = 0; i < prog_->getArgs().size(); i++) {
+      auto *gep = builder_.CreateConstGEP1_64(ptrTy, func_->getArg(0), i);
+      params.push_back(builder_.CreateLoad(ptrTy, gep));
+    }
+    params.push_back(func_->getArg(1));
+    params.push_back(func_->getArg(2));
+    builder_.CreateCall(body, params);
+    builder_.CreateRetVoid();
+    auto *task = func_;
+
+    // Restore the state of the enclosing function.
+    func_ = parentFunc;
+    builder_.restoreIP(savedIP);
+    namedValues_ = savedValues;
+    scratch_ = savedScratch;
+    return task;
+  }
+
+  /// Emit a call to the runtime library that executes the loop \p L in
+  /// parallel.
+  void emitParallelLoop(Loop *L) {
+    auto *ptrTy = llvm::PointerType::get(*ctx_, 0);
+    auto *task = emitParallelTask(L);
+
+    // Pack the arguments of the program into an array.
+    auto *argsTy = llvm::ArrayType::get(ptrTy, prog_->getArgs().size());
+    auto *args = createEntryAlloca(argsTy, "parallel_args");
+    unsigned idx = 0;
+    for (auto *arg : prog_->getArgs()) {
+      auto *gep = builder_.CreateConstGEP2_64(argsTy, args, 0, idx++);
+      builder_.CreateStore(namedValues_[arg->getName()].first, gep);
+    }
+
+    // void bistra_parallel_for(task, void *ctx, int64 end, int64 stride).
+    auto *parallelForTy = llvm::FunctionType::get(
+        llvm::Type::getVoidTy(*ctx_), {ptrTy, ptrTy, int64Ty_, int64Ty_},
+        false);
+    auto parallelFor =
+        M_->getOrInsertFunction("bistra_parallel_for", parallelForTy);
+    auto *end = llvm::ConstantInt::get(int64Ty_, L->getEnd());
+    auto *stride = llvm::ConstantInt::get(int64Ty_, L->getStride());
+    builder_.CreateCall(parallelFor, {task, args, end, stride});
+  }
+
+  void emit(Loop *L) {
+    // Parallel loops that are nested in other loops are emitted serially,
+    // because the task can't access the indices of the enclosing loops.
+    if (L->isParallel() && dynamic_cast<Program *>(L->getParent())) {
+      return emitParallelLoop(L);
+    }
+
+    auto *end = llvm::ConstantInt::get(int64Ty_, L->getEnd());
+    emitLoop(L, int64Zero_, end);
+  }
+
   void emit(Stmt *S) {
     if (auto *L = dynamic_cast<Loop *>(S)) {
       return emit(L);
@@ -369,6 +820,9 @@ public:
     if (auto *ST = dynamic_cast<CallStmt *>(S)) {
       return emit(ST);
     }
+    if (auto *PS = dynamic_cast<PrefetchStmt *>(S)) {
+      return emit(PS);
+    }
     assert(false);
   }
 
@@ -379,6 +833,18 @@ public:
     case ElemKind::Float32Ty:
       res = llvm::Type::getFloatTy(*ctx_);
       break;
+    case ElemKind::Float16Ty:
+      res = llvm::Type::getHalfTy(*ctx_);
+      break;
+    case ElemKind::BFloat16Ty:
+      res = llvm::Type::getBFloatTy(*ctx_);
+      break;
+    case ElemKind::Int8Ty:
+      res = llvm::Type::getInt8Ty(*ctx_);
+      break;
+    case ElemKind::Int32Ty:
+      res = int32Ty_;
+      break;
     case ElemKind::IndexTy:
       res = int64Ty_;
       break;
@@ -398,9 +864,12 @@ public:
   }
 
   /// Generate a simple for loop that calls into the tested program.
-  /// Take the one buffer and split it into pointers that reference the one
-  /// chunks.
-  llvm::Function *emitBenchmark(Program *p, int iter) {
+  /// Take the one buffer and split it into pointers that reference the
+  /// tensors at the offsets \p layout. If \p dynamicSize is set then it is
+  /// passed to the program after the tensors.
+  llvm::Function *emitBenchmark(Program *p, int iter,
+                                const std::vector<uint64_t> &layout,
+                                uint64_t dynamicSize = 0) {
     std::vector<llvm::Type *> argListType;
     argListType.push_back(llvm::PointerType::get(*ctx_, 0));
 
@@ -418,23 +887,14 @@ public:
     auto *memBuffer = F->args().begin();
     std::vector<llvm::Value *> params;
 
-    // Construct the offsets into the memory buffer (in bytes).
-    uint64_t offset = 0;
-    for (auto *arg : p->getArgs()) {
-      switch (arg->getType()->getElementType()) {
-      case ElemKind::Float32Ty: {
-        llvm::Value *offsetV = llvm::ConstantInt::get(int64Ty_, offset);
-        auto *i8Ty = llvm::Type::getInt8Ty(*ctx_);
-        auto *gep = builder_.CreateGEP(i8Ty, memBuffer, offsetV);
-        params.push_back(gep);
-        // Adjust the pointer for the next buffer.
-        offset += arg->getType()->size() *
-                  Type::getElementSizeInBytes(arg->getType()->getElementType());
-        break;
-      }
-      default:
-        assert(false && "Invalid parameter");
-      }
+    // Construct the pointers into the memory buffer.
+    for (unsigned i = 0; i < p->getArgs().size(); i++) {
+      llvm::Value *offsetV = llvm::ConstantInt::get(int64Ty_, layout[i]);
+      auto *i8Ty = llvm::Type::getInt8Ty(*ctx_);
+      params.push_back(builder_.CreateGEP(i8Ty, memBuffer, offsetV));
+    }
+    if (dynamicSize) {
+      params.push_back(llvm::ConstantInt::get(int64Ty_, dynamicSize));
     }
 
     // Generate the loop that calls the program \p iter times.
@@ -470,6 +930,175 @@ public:
     return F;
   }
 
+  /// Emit the function that executes the dynamic kernel \p K, whose variants
+  /// were emitted into \p variants. The function has the arguments of the
+  /// kernel, followed by the size of the dynamic dimension. Sizes that have a
+  /// specialized variant call the variant. Other sizes are split into chunks,
+  /// from the largest variant to the smallest, and the dynamic arguments are
+  /// advanced past the processed chunks.
+  llvm::Function *emitDispatcher(DynamicKernel &K,
+                                 const std::vector<llvm::Function *> &variants) {
+    auto *generic = K.getVariants()[0].second.get();
+    unsigned numArgs = generic->getArgs().size();
+
+    // Make the function type: void kernel(float *A, ..., int64 size).
+    std::vector<llvm::Type *> argListType(numArgs,
+                                          llvm::PointerType::get(*ctx_, 0));
+    argListType.push_back(int64Ty_);
+    llvm::FunctionType *FT = llvm::FunctionType::get(
+        llvm::Type::getVoidTy(*ctx_), argListType, false);
+    func_ = llvm::Function::Create(FT, llvm::Function::ExternalLinkage,
+                                   K.getName(), M_.get());
+    for (unsigned i = 0; i < numArgs; i++) {
+      setParamAttrs(func_->getArg(i), generic->getArg(i));
+    }
+    auto *size = func_->getArg(numArgs);
+    size->setName(K.getDimName());
+
+    auto *entry = llvm::BasicBlock::Create(*ctx_, "entry", func_);
+    auto *split = llvm::BasicBlock::Create(*ctx_, "split", func_);
+    builder_.SetInsertPoint(entry);
+    auto *done = builder_.CreateAlloca(int64Ty_, 0, "done");
+    builder_.CreateStore(int64Zero_, done);
+
+    // Call the specialized variant if there is one.
+    auto *sw = builder_.CreateSwitch(size, split, variants.size());
+    for (unsigned i = 0; i < variants.size(); i++) {
+      auto *BB = llvm::BasicBlock::Create(*ctx_, "exact", func_);
+      builder_.SetInsertPoint(BB);
+      std::vector<llvm::Value *> params;
+      for (unsigned j = 0; j < numArgs; j++) {
+        params.push_back(func_->getArg(j));
+      }
+      builder_.CreateCall(variants[i], params);
+      builder_.CreateRetVoid();
+      auto *caseSize = llvm::ConstantInt::get(
+          llvm::cast<llvm::IntegerType>(int64Ty_), K.getVariants()[i].first);
+      sw->addCase(caseSize, BB);
+    }
+
+    // Process the chunks with the largest variants that fit.
+    builder_.SetInsertPoint(split);
+    for (int i = variants.size() - 1; i >= 0; i--) {
+      auto *chunk = llvm::ConstantInt::get(int64Ty_, K.getVariants()[i].first);
+      auto *header = llvm::BasicBlock::Create(*ctx_, "header", func_);
+      auto *body = llvm::BasicBlock::Create(*ctx_, "chunk", func_);
+      auto *next = llvm::BasicBlock::Create(*ctx_, "next", func_);
+      builder_.CreateBr(header);
+
+      builder_.SetInsertPoint(header);
+      auto *offset = builder_.CreateLoad(int64Ty_, done);
+      auto *remaining = builder_.CreateSub(size, offset);
+      builder_.CreateCondBr(builder_.CreateICmpSGE(remaining, chunk), body,
+                            next);
+
+      builder_.SetInsertPoint(body);
+      std::vector<llvm::Value *> params;
+      auto *i8Ty = llvm::Type::getInt8Ty(*ctx_);
+      for (unsigned j = 0; j < numArgs; j++) {
+        llvm::Value *ptr = func_->getArg(j);
+        if (K.isDynamicArg(j)) {
+          auto *row = llvm::ConstantInt::get(int64Ty_, K.getArgRowSize(j));
+          ptr = builder_.CreateGEP(i8Ty, ptr, builder_.CreateMul(offset, row));
+        }
+        params.push_back(ptr);
+      }
+      builder_.CreateCall(variants[i], params);
+      builder_.CreateStore(builder_.CreateAdd(offset, chunk), done);
+      builder_.CreateBr(header);
+
+      builder_.SetInsertPoint(next);
+    }
+    builder_.CreateRetVoid();
+
+    if (llvm::verifyFunction(*func_, &llvm::outs()))
+      return nullptr;
+
+    return func_;
+  }
+
+  /// Emit the variants of the dynamic kernel \p K and the dispatcher that
+  /// selects between them.
+  llvm::Function *emit(DynamicKernel &K) {
+    std::vector<llvm::Function *> variants;
+    for (auto &v : K.getVariants()) {
+      auto *F = emit(v.second.get());
+      if (!F)
+        return nullptr;
+      variants.push_back(F);
+    }
+    return emitDispatcher(K, variants);
+  }
+
+  /// \returns a private global constant that holds the null-terminated
+  /// string \p str.
+  llvm::Constant *emitStringConstant(const std::string &str) {
+    auto *init = llvm::ConstantDataArray::getString(*ctx_, str);
+    auto *GV = new llvm::GlobalVariable(*M_, init->getType(), true,
+                                        llvm::GlobalValue::PrivateLinkage,
+                                        init, ".str");
+    GV->setUnnamedAddr(llvm::GlobalValue::UnnamedAddr::Global);
+    return GV;
+  }
+
+  /// \returns a private global constant that holds the array \p init.
+  llvm::Constant *emitArrayConstant(llvm::Constant *init,
+                                    const std::string &name) {
+    return new llvm::GlobalVariable(*M_, init->getType(), true,
+                                    llvm::GlobalValue::PrivateLinkage, init,
+                                    name);
+  }
+
+  /// Emit the registry of the library \p L, whose kernels were emitted into
+  /// \p funcs. The registry is a table with an entry for each kernel, and the
+  /// number of entries. The layout of the entries matches the structs that
+  /// are declared in the header of the library.
+  void emitRegistry(KernelLibrary &L,
+                    const std::vector<llvm::Function *> &funcs) {
+    auto *ptrTy = llvm::PointerType::get(*ctx_, 0);
+    auto *tensorTy = llvm::StructType::create(
+        *ctx_, {ptrTy, ptrTy, int32Ty_, int32Ty_, int32Ty_, int32Ty_},
+        "bistra_tensor_info");
+    auto *kernelTy = llvm::StructType::create(
+        *ctx_, {ptrTy, ptrTy, ptrTy, int32Ty_}, "bistra_kernel_info");
+    auto getI32 = [&](uint64_t val) {
+      return llvm::ConstantInt::get(int32Ty_, val);
+    };
+
+    std::vector<llvm::Constant *> kernels;
+    for (unsigned i = 0; i < funcs.size(); i++) {
+      auto &kernel = L.getKernels()[i];
+      std::vector<llvm::Constant *> args;
+      for (auto *arg : kernel.second->getArgs()) {
+        auto *ty = arg->getType();
+        auto elemTy = ty->getElementType();
+        std::vector<uint64_t> dims(ty->getDims().begin(), ty->getDims().end());
+        auto *dimsGV = emitArrayConstant(
+            llvm::ConstantDataArray::get(*ctx_, dims), ".dims");
+        args.push_back(llvm::ConstantStruct::get(
+            tensorTy, {emitStringConstant(arg->getName()), dimsGV,
+                       getI32(dims.size()), getI32((unsigned)elemTy),
+                       getI32(Type::getElementSizeInBytes(elemTy)),
+                       getI32(arg->getAlignment())}));
+      }
+      auto *argsTy = llvm::ArrayType::get(tensorTy, args.size());
+      auto *argsGV =
+          emitArrayConstant(llvm::ConstantArray::get(argsTy, args), ".args");
+      kernels.push_back(llvm::ConstantStruct::get(
+          kernelTy, {emitStringConstant(kernel.first), funcs[i], argsGV,
+                     getI32(args.size())}));
+    }
+
+    auto *tableTy = llvm::ArrayType::get(kernelTy, kernels.size());
+    new llvm::GlobalVariable(*M_, tableTy, true,
+                             llvm::GlobalValue::ExternalLinkage,
+                             llvm::ConstantArray::get(tableTy, kernels),
+                             L.getRegistryName());
+    new llvm::GlobalVariable(*M_, int32Ty_, true,
+                             llvm::GlobalValue::ExternalLinkage,
+                             getI32(kernels.size()), L.getNumKernelsName());
+  }
+
   // Enable fast-math for all instructions:
   void enableFastMath(llvm::Function *F) {
     llvm::FastMathFlags FMF;
@@ -484,6 +1113,7 @@ public:
   }
 
   llvm::Function *emit(Program *p) {
+    prog_ = p;
     func_ = emitPrototype(p);
 
     if (!func_)
@@ -495,9 +1125,9 @@ public:
 
     // Record the function arguments in the NamedValues map.
     namedValues_.clear();
-    for (auto &arg : func_->args()) {
-      auto *ty = llvm::Type::getFloatTy(*ctx_);
-      namedValues_[arg.getName().str()] = std::make_pair(&arg, ty);
+    for (auto *arg : p->getArgs()) {
+      auto *param = func_->getArg(p->getArgIndex(arg));
+      namedValues_[arg->getName()] = std::make_pair(param, getElementType(arg));
     }
 
     for (auto *var : p->getVars()) {
@@ -505,12 +1135,15 @@ public:
       auto *alloca = builder_.CreateAlloca(ty, 0, var->getName());
       namedValues_[var->getName()] = std::make_pair(alloca, ty);
     }
+    allocateTensors();
 
     // Emit the code for the function body.
     for (auto &stmt : p->getBody()) {
       emit(stmt);
     }
 
+    emitStreamingFence(p);
+    releaseTensors();
     builder_.CreateRetVoid();
 
     enableFastMath(func_);
@@ -522,13 +1155,75 @@ public:
   }
 };
 
+/// The alignment of the tensors in the memory buffer of the benchmark.
+static constexpr uint64_t kTensorAlignment = 64;
+
+/// The size of a page. Accesses to addresses with the same offset in the page
+/// may falsely depend on one another (4K aliasing).
+static constexpr uint64_t kPageSize = 4096;
+
+/// \returns the offsets of the tensors of \p p in the memory buffer of the
+/// benchmark, followed by the size of the buffer. If \p packed is set then the
+/// tensors are stored consecutively. Otherwise, each tensor is aligned, is
+/// followed by its padding, and starts at a different offset in the page.
+static std::vector<uint64_t> getBufferLayout(Program *p, bool packed) {
+  std::vector<uint64_t> layout;
+  uint64_t offset = 0;
+  for (unsigned i = 0; i < p->getArgs().size(); i++) {
+    auto *arg = p->getArg(i);
+    if (!packed) {
+      uint64_t align =
+          std::max<uint64_t>(arg->getAlignment(), kTensorAlignment);
+      uint64_t stagger = (i * 2 * align) % kPageSize;
+      offset = llvm::alignTo(offset, std::max(align, kPageSize)) + stagger;
+    }
+    layout.push_back(offset);
+    offset += arg->getType()->getSizeInBytes();
+    if (!packed)
+      offset += arg->getPadding();
+  }
+  layout.push_back(offset);
+  return layout;
+}
+
 void LLVMBackend::emitProgramCode(Program *p, const std::string &path,
                                   bool isSrc, int iter) {
-  LLVMEmitter EE;
+  LLVMEmitter EE(getRegisterWidth() * 32);
   EE.emit(p);
   if (iter) {
-    EE.emitBenchmark(p, iter);
+    EE.emitBenchmark(p, iter, getBufferLayout(p, false));
+  }
+  optimize(getTargetMachine(), EE.getModule().get());
+
+  if (isSrc) {
+    std::string out;
+    llvm::raw_string_ostream rss(out);
+    EE.getModule()->print(rss, nullptr);
+    writeFile(path, rss.str());
+  } else {
+    emitObject(EE.getModule().get(), path);
+  }
+}
+
+/// \returns the offsets of the tensors of the kernel \p K in the memory
+/// buffer of the benchmark, when the dynamic dimension has the size \p size,
+/// followed by the size of the buffer. The tensors are stored consecutively.
+static std::vector<uint64_t> getBufferLayout(DynamicKernel &K, unsigned size) {
+  std::vector<uint64_t> layout;
+  uint64_t offset = 0;
+  unsigned numArgs = K.getVariants()[0].second->getArgs().size();
+  for (unsigned i = 0; i < numArgs; i++) {
+    layout.push_back(offset);
+    offset += K.getArgRowSize(i) * (K.isDynamicArg(i) ? size : 1);
   }
+  layout.push_back(offset);
+  return layout;
+}
+
+void LLVMBackend::emitDynamicCode(DynamicKernel &K, const std::string &path,
+                                  bool isSrc) {
+  LLVMEmitter EE(getRegisterWidth() * 32);
+  EE.emit(K);
   optimize(getTargetMachine(), EE.getModule().get());
 
   if (isSrc) {
@@ -541,6 +1236,65 @@ void LLVMBackend::emitProgramCode(Program *p, const std::string &path,
   }
 }
 
+bool LLVMBackend::emitLibraryCode(KernelLibrary &L, const std::string &path,
+                                  bool isSrc) {
+  // Compile and optimize the kernels in parallel. LLVM contexts are not
+  // thread safe, so each kernel is emitted into a module in its own context,
+  // and the optimized module is handed over as bitcode. The bitcode of kernels
+  // that could not be emitted is left empty.
+  auto &kernels = L.getKernels();
+  std::vector<std::string> bitcode(kernels.size());
+  parallelFor(kernels.size(), std::thread::hardware_concurrency(),
+              [&](unsigned i) {
+                LLVMEmitter KE(getRegisterWidth() * 32);
+                if (!KE.emit(kernels[i].second.get()))
+                  return;
+                optimize(getTargetMachine(), KE.getModule().get());
+                llvm::raw_string_ostream os(bitcode[i]);
+                llvm::WriteBitcodeToFile(*KE.getModule(), os);
+                os.flush();
+              });
+
+  // Link the kernels into one module, which shares the declarations of the
+  // runtime functions, and add the registry.
+  LLVMEmitter EE(getRegisterWidth() * 32);
+  auto *M = EE.getModule().get();
+  M->setDataLayout(getTargetMachine().createDataLayout());
+  M->setTargetTriple(getTargetMachine().getTargetTriple().normalize());
+  llvm::Linker linker(*M);
+  std::vector<llvm::Function *> funcs;
+  for (unsigned i = 0; i < kernels.size(); i++) {
+    auto name = kernels[i].second->getName();
+    if (bitcode[i].empty()) {
+      llvm::errs() << "Unable to emit the kernel " << name << "\n";
+      return false;
+    }
+    llvm::MemoryBufferRef buffer(bitcode[i], name);
+    auto KM = llvm::cantFail(llvm::parseBitcodeFile(buffer, *EE.getContext()));
+    if (linker.linkInModule(std::move(KM))) {
+      llvm::errs() << "Unable to link the kernel " << name << "\n";
+      return false;
+    }
+    auto *F = M->getFunction(name);
+    if (!F) {
+      llvm::errs() << "The kernel " << name << " is missing after linking\n";
+      return false;
+    }
+    funcs.push_back(F);
+  }
+  EE.emitRegistry(L, funcs);
+
+  if (isSrc) {
+    std::string out;
+    llvm::raw_string_ostream rss(out);
+    EE.getModule()->print(rss, nullptr);
+    writeFile(path, rss.str());
+  } else {
+    emitObject(EE.getModule().get(), path);
+  }
+  return true;
+}
+
 /// Init the buffer with some non-zero and all non-nan values.
 static void initBuffer(float *A, int len) {
   for (int i = 0; i < len; i++) {
@@ -548,32 +1302,57 @@ static void initBuffer(float *A, int len) {
   }
 }
 
-double LLVMBackend::evaluateCode(Program *p, unsigned iter) {
-  LLVMEmitter EE;
+std::string LLVMBackend::compile(Program *p, unsigned iter, bool packed) {
+  LLVMEmitter EE(getRegisterWidth() * 32);
   EE.emit(p);
-  EE.emitBenchmark(p, iter);
+  EE.emitBenchmark(p, iter, getBufferLayout(p, packed));
   optimize(getTargetMachine(), EE.getModule().get());
+  return emitObjectBuffer(EE.getModule().get());
+}
 
+std::string LLVMBackend::compileBenchmark(Program *p, unsigned iter) {
+  return compile(p, iter, false);
+}
+
+Measurement LLVMBackend::evaluateBinary(Program *p, const std::string &binary,
+                                        unsigned iter,
+                                        const MeasureOptions &opts) {
   // Calculate how much scratch pad memory do we need to evaluate the code.
-  size_t memSz = 0;
-  for (auto arg : p->getArgs()) {
-    memSz += arg->getType()->getSizeInBytes();
-  }
+  size_t memSz = llvm::alignTo(getBufferLayout(p, false).back(), kPageSize);
 
-  auto *scratchPad = (float *)malloc(memSz);
+  auto *scratchPad = (float *)aligned_alloc(kPageSize, memSz);
   initBuffer(scratchPad, memSz / sizeof(float));
 
-  auto res = run(std::move(EE.getModule()), std::move(EE.getContext()),
-                 scratchPad, iter);
+  auto res = runBinary(binary, scratchPad, iter, opts);
 
   free(scratchPad);
   return res;
 }
 
-void LLVMBackend::runOnce(Program *p, void *mem) {
-  LLVMEmitter EE;
-  EE.emit(p);
-  EE.emitBenchmark(p, 1);
+double LLVMBackend::evaluateCode(Program *p, unsigned iter) {
+  auto binary = compileBenchmark(p, iter);
+  return evaluateBinary(p, binary, iter, MeasureOptions()).median;
+}
+
+void LLVMBackend::runOnce(DynamicKernel &K, unsigned size, void *mem) {
+  LLVMEmitter EE(getRegisterWidth() * 32);
+  EE.emit(K);
+  EE.emitBenchmark(K.getVariants()[0].second.get(), 1,
+                   getBufferLayout(K, size), size);
   optimize(getTargetMachine(), EE.getModule().get());
-  run(std::move(EE.getModule()), std::move(EE.getContext()), mem, 1);
+
+  MeasureOptions opts;
+  opts.warmup = 0;
+  opts.minReps = 1;
+  opts.maxReps = 1;
+  runBinary(emitObjectBuffer(EE.getModule().get()), mem, 1, opts);
+}
+
+void LLVMBackend::runOnce(Program *p, void *mem) {
+  // Execute the program exactly once.
+  MeasureOptions opts;
+  opts.warmup = 0;
+  opts.minReps = 1;
+  opts.maxReps = 1;
+  runBinary(compile(p, 1, true), mem, 1, opts);
 }
@@ -2,6 +2,7 @@
 #include "bistra/Backends/LLVMBackend/LLVMBackend.h"
 #include "bistra/Program/Program.h"
 #include "bistra/Program/Utils.h"
+#include "bistra/Runtime/Runtime.h"
 
 #include "llvm/Analysis/Passes.h"
 #include "llvm/Analysis/TargetLibraryInfo.h"
@@ -18,6 +19,7 @@
 #include "llvm/Passes/PassBuilder.h"
 #include "llvm/Support/CodeGen.h"
 #include "llvm/Support/Error.h"
+#include "llvm/Support/MemoryBuffer.h"
 #include "llvm/Support/TargetSelect.h"
 #include "llvm/Target/TargetMachine.h"
 #include "llvm/Target/TargetOptions.h"
@@ -29,10 +31,65 @@
 
 #include "JIT.h"
 
+#include <algorithm>
+#include <cstdlib>
+#include <map>
+#include <mutex>
 #include <utility>
+#include <vector>
 
 using namespace bistra;
 
+namespace {
+/// Holds the target machines that no thread is using, by target description.
+/// The tuner compiles each batch of candidates on new threads, and creating a
+/// target machine is expensive, so the threads of the next batch reuse the
+/// machines of the threads that exited.
+struct TargetMachinePool {
+  std::mutex lock_;
+  std::map<std::string, std::vector<std::unique_ptr<llvm::TargetMachine>>>
+      free_;
+
+  /// \returns an unused target machine for the target \p desc, or null if
+  /// there is none.
+  std::unique_ptr<llvm::TargetMachine> checkOut(const std::string &desc) {
+    std::lock_guard<std::mutex> guard(lock_);
+    auto &machines = free_[desc];
+    if (machines.empty())
+      return nullptr;
+    auto TM = std::move(machines.back());
+    machines.pop_back();
+    return TM;
+  }
+
+  /// Return the target machine \p TM of the target \p desc to the pool.
+  void checkIn(const std::string &desc,
+               std::unique_ptr<llvm::TargetMachine> TM) {
+    std::lock_guard<std::mutex> guard(lock_);
+    free_[desc].push_back(std::move(TM));
+  }
+};
+
+/// \returns the pool of target machines. The pool is never destroyed,
+/// because threads return their machines when they exit, which may happen
+/// during the destruction of static objects.
+TargetMachinePool &getTargetMachinePool() {
+  static auto *pool = new TargetMachinePool();
+  return *pool;
+}
+
+/// The target machines that the current thread checked out of the pool.
+struct ThreadTargetMachines {
+  std::map<std::string, std::unique_ptr<llvm::TargetMachine>> machines_;
+
+  ~ThreadTargetMachines() {
+    for (auto &TM : machines_) {
+      getTargetMachinePool().checkIn(TM.first, std::move(TM.second));
+    }
+  }
+};
+} // namespace
+
 void LLVMBackend::optimize(llvm::TargetMachine &TM, llvm::Module *M) {
   M->setDataLayout(TM.createDataLayout());
   M->setTargetTriple(TM.getTargetTriple().normalize());
@@ -45,11 +102,9 @@ void LLVMBackend::optimize(llvm::TargetMachine &TM, llvm::Module *M) {
   llvm::CGSCCAnalysisManager CGAM;
   llvm::ModuleAnalysisManager MAM;
 
-  // Create the new pass manager builder.
-  // Take a look at the PassBuilder constructor parameters for more
-  // customization, e.g. specifying a TargetMachine or various debugging
-  // options.
-  llvm::PassBuilder PB;
+  // Create the new pass manager builder. The target machine provides the
+  // cost model of the target to the optimizations.
+  llvm::PassBuilder PB(&TM);
 
   // Register all the basic analyses with the managers.
   PB.registerModuleAnalyses(MAM);
@@ -68,27 +123,105 @@ void LLVMBackend::optimize(llvm::TargetMachine &TM, llvm::Module *M) {
 }
 static llvm::ExitOnError ExitOnErr;
 
-LLVMBackend::LLVMBackend() {
+/// \returns the features of the host CPU, such as "+avx2,-avx512f".
+static std::string getHostFeatures() {
+  llvm::StringMap<bool> features;
+  if (!llvm::sys::getHostCPUFeatures(features))
+    return "";
+
+  std::vector<std::string> names;
+  for (auto &F : features) {
+    names.push_back((F.second ? "+" : "-") + F.first().str());
+  }
+  std::sort(names.begin(), names.end());
+
+  std::string res;
+  for (auto &name : names) {
+    res += (res.empty() ? "" : ",") + name;
+  }
+  return res;
+}
+
+LLVMBackend::LLVMBackend(const std::string &cpu, const std::string &features)
+    : cpu_(cpu), features_(features) {
   llvm::InitializeNativeTarget();
   llvm::InitializeNativeTargetAsmPrinter();
   llvm::InitializeNativeTargetAsmParser();
+
+  // Target the host CPU, unless the user selected a different target.
+  if (cpu_.empty() && features_.empty())
+    features_ = getHostFeatures();
+  if (cpu_.empty())
+    cpu_ = llvm::sys::getHostCPUName().str();
+
+  detectRegisters();
+
+  // Create the JIT session and expose the runtime library to the generated
+  // code.
+  JIT = ExitOnErr(llvm::orc::SimpleJIT::Create()).release();
+  ExitOnErr(JIT->addSymbol("bistra_parallel_for", &bistra_parallel_for));
+  ExitOnErr(JIT->addSymbol("aligned_alloc", &aligned_alloc));
+  ExitOnErr(JIT->addSymbol("free", &free));
+  ExitOnErr(JIT->addSymbol("abort", &abort));
 }
 
-LLVMBackend::~LLVMBackend() {}
+LLVMBackend::~LLVMBackend() { delete JIT; }
+
+void LLVMBackend::detectRegisters() {
+  using namespace llvm;
+  // The target transform info is queried through some function.
+  LLVMContext ctx;
+  Module M("registers", ctx);
+  auto *FT = FunctionType::get(llvm::Type::getVoidTy(ctx), false);
+  auto *F = Function::Create(FT, Function::ExternalLinkage, "query", &M);
+  // Ask for the widest vector registers and not for the preferred width.
+  F->addFnAttr("prefer-vector-width", "512");
+
+  auto TTI = getTargetMachine().getTargetTransformInfo(*F);
+  auto vectorClass = TTI.getRegisterClassForType(true);
+  numRegisters_ = TTI.getNumberOfRegisters(vectorClass);
+  auto bits =
+      TTI.getRegisterBitWidth(TargetTransformInfo::RGK_FixedWidthVector);
+  registerWidth_ = std::max<unsigned>(1, bits.getFixedValue() / 32);
+
+  // Targets without vector registers.
+  if (!numRegisters_) {
+    auto scalarClass = TTI.getRegisterClassForType(false);
+    numRegisters_ = TTI.getNumberOfRegisters(scalarClass);
+  }
+}
 
 llvm::TargetMachine &LLVMBackend::getTargetMachine() {
   using namespace llvm;
+  // The target machine is not thread safe, so each thread that compiles code
+  // checks out its own instance, and returns it to the pool when it exits.
+  // The instances are shared by backends that have the same target.
+  thread_local ThreadTargetMachines cache;
+  auto desc = getTargetDescription();
+  auto &TM = cache.machines_[desc];
+  if (TM)
+    return *TM;
+  TM = getTargetMachinePool().checkOut(desc);
+  if (TM)
+    return *TM;
 
-  auto CPU = "generic";
-  auto Features = "";
   auto TargetTriple = sys::getProcessTriple();
   std::string Error;
   auto Target = TargetRegistry::lookupTarget(TargetTriple, Error);
   assert(Target && "Can't initialize the target");
 
+  // Position independent code can be loaded anywhere by the JIT, and linked
+  // into position independent executables.
   llvm::TargetOptions opt;
-  auto RM = std::optional<llvm::Reloc::Model>();
-  return *Target->createTargetMachine(TargetTriple, CPU, Features, opt, RM);
+  auto RM = std::optional<llvm::Reloc::Model>(llvm::Reloc::PIC_);
+  TM.reset(
+      Target->createTargetMachine(TargetTriple, cpu_, features_, opt, RM));
+  return *TM;
+}
+
+std::string LLVMBackend::getTargetDescription() const {
+  return "llvm-" + llvm::sys::getProcessTriple() + "-" + cpu_ + "-" +
+         features_;
 }
 
 /// Calculate some checksum for the buffer.
@@ -101,38 +234,50 @@ static unsigned crcBuffer(float *A, int len) {
   return sum;
 }
 
-double LLVMBackend::run(std::unique_ptr<llvm::Module> M,
-                        std::unique_ptr<llvm::LLVMContext> ctx, void *mem,
-                        unsigned iter) {
+std::string LLVMBackend::emitObjectBuffer(llvm::Module *M) {
+  using namespace llvm;
+  SmallVector<char, 0> buffer;
+  raw_svector_ostream dest(buffer);
 
+  legacy::PassManager pass;
+  auto FileType = CodeGenFileType::ObjectFile;
+  if (getTargetMachine().addPassesToEmitFile(pass, dest, nullptr, FileType)) {
+    errs() << "TargetMachine can't emit a file of this type";
+    return "";
+  }
+
+  pass.run(*M);
+  return std::string(buffer.begin(), buffer.end());
+}
+
+Measurement LLVMBackend::runBinary(const std::string &binary, void *mem,
+                                   unsigned iter, const MeasureOptions &opts) {
   using namespace llvm;
   llvm::ExitOnError ExitOnErr;
-  auto J = ExitOnErr(orc::LLJITBuilder().create());
-  llvm::orc::ThreadSafeModule TSM(std::move(M), std::move(ctx));
-
-  ExitOnErr(J->addIRModule(std::move(TSM)));
+  // Load the code into its own dylib, which is removed after the measurement.
+  auto MB = MemoryBuffer::getMemBufferCopy(binary, "benchmark");
+  auto &JD = ExitOnErr(JIT->addObject(std::move(MB)));
 
   // Look up the JIT'd function, cast it to a function pointer, then call it.
-  auto ExprSymbol = ExitOnErr(J->lookup("benchmark"));
+  auto ExprSymbol = ExitOnErr(JIT->lookup(JD, "benchmark"));
 
   assert(ExprSymbol && "Function not found");
 
   auto addr = ExprSymbol.toPtr<void (*)(void *)>();
 
-  double timeSpent = 0.0;
+  Measurement res;
 
   if (addr) {
     void (*call)(void *) = addr;
-    clock_t begin = clock();
-    call(mem);
-    clock_t end = clock();
-    timeSpent += (double)(end - begin) / CLOCKS_PER_SEC;
+    res = measure([&]() { call(mem); }, opts);
   }
 
   // Don't warn on the unused function that is used for verification.
   (void)crcBuffer;
 
-  return timeSpent / iter;
+  ExitOnErr(JIT->remove(JD));
+
+  return res.scale(iter);
 }
 
 void LLVMBackend::emitObject(llvm::Module *M, const std::string &path) {
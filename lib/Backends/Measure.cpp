@@ -0,0 +1,142 @@
+#include "bistra/Backends/Measure.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define BISTRA_HAS_TSC 1
+#endif
+
+using namespace bistra;
+
+/// \returns the value of the monotonic clock, in seconds.
+static double now() {
+  auto t = std::chrono::steady_clock::now().time_since_epoch();
+  return std::chrono::duration<double>(t).count();
+}
+
+#ifdef BISTRA_HAS_TSC
+/// \returns the number of time-stamp counter ticks per second.
+static double getTSCFrequency() {
+  static double freq = [] {
+    // Calibrate the counter against the monotonic clock.
+    double t0 = now();
+    uint64_t c0 = __rdtsc();
+    double t1 = t0;
+    while (t1 - t0 < 0.01) {
+      t1 = now();
+    }
+    uint64_t c1 = __rdtsc();
+    return (c1 - c0) / (t1 - t0);
+  }();
+  return freq;
+}
+#endif
+
+/// \returns the time in seconds that it takes to execute \p fn.
+static double timeOnce(const std::function<void()> &fn, bool useTSC) {
+#ifdef BISTRA_HAS_TSC
+  if (useTSC) {
+    uint64_t begin = __rdtsc();
+    fn();
+    uint64_t end = __rdtsc();
+    return (end - begin) / getTSCFrequency();
+  }
+#endif
+  double begin = now();
+  fn();
+  return now() - begin;
+}
+
+/// \returns the median of the sorted vector \p v.
+static double median(const std::vector<double> &v) {
+  unsigned n = v.size();
+  if (n % 2)
+    return v[n / 2];
+  return (v[n / 2 - 1] + v[n / 2]) / 2;
+}
+
+Measurement Measurement::scale(unsigned n) const {
+  Measurement m = *this;
+  m.median /= n;
+  m.min /= n;
+  m.mean /= n;
+  m.stddev /= n;
+  return m;
+}
+
+Measurement bistra::computeStatistics(std::vector<double> samples) {
+  Measurement m;
+  if (samples.empty())
+    return m;
+
+  std::sort(samples.begin(), samples.end());
+  m.samples = samples.size();
+  m.min = samples[0];
+  m.median = median(samples);
+
+  // Reject samples that are far from the median, using the median absolute
+  // deviation, which is not affected by the outliers themselves.
+  std::vector<double> deviations;
+  for (auto s : samples) {
+    deviations.push_back(std::abs(s - m.median));
+  }
+  std::sort(deviations.begin(), deviations.end());
+  double threshold = 3 * 1.4826 * median(deviations);
+
+  std::vector<double> kept;
+  for (auto s : samples) {
+    if (std::abs(s - m.median) <= threshold)
+      kept.push_back(s);
+  }
+  if (kept.empty())
+    kept = samples;
+  m.outliers = samples.size() - kept.size();
+
+  double sum = 0;
+  for (auto s : kept) {
+    sum += s;
+  }
+  m.mean = sum / kept.size();
+
+  double var = 0;
+  for (auto s : kept) {
+    var += (s - m.mean) * (s - m.mean);
+  }
+  if (kept.size() > 1)
+    m.stddev = std::sqrt(var / (kept.size() - 1));
+
+  return m;
+}
+
+Measurement bistra::measure(const std::function<void()> &fn,
+                            const MeasureOptions &opts) {
+  // Warm up the caches.
+  for (unsigned i = 0; i < opts.warmup; i++) {
+    fn();
+  }
+
+  std::vector<double> samples;
+  double start = now();
+  while (samples.size() < std::max(1u, opts.maxReps)) {
+    samples.push_back(timeOnce(fn, opts.useTSC));
+
+    // Don't spend too much time on slow programs.
+    if (now() - start > opts.maxSeconds)
+      break;
+
+    if (samples.size() < opts.minReps)
+      continue;
+
+    // Stop when the confidence interval of the mean is narrow enough.
+    Measurement m = computeStatistics(samples);
+    unsigned n = m.samples - m.outliers;
+    double interval = 1.96 * m.stddev / std::sqrt(n);
+    if (interval <= opts.relativeError * m.mean)
+      break;
+  }
+
+  return computeStatistics(samples);
+}
@@ -0,0 +1,130 @@
+#include "bistra/Bytecode/Archive.h"
+#include "bistra/Program/Program.h"
+
+#include <fcntl.h>
+#include <set>
+#include <sys/file.h>
+#include <unistd.h>
+
+using namespace bistra;
+
+BytecodeArchive::BytecodeArchive(const std::string &path) : path_(path) {
+  reload();
+}
+
+void BytecodeArchive::reload() {
+  entries_.clear();
+  end_ = 0;
+  file_ = std::make_unique<MappedFile>(path_);
+  if (!file_->isValid())
+    return;
+
+  StreamReader SR(file_->data(), file_->size());
+  if (!SR.hasBytes(4) || SR.readFixed32() != kMagic)
+    return;
+  end_ = SR.getPos();
+
+  // Read the keys of the records and skip their bytecode. A record that was
+  // not written completely ends the archive.
+  while (SR.hasMore()) {
+    ArchiveEntry entry;
+    if (!SR.tryReadStr(entry.name_) || !SR.tryReadStr(entry.shape_) ||
+        !SR.tryReadStr(entry.target_) || !SR.hasBytes(4))
+      return;
+    entry.size_ = SR.readFixed32();
+    entry.offset_ = SR.getPos();
+    if (!SR.hasBytes(entry.size_))
+      return;
+    SR.skip(entry.size_);
+    entries_.push_back(entry);
+    end_ = SR.getPos();
+  }
+}
+
+std::string BytecodeArchive::getShapeSignature(Program *p) {
+  std::string sig;
+  for (auto *arg : p->getArgs()) {
+    auto *ty = arg->getType();
+    sig += (sig.empty() ? "" : ",") + std::string(ty->getElementName()) + "<";
+    for (unsigned i = 0; i < ty->getNumDims(); i++) {
+      sig += (i ? "," : "") + std::to_string(ty->getDims()[i]);
+    }
+    sig += ">";
+  }
+  return sig;
+}
+
+const ArchiveEntry *BytecodeArchive::find(const std::string &name,
+                                          const std::string &shape,
+                                          const std::string &target) const {
+  for (auto it = entries_.rbegin(); it != entries_.rend(); ++it) {
+    if (it->name_ == name && it->shape_ == shape && it->target_ == target)
+      return &*it;
+  }
+  return nullptr;
+}
+
+std::vector<const ArchiveEntry *>
+BytecodeArchive::getLatestEntries(const std::string &target) const {
+  std::vector<const ArchiveEntry *> res;
+  std::set<std::pair<std::string, std::string>> seen;
+  for (auto it = entries_.rbegin(); it != entries_.rend(); ++it) {
+    if (it->target_ != target)
+      continue;
+    if (seen.insert({it->name_, it->shape_}).second)
+      res.insert(res.begin(), &*it);
+  }
+  return res;
+}
+
+Program *BytecodeArchive::load(const ArchiveEntry &entry) const {
+  return Bytecode::deserialize(file_->data() + entry.offset_, entry.size_);
+}
+
+bool BytecodeArchive::append(Program *p, const std::string &target) {
+  std::string record;
+  StreamWriter SW(record);
+  auto media = Bytecode::serialize(p);
+  SW.write(p->getName());
+  SW.write(getShapeSignature(p));
+  SW.write(target);
+  SW.writeFixed32(media.size());
+  record.append(media);
+
+  int fd = open(path_.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+  if (fd < 0)
+    return false;
+
+  // Other processes may append to the archive at the same time. Hold an
+  // exclusive lock from reading the end of the archive until the record is
+  // written, so that the records don't interleave, and a record that another
+  // process is writing is not mistaken for a broken record.
+  bool written = false;
+  if (!flock(fd, LOCK_EX)) {
+    reload();
+    std::string header;
+    StreamWriter HW(header);
+    bool valid = true;
+    if (!file_->isValid()) {
+      // The archive is empty.
+      HW.writeFixed32(kMagic);
+    } else if (!end_) {
+      // The file is not an archive.
+      valid = false;
+    } else if (end_ < file_->size()) {
+      // Discard a record that was not written completely.
+      valid = !ftruncate(fd, end_);
+    }
+
+    // Write the record with a single write, at the end of the file.
+    if (valid) {
+      header.append(record);
+      ssize_t res = write(fd, header.data(), header.size());
+      written = res == ssize_t(header.size());
+    }
+  }
+  close(fd);
+
+  reload();
+  return written;
+}
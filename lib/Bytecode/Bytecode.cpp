@@ -2,15 +2,51 @@
 #include "bistra/Analysis/Value.h"
 #include "bistra/Program/Program.h"
 
+#include <algorithm>
 #include <cstring>
 #include <memory>
 #include <unordered_map>
 
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
 using namespace bistra;
 
+/// \returns the index of the buffer \p arg in the program \p p. The local
+/// tensors are numbered after the arguments.
+static unsigned getBufferIndex(Program *p, Argument *arg) {
+  auto &tensors = p->getTensors();
+  auto it = std::find(tensors.begin(), tensors.end(), arg);
+  if (it != tensors.end())
+    return p->getArgs().size() + (it - tensors.begin());
+  return p->getArgIndex(arg);
+}
+
+/// \returns the buffer at index \p idx in the program \p p (see
+/// getBufferIndex).
+static Argument *getBuffer(Program *p, unsigned idx) {
+  unsigned numArgs = p->getArgs().size();
+  if (idx < numArgs)
+    return p->getArg(idx);
+  assert(idx - numArgs < p->getTensors().size() && "Invalid buffer index");
+  return p->getTensors()[idx - numArgs];
+}
+
 StreamWriter::StreamWriter(std::string &str) : stream_(str) {}
 
 void StreamWriter::write(uint32_t num) {
+  // Write seven bits at a time, and set the high bit of all of the bytes
+  // except for the last one.
+  while (num >= 0x80) {
+    write((uint8_t)(num | 0x80));
+    num >>= 7;
+  }
+  write((uint8_t)num);
+}
+
+void StreamWriter::writeFixed32(uint32_t num) {
   write((uint8_t)(num >> 24));
   write((uint8_t)(num >> 16));
   write((uint8_t)(num >> 8));
@@ -21,22 +57,33 @@ void StreamWriter::write(float num) {
   float f = num;
   uint32_t val;
   memcpy(&val, &f, sizeof(float));
-  write((uint32_t)val);
+  writeFixed32(val);
 }
 
 void StreamWriter::write(uint8_t num) { stream_.push_back(num); }
 
 void StreamWriter::write(const std::string &s) {
-  assert(s.size() < 256 && "String too long to serialize");
-  write((uint8_t)s.size());
-  for (auto &c : s) {
-    stream_.push_back(c);
-  }
+  write((uint32_t)s.size());
+  stream_.append(s);
 }
 
-StreamReader::StreamReader(const std::string &str) : stream_(str), pos_(0) {}
+StreamReader::StreamReader(const std::string &str) : str_(&str) {}
+
+StreamReader::StreamReader(const char *data, size_t size)
+    : data_(data), size_(size) {}
 
 uint32_t StreamReader::readU32() {
+  uint32_t res = 0;
+  for (unsigned shift = 0; shift < 35; shift += 7) {
+    uint8_t byte = readU8();
+    res |= uint32_t(byte & 0x7f) << shift;
+    if (!(byte & 0x80))
+      break;
+  }
+  return res;
+}
+
+uint32_t StreamReader::readFixed32() {
   uint32_t res = 0;
   res = (res << 8) + readU8();
   res = (res << 8) + readU8();
@@ -46,32 +93,70 @@ uint32_t StreamReader::readU32() {
 }
 
 float StreamReader::readF32() {
-  uint32_t val = readU32();
+  uint32_t val = readFixed32();
   float f;
   memcpy(&f, &val, sizeof(float));
   return f;
 }
 
 uint8_t StreamReader::readU8() {
-  assert(stream_.size() > pos_);
-  return stream_[pos_++];
+  assert(size() > pos_);
+  return data()[pos_++];
 }
 
 std::string StreamReader::readStr() {
-  unsigned len = readU8();
-  std::string res;
-  for (unsigned i = 0; i < len; i++) {
-    res.push_back(stream_[pos_++]);
+  unsigned len = readU32();
+  assert(hasBytes(len) && "String past the end of the stream");
+  std::string res(data() + pos_, len);
+  pos_ += len;
+  return res;
+}
+
+bool StreamReader::tryReadU32(uint32_t &val) {
+  val = 0;
+  for (unsigned shift = 0;; shift += 7) {
+    if (shift >= 35 || !hasBytes(1))
+      return false;
+    uint8_t byte = readU8();
+    val |= uint32_t(byte & 0x7f) << shift;
+    if (!(byte & 0x80))
+      return true;
   }
+}
 
-  return res;
+bool StreamReader::tryReadStr(std::string &s) {
+  uint32_t len = 0;
+  if (!tryReadU32(len) || !hasBytes(len))
+    return false;
+  s.assign(data() + pos_, len);
+  pos_ += len;
+  return true;
 }
 
-bool StreamReader::hasMore() const { return pos_ != stream_.size(); }
+bool StreamReader::hasMore() const { return pos_ != size(); }
 
-void BytecodeHeader::serialize(StreamWriter &SW) {
-  SW.write((uint32_t)0x03070102);
+MappedFile::MappedFile(const std::string &path) {
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0)
+    return;
 
+  struct stat st;
+  if (!fstat(fd, &st) && st.st_size > 0) {
+    void *addr = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (addr != MAP_FAILED) {
+      data_ = (const char *)addr;
+      size_ = st.st_size;
+    }
+  }
+  close(fd);
+}
+
+MappedFile::~MappedFile() {
+  if (data_)
+    munmap((void *)data_, size_);
+}
+
+void BytecodeHeader::serialize(StreamWriter &SW) {
   // Serialize all of the names of the tensor dims.
   for (auto &tt : tensorTypeTable_.get()) {
     for (auto &name : tt.getNames()) {
@@ -118,12 +203,6 @@ void BytecodeHeader::serialize(StreamWriter &SW) {
 }
 
 void BytecodeHeader::deserialize(StreamReader &SR) {
-  auto magic = SR.readU32();
-  if (magic != 0x03070102) {
-    assert(false && "Invalid signature");
-    return;
-  }
-
   // Read the number of strings.
   unsigned n = SR.readU32();
   // And read the strings.
@@ -181,6 +260,8 @@ enum ExprTokenKind {
   BroadcastExprKind,
   IndexExprKind,
   GEPExprKind,
+  CastExprKind,
+  ReduceExprKind,
   LastExprKind
 };
 
@@ -190,6 +271,7 @@ enum StmtTokenKind {
   StoreStmtKind,
   StoreLocalStmtKind,
   IfRangeKind,
+  PrefetchStmtKind,
   LastStmtKind
 };
 
@@ -287,6 +369,30 @@ void Bytecode::serialize(StreamWriter &SW, BytecodeHeader &BH,
     return;
   }
 
+  if (auto *CE = dynamic_cast<CastExpr *>(E)) {
+    // Kind:
+    SW.write((uint32_t)ExprTokenKind::CastExprKind);
+    // My ID:
+    SW.write((uint32_t)BC.exprTable_.getIdFor(CE));
+    // The element type to convert to:
+    SW.write((uint8_t)CE->getType().getElementType());
+    // Param reference references:
+    SW.write((uint32_t)BC.exprTable_.getIdFor(CE->getVal()));
+    return;
+  }
+
+  if (auto *RE = dynamic_cast<ReduceExpr *>(E)) {
+    // Kind:
+    SW.write((uint32_t)ExprTokenKind::ReduceExprKind);
+    // My ID:
+    SW.write((uint32_t)BC.exprTable_.getIdFor(RE));
+    // OpKind:
+    SW.write((uint8_t)RE->getKind());
+    // Param reference references:
+    SW.write((uint32_t)BC.exprTable_.getIdFor(RE->getVal()));
+    return;
+  }
+
   if (auto *LE = dynamic_cast<LoadExpr *>(E)) {
     // Kind:
     SW.write((uint32_t)ExprTokenKind::LoadExprKind);
@@ -338,8 +444,8 @@ void Bytecode::serialize(StreamWriter &SW, BytecodeHeader &BH,
     // My ID:
     SW.write((uint32_t)BC.exprTable_.getIdFor(GEP));
 
-    // Save the index of the argument that we are indexing.
-    SW.write((uint32_t)p->getArgIndex(GEP->getDest()));
+    // Save the index of the buffer that we are indexing.
+    SW.write((uint32_t)getBufferIndex(p, GEP->getDest()));
     // Write the number of subscript indices.
     SW.write((uint32_t)GEP->getIndices().size());
     // Save the indices ids:
@@ -367,6 +473,8 @@ void Bytecode::serialize(StreamWriter &SW, BytecodeHeader &BH,
     SW.write((uint32_t)L->getEnd());
     // Write loop stride.
     SW.write((uint32_t)L->getStride());
+    // Write the parallel flag.
+    SW.write((uint32_t)L->isParallel());
     return;
   }
   if (auto *IR = dynamic_cast<IfRange *>(S)) {
@@ -381,7 +489,9 @@ void Bytecode::serialize(StreamWriter &SW, BytecodeHeader &BH,
     // Write range start.
     SW.write((uint32_t)IR->getRange().first);
     // Write range end.
-    SW.write((uint32_t)IR->getRange().first);
+    SW.write((uint32_t)IR->getRange().second);
+    // Write the number of checked lanes.
+    SW.write((uint8_t)IR->getWidth());
     return;
   }
   if (auto *CS = dynamic_cast<CallStmt *>(S)) {
@@ -408,14 +518,26 @@ void Bytecode::serialize(StreamWriter &SW, BytecodeHeader &BH,
     SW.write((uint32_t)BC.stmtTable_.getIdFor(ST));
     // Parent ID:
     SW.write((uint32_t)BC.stmtTable_.getIdFor((Stmt *)ST->getParent()));
-    // Write if this is a write-only or accumulator store.
-    SW.write((uint8_t)ST->isAccumulate());
+    // Write if this is a write-only or accumulator store, and if the store is
+    // non-temporal.
+    SW.write((uint8_t)(ST->isAccumulate() | (ST->isNonTemporal() << 1)));
     // Write the index to the saved expression.
     SW.write((uint32_t)BC.exprTable_.getIdFor(ST->getValue().get()));
     // Save the index of the GEP that we are indexing.
     SW.write((uint32_t)BC.exprTable_.getIdFor(ST->getGep()));
     return;
   }
+  if (auto *PS = dynamic_cast<PrefetchStmt *>(S)) {
+    // Kind:
+    SW.write((uint32_t)StmtTokenKind::PrefetchStmtKind);
+    // My ID:
+    SW.write((uint32_t)BC.stmtTable_.getIdFor(PS));
+    // Parent ID:
+    SW.write((uint32_t)BC.stmtTable_.getIdFor((Stmt *)PS->getParent()));
+    // Save the index of the GEP that we prefetch.
+    SW.write((uint32_t)BC.exprTable_.getIdFor(PS->getGep()));
+    return;
+  }
   if (auto *STL = dynamic_cast<StoreLocalStmt *>(S)) {
     // Kind:
     SW.write((uint32_t)StmtTokenKind::StoreLocalStmtKind);
@@ -475,9 +597,26 @@ void Bytecode::deserializeExpr(StreamReader &SR, BytecodeHeader &BH,
                     new UnaryExpr(V, (UnaryExpr::UnaryOpKind)kind, loc));
     return;
   }
+  case CastExprKind: {
+    // Read the element type to convert to.
+    auto kind = SR.readU8();
+    // Read the value operand:
+    auto *V = BC.getExpr(SR.readU32());
+    BC.registerExpr(exprId, new CastExpr(V, (ElemKind)kind, loc));
+    return;
+  }
+  case ReduceExprKind: {
+    // Read the operation kind.
+    auto kind = SR.readU8();
+    // Read the value operand:
+    auto *V = BC.getExpr(SR.readU32());
+    BC.registerExpr(exprId,
+                    new ReduceExpr(V, (BinaryExpr::BinOpKind)kind, loc));
+    return;
+  }
   case GEPExprKind: {
-    // Read the argument that we index.
-    auto *arg = p->getArg(SR.readU32());
+    // Read the buffer that we index.
+    auto *arg = getBuffer(p, SR.readU32());
     // Read the indices, as a list of expression references.
     unsigned numIndices = SR.readU32();
     std::vector<Expr *> indices;
@@ -546,7 +685,9 @@ void Bytecode::deserializeStmt(StreamReader &SR, BytecodeHeader &BH,
     std::string name = BH.getStringTable().getById(SR.readU32());
     auto end = SR.readU32();
     auto stride = SR.readU32();
+    auto parallel = SR.readU32();
     auto *L = new Loop(name, loc, end, stride);
+    L->setParallel(parallel);
     parent->addStmt(L);
     BC.registerStmt(stmtId, L);
     return;
@@ -559,6 +700,7 @@ void Bytecode::deserializeStmt(StreamReader &SR, BytecodeHeader &BH,
     auto end = SR.readU32();
     // Register the new If.
     auto *IR = new IfRange(idxVal, start, end, loc);
+    IR->setWidth(SR.readU8());
     parent->addStmt(IR);
     BC.registerStmt(stmtId, IR);
     return;
@@ -579,14 +721,16 @@ void Bytecode::deserializeStmt(StreamReader &SR, BytecodeHeader &BH,
     return;
   }
   case StoreStmtKind: {
-    // Is this an accumulate store or write-only.
-    bool accumulate = SR.readU8();
+    // Is this an accumulate store or write-only, and is it non-temporal.
+    uint8_t flags = SR.readU8();
+    bool accumulate = flags & 1;
     // Read the index of the stored expr.
     auto storedVal = BC.getExpr(SR.readU32());
     // Read the GEP.
     auto *GEP = BC.getExpr(SR.readU32());
     // Register the store.
     auto *st = new StoreStmt((GEPExpr *)GEP, storedVal, accumulate, loc);
+    st->setNonTemporal(flags & 2);
     parent->addStmt(st);
     BC.registerStmt(stmtId, st);
     return;
@@ -604,6 +748,15 @@ void Bytecode::deserializeStmt(StreamReader &SR, BytecodeHeader &BH,
     BC.registerStmt(stmtId, stl);
     return;
   }
+  case PrefetchStmtKind: {
+    // Read the GEP.
+    auto *GEP = BC.getExpr(SR.readU32());
+    // Register the prefetch.
+    auto *ps = new PrefetchStmt((GEPExpr *)GEP, loc);
+    parent->addStmt(ps);
+    BC.registerStmt(stmtId, ps);
+    return;
+  }
   case LastStmtKind:
     assert(false);
     return;
@@ -612,9 +765,24 @@ void Bytecode::deserializeStmt(StreamReader &SR, BytecodeHeader &BH,
   assert(false);
 }
 
+/// \returns the features of the format that the program \p p uses.
+static uint32_t getFeatures(Program *p) {
+  uint32_t features = 0;
+  if (p->getTensors().size())
+    features |= Bytecode::LocalTensors;
+  for (auto *s : collectStmts(p)) {
+    auto *SS = dynamic_cast<StoreStmt *>(s);
+    if (SS && SS->isNonTemporal())
+      features |= Bytecode::NonTemporalStores;
+    if (dynamic_cast<PrefetchStmt *>(s))
+      features |= Bytecode::Prefetch;
+  }
+  return features;
+}
+
 std::string Bytecode::serialize(Program *p) {
   std::string body;
-  std::string header;
+  std::string tables;
   BytecodeHeader BH;
   StreamWriter SR(body);
 
@@ -625,10 +793,12 @@ std::string Bytecode::serialize(Program *p) {
 
   // How many arguments.
   SR.write((uint32_t)p->getArgs().size());
-  // Each argument is described by name and type.
+  // Each argument is described by name, type, alignment and padding.
   for (auto &arg : p->getArgs()) {
     SR.write((uint32_t)BH.getStringTable().getIdFor(arg->getName()));
     SR.write((uint32_t)BH.getTensorTypeTable().getIdFor(*arg->getType()));
+    SR.write((uint32_t)arg->getAlignment());
+    SR.write((uint32_t)arg->getPadding());
   }
 
   // How many local variables.
@@ -639,6 +809,15 @@ std::string Bytecode::serialize(Program *p) {
     SR.write((uint32_t)BH.getExprTyTable().getIdFor(var->getType()));
   }
 
+  // How many local tensors.
+  SR.write((uint32_t)p->getTensors().size());
+  // Each tensor is described by name, type and alignment.
+  for (auto &tensor : p->getTensors()) {
+    SR.write((uint32_t)BH.getStringTable().getIdFor(tensor->getName()));
+    SR.write((uint32_t)BH.getTensorTypeTable().getIdFor(*tensor->getType()));
+    SR.write((uint32_t)tensor->getAlignment());
+  }
+
   //----------- Serialize the program body ----------------//
   SerializeContext BC;
   // The program is serialized as index zero (see deserializer).
@@ -665,16 +844,81 @@ std::string Bytecode::serialize(Program *p) {
     serialize(SR, BH, BC, p, s);
   }
 
-  // Return the complete serialized program.
-  StreamWriter headerSR(header);
-  BH.serialize(headerSR);
-  return header + body;
+  // The tables are written after the body, which fills them.
+  StreamWriter tablesSW(tables);
+  BH.serialize(tablesSW);
+
+  // Write the preamble and the section table. The entries of the section
+  // table have a fixed size, so the offsets of the sections are known before
+  // the table is written.
+  std::string media;
+  StreamWriter SW(media);
+  SW.writeFixed32(kMagic);
+  SW.write((uint32_t)kVersion);
+  SW.write((uint32_t)getFeatures(p));
+  std::vector<std::pair<Section, std::string *>> sections = {
+      {TablesSection, &tables}, {ProgramSection, &body}};
+  SW.write((uint32_t)sections.size());
+  uint32_t offset = SW.size() + sections.size() * 9;
+  for (auto &section : sections) {
+    SW.write((uint8_t)section.first);
+    SW.writeFixed32(offset);
+    SW.writeFixed32(section.second->size());
+    offset += section.second->size();
+  }
+  for (auto &section : sections) {
+    media.append(*section.second);
+  }
+  return media;
 }
 
 Program *Bytecode::deserialize(const std::string &media) {
+  return deserialize(media.data(), media.size());
+}
+
+Program *Bytecode::deserializeFile(const std::string &path) {
+  MappedFile file(path);
+  if (!file.isValid())
+    return nullptr;
+  return deserialize(file.data(), file.size());
+}
+
+Program *Bytecode::deserialize(const char *data, size_t size) {
+  // Check the preamble.
+  StreamReader PR(data, size);
+  if (!PR.hasBytes(4) || PR.readFixed32() != kMagic)
+    return nullptr;
+  uint32_t version, features, numSections;
+  if (!PR.tryReadU32(version) || version != kVersion)
+    return nullptr;
+  if (!PR.tryReadU32(features) || (features & ~kKnownFeatures))
+    return nullptr;
+
+  // Find the sections.
+  const char *sections[ProgramSection + 1] = {};
+  size_t sizes[ProgramSection + 1] = {};
+  if (!PR.tryReadU32(numSections))
+    return nullptr;
+  for (unsigned i = 0; i < numSections; i++) {
+    if (!PR.hasBytes(9))
+      return nullptr;
+    uint8_t kind = PR.readU8();
+    uint32_t offset = PR.readFixed32();
+    uint32_t len = PR.readFixed32();
+    if (offset > size || len > size - offset)
+      return nullptr;
+    if (kind <= ProgramSection) {
+      sections[kind] = data + offset;
+      sizes[kind] = len;
+    }
+  }
+  if (!sections[TablesSection] || !sections[ProgramSection])
+    return nullptr;
+
   BytecodeHeader BH;
-  StreamReader SR(media);
-  BH.deserialize(SR);
+  StreamReader TR(sections[TablesSection], sizes[TablesSection]);
+  BH.deserialize(TR);
+  StreamReader SR(sections[ProgramSection], sizes[ProgramSection]);
 
   //----------- Deserialize the program decl ----------------//
 
@@ -686,10 +930,13 @@ Program *Bytecode::deserialize(const std::string &media) {
   // Read the arguments:
   unsigned numArgs = SR.readU32();
   for (unsigned i = 0; i < numArgs; i++) {
-    // Name + TensorType.
+    // Name + TensorType + alignment + padding.
     auto name = BH.getStringTable().getById(SR.readU32());
     auto type = BH.getTensorTypeTable().getById(SR.readU32());
-    p->addArgument(new Argument(name, type));
+    auto *arg = new Argument(name, type);
+    arg->setAlignment(SR.readU32());
+    arg->setPadding(SR.readU32());
+    p->addArgument(arg);
   }
 
   // Read the variables:
@@ -701,6 +948,17 @@ Program *Bytecode::deserialize(const std::string &media) {
     p->addVar(new LocalVar(name, type));
   }
 
+  // Read the local tensors:
+  unsigned numTensors = SR.readU32();
+  for (unsigned i = 0; i < numTensors; i++) {
+    // Name + TensorType + alignment.
+    auto name = BH.getStringTable().getById(SR.readU32());
+    auto type = BH.getTensorTypeTable().getById(SR.readU32());
+    auto *tensor = new Argument(name, type);
+    tensor->setAlignment(SR.readU32());
+    p->addTensor(tensor);
+  }
+
   //----------- Deserialize the program body ----------------//
   DeserializeContext BC;
   // The program is serialized as index zero (see serializer).
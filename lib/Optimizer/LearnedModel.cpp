@@ -0,0 +1,161 @@
+#include "bistra/Optimizer/LearnedModel.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+
+using namespace bistra;
+
+namespace {
+
+/// Solve the linear system A * x = b, where A is a square matrix, with
+/// Gaussian elimination. \returns False if the matrix is singular.
+bool solve(std::vector<std::vector<double>> A, std::vector<double> b,
+           std::vector<double> &x) {
+  unsigned n = b.size();
+  for (unsigned col = 0; col < n; col++) {
+    // Pick the row with the largest pivot.
+    unsigned pivot = col;
+    for (unsigned r = col + 1; r < n; r++) {
+      if (std::abs(A[r][col]) > std::abs(A[pivot][col]))
+        pivot = r;
+    }
+    if (std::abs(A[pivot][col]) < 1e-12)
+      return false;
+    std::swap(A[col], A[pivot]);
+    std::swap(b[col], b[pivot]);
+
+    for (unsigned r = col + 1; r < n; r++) {
+      double f = A[r][col] / A[col][col];
+      for (unsigned c = col; c < n; c++) {
+        A[r][c] -= f * A[col][c];
+      }
+      b[r] -= f * b[col];
+    }
+  }
+
+  x.assign(n, 0);
+  for (unsigned r = n; r-- > 0;) {
+    double sum = b[r];
+    for (unsigned c = r + 1; c < n; c++) {
+      sum -= A[r][c] * x[c];
+    }
+    x[r] = sum / A[r][r];
+  }
+  return true;
+}
+
+} // namespace
+
+bool LearnedModel::train(const std::vector<std::vector<double>> &features,
+                         const std::vector<double> &times, double lambda) {
+  weights_.clear();
+  unsigned n = features.size();
+  if (n < minSamples || n != times.size())
+    return false;
+
+  // Standardize the features, to make the regularization fair.
+  unsigned d = features[0].size();
+  mean_.assign(d, 0);
+  scale_.assign(d, 0);
+  for (auto &f : features) {
+    assert(f.size() == d && "Invalid number of features");
+    for (unsigned j = 0; j < d; j++) {
+      mean_[j] += f[j] / n;
+    }
+  }
+  for (auto &f : features) {
+    for (unsigned j = 0; j < d; j++) {
+      scale_[j] += (f[j] - mean_[j]) * (f[j] - mean_[j]) / n;
+    }
+  }
+  for (auto &s : scale_) {
+    s = s > 1e-12 ? std::sqrt(s) : 1;
+  }
+
+  // The model predicts the logarithm of the time, which turns the products of
+  // the features into sums.
+  std::vector<double> y(n);
+  bias_ = 0;
+  for (unsigned i = 0; i < n; i++) {
+    y[i] = std::log(std::max(times[i], 1e-12));
+    bias_ += y[i] / n;
+  }
+
+  // Solve the normal equations of the ridge regression:
+  // (X^T * X + lambda * I) * w = X^T * y
+  std::vector<std::vector<double>> A(d, std::vector<double>(d, 0));
+  std::vector<double> b(d, 0);
+  std::vector<double> x(d);
+  for (unsigned i = 0; i < n; i++) {
+    for (unsigned j = 0; j < d; j++) {
+      x[j] = (features[i][j] - mean_[j]) / scale_[j];
+    }
+    for (unsigned j = 0; j < d; j++) {
+      for (unsigned k = 0; k < d; k++) {
+        A[j][k] += x[j] * x[k];
+      }
+      b[j] += x[j] * (y[i] - bias_);
+    }
+  }
+  for (unsigned j = 0; j < d; j++) {
+    A[j][j] += lambda;
+  }
+
+  if (!solve(A, b, weights_)) {
+    weights_.clear();
+    return false;
+  }
+  return true;
+}
+
+unsigned LearnedModel::trainFromLog(const std::string &path,
+                                    unsigned numFeatures) {
+  std::vector<std::vector<double>> features;
+  std::vector<double> times;
+
+  std::ifstream log(path);
+  std::string line;
+  while (std::getline(log, line)) {
+    std::istringstream ss(line);
+    double time;
+    if (!(ss >> time))
+      continue;
+    std::vector<double> f;
+    double value;
+    while (ss >> value) {
+      f.push_back(value);
+    }
+    if (f.size() != numFeatures)
+      continue;
+    features.push_back(f);
+    times.push_back(time);
+  }
+
+  if (!train(features, times))
+    return 0;
+  return features.size();
+}
+
+double LearnedModel::predict(const std::vector<double> &features) const {
+  assert(isTrained() && "The model was not trained");
+  assert(features.size() == weights_.size() && "Invalid number of features");
+  double logTime = bias_;
+  for (unsigned j = 0; j < weights_.size(); j++) {
+    logTime += weights_[j] * (features[j] - mean_[j]) / scale_[j];
+  }
+  return std::exp(logTime);
+}
+
+void LearnedModel::appendToLog(const std::string &path, double time,
+                               const std::vector<double> &features) {
+  std::ofstream log(path, std::ios::app);
+  log << std::setprecision(10) << time;
+  for (auto f : features) {
+    log << " " << f;
+  }
+  log << "\n";
+}
@@ -1,4 +1,7 @@
 #include "bistra/Optimizer/Optimizer.h"
+#include "bistra/Optimizer/LearnedModel.h"
+#include "bistra/Optimizer/TuningCache.h"
+#include "bistra/Analysis/CostModel.h"
 #include "bistra/Analysis/Program.h"
 #include "bistra/Analysis/Value.h"
 #include "bistra/Backends/Backend.h"
@@ -10,23 +13,73 @@
 #include "bistra/Transforms/Transforms.h"
 
 #include <array>
+#include <chrono>
+#include <functional>
 #include <iostream>
+#include <limits>
+#include <map>
+#include <random>
 #include <set>
+#include <thread>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
 
 using namespace bistra;
 
+/// A list of programs that a pass generates.
+using VariantList = std::vector<std::unique_ptr<Program>>;
+
+/// Transforms the clone \p np of the program that a pass inspected. The
+/// context \p map maps the loops and the buffers of the inspected program to
+/// the clone. \returns False if the transform did not apply.
+using Transform = std::function<bool(Program *np, CloneCtx &map)>;
+
+/// A transform that keeps the program as is.
+static bool keepProgram(Program *np, CloneCtx &map) { return true; }
+
+/// A stage of the tuner. Each stage transforms the program in a few different
+/// ways, and the search strategy decides which of the variants to explore.
 class Pass {
   std::string name_;
 
-protected:
-  Pass *nextPass_;
-
 public:
-  Pass(const std::string &name, Pass *next) : name_(name), nextPass_(next) {}
-  virtual void doIt(Program *p) = 0;
+  Pass(const std::string &name) : name_(name) {}
+  virtual ~Pass() = default;
+  /// Add the transforms that generate the variants of the program \p p to
+  /// \p transforms. The transforms only record the decisions of the pass, so
+  /// the variants can be counted and sampled without cloning the program for
+  /// each of them. Passes that reject the program don't add any transform.
+  virtual void getTransforms(Program *p,
+                             std::vector<Transform> &transforms) = 0;
+
+  /// \returns the variant of the program \p p that the transform \p t
+  /// generates, or nullptr if the transform does not apply.
+  static std::unique_ptr<Program> getVariant(Program *p, const Transform &t) {
+    CloneCtx map;
+    std::unique_ptr<Program> np((Program *)p->clone(map));
+    if (!t(np.get(), map))
+      return nullptr;
+    return np;
+  }
+
+  /// Add the variants of the program \p p to \p variants, without
+  /// duplicates.
+  void getVariants(Program *p, VariantList &variants) {
+    std::vector<Transform> transforms;
+    getTransforms(p, transforms);
+    std::set<uint64_t> seen;
+    for (auto &t : transforms) {
+      auto np = getVariant(p, t);
+      if (np && seen.insert(np->hash()).second)
+        variants.push_back(std::move(np));
+    }
+  }
 };
 
-class EvaluatorPass : public Pass {
+class EvaluatorPass {
   double bestTime_{1000};
   StmtHandle bestProgram_;
   Backend &backend_;
@@ -38,111 +91,379 @@ class EvaluatorPass : public Pass {
   bool isBytecode_;
   // A set of already-ran programs hash codes.
   std::set<uint64_t> alreadyRan_;
+  /// The number of threads that compile the candidates.
+  unsigned numThreads_;
+  /// A queue of candidates that are waiting to be compiled and evaluated.
+  /// The candidates are evaluated in the order in which they were generated.
+  std::vector<std::unique_ptr<Program>> pending_;
+  /// The number of candidates that are compiled together.
+  static constexpr unsigned batchSize_ = 64;
+  /// An optional persistent database of tuning results.
+  TuningCache *cache_;
+  /// Controls the measurement of the candidates and the budget of the search.
+  TuningOptions options_;
+  /// The machine that the cost model predicts the execution time for.
+  MachineModel machine_;
+  /// A model that is trained on the results of previous sessions.
+  LearnedModel model_;
+  /// The candidates with the best predicted execution time.
+  std::multimap<double, std::unique_ptr<Program>> ranked_;
+  /// The number of candidates that were ranked by the cost model.
+  unsigned numRanked_{0};
+  /// The execution time of the candidates, by their hash.
+  std::unordered_map<uint64_t, double> results_;
+  /// The number of different candidates that were evaluated.
+  unsigned numCandidates_{0};
+  /// The number of results since the last improvement of the best result.
+  unsigned sinceImprovement_{0};
+  /// The start time of the search.
+  std::chrono::steady_clock::time_point start_;
+
+  /// \returns True if the time budget of the search was used up.
+  bool isOutOfTime() const;
+
+  /// Predict the execution time of \p p and keep it if it is one of the best
+  /// candidates.
+  void rank(Program *p);
+
+  /// Compile all of the pending candidates in parallel, and then time them
+  /// one after the other.
+  void measurePending();
+
+  /// Record the execution time \p res of the program \p p.
+  void recordResult(Program *p, double res);
+
+  /// Save the program \p p to the output path.
+  void saveProgram(Program *p);
 
 public:
   EvaluatorPass(Backend &backend, const std::string &savePath, bool isText,
-                bool isBytecode)
-      : Pass("evaluator", nullptr), bestProgram_(nullptr, nullptr),
-        backend_(backend), savePath_(savePath), isText_(isText),
-        isBytecode_(isBytecode) {}
-  virtual void doIt(Program *p) override;
+                bool isBytecode, unsigned numThreads, TuningCache *cache,
+                const TuningOptions &options, const MachineModel &machine,
+                const LearnedModel &model)
+      : bestProgram_(nullptr, nullptr), backend_(backend), savePath_(savePath),
+        isText_(isText), isBytecode_(isBytecode), numThreads_(numThreads),
+        cache_(cache), options_(options), machine_(machine), model_(model),
+        start_(std::chrono::steady_clock::now()) {}
+  /// Evaluate the candidate \p p.
+  /// \returns True if the candidate was not evaluated before.
+  bool doIt(Program *p);
+  /// Evaluate all of the candidates that are still waiting in the queue.
+  void flush();
+  /// Evaluate the remaining candidates and complete the tuning session.
+  void finish();
+  /// \returns True if the budget of the search was used up.
+  bool isExhausted() const;
+  /// \returns a prediction of the execution time of \p p, which is used for
+  /// ranking candidates.
+  double predict(Program *p);
+  /// Sets \p time to the execution time of the candidate with the hash
+  /// \p hash. \returns True if the candidate was measured.
+  bool lookupTime(uint64_t hash, double &time) const;
   Program *getBestProgram() { return (Program *)bestProgram_.get(); }
+  /// Make \p p the best program, with the execution time \p time, and save
+  /// it to the output path.
+  void setBestProgram(Program *p, double time);
 };
 
 class FilterPass : public Pass {
   Backend &backend_;
 
 public:
-  FilterPass(Backend &backend, Pass *next)
-      : Pass("filter", next), backend_(backend) {}
-  virtual void doIt(Program *p) override;
+  FilterPass(Backend &backend) : Pass("filter"), backend_(backend) {}
+  virtual void getTransforms(Program *p,
+                             std::vector<Transform> &transforms) override;
 };
 
 class VectorizerPass : public Pass {
   Backend &backend_;
 
 public:
-  VectorizerPass(Backend &backend, Pass *next)
-      : Pass("vectorizer", next), backend_(backend) {}
-  virtual void doIt(Program *p) override;
+  VectorizerPass(Backend &backend) : Pass("vectorizer"), backend_(backend) {}
+  virtual void getTransforms(Program *p,
+                             std::vector<Transform> &transforms) override;
 };
 
 class InterchangerPass : public Pass {
 public:
-  InterchangerPass(Pass *next) : Pass("interchange", next) {}
-  virtual void doIt(Program *p) override;
+  InterchangerPass() : Pass("interchange") {}
+  virtual void getTransforms(Program *p,
+                             std::vector<Transform> &transforms) override;
 };
 
 class TilerPass : public Pass {
 public:
-  TilerPass(Pass *next) : Pass("tiler", next) {}
-  virtual void doIt(Program *p) override;
+  TilerPass() : Pass("tiler") {}
+  virtual void getTransforms(Program *p,
+                             std::vector<Transform> &transforms) override;
 };
 
 class WidnerPass : public Pass {
   Backend &backend_;
 
 public:
-  WidnerPass(Backend &backend, Pass *next)
-      : Pass("widner", next), backend_(backend) {}
-  virtual void doIt(Program *p) override;
+  WidnerPass(Backend &backend) : Pass("widner"), backend_(backend) {}
+  virtual void getTransforms(Program *p,
+                             std::vector<Transform> &transforms) override;
 };
 
 class PromoterPass : public Pass {
 public:
-  PromoterPass(Pass *next) : Pass("promoter", next) {}
-  virtual void doIt(Program *p) override;
+  PromoterPass() : Pass("promoter") {}
+  virtual void getTransforms(Program *p,
+                             std::vector<Transform> &transforms) override;
+};
+
+class PrefetchPass : public Pass {
+public:
+  PrefetchPass() : Pass("prefetch") {}
+  virtual void getTransforms(Program *p,
+                             std::vector<Transform> &transforms) override;
+};
+
+class StreamPass : public Pass {
+public:
+  StreamPass() : Pass("stream") {}
+  virtual void getTransforms(Program *p,
+                             std::vector<Transform> &transforms) override;
+};
+
+class ParallelizerPass : public Pass {
+public:
+  ParallelizerPass() : Pass("parallelizer") {}
+  virtual void getTransforms(Program *p,
+                             std::vector<Transform> &transforms) override;
 };
 
 class DistributePass : public Pass {
 public:
-  DistributePass(Pass *next) : Pass("distribute", next) {}
-  virtual void doIt(Program *p) override;
+  DistributePass() : Pass("distribute") {}
+  virtual void getTransforms(Program *p,
+                             std::vector<Transform> &transforms) override;
 };
 
 class FusePass : public Pass {
 public:
-  FusePass(Pass *next) : Pass("fuse", next) {}
-  virtual void doIt(Program *p) override;
+  FusePass() : Pass("fuse") {}
+  virtual void getTransforms(Program *p,
+                             std::vector<Transform> &transforms) override;
+};
+
+class PackPass : public Pass {
+public:
+  PackPass() : Pass("pack") {}
+  virtual void getTransforms(Program *p,
+                             std::vector<Transform> &transforms) override;
 };
 
-void EvaluatorPass::doIt(Program *p) {
+/// Pins the current thread to a single core for the lifetime of the object,
+/// to reduce the noise in the measurements.
+class ThreadPinner {
+#ifdef __linux__
+  /// The original affinity of the thread.
+  cpu_set_t saved_;
+#endif
+  /// Was the thread pinned?
+  bool pinned_{false};
+
+public:
+  ThreadPinner() {
+#ifdef __linux__
+    if (pthread_getaffinity_np(pthread_self(), sizeof(saved_), &saved_))
+      return;
+
+    // Pick the first core that the thread is allowed to run on.
+    for (unsigned i = 0; i < CPU_SETSIZE; i++) {
+      if (!CPU_ISSET(i, &saved_))
+        continue;
+      cpu_set_t single;
+      CPU_ZERO(&single);
+      CPU_SET(i, &single);
+      pinned_ =
+          !pthread_setaffinity_np(pthread_self(), sizeof(single), &single);
+      return;
+    }
+#endif
+  }
+
+  ~ThreadPinner() {
+#ifdef __linux__
+    if (pinned_)
+      pthread_setaffinity_np(pthread_self(), sizeof(saved_), &saved_);
+#endif
+  }
+};
+
+bool EvaluatorPass::doIt(Program *p) {
+  if (isExhausted())
+    return false;
+
   // Check if we already benchmarked this program.
   if (!alreadyRan_.insert(p->hash()).second) {
     std::cout << ":" << std::flush;
-    return;
+    return false;
   }
 
   p->verify();
+  numCandidates_++;
 
-  std::unordered_map<ASTNode *, ComputeCostTy> heatmap;
-  estimateCompute(p, heatmap);
-  assert(heatmap.count(p) && "No information for the program");
-  auto info = heatmap[p];
+  // Reuse the results of a previous tuning session.
+  double time;
+  if (cache_ && cache_->lookupTime(p->hash(), time)) {
+    recordResult(p, time);
+    return true;
+  }
+
+  if (options_.topK) {
+    rank(p);
+    return true;
+  }
+
+  pending_.emplace_back((Program *)p->clone());
+  if (pending_.size() >= batchSize_)
+    measurePending();
+  return true;
+}
+
+bool EvaluatorPass::isExhausted() const {
+  if (options_.maxCandidates && numCandidates_ >= options_.maxCandidates)
+    return true;
+  if (options_.patience && sinceImprovement_ >= options_.patience)
+    return true;
+  return isOutOfTime();
+}
+
+double EvaluatorPass::predict(Program *p) {
+  if (model_.isTrained())
+    return model_.predict(getProgramFeatures(p, machine_));
+  return estimateCycles(p, machine_);
+}
+
+bool EvaluatorPass::isOutOfTime() const {
+  std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start_;
+  return options_.maxSeconds > 0 && elapsed.count() >= options_.maxSeconds;
+}
+
+bool EvaluatorPass::lookupTime(uint64_t hash, double &time) const {
+  auto it = results_.find(hash);
+  if (it == results_.end())
+    return false;
+  time = it->second;
+  return true;
+}
+
+void EvaluatorPass::rank(Program *p) {
+  numRanked_++;
+  double cost = predict(p);
+  if (ranked_.size() == options_.topK) {
+    auto worst = std::prev(ranked_.end());
+    if (cost >= worst->first)
+      return;
+    ranked_.erase(worst);
+  }
+  ranked_.emplace(cost, std::unique_ptr<Program>((Program *)p->clone()));
+}
+
+void EvaluatorPass::measurePending() {
+  unsigned n = pending_.size();
+  if (!n)
+    return;
+
+  // Compile all of the candidates in parallel.
+  std::vector<std::string> binaries(n);
+  parallelFor(n, numThreads_, [&](unsigned i) {
+    binaries[i] = backend_.compileBenchmark(pending_[i].get(), 10);
+  });
+
+  // Measure the candidates one at a time, in the order in which they were
+  // generated, to make the result independent of the number of threads.
+  {
+    ThreadPinner pin;
+    for (unsigned i = 0; i < n; i++) {
+      // Stop measuring when the time is up, once we have some result.
+      if (isOutOfTime() && getBestProgram())
+        break;
+      auto *candidate = pending_[i].get();
+      auto res = backend_.evaluateBinary(candidate, binaries[i], 10,
+                                         options_.measure)
+                     .median;
+      if (cache_)
+        cache_->recordTime(candidate->hash(), res);
+      if (options_.featureLog.size())
+        LearnedModel::appendToLog(options_.featureLog, res,
+                                  getProgramFeatures(candidate, machine_));
+      recordResult(candidate, res);
+    }
+  }
+
+  pending_.clear();
+}
 
-  auto res = backend_.evaluateCode(p, 10);
+void EvaluatorPass::recordResult(Program *p, double res) {
+  results_[p->hash()] = res;
+  sinceImprovement_++;
   if (res < bestTime_) {
+    sinceImprovement_ = 0;
+    std::unordered_map<ASTNode *, ComputeCostTy> heatmap;
+    estimateCompute(p, heatmap);
+    assert(heatmap.count(p) && "No information for the program");
+    auto info = heatmap[p];
+
     p->dump();
     std::cout << "New best result: " << res << ", "
               << prettyPrintNumber(info.second / res) << " flops/sec. \n";
 
-    bestTime_ = res;
-    bestProgram_.setReference(p->clone());
-
-    if (savePath_.size()) {
-      remove(savePath_.c_str());
-      if (isBytecode_) {
-        writeFile(savePath_, Bytecode::serialize(p));
-      } else {
-        // Emit the program code.
-        backend_.emitProgramCode(p, savePath_, isText_, 10);
-      }
-    }
+    setBestProgram(p, res);
+    if (cache_)
+      cache_->saveBest(p, res, false);
   } else {
     std::cout << "." << std::flush;
   }
 }
 
+void EvaluatorPass::setBestProgram(Program *p, double time) {
+  bestTime_ = time;
+  bestProgram_.setReference(p->clone());
+  saveProgram(p);
+}
+
+void EvaluatorPass::saveProgram(Program *p) {
+  if (savePath_.empty())
+    return;
+
+  remove(savePath_.c_str());
+  if (isBytecode_) {
+    writeFile(savePath_, Bytecode::serialize(p));
+  } else {
+    // Emit the program code.
+    backend_.emitProgramCode(p, savePath_, isText_, 10);
+  }
+}
+
+void EvaluatorPass::flush() {
+  // Measure the candidates with the best prediction first.
+  if (ranked_.size()) {
+    std::cout << "\nMeasuring the " << ranked_.size() << " best of "
+              << numRanked_ << " candidates.\n";
+    for (auto &candidate : ranked_) {
+      pending_.push_back(std::move(candidate.second));
+      if (pending_.size() >= batchSize_)
+        measurePending();
+    }
+    ranked_.clear();
+    numRanked_ = 0;
+  }
+  measurePending();
+}
+
+void EvaluatorPass::finish() {
+  flush();
+  // Mark the tuning session as completed, unless the budget cut it short.
+  if (cache_ && getBestProgram() && !isExhausted())
+    cache_->saveBest(getBestProgram(), bestTime_, true);
+}
+
 /// \returns a list of innermost loops in \p s.
 static std::vector<Loop *> collectInnermostLoops(Scope *s) {
   auto loops = collectLoops(s);
@@ -167,7 +488,8 @@ static std::vector<Loop *> collectLoopHierarchy(Loop *L, int levels) {
   return hierarchy;
 }
 
-void FilterPass::doIt(Program *p) {
+void FilterPass::getTransforms(Program *p,
+                               std::vector<Transform> &transforms) {
   std::vector<Loop *> loops;
   collectLoops(p, loops);
 
@@ -193,7 +515,7 @@ void FilterPass::doIt(Program *p) {
   }
 
   // All of the filters passed. Move on to the next level.
-  nextPass_->doIt(p);
+  transforms.push_back(keepProgram);
 }
 
 /// Collect the arguments that are used in the region \p s.
@@ -208,18 +530,58 @@ std::set<Argument *> collectArgsUsed(Stmt *s) {
   return args;
 }
 
-// Try to fuse all of the shallow fusable loops.
-bool tryToFuseAllShallowLoops(Program *p) {
+/// \returns True if the loop \p L2 reads or updates a buffer that the loop
+/// \p L writes. For example, an elementwise epilogue that follows a matrix
+/// multiplication.
+static bool isProducerConsumer(Loop *L, Loop *L2) {
+  std::vector<LoadExpr *> loads, loads2;
+  std::vector<StoreStmt *> stores, stores2;
+  collectLoadStores(L, loads, stores);
+  collectLoadStores(L2, loads2, stores2);
+
+  std::set<Argument *> produced;
+  for (auto *st : stores) {
+    produced.insert(st->getDest());
+  }
+  for (auto *ld : loads2) {
+    if (produced.count(ld->getDest()))
+      return true;
+  }
+  for (auto *st : stores2) {
+    if (produced.count(st->getDest()))
+      return true;
+  }
+  return false;
+}
+
+/// \returns the number of loops that enclose the statement \p s.
+static unsigned getLoopDepth(Stmt *s) {
+  unsigned depth = 0;
+  while (auto *parent = dynamic_cast<Stmt *>(s->getParent())) {
+    if (dynamic_cast<Loop *>(parent))
+      depth++;
+    s = parent;
+  }
+  return depth;
+}
+
+// Try to fuse all of the shallow fusable loops, in the \p levels outermost
+// levels of the loop nests.
+bool tryToFuseAllShallowLoops(Program *p, unsigned levels = 8) {
   bool changed = false;
 
 restart:
   for (auto *L : collectLoops(p)) {
+    unsigned depth = getLoopDepth(L);
+    if (depth >= levels)
+      continue;
+
     // Find the following consecutive loop.
     Loop *L2 = dynamic_cast<Loop *>(getNextStmt(L));
 
     // We were not able to find a consecutive loop.
     if (!L2)
-      return false;
+      continue;
 
     /// Scan the first and second loops and collect the buffers that we access.
     std::set<Argument *> buffers1 = collectArgsUsed(L);
@@ -233,13 +595,15 @@ restart:
       }
     }
 
-    // Heuristics: loops must share most of the buffers.
+    // Heuristics: loops must share most of the buffers, or the second loop
+    // must consume the output of the first loop, which saves a pass over the
+    // output.
     unsigned numBuffers = std::max(buffers1.size(), buffers2.size());
-    if (numShared < numBuffers / 2)
+    if (numShared < numBuffers / 2 && !isProducerConsumer(L, L2))
       continue;
 
     // Okay, the loops share most buffers. Let's merge them.
-    bool f = (bool)::fuse(L, 8);
+    bool f = (bool)::fuse(L, levels - depth);
     changed |= f;
 
     // The fuser deleted a loop. Simplify the code and run again.
@@ -251,33 +615,49 @@ restart:
   return changed;
 }
 
-// Try to vectorize all of the loops.
-bool tryToVectorizeAllLoops(Program *p, unsigned VF) {
+/// \returns the vectorization factor for the loop \p L, where a vector
+/// register holds \p width 32-bit lanes. Loops that only operate on narrow
+/// elements (such as int8 or bfloat16) fit more elements in a register.
+static unsigned getVectorizationFactor(Loop *L, unsigned width) {
+  unsigned widest = 1;
+  for (auto *E : collectExprs(L)) {
+    if (E->getType().isIndexTy())
+      continue;
+    widest = std::max(widest, E->getType().getElementSizeInBytes());
+  }
+  return std::max(1u, width * 4 / widest);
+}
+
+// Try to vectorize all of the loops. If \p masked is set then the remaining
+// iterations of the loops are executed with masks.
+bool tryToVectorizeAllLoops(Program *p, unsigned width, bool masked = false) {
   bool changed = false;
   for (auto *l : collectLoops(p)) {
-    changed |= (bool)::vectorize(l, VF);
+    changed |= (bool)::vectorize(l, getVectorizationFactor(l, width), masked);
   }
   return changed;
 }
 
-void VectorizerPass::doIt(Program *p) {
+void VectorizerPass::getTransforms(Program *p,
+                                   std::vector<Transform> &transforms) {
   p->verify();
 
-  // Vectorization Factor:
-  unsigned VF = backend_.getRegisterWidth();
+  // The number of 32-bit lanes in a vector register.
+  unsigned width = backend_.getRegisterWidth();
 
-  CloneCtx map;
-  std::unique_ptr<Program> np((Program *)p->clone(map));
+  // Try the version with masked tails. If no loop has a tail then this is the
+  // same as the vectorized version.
+  transforms.push_back([=](Program *np, CloneCtx &map) {
+    return tryToVectorizeAllLoops(np, width, true);
+  });
 
   // The vectorizer pass is pretty simple. Just try to vectorize all loops.
-  bool changed = tryToVectorizeAllLoops(np.get(), VF);
-
-  // Try the vectorized version:
-  if (changed)
-    nextPass_->doIt(np.get());
+  transforms.push_back([=](Program *np, CloneCtx &map) {
+    return tryToVectorizeAllLoops(np, width);
+  });
 
   // Try the unvectorized code.
-  nextPass_->doIt(p);
+  transforms.push_back(keepProgram);
 }
 
 /// Add element \p elem into the ordered set vector \p set.
@@ -328,20 +708,17 @@ bool sinkLoopsForConsecutiveIndexAccess(Program *p) {
   return changed;
 }
 
-void InterchangerPass::doIt(Program *p) {
+void InterchangerPass::getTransforms(Program *p,
+                                     std::vector<Transform> &transforms) {
   p->verify();
-  CloneCtx map;
-  std::unique_ptr<Program> np((Program *)p->clone(map));
 
   // Sink loops to allow vectorization.
-  bool changed = sinkLoopsForConsecutiveIndexAccess(np.get());
-
-  if (changed) {
-    nextPass_->doIt(np.get());
-  }
+  transforms.push_back([](Program *np, CloneCtx &map) {
+    return sinkLoopsForConsecutiveIndexAccess(np);
+  });
 
   // Evaluate the original version.
-  nextPass_->doIt(p);
+  transforms.push_back(keepProgram);
 }
 
 /// Compute the arithmetic and IO properties for the loop \p L.
@@ -408,11 +785,11 @@ bool tryToTileForLocality(Program *p) {
   return changed;
 }
 
-void TilerPass::doIt(Program *p) {
+void TilerPass::getTransforms(Program *p, std::vector<Transform> &transforms) {
   std::array<int, 6> tileSize = {8, 16, 32, 64, 128, 256};
   unsigned numTiles = tileSize.size();
   p->verify();
-  nextPass_->doIt(p);
+  transforms.push_back(keepProgram);
 
   // Collect the innermost loops.
   std::vector<Loop *> innermost = collectInnermostLoops(p);
@@ -441,41 +818,38 @@ void TilerPass::doIt(Program *p) {
     // tile size is a letter in the alphabet and we iterate over the words and
     // extract one letter at a time.
     unsigned numTries = ipow(numTiles, hierarchy.size());
-    bool changed = false;
     assert(numTries < 1e6 && "Too many combinations!");
 
     // Try all possible block size combinations (see comment above).
     for (unsigned attemptID = 0; attemptID < numTries; attemptID++) {
-
-      CloneCtx map;
-      std::unique_ptr<Program> np((Program *)p->clone(map));
-
-      int ctr = attemptID;
-      for (auto *l : hierarchy) {
-        // Pick the last
-        int currBlockSize = tileSize[ctr % numTiles];
-        ctr = ctr / numTiles;
-
-        // Adjust the tile size to the loop stride.
-        auto ts = roundTileSize(currBlockSize, l->getStride());
-        if (ts == 0)
-          continue;
-
-        auto *newL = map.get(l);
-        if (!::tile(newL, ts))
-          continue;
-
-        // Hoist the loop twice.
-        changed |= ::hoist(newL, hierarchy.size());
-      } // Loop hierarchy.
-      if (changed) {
-        nextPass_->doIt(np.get());
-      }
+      transforms.push_back([=](Program *np, CloneCtx &map) {
+        bool changed = false;
+        int ctr = attemptID;
+        for (auto *l : hierarchy) {
+          // Pick the last
+          int currBlockSize = tileSize[ctr % numTiles];
+          ctr = ctr / numTiles;
+
+          // Adjust the tile size to the loop stride.
+          auto ts = roundTileSize(currBlockSize, l->getStride());
+          if (ts == 0)
+            continue;
+
+          auto *newL = map.get(l);
+          if (!::tile(newL, ts))
+            continue;
+
+          // Hoist the loop twice.
+          changed |= ::hoist(newL, hierarchy.size());
+        } // Loop hierarchy.
+        return changed;
+      });
     } // Tiling attempt.
   }   // Each innermost loop.
 }
 
-void WidnerPass::doIt(Program *p) {
+void WidnerPass::getTransforms(Program *p,
+                               std::vector<Transform> &transforms) {
   std::array<int, 4> widths = {2, 3, 4, 5};
   unsigned numWidths = widths.size();
   p->verify();
@@ -505,73 +879,427 @@ void WidnerPass::doIt(Program *p) {
     // tile size is a letter in the alphabet and we iterate over the words and
     // extract one letter at a time.
     unsigned numTries = ipow(numWidths, hierarchy.size());
-    bool changed = false;
     assert(numTries < 1e6 && "Too many combinations!");
 
     // Try all possible block size combinations (see comment above).
     for (unsigned attemptID = 0; attemptID < numTries; attemptID++) {
-      CloneCtx map;
-      std::unique_ptr<Program> np((Program *)p->clone(map));
+      // Skip configurations that need too many registers.
       unsigned numRegs = 1;
-
       int ctr = attemptID;
-      for (auto *l : hierarchy) {
-        // Pick a width:
-        int ws = widths[ctr % numWidths];
+      for (unsigned i = 0; i < hierarchy.size(); i++) {
+        numRegs *= widths[ctr % numWidths];
         ctr = ctr / numWidths;
-
-        auto *newL = map.get(l);
-        changed |= (bool)::widen(newL, ws);
-        numRegs *= ws;
-      } // Loop hierarchy.
+      }
+      if (numRegs > maxRegs)
+        continue;
 
       // Try this configuration.
-      if (changed && numRegs <= maxRegs) {
-        nextPass_->doIt(np.get());
-      }
+      transforms.push_back([=](Program *np, CloneCtx &map) {
+        bool changed = false;
+        int ctr = attemptID;
+        for (auto *l : hierarchy) {
+          // Pick a width:
+          int ws = widths[ctr % numWidths];
+          ctr = ctr / numWidths;
+
+          auto *newL = map.get(l);
+          changed |= (bool)::widen(newL, ws);
+        } // Loop hierarchy.
+        return changed;
+      });
     } // Tiling attempt.
   }   // Each innermost loop.
 
   // Try unwidened loops.
-  nextPass_->doIt(p);
+  transforms.push_back(keepProgram);
 }
 
-void PromoterPass::doIt(Program *p) {
+void PromoterPass::getTransforms(Program *p,
+                                 std::vector<Transform> &transforms) {
   p->verify();
-  CloneCtx map;
   // This is a simple cleanup pass.
-  std::unique_ptr<Program> np((Program *)p->clone(map));
-  ::simplify(np.get());
-  ::promoteLICM(np.get());
-  nextPass_->doIt(np.get());
+  transforms.push_back([](Program *np, CloneCtx &map) {
+    ::simplify(np);
+    ::promoteLICM(np);
+    return true;
+  });
 }
 
-void DistributePass::doIt(Program *p) {
+void PrefetchPass::getTransforms(Program *p,
+                                 std::vector<Transform> &transforms) {
+  p->verify();
+  transforms.push_back(keepProgram);
+
+  // The prefetch distances to try, in iterations of the innermost loops.
+  const unsigned distances[] = {8, 32};
+  for (unsigned distance : distances) {
+    transforms.push_back([=](Program *np, CloneCtx &map) {
+      bool changed = false;
+      for (auto *L : collectInnermostLoops(np)) {
+        // Don't prefetch past the end of short loops.
+        if (L->getEnd() / L->getStride() <= distance)
+          continue;
+        changed |= ::prefetch(L, distance);
+      }
+      return changed;
+    });
+  }
+}
+
+void StreamPass::getTransforms(Program *p,
+                               std::vector<Transform> &transforms) {
+  p->verify();
+  transforms.push_back(keepProgram);
+
+  // Write the outputs that the program only writes with streaming stores.
+  transforms.push_back([](Program *np, CloneCtx &map) {
+    bool changed = false;
+    for (auto *arg : np->getArgs()) {
+      for (auto &s : np->getBody()) {
+        if (auto *L = dynamic_cast<Loop *>(s.get()))
+          changed |= ::streamStores(L, arg);
+      }
+    }
+    return changed;
+  });
+}
+
+void ParallelizerPass::getTransforms(Program *p,
+                                     std::vector<Transform> &transforms) {
+  p->verify();
+
+  // Try to run the outermost loops on all of the cores.
+  transforms.push_back([](Program *np, CloneCtx &map) {
+    bool changed = false;
+    for (auto &s : np->getBody()) {
+      if (auto *L = dynamic_cast<Loop *>(s.get()))
+        changed |= ::parallelize(L);
+    }
+    return changed;
+  });
+
+  // Evaluate the serial version.
+  transforms.push_back(keepProgram);
+}
+
+/// \returns True if the loop \p L reads the same elements of \p arg in many
+/// iterations of some loop. This is the case when the loads of \p arg don't
+/// depend on the loop.
+static bool isReusedInLoop(Loop *L, Argument *arg) {
+  std::vector<LoadExpr *> loads;
+  std::vector<StoreStmt *> stores;
+  collectLoadStores(L, loads, stores, arg);
+
+  std::vector<Loop *> loops = collectLoops(L);
+  loops.push_back(L);
+  for (auto *l : loops) {
+    if (l->getEnd() / l->getStride() < 4)
+      continue;
+    bool reused = true;
+    for (auto *ld : loads) {
+      reused &= !dependsOnLoop(ld, l);
+    }
+    if (reused)
+      return true;
+  }
+  return false;
+}
+
+void PackPass::getTransforms(Program *p, std::vector<Transform> &transforms) {
+  p->verify();
+  transforms.push_back(keepProgram);
+
+  // Pack the tiles of the arguments that are reused by the loop nests. The
+  // tiles are packed at the outermost loop where they fit in the packed
+  // buffer, to amortize the cost of the copy.
+  std::set<std::pair<Loop *, Argument *>> packed;
+  for (auto *inner : collectInnermostLoops(p)) {
+    std::vector<Loop *> hierarchy = collectLoopHierarchy(inner, 8);
+    for (auto *arg : p->getArgs()) {
+      for (auto it = hierarchy.rbegin(); *it != inner; ++it) {
+        Loop *L = *it;
+        if (!isReusedInLoop(L, arg))
+          continue;
+        // Another innermost loop in the nest already packed this tile.
+        if (packed.count({L, arg}))
+          break;
+
+        Type packedTy;
+        // Copying the whole argument does not change the access pattern.
+        if (!::canPack(L, arg, packedTy) ||
+            packedTy.size() >= arg->getType()->size())
+          continue;
+
+        packed.insert({L, arg});
+        transforms.push_back([=](Program *np, CloneCtx &map) {
+          return ::pack(map.get(L), map.get(arg)) != nullptr;
+        });
+        break;
+      }
+    }
+  }
+}
+
+void DistributePass::getTransforms(Program *p,
+                                   std::vector<Transform> &transforms) {
   p->verify();
-  CloneCtx map;
-  std::unique_ptr<Program> np((Program *)p->clone(map));
   // Distribute all of the loops to ensure that all of the non-scope stmts are
   // located in innermost loops. This allows us to interchange loops.
-  ::distributeAllLoops(np.get());
-  ::simplify(np.get());
-  nextPass_->doIt(np.get());
+  transforms.push_back([](Program *np, CloneCtx &map) {
+    ::distributeAllLoops(np);
+    ::simplify(np);
+    return true;
+  });
 }
 
-void FusePass::doIt(Program *p) {
+void FusePass::getTransforms(Program *p, std::vector<Transform> &transforms) {
   p->verify();
-  CloneCtx map;
-  std::unique_ptr<Program> np((Program *)p->clone(map));
-  // Try to fuse some of the loops that belong together.
-  bool changed = ::tryToFuseAllShallowLoops(np.get());
-  if (changed) {
-    nextPass_->doIt(np.get());
+  // Try to fuse some of the loops that belong together. Fusing only the
+  // outermost loops keeps the inner loops of the producer intact, and fusing
+  // the whole loop nests keeps the consumed values in registers.
+  for (unsigned levels : {1, 8}) {
+    transforms.push_back([=](Program *np, CloneCtx &map) {
+      return ::tryToFuseAllShallowLoops(np, levels);
+    });
   }
-  nextPass_->doIt(p);
+  transforms.push_back(keepProgram);
 }
 
+/// Explores the variants that the stages of the tuner generate, and sends the
+/// complete candidates to the evaluator.
+class SearchStrategy {
+protected:
+  /// The stages of the tuner, in the order in which they are applied.
+  std::vector<std::unique_ptr<Pass>> &stages_;
+  /// Evaluates the complete candidates.
+  EvaluatorPass &ev_;
+  /// Makes the random decisions of the search. The seed is fixed to make the
+  /// search reproducible.
+  std::mt19937 rng_{0};
+
+  /// A list of decisions, one for each stage. Each decision selects one of the
+  /// variants of the stage (modulo the number of variants).
+  using Genome = std::vector<unsigned>;
+
+  /// \returns the variants of the program \p p at the stage \p stage.
+  VariantList getVariants(Program *p, unsigned stage) {
+    VariantList variants;
+    stages_[stage]->getVariants(p, variants);
+    return variants;
+  }
+
+  /// \returns a random list of decisions.
+  Genome getRandomGenome() {
+    Genome genome(stages_.size());
+    for (auto &gene : genome) {
+      gene = rng_();
+    }
+    return genome;
+  }
+
+  /// Apply the decisions \p genome to the program \p p. Only the selected
+  /// variant of each stage is generated. If the selected transform does not
+  /// apply then the decision falls through to the next transform.
+  /// \returns the candidate, or nullptr if some stage rejected the program.
+  std::unique_ptr<Program> decode(Program *p, const Genome &genome) {
+    std::unique_ptr<Program> current;
+    for (unsigned i = 0; i < stages_.size(); i++) {
+      Program *prev = current ? current.get() : p;
+      std::vector<Transform> transforms;
+      stages_[i]->getTransforms(prev, transforms);
+      std::unique_ptr<Program> next;
+      unsigned n = transforms.size();
+      for (unsigned j = 0; j < n && !next; j++) {
+        next = Pass::getVariant(prev, transforms[(genome[i] % n + j) % n]);
+      }
+      if (!next)
+        return nullptr;
+      current = std::move(next);
+    }
+    return current ? std::move(current)
+                   : std::unique_ptr<Program>((Program *)p->clone());
+  }
+
+public:
+  SearchStrategy(std::vector<std::unique_ptr<Pass>> &stages, EvaluatorPass &ev)
+      : stages_(stages), ev_(ev) {}
+  virtual ~SearchStrategy() = default;
+  /// Search for the best version of the program \p p.
+  virtual void run(Program *p) = 0;
+};
+
+/// Evaluates all of the combinations of variants, in order.
+class ExhaustiveSearch : public SearchStrategy {
+  void explore(Program *p, unsigned stage) {
+    if (ev_.isExhausted())
+      return;
+    if (stage == stages_.size()) {
+      ev_.doIt(p);
+      return;
+    }
+    // Generate each variant right before exploring it, to keep only one
+    // variant of each stage alive.
+    std::vector<Transform> transforms;
+    stages_[stage]->getTransforms(p, transforms);
+    std::set<uint64_t> seen;
+    for (auto &t : transforms) {
+      if (ev_.isExhausted())
+        return;
+      auto variant = Pass::getVariant(p, t);
+      if (variant && seen.insert(variant->hash()).second)
+        explore(variant.get(), stage + 1);
+    }
+  }
+
+public:
+  using SearchStrategy::SearchStrategy;
+  virtual void run(Program *p) override { explore(p, 0); }
+};
+
+/// Evaluates random combinations of variants.
+class RandomSearch : public SearchStrategy {
+  /// Stop after this number of consecutive samples that were already
+  /// evaluated, which means that most of the search space was covered.
+  static constexpr unsigned maxRepeats_ = 1000;
+
+public:
+  using SearchStrategy::SearchStrategy;
+  virtual void run(Program *p) override {
+    unsigned repeats = 0;
+    while (!ev_.isExhausted() && repeats < maxRepeats_) {
+      auto candidate = decode(p, getRandomGenome());
+      bool isNew = candidate && ev_.doIt(candidate.get());
+      repeats = isNew ? 0 : repeats + 1;
+    }
+  }
+};
+
+/// Keeps the variants with the best predicted execution time at each stage,
+/// and evaluates the variants that survive the last stage.
+class BeamSearch : public SearchStrategy {
+  /// The number of variants that are kept at each stage.
+  unsigned width_;
+
+public:
+  BeamSearch(std::vector<std::unique_ptr<Pass>> &stages, EvaluatorPass &ev,
+             unsigned width)
+      : SearchStrategy(stages, ev), width_(std::max(1u, width)) {}
+
+  virtual void run(Program *p) override {
+    VariantList beam;
+    beam.emplace_back((Program *)p->clone());
+    for (unsigned i = 0; i < stages_.size(); i++) {
+      // Expand all of the programs in the beam, and drop duplicates.
+      std::vector<std::pair<double, std::unique_ptr<Program>>> next;
+      std::set<uint64_t> seen;
+      for (auto &prog : beam) {
+        for (auto &variant : getVariants(prog.get(), i)) {
+          if (!seen.insert(variant->hash()).second)
+            continue;
+          double cost = ev_.predict(variant.get());
+          next.emplace_back(cost, std::move(variant));
+        }
+      }
+
+      std::stable_sort(next.begin(), next.end(),
+                       [](const auto &a, const auto &b) {
+                         return a.first < b.first;
+                       });
+      beam.clear();
+      for (unsigned j = 0; j < next.size() && j < width_; j++) {
+        beam.push_back(std::move(next[j].second));
+      }
+    }
+
+    for (auto &candidate : beam) {
+      ev_.doIt(candidate.get());
+    }
+  }
+};
+
+/// Evolves a population of decision lists. The candidates of each generation
+/// are measured, and the fastest candidates are combined and mutated to form
+/// the next generation.
+class GeneticSearch : public SearchStrategy {
+  /// The number of candidates in each generation.
+  static constexpr unsigned populationSize_ = 16;
+  /// The number of best candidates that survive to the next generation.
+  static constexpr unsigned numElites_ = 2;
+  /// Stop after this number of generations that don't find new candidates.
+  static constexpr unsigned maxStale_ = 5;
+
+  /// \returns the index of the fitter of two random candidates.
+  unsigned selectParent(const std::vector<double> &fitness) {
+    unsigned a = rng_() % fitness.size();
+    unsigned b = rng_() % fitness.size();
+    return fitness[a] <= fitness[b] ? a : b;
+  }
+
+public:
+  using SearchStrategy::SearchStrategy;
+  virtual void run(Program *p) override {
+    std::vector<Genome> population;
+    for (unsigned i = 0; i < populationSize_; i++) {
+      population.push_back(getRandomGenome());
+    }
+
+    unsigned stale = 0;
+    while (!ev_.isExhausted() && stale < maxStale_) {
+      // Evaluate the generation. Rejected and unmeasured candidates have an
+      // infinite execution time.
+      std::vector<double> fitness(populationSize_,
+                                  std::numeric_limits<double>::infinity());
+      std::vector<uint64_t> hashes(populationSize_, 0);
+      bool found = false;
+      for (unsigned i = 0; i < populationSize_; i++) {
+        auto candidate = decode(p, population[i]);
+        if (!candidate)
+          continue;
+        hashes[i] = candidate->hash();
+        found |= ev_.doIt(candidate.get());
+      }
+      ev_.flush();
+      for (unsigned i = 0; i < populationSize_; i++) {
+        if (hashes[i])
+          ev_.lookupTime(hashes[i], fitness[i]);
+      }
+      stale = found ? 0 : stale + 1;
+
+      // Keep the best candidates.
+      std::vector<unsigned> order(populationSize_);
+      for (unsigned i = 0; i < populationSize_; i++) {
+        order[i] = i;
+      }
+      std::stable_sort(order.begin(), order.end(), [&](unsigned a, unsigned b) {
+        return fitness[a] < fitness[b];
+      });
+      std::vector<Genome> next;
+      for (unsigned i = 0; i < numElites_; i++) {
+        next.push_back(population[order[i]]);
+      }
+
+      // Fill the rest of the generation with the children of fit candidates.
+      while (next.size() < populationSize_) {
+        auto &mom = population[selectParent(fitness)];
+        auto &dad = population[selectParent(fitness)];
+        Genome child(stages_.size());
+        for (unsigned i = 0; i < child.size(); i++) {
+          child[i] = (rng_() % 2) ? mom[i] : dad[i];
+          // Mutate about one decision in every child.
+          if (rng_() % child.size() == 0)
+            child[i] = rng_();
+        }
+        next.push_back(child);
+      }
+      population = std::move(next);
+    }
+  }
+};
+
 Program *bistra::optimizeEvaluate(Backend &backend, Program *p,
                                   const std::string &filename, bool isTextual,
-                                  bool isBytecode) {
+                                  bool isBytecode,
+                                  const TuningOptions &options) {
 
   // A simple search procedure, similar to the one implemented here is
   // described in the paper:
@@ -579,16 +1307,81 @@ Program *bistra::optimizeEvaluate(Backend &backend, Program *p,
   // Autotuning GEMM Kernels for the Fermi GPU, 2012
   // Kurzak, Jakub and Tomov, Stanimire and Dongarra, Jack
 
-  auto *ev = new EvaluatorPass(backend, filename, isTextual, isBytecode);
-  Pass *ps = new FilterPass(backend, ev);
-  ps = new PromoterPass(ps);
-  ps = new WidnerPass(backend, ps);
-  ps = new VectorizerPass(backend, ps);
-  ps = new FusePass(ps);
-  ps = new TilerPass(ps);
-  ps = new InterchangerPass(ps);
-  ps = new DistributePass(ps);
-  ps->doIt(p);
+  unsigned numThreads = options.numThreads;
+  if (!numThreads)
+    numThreads = std::max(1u, std::thread::hardware_concurrency());
+
+  std::unique_ptr<TuningCache> cache;
+  if (options.cacheDir.size()) {
+    cache = std::make_unique<TuningCache>(options.cacheDir, p,
+                                          backend.getTargetDescription());
+  }
+
+  // The cost model uses the registers of the target.
+  MachineModel machine = options.machine;
+  machine.numRegisters = backend.getNumRegisters();
+  machine.vectorWidth = backend.getRegisterWidth();
+
+  // Train a model on the results of previous sessions.
+  LearnedModel model;
+  assert((!options.useLearnedModel || options.featureLog.size()) &&
+         "The learned model requires a feature log");
+  if (options.useLearnedModel) {
+    unsigned numFeatures = getProgramFeatures(p, machine).size();
+    if (unsigned n = model.trainFromLog(options.featureLog, numFeatures))
+      std::cout << "Trained the cost model on " << n << " results.\n";
+  }
+
+  auto *ev = new EvaluatorPass(backend, filename, isTextual, isBytecode,
+                               numThreads, cache.get(), options, machine,
+                               model);
+
+  // Return the result of a completed tuning session.
+  double time;
+  if (cache) {
+    if (Program *best = cache->loadCompletedBest(time)) {
+      std::cout << "Loaded a tuned program from the cache: " << time
+                << " seconds.\n";
+      best->dump();
+      ev->setBestProgram(best, time);
+      delete best;
+      return ev->getBestProgram();
+    }
+  }
+
+  // The stages of the tuner, in the order in which they transform the program.
+  std::vector<std::unique_ptr<Pass>> stages;
+  stages.emplace_back(new DistributePass());
+  stages.emplace_back(new InterchangerPass());
+  stages.emplace_back(new TilerPass());
+  stages.emplace_back(new FusePass());
+  stages.emplace_back(new PackPass());
+  stages.emplace_back(new VectorizerPass(backend));
+  stages.emplace_back(new WidnerPass(backend));
+  stages.emplace_back(new PromoterPass());
+  stages.emplace_back(new PrefetchPass());
+  stages.emplace_back(new StreamPass());
+  stages.emplace_back(new ParallelizerPass());
+  stages.emplace_back(new FilterPass(backend));
+
+  std::unique_ptr<SearchStrategy> search;
+  switch (options.search) {
+  case SearchKind::Exhaustive:
+    search = std::make_unique<ExhaustiveSearch>(stages, *ev);
+    break;
+  case SearchKind::Random:
+    search = std::make_unique<RandomSearch>(stages, *ev);
+    break;
+  case SearchKind::Beam:
+    search = std::make_unique<BeamSearch>(stages, *ev, options.beamWidth);
+    break;
+  case SearchKind::Genetic:
+    search = std::make_unique<GeneticSearch>(stages, *ev);
+    break;
+  }
+
+  search->run(p);
+  ev->finish();
   return ev->getBestProgram();
 }
 
@@ -597,8 +1390,8 @@ std::unique_ptr<Program> bistra::optimizeStatic(Backend *backend, Program *p) {
   CloneCtx map;
   std::unique_ptr<Program> np((Program *)p->clone(map));
 
-  // Vectorization factor.
-  unsigned VF = backend->getRegisterWidth();
+  // The number of 32-bit lanes in a vector register.
+  unsigned width = backend->getRegisterWidth();
 
   // Distribute all of the loops to ensure that all of the non-scope stmts are
   // located in innermost loops. This allows us to interchange loops.
@@ -611,7 +1404,7 @@ std::unique_ptr<Program> bistra::optimizeStatic(Backend *backend, Program *p) {
   // Try to fuse shallow loops.
   changed |= tryToFuseAllShallowLoops(np.get());
 
-  changed |= tryToVectorizeAllLoops(np.get(), VF);
+  changed |= tryToVectorizeAllLoops(np.get(), width);
 
   changed |= tryToTileForLocality(np.get());
 
@@ -0,0 +1,80 @@
+#include "bistra/Optimizer/TuningCache.h"
+#include "bistra/Bytecode/Bytecode.h"
+#include "bistra/Program/Program.h"
+#include "bistra/Program/Utils.h"
+
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+
+using namespace bistra;
+
+TuningCache::TuningCache(const std::string &dir, Program *p,
+                         const std::string &target)
+    : dir_(dir), key_(hashJoin(p->hash(), hashString(target))) {
+  std::error_code EC;
+  std::filesystem::create_directories(dir_, EC);
+  if (EC) {
+    std::cout << "Unable to create the tuning cache directory " << dir_
+              << "\n";
+  }
+
+  // Load the times of the candidates that were measured in previous sessions.
+  std::ifstream log(getPath(".log"));
+  uint64_t hash;
+  double time;
+  while (log >> std::hex >> hash >> std::dec >> time) {
+    times_[hash] = time;
+  }
+}
+
+std::string TuningCache::getPath(const std::string &suffix) const {
+  std::stringstream ss;
+  ss << std::hex << key_;
+  return dir_ + "/" + ss.str() + suffix;
+}
+
+bool TuningCache::lookupTime(uint64_t hash, double &time) const {
+  auto it = times_.find(hash);
+  if (it == times_.end())
+    return false;
+  time = it->second;
+  return true;
+}
+
+void TuningCache::recordTime(uint64_t hash, double time) {
+  times_[hash] = time;
+  // Append the result to the log, to allow resuming an interrupted session.
+  std::ofstream log(getPath(".log"), std::ios::app);
+  log << std::hex << hash << " " << std::dec << std::setprecision(10) << time
+      << "\n";
+}
+
+void TuningCache::saveBest(Program *p, double time, bool complete) {
+  // Write the record to a temporary file and rename it to make the update
+  // atomic.
+  auto path = getPath(".best");
+  auto tmpPath = path + ".tmp";
+  {
+    std::ofstream out(tmpPath, std::ios::binary | std::ios::trunc);
+    out << std::setprecision(10) << time << " " << complete << "\n";
+    out << Bytecode::serialize(p);
+  }
+  std::error_code EC;
+  std::filesystem::rename(tmpPath, path, EC);
+}
+
+Program *TuningCache::loadCompletedBest(double &time) const {
+  std::ifstream in(getPath(".best"), std::ios::binary);
+  bool complete = false;
+  if (!(in >> time >> complete) || !complete)
+    return nullptr;
+
+  // Skip the end of the record header and read the bytecode.
+  in.get();
+  std::string content((std::istreambuf_iterator<char>(in)),
+                      std::istreambuf_iterator<char>());
+  return Bytecode::deserialize(content);
+}
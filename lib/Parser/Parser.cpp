@@ -374,6 +374,23 @@ Expr *Parser::parseExprPrimary() {
     return new ConstantStringExpr(unescapeCString(str));
   }
 
+  case builtin_type_float:
+  case builtin_type_int8:
+  case builtin_type_int32:
+  case builtin_type_float16:
+  case builtin_type_bfloat16:
+  case builtin_type_index: {
+    // Parse a conversion, such as "int32(A[i])".
+    auto loc = Tok.getLoc();
+    ElemKind kind;
+    std::vector<Expr *> args;
+    if (parseBuiltinType(kind) || parseCallArgumentList(args, false, 1))
+      return nullptr;
+    if (args[0]->getType().getElementType() == kind)
+      return args[0];
+    return new CastExpr(args[0], kind, loc);
+  }
+
   case identifier: {
     auto argLoc = Tok.getLoc();
     std::string varName;
@@ -390,7 +407,7 @@ Expr *Parser::parseExprPrimary() {
     }
 
     // Check if this is a buffer access.
-    Argument *A = ctx_.getArgMap().getByName(varName);
+    Argument *A = getBufferByName(varName);
     if (Tok.is(l_square)) {
       if (!A) {
         ctx_.diagnose(DiagnoseKind::Error, Tok.getLoc(),
@@ -512,6 +529,18 @@ bool Parser::parseBuiltinType(ElemKind &kind) {
     kind = ElemKind::Int8Ty;
     break;
 
+  case TokenKind::builtin_type_int32:
+    kind = ElemKind::Int32Ty;
+    break;
+
+  case TokenKind::builtin_type_float16:
+    kind = ElemKind::Float16Ty;
+    break;
+
+  case TokenKind::builtin_type_bfloat16:
+    kind = ElemKind::BFloat16Ty;
+    break;
+
   case TokenKind::builtin_type_index:
     kind = ElemKind::IndexTy;
     break;
@@ -544,6 +573,11 @@ bool Parser::parseNamedType(Type &T, std::string &name) {
     return true;
   }
 
+  return parseDimList(scalarsTy, T);
+}
+
+// Example: <I:512,J:512>
+bool Parser::parseDimList(ElemKind scalarsTy, Type &T) {
   if (!consumeIf(TokenKind::lt)) {
     ctx_.diagnose(DiagnoseKind::Error, Tok.getLoc(),
                   "expecting dimension list");
@@ -585,6 +619,12 @@ bool Parser::parseNamedType(Type &T, std::string &name) {
   return false;
 }
 
+Argument *Parser::getBufferByName(const std::string &name) {
+  if (Argument *arg = ctx_.getArgMap().getByName(name))
+    return arg;
+  return ctx_.getTensorMap().getByName(name);
+}
+
 bool Parser::parseScope(Scope *scope) {
   // Remember the state of the let expression stack.
   auto letStackHandle = ctx_.getLetStack().getStackLevel();
@@ -817,7 +857,7 @@ bool Parser::parseLiteralOrDimExpr(int &value) {
       }
     }
 
-    Argument *arg = ctx_.getArgMap().getByName(varName);
+    Argument *arg = getBufferByName(varName);
     if (!arg) {
       ctx_.diagnose(DiagnoseKind::Error, Tok.getLoc(),
                     "unexpected argument name in for loop range: " + varName);
@@ -879,6 +919,44 @@ bool Parser::parseLetStmt() {
   return false;
 }
 
+bool Parser::parseDynamicDecl() {
+  consumeToken(TokenKind::kw_dynamic);
+
+  // dynamic batch = 1, 8, 32
+  std::string dimName;
+  if (parseIdentifier(dimName)) {
+    ctx_.diagnose(DiagnoseKind::Error, Tok.getLoc(),
+                  "expecting a dimension name in dynamic decleration");
+    return true;
+  }
+
+  if (!consumeIf(TokenKind::assign)) {
+    ctx_.diagnose(DiagnoseKind::Error, Tok.getLoc(),
+                  "expecting assignment in dynamic decleration");
+    return true;
+  }
+
+  std::vector<unsigned> sizes;
+  do {
+    int size;
+    if (parseIntegerLiteral(size) || size <= 0) {
+      ctx_.diagnose(DiagnoseKind::Error, Tok.getLoc(),
+                    "expecting a positive size in dynamic decleration");
+      return true;
+    }
+    sizes.push_back(size);
+  } while (consumeIf(TokenKind::comma));
+
+  ctx_.setDynamicDim(dimName, sizes);
+
+  // The caller may register the size to specialize the program for (see
+  // parseProgram). Use the first size otherwise.
+  if (!ctx_.getLetStack().getByName(dimName)) {
+    ctx_.getLetStack().registerValue(dimName, new ConstantExpr(sizes[0]));
+  }
+  return false;
+}
+
 bool Parser::parseVarDecl(Scope *s) {
   consumeToken(TokenKind::kw_var);
 
@@ -899,6 +977,27 @@ bool Parser::parseVarDecl(Scope *s) {
     return true;
   }
 
+  if (getBufferByName(varName)) {
+    ctx_.diagnose(DiagnoseKind::Error, Tok.getLoc(),
+                  varName + " buffer with this name already exists");
+    return true;
+  }
+
+  // Parse local tensors. Example: var T : float<I:4, J:8>
+  if (Tok.is(TokenKind::lt)) {
+    Type T;
+    if (parseDimList(scalarsTy, T)) {
+      return true;
+    }
+    if (ctx_.getVarMap().getByName(varName)) {
+      ctx_.diagnose(DiagnoseKind::Error, Tok.getLoc(),
+                    varName + " variable with this name already exists");
+      return true;
+    }
+    ctx_.getTensorMap().registerValue(new Argument(varName, T));
+    return false;
+  }
+
   Expr *storedValue = nullptr;
   auto storedValLoc = Tok.getLoc();
   // Parse the assignment to the variable.
@@ -994,7 +1093,7 @@ Stmt *Parser::parseOneStmt() {
       return new CallStmt(varName, params, argLoc);
     }
 
-    Argument *arg = ctx_.getArgMap().getByName(varName);
+    Argument *arg = getBufferByName(varName);
     if (!arg) {
       ctx_.diagnose(DiagnoseKind::Error, Tok.getLoc(),
                     "accessing unknown variable.");
@@ -1045,6 +1144,17 @@ Stmt *Parser::parseOneStmt() {
         return nullptr;
       }
 
+      // Check that the stored value matches the type of the buffer. Integer
+      // literals are stored into buffers of any type.
+      auto elemTy = arg->getType()->getElementType();
+      auto valTy = storedValue->getType();
+      if (!valTy.isIndexTy() && valTy.getElementType() != elemTy) {
+        ctx_.diagnose(DiagnoseKind::Error, asLoc,
+                      "storing a value of a different type into a buffer of " +
+                          std::string(Type::getElementName(elemTy)));
+        return nullptr;
+      }
+
       return new StoreStmt(arg, indices, storedValue, accumulate, asLoc);
     }
 
@@ -1095,7 +1205,9 @@ void Parser::parseScriptDecl() {
   while (!Tok.is(TokenKind::r_brace)) {
     std::string loopName = "";
     std::string newName = "";
+    std::string argName = "";
     int arg0 = 0;
+    bool masked = false;
     auto loc = Tok.getLoc();
 
     PragmaCommand::PragmaKind pk = PragmaCommand::PragmaKind::other;
@@ -1112,6 +1224,10 @@ void Parser::parseScriptDecl() {
     MATCH(sink);
     MATCH(fuse);
     MATCH(distribute);
+    MATCH(parallelize);
+    MATCH(pack);
+    MATCH(prefetch);
+    MATCH(stream);
 #undef MATCH
 
     if (pk == PragmaCommand::PragmaKind::other) {
@@ -1136,12 +1252,29 @@ void Parser::parseScriptDecl() {
       continue;
     }
 
-    if (pk == PragmaCommand::PragmaKind::distribute) {
-      // We are not parsing any arguments for the distribute command.
+    if (pk == PragmaCommand::PragmaKind::distribute ||
+        pk == PragmaCommand::PragmaKind::parallelize) {
+      // We are not parsing any arguments for the distribute and parallelize
+      // commands.
+      goto pragma_done;
+    }
+
+    // pack "i" "A"
+    // stream "i" "A"
+    if (pk == PragmaCommand::PragmaKind::pack ||
+        pk == PragmaCommand::PragmaKind::stream) {
+      if (parseStringLiteral(argName)) {
+        ctx_.diagnose(DiagnoseKind::Error, Tok.getLoc(),
+                      "expecting argument name after loop name.");
+        skipUntil(r_brace);
+        continue;
+      }
       goto pragma_done;
     }
 
     consumeIf(TokenKind::kw_to);
+    // prefetch "k" distance 8
+    consumeIf(TokenKind::kw_distance);
 
     if (parseIntegerLiteral(arg0)) {
       ctx_.diagnose(DiagnoseKind::Error, Tok.getLoc(),
@@ -1152,6 +1285,11 @@ void Parser::parseScriptDecl() {
 
     consumeIf(TokenKind::kw_times);
 
+    // vectorize "i" to 8 masked.
+    if (pk == PragmaCommand::PragmaKind::vectorize) {
+      masked = consumeIf(TokenKind::kw_masked);
+    }
+
     // tile "i" 4 times [as "newname"].
     if (Tok.is(TokenKind::kw_as)) {
       consumeToken(kw_as);
@@ -1165,7 +1303,8 @@ void Parser::parseScriptDecl() {
 
   pragma_done:
     // Register the command.
-    PragmaCommand pc(pk, loopName, newName, arg0, loc);
+    PragmaCommand pc(pk, loopName, newName, arg0, loc, argName);
+    pc.masked_ = masked;
     ctx_.addPragma(pc);
   }
 
@@ -1233,10 +1372,13 @@ Program *Parser::parseFunctionDecl() {
     return nullptr;
   }
 
-  // Register all of the variables that were declared.
+  // Register all of the variables and tensors that were declared.
   for (auto *v : ctx_.getVarMap()) {
     p->addVar(v);
   }
+  for (auto *t : ctx_.getTensorMap()) {
+    p->addTensor(t);
+  }
   return p;
 }
 
@@ -1244,32 +1386,45 @@ void Parser::parse() {
   // Prime the Lexer!
   consumeToken();
 
-  // Parse let statements in the beginning of the program.
-  while (Tok.is(TokenKind::kw_let)) {
-    if (parseLetStmt())
+  while (!Tok.is(TokenKind::eof)) {
+    // Parse let statements and the dynamic dimension.
+    if (Tok.is(TokenKind::kw_let) || Tok.is(TokenKind::kw_dynamic)) {
+      if (Tok.is(TokenKind::kw_dynamic) ? parseDynamicDecl() : parseLetStmt())
+        return;
+      continue;
+    }
+
+    // Only allow function declerations in the top-level scope.
+    if (!Tok.is(kw_func)) {
+      ctx_.diagnose(DiagnoseKind::Error, Tok.getLoc(),
+                    "expecting function decleration.");
+      return;
+    }
+
+    auto loc = Tok.getLoc();
+    Program *func = parseFunctionDecl();
+    ctx_.clearFunctionState();
+    if (!func)
       return;
-  }
 
-  // Only allow function declerations in the top-level scope.
-  if (Tok.is(kw_func)) {
-    if (Program *func = parseFunctionDecl()) {
-      ctx_.registerProgram(func);
+    if (ctx_.getProgramByName(func->getName())) {
+      ctx_.diagnose(DiagnoseKind::Error, loc,
+                    "function with this name already exists.");
+      delete func;
+      return;
     }
+    ctx_.registerProgram(func);
 
+    // Each function may be followed by the script that optimizes it.
     if (Tok.is(kw_script)) {
       parseScriptDecl();
     }
-
-    if (!Tok.is(TokenKind::eof)) {
-      ctx_.diagnose(DiagnoseKind::Error, Tok.getLoc(),
-                    "expecting eof of file after function.");
-    }
-    return;
   }
 
-  ctx_.diagnose(DiagnoseKind::Error, Tok.getLoc(),
-                "expecting function decleration.");
-  return;
+  if (ctx_.getPrograms().empty()) {
+    ctx_.diagnose(DiagnoseKind::Error, Tok.getLoc(),
+                  "expecting function decleration.");
+  }
 }
 
 Program *bistra::parseProgram(ParserContext &ctx,
@@ -26,7 +26,11 @@ Loop *ParserContext::popLoop() {
   return L;
 }
 
-void ParserContext::addPragma(PragmaCommand &pc) { pragmas_.push_back(pc); }
+void ParserContext::addPragma(PragmaCommand &pc) {
+  // Scripts of functions that failed to parse are ignored.
+  if (pragmas_.size())
+    pragmas_.back().push_back(pc);
+}
 
 std::pair<unsigned, unsigned> ParserContext::getLineCol(DebugLoc pos) {
   // Don't try to analyze the buffer if debug-loc is unavailable.
@@ -101,4 +105,21 @@ void ParserContext::diagnose(DiagnoseKind kind, DebugLoc loc,
   std::cout << "^\n\n";
 }
 
-void ParserContext::registerProgram(Program *p) { prog_ = p; }
+void ParserContext::registerProgram(Program *p) {
+  progs_.push_back(p);
+  pragmas_.emplace_back();
+}
+
+void ParserContext::clearFunctionState() {
+  argMap_.clear();
+  varMap_.clear();
+  tensorMap_.clear();
+}
+
+Program *ParserContext::getProgramByName(const std::string &name) const {
+  for (auto *p : progs_) {
+    if (p->getName() == name)
+      return p;
+  }
+  return nullptr;
+}
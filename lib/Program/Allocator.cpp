@@ -0,0 +1,184 @@
+#include "bistra/Program/Allocator.h"
+
+#include <mutex>
+#include <new>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+using namespace bistra;
+
+namespace {
+
+constexpr size_t kGranule = NodeAllocator::kGranule;
+constexpr size_t kNumClasses = NodeAllocator::kMaxNodeSize / kGranule;
+
+/// An entry in a free list, which is placed in the memory of a released node.
+struct FreeNode {
+  FreeNode *next_;
+};
+
+/// \returns the size class of nodes of \p size bytes.
+size_t getSizeClass(size_t size) { return (size - 1) / kGranule; }
+
+/// \returns the number of bytes of the nodes in the size class \p sc.
+size_t getClassSize(size_t sc) { return (sc + 1) * kGranule; }
+
+/// Pushes the memory \p ptr to the front of the free list \p list.
+void push(FreeNode *&list, void *ptr) {
+  auto *node = (FreeNode *)ptr;
+  node->next_ = list;
+  list = node;
+}
+
+/// Holds the memory of the threads that exited, until other threads use it.
+struct SharedPool {
+  std::mutex lock_;
+  /// The free lists that threads returned, for each size class.
+  std::vector<FreeNode *> lists_[kNumClasses];
+  /// The unused parts of slabs, as [begin, end) ranges.
+  std::vector<std::pair<char *, char *>> slabs_;
+
+  /// Adds the unused range [\p begin, \p end) of some slab to the pool.
+  void addRange(char *begin, char *end) {
+    if (begin != end)
+      slabs_.push_back({begin, end});
+  }
+};
+
+/// \returns the shared pool. The pool is never destroyed, because nodes may be
+/// deleted during the destruction of static objects.
+SharedPool &getSharedPool() {
+  static auto *pool = new SharedPool();
+  return *pool;
+}
+
+/// Set when the pool of the current thread was destroyed. After that point
+/// the thread allocates and releases nodes through the shared pool.
+thread_local bool threadPoolDestroyed = false;
+
+/// The slab and the free lists of one thread.
+struct ThreadPool {
+  /// The free lists, for each size class.
+  FreeNode *lists_[kNumClasses] = {};
+  /// The unused part of the current slab.
+  char *cur_{nullptr};
+  char *end_{nullptr};
+
+  ~ThreadPool() {
+    auto &shared = getSharedPool();
+    std::lock_guard<std::mutex> guard(shared.lock_);
+    for (size_t sc = 0; sc < kNumClasses; sc++) {
+      if (lists_[sc])
+        shared.lists_[sc].push_back(lists_[sc]);
+    }
+    shared.addRange(cur_, end_);
+    threadPoolDestroyed = true;
+  }
+
+  /// \returns memory for a node in the size class \p sc.
+  void *allocate(size_t sc) {
+    if (FreeNode *node = lists_[sc]) {
+      lists_[sc] = node->next_;
+      return node;
+    }
+
+    size_t size = getClassSize(sc);
+    if (size_t(end_ - cur_) < size)
+      refill(sc);
+    if (FreeNode *node = lists_[sc]) {
+      lists_[sc] = node->next_;
+      return node;
+    }
+
+    void *ptr = cur_;
+    cur_ += size;
+    return ptr;
+  }
+
+  /// Gets more memory for the size class \p sc, either in its free list or in
+  /// the current slab.
+  void refill(size_t sc) {
+    // The end of the current slab is too small for this node. Keep it for
+    // smaller nodes.
+    if (size_t rest = end_ - cur_) {
+      push(lists_[getSizeClass(rest)], cur_);
+    }
+    cur_ = end_ = nullptr;
+
+    {
+      auto &shared = getSharedPool();
+      std::lock_guard<std::mutex> guard(shared.lock_);
+      // Adopt a free list of a thread that exited.
+      auto &lists = shared.lists_[sc];
+      if (!lists.empty()) {
+        lists_[sc] = lists.back();
+        lists.pop_back();
+        return;
+      }
+      // Continue a slab of a thread that exited.
+      if (!shared.slabs_.empty()) {
+        std::tie(cur_, end_) = shared.slabs_.back();
+        shared.slabs_.pop_back();
+        if (size_t(end_ - cur_) >= getClassSize(sc))
+          return;
+        push(lists_[getSizeClass(end_ - cur_)], cur_);
+      }
+    }
+
+    cur_ = (char *)::operator new(NodeAllocator::kSlabSize);
+    end_ = cur_ + NodeAllocator::kSlabSize;
+  }
+};
+
+/// \returns the pool of the current thread.
+ThreadPool &getThreadPool() {
+  thread_local ThreadPool pool;
+  return pool;
+}
+
+} // namespace
+
+void *NodeAllocator::allocate(size_t size) {
+  if (size > kMaxNodeSize)
+    return ::operator new(size);
+
+  size_t sc = getSizeClass(size);
+  if (!threadPoolDestroyed)
+    return getThreadPool().allocate(sc);
+
+  auto &shared = getSharedPool();
+  std::lock_guard<std::mutex> guard(shared.lock_);
+  auto &lists = shared.lists_[sc];
+  if (!lists.empty()) {
+    FreeNode *node = lists.back();
+    if (node->next_) {
+      lists.back() = node->next_;
+    } else {
+      lists.pop_back();
+    }
+    return node;
+  }
+  return ::operator new(getClassSize(sc));
+}
+
+void NodeAllocator::deallocate(void *ptr, size_t size) {
+  if (!ptr)
+    return;
+  if (size > kMaxNodeSize) {
+    ::operator delete(ptr);
+    return;
+  }
+
+  size_t sc = getSizeClass(size);
+  if (!threadPoolDestroyed) {
+    push(getThreadPool().lists_[sc], ptr);
+    return;
+  }
+
+  auto &shared = getSharedPool();
+  std::lock_guard<std::mutex> guard(shared.lock_);
+  FreeNode *list = nullptr;
+  push(list, ptr);
+  shared.lists_[sc].push_back(list);
+}
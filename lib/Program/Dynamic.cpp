@@ -0,0 +1,224 @@
+#include "bistra/Program/Dynamic.h"
+#include "bistra/Analysis/Visitors.h"
+
+#include <algorithm>
+#include <iostream>
+#include <map>
+#include <set>
+
+using namespace bistra;
+
+void DynamicKernel::addVariant(unsigned size, Program *p) {
+  assert(size && !getVariant(size) && "Invalid variant size");
+  p->setName(name_ + "_" + std::to_string(size));
+  auto it = variants_.begin();
+  while (it != variants_.end() && it->first < size) {
+    ++it;
+  }
+  variants_.insert(it, {size, std::unique_ptr<Program>(p)});
+}
+
+Program *DynamicKernel::replaceVariant(unsigned size, Program *p) {
+  for (auto &v : variants_) {
+    if (v.first != size)
+      continue;
+    p->setName(v.second->getName());
+    auto *old = v.second.release();
+    v.second.reset(p);
+    return old;
+  }
+  assert(false && "No variant for this size");
+  return nullptr;
+}
+
+Program *DynamicKernel::getVariant(unsigned size) const {
+  for (auto &v : variants_) {
+    if (v.first == size)
+      return v.second.get();
+  }
+  return nullptr;
+}
+
+uint64_t DynamicKernel::getArgRowSize(unsigned idx) const {
+  assert(variants_.size() && variants_[0].first == 1 && "No generic variant");
+  return variants_[0].second->getArg(idx)->getType()->getSizeInBytes();
+}
+
+namespace {
+/// A visitor class that collects the buffers that a program writes.
+struct StoreDestCollector : public NodeVisitor {
+  std::set<Argument *> &dests_;
+  StoreDestCollector(std::set<Argument *> &dests) : dests_(dests) {}
+
+  virtual void enter(Stmt *S) override {
+    if (auto *ST = dynamic_cast<StoreStmt *>(S))
+      dests_.insert(ST->getDest());
+  }
+};
+
+/// A visitor class that collects the first subscript of the loads and the
+/// stores of some buffers.
+struct RowSubscriptCollector : public NodeVisitor {
+  /// The buffers to inspect.
+  const std::set<Argument *> &args_;
+  /// The first subscript of each access.
+  std::vector<Expr *> &rows_;
+  RowSubscriptCollector(const std::set<Argument *> &args,
+                        std::vector<Expr *> &rows)
+      : args_(args), rows_(rows) {}
+
+  virtual void enter(Stmt *S) override {
+    if (auto *ST = dynamic_cast<StoreStmt *>(S)) {
+      if (args_.count(ST->getDest()))
+        rows_.push_back(ST->getIndices()[0].get());
+    }
+  }
+  virtual void enter(Expr *E) override {
+    if (auto *LD = dynamic_cast<LoadExpr *>(E)) {
+      if (args_.count(LD->getDest()))
+        rows_.push_back(LD->getIndices()[0].get());
+    }
+  }
+};
+
+
+/// A visitor class that collects the loops of a program.
+struct LoopCollector : public NodeVisitor {
+  std::vector<Loop *> &loops_;
+  LoopCollector(std::vector<Loop *> &loops) : loops_(loops) {}
+
+  virtual void enter(Stmt *S) override {
+    if (auto *L = dynamic_cast<Loop *>(S))
+      loops_.push_back(L);
+  }
+};
+} // namespace
+
+/// \returns the loops of the variant \p p whose trip count depends on the
+/// dynamic dimension. These are the loops whose range is different from the
+/// loop with the same name in the \p generic variant.
+static std::vector<Loop *> getDynamicLoops(Program *p, Program *generic) {
+  std::vector<Loop *> loops, genericLoops;
+  LoopCollector LC(loops), GLC(genericLoops);
+  p->visit(&LC);
+  generic->visit(&GLC);
+
+  std::map<std::string, std::set<unsigned>> genericEnds;
+  for (auto *L : genericLoops) {
+    genericEnds[L->getName()].insert(L->getEnd());
+  }
+
+  std::vector<Loop *> dynamicLoops;
+  for (auto *L : loops) {
+    if (!genericEnds[L->getName()].count(L->getEnd()))
+      dynamicLoops.push_back(L);
+  }
+  return dynamicLoops;
+}
+
+/// \returns True if the subscript \p row selects the row of the current
+/// iteration of the loop \p L, which spans the whole dynamic dimension of the
+/// size \p size.
+static bool isOwnRow(Expr *row, Loop *L, unsigned size) {
+  auto *idx = dynamic_cast<IndexExpr *>(row);
+  return idx && idx->getLoop() == L && L->getEnd() == size &&
+         L->getStride() == 1;
+}
+
+bool DynamicKernel::analyze() {
+  // The generic variant processes one element of the dimension.
+  if (variants_.empty() || variants_[0].first != 1)
+    return false;
+
+  Program *generic = variants_[0].second.get();
+  unsigned numArgs = generic->getArgs().size();
+  dynamicArgs_.assign(numArgs, false);
+
+  for (auto &v : variants_) {
+    Program *p = v.second.get();
+    if (p->getArgs().size() != numArgs)
+      return false;
+
+    for (unsigned i = 0; i < numArgs; i++) {
+      auto *ty = p->getArg(i)->getType();
+      auto *genericTy = generic->getArg(i)->getType();
+      if (ty->getElementType() != genericTy->getElementType() ||
+          ty->getNumDims() != genericTy->getNumDims())
+        return false;
+      if (ty->getDims() == genericTy->getDims())
+        continue;
+
+      // Only the outermost dimension may change with the size.
+      if (ty->getDims()[0] != v.first || genericTy->getDims()[0] != 1)
+        return false;
+      for (unsigned d = 1; d < ty->getNumDims(); d++) {
+        if (ty->getDims()[d] != genericTy->getDims()[d])
+          return false;
+      }
+      dynamicArgs_[i] = true;
+    }
+  }
+
+  for (auto &v : variants_) {
+    Program *p = v.second.get();
+
+    // The chunks must not write to the same buffers.
+    std::set<Argument *> dests;
+    StoreDestCollector SDC(dests);
+    p->visit(&SDC);
+    for (unsigned i = 0; i < numArgs; i++) {
+      if (dests.count(p->getArg(i)) && !dynamicArgs_[i])
+        return false;
+    }
+
+    // A single loop may iterate over the dynamic dimension, and each of its
+    // iterations must only access its own row, so that the rows don't depend
+    // on each other. This rejects reductions over the dimension, nested loops
+    // over the dimension and accesses to neighboring rows. The generic
+    // variant has a single row.
+    if (v.first > 1) {
+      std::vector<Loop *> dynamicLoops = getDynamicLoops(p, generic);
+      if (dynamicLoops.size() > 1)
+        return false;
+      Loop *rowLoop = dynamicLoops.empty() ? nullptr : dynamicLoops[0];
+
+      std::set<Argument *> dynamic;
+      for (unsigned i = 0; i < numArgs; i++) {
+        if (dynamicArgs_[i])
+          dynamic.insert(p->getArg(i));
+      }
+      std::vector<Expr *> rows;
+      RowSubscriptCollector RSC(dynamic, rows);
+      p->visit(&RSC);
+      for (auto *row : rows) {
+        if (!isOwnRow(row, rowLoop, v.first))
+          return false;
+      }
+    }
+
+    // The chunks start at a multiple of the size of one element of the
+    // dimension, which may be less aligned than the buffer.
+    for (unsigned i = 0; i < numArgs; i++) {
+      if (!dynamicArgs_[i])
+        continue;
+      uint64_t row = getArgRowSize(i);
+      uint64_t rowAlign = row & -row;
+      auto *arg = p->getArg(i);
+      if (arg->getAlignment() > rowAlign)
+        arg->setAlignment(rowAlign);
+    }
+  }
+
+  return true;
+}
+
+void DynamicKernel::dump() const {
+  std::cout << "dynamic " << name_ << " on " << dimName_ << " = ";
+  for (unsigned i = 0; i < variants_.size(); i++) {
+    std::cout << (i ? ", " : "") << variants_[i].first;
+  }
+  std::cout << "\n";
+  for (auto &v : variants_) {
+    v.second->dump();
+  }
+}
@@ -0,0 +1,158 @@
+#include "bistra/Program/Library.h"
+
+#include <cctype>
+#include <sstream>
+
+using namespace bistra;
+
+/// \returns the dimensions of all of the arguments of \p p, concatenated.
+static std::vector<unsigned> getArgDims(Program *p) {
+  std::vector<unsigned> dims;
+  for (auto *arg : p->getArgs()) {
+    auto &d = arg->getType()->getDims();
+    dims.insert(dims.end(), d.begin(), d.end());
+  }
+  return dims;
+}
+
+/// \returns the types of the arguments of \p p.
+static std::vector<Type> getArgTypes(Program *p) {
+  std::vector<Type> types;
+  for (auto *arg : p->getArgs()) {
+    types.push_back(*arg->getType());
+  }
+  return types;
+}
+
+bool KernelLibrary::addKernel(Program *p) {
+  std::string name = p->getName();
+  if (getKernel(name, getArgTypes(p)))
+    return false;
+
+  // Pick a unique symbol for kernels that share a name.
+  auto isTaken = [&](const std::string &symbol) {
+    for (auto &k : kernels_) {
+      if (k.second->getName() == symbol)
+        return true;
+    }
+    return false;
+  };
+  for (unsigned i = 1; isTaken(p->getName()); i++) {
+    p->setName(name + "_" + std::to_string(i));
+  }
+
+  kernels_.emplace_back(name, std::unique_ptr<Program>(p));
+  return true;
+}
+
+Program *KernelLibrary::getKernel(const std::string &name,
+                                  const std::vector<Type> &types) const {
+  for (auto &k : kernels_) {
+    if (k.first == name && getArgTypes(k.second.get()) == types)
+      return k.second.get();
+  }
+  return nullptr;
+}
+
+Program *KernelLibrary::getKernel(const std::string &name,
+                                  const std::vector<unsigned> &dims) const {
+  for (auto &k : kernels_) {
+    if (k.first == name && getArgDims(k.second.get()) == dims)
+      return k.second.get();
+  }
+  return nullptr;
+}
+
+std::string KernelLibrary::emitHeader() const {
+  std::stringstream os;
+  std::string guard = name_;
+  for (auto &c : guard) {
+    c = isalnum(c) ? toupper(c) : '_';
+  }
+  guard += "_H";
+
+  os << "/* Generated by bistrac. Do not edit. */\n";
+  os << "#ifndef " << guard << "\n#define " << guard << "\n\n";
+  os << "#include <stdint.h>\n#include <string.h>\n\n";
+  os << "#ifdef __cplusplus\nextern \"C\" {\n#endif\n\n";
+
+  // The layout of the registry, which is shared by all of the libraries.
+  os << "#ifndef BISTRA_KERNEL_INFO_DEFINED\n"
+        "#define BISTRA_KERNEL_INFO_DEFINED\n\n"
+        "/* The element types of the tensors. */\n";
+  const char *kinds[] = {"FLOAT32", "INT8",  "INDEX",   "PTR",
+                         "STRING",  "INT32", "FLOAT16", "BFLOAT16"};
+  for (unsigned i = 0; i < sizeof(kinds) / sizeof(kinds[0]); i++) {
+    os << "#define BISTRA_" << kinds[i] << " " << i << "\n";
+  }
+  os << "\n"
+        "/* Describes one tensor argument of a kernel. */\n"
+        "typedef struct {\n"
+        "  const char *name;\n"
+        "  const int64_t *dims;\n"
+        "  uint32_t num_dims;\n"
+        "  uint32_t element_kind;\n"
+        "  uint32_t element_size;\n"
+        "  uint32_t alignment;\n"
+        "} bistra_tensor_info;\n\n"
+        "/* Describes a kernel. The function takes a pointer to each tensor. */\n"
+        "typedef struct {\n"
+        "  const char *name;\n"
+        "  void *func;\n"
+        "  const bistra_tensor_info *args;\n"
+        "  uint32_t num_args;\n"
+        "} bistra_kernel_info;\n\n"
+        "#endif /* BISTRA_KERNEL_INFO_DEFINED */\n\n";
+
+  // The prototypes of the kernels.
+  for (auto &k : kernels_) {
+    Program *p = k.second.get();
+    os << "/* " << k.first << ":\n";
+    for (auto *arg : p->getArgs()) {
+      auto *ty = arg->getType();
+      os << " *   " << arg->getName() << ": " << ty->getElementName() << "<";
+      for (unsigned i = 0; i < ty->getNumDims(); i++) {
+        os << (i ? ", " : "") << ty->getNames()[i] << ":" << ty->getDims()[i];
+      }
+      os << ">, aligned to " << arg->getAlignment() << " bytes\n";
+    }
+    os << " */\nvoid " << p->getName() << "(";
+    for (unsigned i = 0; i < p->getArgs().size(); i++) {
+      auto *arg = p->getArg(i);
+      os << (i ? ", " : "") << arg->getType()->getElementName() << " *"
+         << arg->getName();
+    }
+    os << ");\n\n";
+  }
+
+  // The registry and the lookup function.
+  auto table = getRegistryName();
+  auto count = getNumKernelsName();
+  os << "/* The kernels of the library. */\n"
+     << "extern const bistra_kernel_info " << table << "[];\n"
+     << "extern const uint32_t " << count << ";\n\n"
+     << "/* Finds the kernel with the name 'name' whose arguments have the\n"
+        " * dimensions 'dims', concatenated. Matches only the name if 'dims' "
+        "is NULL.\n * Returns NULL if there is no such kernel. */\n"
+     << "static inline const bistra_kernel_info *\n"
+     << name_ << "_lookup(const char *name, const int64_t *dims, "
+     << "uint32_t num_dims) {\n"
+     << "  for (uint32_t i = 0; i < " << count << "; i++) {\n"
+     << "    const bistra_kernel_info *k = &" << table << "[i];\n"
+     << "    uint32_t n = 0;\n"
+     << "    int match = !strcmp(k->name, name);\n"
+     << "    for (uint32_t a = 0; dims && match && a < k->num_args; a++) {\n"
+     << "      for (uint32_t d = 0; match && d < k->args[a].num_dims; d++) {\n"
+     << "        match = n < num_dims && k->args[a].dims[d] == dims[n++];\n"
+     << "      }\n"
+     << "    }\n"
+     << "    if (match && (!dims || n == num_dims))\n"
+     << "      return k;\n"
+     << "  }\n"
+     << "  return NULL;\n"
+     << "}\n\n";
+
+  os << "#ifdef __cplusplus\n}\n#endif\n\n";
+  os << "#endif /* " << guard << " */\n";
+  return os.str();
+}
@@ -58,6 +58,9 @@ Program::~Program() {
   for (auto *var : vars_) {
     delete var;
   }
+  for (auto *tensor : tensors_) {
+    delete tensor;
+  }
 }
 
 LocalVar *Program::getVar(const std::string &name) {
@@ -84,6 +87,17 @@ LocalVar *Program::addLocalVar(const std::string &name, ExprType Ty) {
   return var;
 }
 
+Argument *Program::addLocalTensor(const std::string &name,
+                                  const std::vector<unsigned> &dims,
+                                  const std::vector<std::string> &names,
+                                  ElemKind Ty) {
+  assert(!isNameInUse(name) && "The name is already in use");
+  Type t(Ty, dims, names);
+  Argument *tensor = new Argument(name, t);
+  addTensor(tensor);
+  return tensor;
+}
+
 LocalVar *Program::addTempVar(const std::string &nameHint, ExprType Ty) {
   unsigned counter = 1;
   std::string name = nameHint;
@@ -96,10 +110,46 @@ LocalVar *Program::addTempVar(const std::string &nameHint, ExprType Ty) {
   return addLocalVar(name, Ty);
 }
 
+Argument *Program::addTempTensor(const std::string &nameHint,
+                                 const Type &Ty) {
+  unsigned counter = 1;
+  std::string name = nameHint;
+
+  // Generate the pattern: "foo14"
+  do {
+    name = nameHint + std::to_string(counter++);
+  } while (isNameInUse(name));
+
+  Argument *tensor = new Argument(name, Ty);
+  addTensor(tensor);
+  return tensor;
+}
+
+bool Program::isNameInUse(const std::string &name) const {
+  for (auto *a : args_) {
+    if (name == a->getName())
+      return true;
+  }
+  for (auto *v : vars_) {
+    if (name == v->getName())
+      return true;
+  }
+  for (auto *t : tensors_) {
+    if (name == t->getName())
+      return true;
+  }
+  return false;
+}
+
 void Program::addArgument(Argument *arg) { args_.push_back(arg); }
 
 void Program::addVar(LocalVar *var) { vars_.push_back(var); }
 
+void Program::addTensor(Argument *tensor) {
+  tensor->setAlignment(std::max(tensor->getAlignment(), 64u));
+  tensors_.push_back(tensor);
+}
+
 void Program::dump(unsigned indent) const {
   std::cout << "func " << getName() << "(";
   for (int i = 0, e = args_.size(); i < e; i++) {
@@ -115,6 +165,11 @@ void Program::dump(unsigned indent) const {
     var->dump();
     std::cout << "\n";
   }
+  for (auto *tensor : tensors_) {
+    std::cout << "var " << tensor->getName() << " : ";
+    tensor->getType()->dump();
+    std::cout << "\n";
+  }
 
   Scope::dump(1);
   std::cout << "}\n";
@@ -136,7 +191,8 @@ uint64_t ExprType::hash() const {
 }
 
 uint64_t Argument::hash() const {
-  return hashJoin(hashString(getName()), getType()->hash());
+  uint64_t h = hashJoin(hashString(getName()), getType()->hash());
+  return hashJoin(h, hashJoin(getAlignment(), padding_));
 }
 
 uint64_t LocalVar::hash() const {
@@ -152,6 +208,9 @@ uint64_t Program::hash() const {
   for (auto &var : vars_) {
     hash = hashJoin(hash, var->hash());
   }
+  for (auto &tensor : tensors_) {
+    hash = hashJoin(hash, tensor->hash());
+  }
 
   // Hash the body of the program.
   return hashJoin(Scope::hash(), hash);
@@ -167,6 +226,8 @@ bool Program::compare(const Stmt *other) const {
     return false;
   if (p->getVars() != getVars())
     return false;
+  if (p->getTensors() != getTensors())
+    return false;
   return Scope::compare(other);
 }
 
@@ -318,6 +379,7 @@ uint64_t Loop::hash() const {
   // Hash the name, stride, range.
   uint64_t hash = hashString(getName());
   hash = hashJoin(hash, getEnd(), getStride());
+  hash = hashJoin(hash, isParallel());
   // Hash the body:
   return hashJoin(hash, Scope::hash());
 }
@@ -334,6 +396,8 @@ bool Loop::compare(const Stmt *other) const {
     return false;
   if (s->getStride() != getStride())
     return false;
+  if (s->isParallel() != isParallel())
+    return false;
 
   // Compare the body:
   return Scope::compare(other);
@@ -346,6 +410,10 @@ void Loop::dump(unsigned indent) const {
     stride = std::string(", ") + std::to_string(stride_);
   }
 
+  if (parallel_) {
+    std::cout << "parallel ";
+  }
+
   std::cout << "for"
             << " (" << indexName_ << " in 0.." << end_ << stride << ") {\n";
   Scope::dump(indent + 1);
@@ -358,7 +426,10 @@ void IfRange::dump(unsigned indent) const {
   std::cout << "if"
             << " (";
   val_->dump();
-  std::cout << " in " << start_ << " .. " << end_ << ") {\n";
+  std::cout << " in " << start_ << " .. " << end_;
+  if (width_ > 1)
+    std::cout << ", " << width_;
+  std::cout << ") {\n";
   Scope::dump(indent + 1);
   spaces(indent);
   std::cout << "}\n";
@@ -370,7 +441,7 @@ bool IfRange::compare(const Stmt *other) const {
   if (!s)
     return false;
 
-  if (s->getRange() != getRange())
+  if (s->getRange() != getRange() || s->getWidth() != getWidth())
     return false;
   if (!val_->compare(s->val_.get()))
     return false;
@@ -382,7 +453,7 @@ bool IfRange::compare(const Stmt *other) const {
 uint64_t IfRange::hash() const {
   // Hash the members.
   uint64_t hash = val_->hash();
-  hash = hashJoin(hash, start_, end_);
+  hash = hashJoin(hash, start_, hashJoin(end_, width_));
   // Hash the body:
   return hashJoin(hash, Scope::hash());
 }
@@ -447,6 +518,41 @@ void BroadcastExpr::dump() const {
   std::cout << ")";
 }
 
+void CastExpr::dump() const {
+  std::cout << " " << getType().getElementName() << "(";
+  val_->dump();
+  std::cout << ")";
+}
+
+bool CastExpr::compare(const Expr *other) const {
+  auto *e = dynamic_cast<const CastExpr *>(other);
+  if (!e)
+    return false;
+  return e->getType() == getType() && val_->compare(e->val_.get());
+}
+
+uint64_t CastExpr::hash() const {
+  return hashJoin(getType().hash(), val_->hash());
+}
+
+void ReduceExpr::dump() const {
+  const char *names[] = {"mul", "add", "div", "sub", "max", "min", "pow"};
+  std::cout << " reduce_" << names[kind_] << "(";
+  val_->dump();
+  std::cout << ")";
+}
+
+bool ReduceExpr::compare(const Expr *other) const {
+  auto *e = dynamic_cast<const ReduceExpr *>(other);
+  if (!e)
+    return false;
+  return e->kind_ == kind_ && val_->compare(e->val_.get());
+}
+
+uint64_t ReduceExpr::hash() const {
+  return hashJoin(getType().hash(), (uint64_t)kind_, val_->hash());
+}
+
 bool BroadcastExpr::compare(const Expr *other) const {
   auto *e = dynamic_cast<const BroadcastExpr *>(other);
   if (!e)
@@ -586,12 +692,12 @@ bool StoreStmt::compare(const Stmt *other) const {
   if (!e)
     return false;
 
-  return e->accumulate_ == accumulate_ && gep_->compare(e->gep_.get()) &&
-         value_->compare(e->value_.get());
+  return e->accumulate_ == accumulate_ && e->nontemporal_ == nontemporal_ &&
+         gep_->compare(e->gep_.get()) && value_->compare(e->value_.get());
 }
 
 uint64_t StoreStmt::hash() const {
-  return hashJoin(accumulate_, gep_->hash(), value_->hash());
+  return hashJoin(accumulate_ + 2 * nontemporal_, gep_->hash(), value_->hash());
 }
 
 std::vector<Expr *> StoreStmt::cloneIndicesPtr(CloneCtx &map) {
@@ -656,6 +762,24 @@ bool CallStmt::compare(const Stmt *other) const {
   return true;
 }
 
+bool PrefetchStmt::compare(const Stmt *other) const {
+  auto *e = dynamic_cast<const PrefetchStmt *>(other);
+  if (!e)
+    return false;
+  return gep_->compare(e->gep_.get());
+}
+
+uint64_t PrefetchStmt::hash() const {
+  return hashJoin(hashString("prefetch"), gep_->hash());
+}
+
+void PrefetchStmt::dump(unsigned indent) const {
+  spaces(indent);
+  std::cout << "prefetch ";
+  gep_->dump();
+  std::cout << ";\n";
+}
+
 void StoreStmt::dump(unsigned indent) const {
   spaces(indent);
   gep_->dump();
@@ -664,7 +788,7 @@ void StoreStmt::dump(unsigned indent) const {
   }
   std::cout << (accumulate_ ? " += " : " = ");
   value_->dump();
-  std::cout << ";\n";
+  std::cout << (nontemporal_ ? "; // non-temporal\n" : ";\n");
 }
 
 uint64_t StoreLocalStmt::hash() const {
@@ -782,6 +906,14 @@ Expr *UnaryExpr::clone(CloneCtx &map) {
   return new UnaryExpr(val_->clone(map), getKind(), getLoc());
 }
 
+Expr *CastExpr::clone(CloneCtx &map) {
+  return new CastExpr(val_->clone(map), getType().getElementType(), getLoc());
+}
+
+Expr *ReduceExpr::clone(CloneCtx &map) {
+  return new ReduceExpr(val_->clone(map), kind_, getLoc());
+}
+
 Expr *BroadcastExpr::clone(CloneCtx &map) {
   return new BroadcastExpr(val_->clone(map), vf_);
 }
@@ -814,8 +946,14 @@ Stmt *CallStmt::clone(CloneCtx &map) {
 
 Stmt *StoreStmt::clone(CloneCtx &map) {
   verify();
-  return new StoreStmt((GEPExpr *)gep_->clone(map), value_->clone(map),
-                       accumulate_, getLoc());
+  auto *st = new StoreStmt((GEPExpr *)gep_->clone(map), value_->clone(map),
+                           accumulate_, getLoc());
+  st->setNonTemporal(nontemporal_);
+  return st;
+}
+
+Stmt *PrefetchStmt::clone(CloneCtx &map) {
+  return new PrefetchStmt((GEPExpr *)gep_->clone(map), getLoc());
 }
 
 Stmt *StoreLocalStmt::clone(CloneCtx &map) {
@@ -831,6 +969,7 @@ Expr *IndexExpr::clone(CloneCtx &map) {
 
 Stmt *Loop::clone(CloneCtx &map) {
   Loop *loop = new Loop(indexName_, getLoc(), end_, stride_);
+  loop->setParallel(parallel_);
   map.map(this, loop);
   for (auto &MH : body_) {
     loop->addStmt(MH->clone(map));
@@ -840,6 +979,7 @@ Stmt *Loop::clone(CloneCtx &map) {
 
 Stmt *IfRange::clone(CloneCtx &map) {
   IfRange *IR = new IfRange(val_->clone(map), start_, end_, getLoc());
+  IR->setWidth(width_);
   for (auto &MH : body_) {
     IR->addStmt(MH->clone(map));
   }
@@ -868,6 +1008,11 @@ Stmt *Program::clone(CloneCtx &map) {
     np->addVar(newVar);
     map.map(var, newVar);
   }
+  for (auto *tensor : tensors_) {
+    Argument *newTensor = new Argument(*tensor);
+    np->addTensor(newTensor);
+    map.map(tensor, newTensor);
+  }
 
   for (auto &MH : body_) {
     np->addStmt(MH->clone(map));
@@ -907,6 +1052,8 @@ void Loop::verify() const {
 
 void IfRange::verify() const {
   assert(end_ >= start_ && "Invalid range");
+  assert(width_ > 0 && "Invalid width");
+  assert(!val_->getType().isVector() && "The index must be a scalar");
   val_->verify();
   Scope::verify();
 }
@@ -930,6 +1077,24 @@ void IndexExpr::verify() const {
                      "loop scope.");
   }
 }
+void CastExpr::verify() const {
+  assert(val_.getParent() == this && "Invalid handle owner pointer");
+  assert(val_.get() && "Invalid operand");
+  assert(getType().getWidth() == val_->getType().getWidth() &&
+         "Casts must not change the vector width");
+  val_->verify();
+}
+
+void ReduceExpr::verify() const {
+  assert(val_.getParent() == this && "Invalid handle owner pointer");
+  assert(val_.get() && "Invalid operand");
+  assert(val_->getType().isVector() && "Reducing a scalar");
+  assert((kind_ == BinaryExpr::Add || kind_ == BinaryExpr::Max ||
+          kind_ == BinaryExpr::Min) &&
+         "Invalid reduction operator");
+  val_->verify();
+}
+
 void BroadcastExpr::verify() const {
   val_->verify();
   assert(getType().getWidth() == vf_ && "Invalid vectorization factor");
@@ -980,6 +1145,12 @@ void StoreStmt::verify() const {
   assert(storedType.getElementType() == EK && "Stored element type mismatch");
 }
 
+void PrefetchStmt::verify() const {
+  assert(dynamic_cast<GEPExpr *>(gep_.get()));
+  gep_->verify();
+  gep_.verify();
+}
+
 void CallStmt::verify() const {
   for (auto &E : params_) {
     E.verify();
@@ -1015,6 +1186,9 @@ void Program::verify() const {
   for (auto *a : vars_) {
     a->verify();
   }
+  for (auto *a : tensors_) {
+    a->verify();
+  }
   assert(isLegalName(getName()) && "Invalid program name.");
   Scope::verify();
 }
@@ -1076,6 +1250,12 @@ void StoreStmt::visit(NodeVisitor *visitor) {
   visitor->leave(this);
 }
 
+void PrefetchStmt::visit(NodeVisitor *visitor) {
+  visitor->enter(this);
+  gep_->visit(visitor);
+  visitor->leave(this);
+}
+
 void CallStmt::visit(NodeVisitor *visitor) {
   visitor->enter(this);
   for (auto &ii : this->getParams()) {
@@ -1090,6 +1270,18 @@ void StoreLocalStmt::visit(NodeVisitor *visitor) {
   visitor->leave(this);
 }
 
+void CastExpr::visit(NodeVisitor *visitor) {
+  visitor->enter(this);
+  val_->visit(visitor);
+  visitor->leave(this);
+}
+
+void ReduceExpr::visit(NodeVisitor *visitor) {
+  visitor->enter(this);
+  val_->visit(visitor);
+  visitor->leave(this);
+}
+
 void BroadcastExpr::visit(NodeVisitor *visitor) {
   visitor->enter(this);
   val_->visit(visitor);
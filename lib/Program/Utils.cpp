@@ -3,9 +3,12 @@
 #include "bistra/Program/Program.h"
 #include "bistra/Program/Types.h"
 
+#include <algorithm>
+#include <atomic>
 #include <fstream>
 #include <iostream>
 #include <set>
+#include <thread>
 #include <vector>
 
 using namespace bistra;
@@ -92,3 +95,24 @@ uint64_t bistra::hashString(const std::string &str) {
   }
   return h;
 }
+
+void bistra::parallelFor(unsigned n, unsigned numThreads,
+                         const std::function<void(unsigned)> &fn) {
+  std::atomic<unsigned> next{0};
+  auto worker = [&]() {
+    for (unsigned i = next++; i < n; i = next++) {
+      fn(i);
+    }
+  };
+
+  numThreads = std::max(1u, std::min(numThreads, n));
+  std::vector<std::thread> threads;
+  for (unsigned i = 1; i < numThreads; i++) {
+    threads.emplace_back(worker);
+  }
+  // The current thread is one of the workers.
+  worker();
+  for (auto &t : threads) {
+    t.join();
+  }
+}
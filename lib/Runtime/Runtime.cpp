@@ -0,0 +1,168 @@
+#include "bistra/Runtime/Runtime.h"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdlib>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace {
+
+/// Set on threads that are executing a parallel loop. Nested parallel loops
+/// are executed serially.
+thread_local bool insideParallelLoop = false;
+
+/// A pool of threads that execute the chunks of parallel loops. The thread
+/// that starts the parallel loop participates in the work.
+class ThreadPool {
+  /// The worker threads.
+  std::vector<std::thread> workers_;
+  /// Protects the state of the current job.
+  std::mutex lock_;
+  /// Wakes the workers when a new job is ready.
+  std::condition_variable wake_;
+  /// Wakes the caller when the workers are done.
+  std::condition_variable done_;
+  /// Allows a single parallel loop to execute at a time.
+  std::mutex callers_;
+
+  /// The current job.
+  bistra_task_t task_{nullptr};
+  void *ctx_{nullptr};
+  int64_t numIters_{0};
+  int64_t stride_{1};
+  unsigned numChunks_{0};
+  /// The index of the next chunk to execute.
+  std::atomic<unsigned> nextChunk_{0};
+  /// The number of workers that did not finish the current job.
+  unsigned busy_{0};
+  /// Incremented for every new job.
+  uint64_t generation_{0};
+  /// Set when the pool is destroyed.
+  bool exit_{false};
+
+  /// Execute the chunks of the current job until there are no chunks left.
+  void runChunks() {
+    insideParallelLoop = true;
+    for (unsigned i = nextChunk_++; i < numChunks_; i = nextChunk_++) {
+      int64_t begin = numIters_ * i / numChunks_;
+      int64_t end = numIters_ * (i + 1) / numChunks_;
+      task_(ctx_, begin * stride_, end * stride_);
+    }
+    insideParallelLoop = false;
+  }
+
+  void workerLoop() {
+#ifdef __linux__
+    // The pool may be created by a thread that is pinned to a single core.
+    // Allow the workers to run on all of the cores.
+    cpu_set_t all;
+    CPU_ZERO(&all);
+    for (unsigned i = 0; i < CPU_SETSIZE; i++) {
+      CPU_SET(i, &all);
+    }
+    pthread_setaffinity_np(pthread_self(), sizeof(all), &all);
+#endif
+
+    uint64_t seen = 0;
+    while (true) {
+      {
+        std::unique_lock<std::mutex> guard(lock_);
+        wake_.wait(guard, [&]() { return exit_ || generation_ != seen; });
+        if (exit_)
+          return;
+        seen = generation_;
+      }
+
+      runChunks();
+
+      std::unique_lock<std::mutex> guard(lock_);
+      if (--busy_ == 0)
+        done_.notify_one();
+    }
+  }
+
+public:
+  explicit ThreadPool(unsigned numThreads) {
+    for (unsigned i = 1; i < numThreads; i++) {
+      workers_.emplace_back([this]() { workerLoop(); });
+    }
+  }
+
+  ~ThreadPool() {
+    {
+      std::unique_lock<std::mutex> guard(lock_);
+      exit_ = true;
+    }
+    wake_.notify_all();
+    for (auto &t : workers_) {
+      t.join();
+    }
+  }
+
+  /// \returns the number of threads that execute parallel loops.
+  unsigned getNumThreads() const { return workers_.size() + 1; }
+
+  void run(bistra_task_t task, void *ctx, int64_t numIters, int64_t stride) {
+    std::unique_lock<std::mutex> caller(callers_);
+    {
+      std::unique_lock<std::mutex> guard(lock_);
+      task_ = task;
+      ctx_ = ctx;
+      numIters_ = numIters;
+      stride_ = stride;
+      numChunks_ = std::min<int64_t>(numIters, getNumThreads());
+      nextChunk_ = 0;
+      busy_ = workers_.size();
+      generation_++;
+    }
+    wake_.notify_all();
+
+    runChunks();
+
+    std::unique_lock<std::mutex> guard(lock_);
+    done_.wait(guard, [&]() { return busy_ == 0; });
+  }
+};
+
+/// \returns the number of threads that the user requested, or the number of
+/// cores.
+unsigned getNumThreads() {
+  if (const char *env = getenv("BISTRA_NUM_THREADS")) {
+    int n = atoi(env);
+    if (n > 0)
+      return n;
+  }
+  return std::max(1u, std::thread::hardware_concurrency());
+}
+
+ThreadPool &getThreadPool() {
+  static ThreadPool pool(getNumThreads());
+  return pool;
+}
+
+} // namespace
+
+void bistra_parallel_for(bistra_task_t task, void *ctx, int64_t end,
+                         int64_t stride) {
+  int64_t numIters = end / stride;
+  if (insideParallelLoop || numIters < 2) {
+    task(ctx, 0, end);
+    return;
+  }
+
+  auto &pool = getThreadPool();
+  if (pool.getNumThreads() < 2) {
+    task(ctx, 0, end);
+    return;
+  }
+
+  pool.run(task, ctx, numIters, stride);
+}
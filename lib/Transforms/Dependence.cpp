@@ -6,6 +6,8 @@
 #include "bistra/Program/Utils.h"
 #include "bistra/Transforms/Simplify.h"
 
+#include <algorithm>
+#include <map>
 #include <set>
 
 using namespace bistra;
@@ -22,33 +24,132 @@ static bool isRefOfLoop(Expr *e, Loop *L, bool recursive) {
   return false;
 }
 
+/// \returns the coefficient c, if the expression \p e has the form c * L + r,
+/// where r does not depend on the loop \p L, or -1 if the expression has a
+/// different form. For example, the coefficient of (i * 4 + j) is 4.
+static int getLinearCoefficient(Expr *e, Loop *L) {
+  if (isRefOfLoop(e, L, false))
+    return 1;
+  if (!isRefOfLoop(e, L, true))
+    return 0;
+
+  auto *BE = dynamic_cast<BinaryExpr *>(e);
+  if (!BE)
+    return -1;
+
+  int lhs = getLinearCoefficient(BE->getLHS(), L);
+  int rhs = getLinearCoefficient(BE->getRHS(), L);
+  if (lhs < 0 || rhs < 0)
+    return -1;
+
+  switch (BE->getKind()) {
+  case BinaryExpr::Add:
+    return lhs + rhs;
+  case BinaryExpr::Sub:
+    return rhs ? -1 : lhs;
+  case BinaryExpr::Mul: {
+    // Multiplication of the index by a positive constant.
+    auto *C = dynamic_cast<ConstantExpr *>(lhs ? BE->getRHS() : BE->getLHS());
+    if (!C || C->getValue() <= 0)
+      return -1;
+    return (lhs + rhs) * C->getValue();
+  }
+  default:
+    return -1;
+  }
+}
+
+/// \returns True if the subscript \p e1 in the loop \p I1 and the subscript
+/// \p e2 in the loop \p I2, that access \p w1 and \p w2 consecutive elements,
+/// can only access the same element in the same iteration of the two loops.
+/// This is the case for subscripts of the form c * I + r, where the terms of r
+/// that depend on the enclosing loops are identical, and the terms that depend
+/// on the inner loops are narrower than the distance between the elements of
+/// consecutive iterations. For example: A[i * 4 + ii] and A[j * 4 + jj], where
+/// ii and jj are in the range 0 .. 4.
+static bool isSameIterationAccess(Loop *I1, Expr *e1, unsigned w1, Loop *I2,
+                                  Expr *e2, unsigned w2) {
+  if (I1->getStride() != I2->getStride())
+    return false;
+  int coefficient = getLinearCoefficient(e1, I1);
+  if (coefficient <= 0 || coefficient != getLinearCoefficient(e2, I2))
+    return false;
+
+  auto inner1 = collectLoops(I1);
+  auto inner2 = collectLoops(I2);
+  std::set<Loop *> live1(inner1.begin(), inner1.end());
+  std::set<Loop *> live2(inner2.begin(), inner2.end());
+  live1.erase(I1);
+  live2.erase(I2);
+
+  // The terms that depend on the enclosing loops must be identical.
+  std::set<Loop *> outer;
+  for (auto *IE : collectIndices(e1)) {
+    if (IE->getLoop() != I1 && !live1.count(IE->getLoop()))
+      outer.insert(IE->getLoop());
+  }
+  for (auto *IE : collectIndices(e2)) {
+    if (IE->getLoop() != I2 && !live2.count(IE->getLoop()))
+      outer.insert(IE->getLoop());
+  }
+  for (auto *O : outer) {
+    int c = getLinearCoefficient(e1, O);
+    if (c < 0 || c != getLinearCoefficient(e2, O))
+      return false;
+  }
+
+  // The enclosing loops and the loops I1 and I2 are fixed at zero.
+  std::pair<int, int> range1, range2;
+  if (!computeKnownIntegerRange(e1, range1, &live1) ||
+      !computeKnownIntegerRange(e2, range2, &live2))
+    return false;
+
+  int distance = coefficient * int(I1->getStride());
+  return range1.first >= 0 && range2.first >= 0 &&
+         range1.second + int(w1) <= distance &&
+         range2.second + int(w2) <= distance;
+}
+
 DepRelationKind bistra::depends(Loop *I1, Loop *I2, StoreStmt *W1,
                                 LoadExpr *R2) {
-  return checkWeakSIVDependenceForIndex(I1, I2, W1->getDest(), R2->getDest(),
-                                        W1->getIndices(), R2->getIndices());
+  return checkWeakSIVDependenceForIndex(
+      I1, I2, W1->getDest(), R2->getDest(), W1->getIndices(), R2->getIndices(),
+      W1->getValue()->getType().getWidth(), R2->getType().getWidth());
 }
 
 DepRelationKind bistra::depends(Loop *I1, Loop *I2, StoreStmt *W1,
                                 StoreStmt *W2) {
-  return checkWeakSIVDependenceForIndex(I1, I2, W1->getDest(), W2->getDest(),
-                                        W1->getIndices(), W2->getIndices());
+  return checkWeakSIVDependenceForIndex(
+      I1, I2, W1->getDest(), W2->getDest(), W1->getIndices(), W2->getIndices(),
+      W1->getValue()->getType().getWidth(),
+      W2->getValue()->getType().getWidth());
 }
 
 bistra::DepRelationKind bistra::checkWeakSIVDependenceForIndex(
     Loop *I1, Loop *I2, Argument *A1, Argument *A2,
-    std::vector<ExprHandle> &indices1, std::vector<ExprHandle> &indices2) {
+    std::vector<ExprHandle> &indices1, std::vector<ExprHandle> &indices2,
+    unsigned width1, unsigned width2) {
   // Accessing a different buffer. No dep.
   if (A1 != A2)
     return DepRelationKind::NoDep;
 
   assert(indices1.size() == indices2.size() && "Invalid index vector");
 
+  // Set when some subscript ties the iterations of I1 and I2 together.
+  bool sameIteration = false;
+
   for (unsigned i = 0; i < indices1.size(); i++) {
+    // Vector accesses touch consecutive elements in the last dimension.
+    bool last = i + 1 == indices1.size();
+    unsigned w1 = last ? width1 : 1;
+    unsigned w2 = last ? width2 : 1;
+
     // Check direct access to I and J.
     bool isIndex1 = isRefOfLoop(indices1[i], I1, false);
     bool isIndex2 = isRefOfLoop(indices2[i], I2, false);
     if (isIndex1 && isIndex2) {
       // Immediate access at the same array index are allowed.
+      sameIteration = true;
       continue;
     }
 
@@ -60,8 +161,15 @@ bistra::DepRelationKind bistra::checkWeakSIVDependenceForIndex(
     bool r2 = computeKnownIntegerRange(indices2[i], range2);
     if (r1 && r2) {
       // If the analysis worked: check if the ranges are disjoint.
-      if (range1.second < range2.first || range2.second < range1.first)
-        continue;
+      if (range1.second + int(w1) <= range2.first ||
+          range2.second + int(w2) <= range1.first)
+        return DepRelationKind::NoDep;
+    }
+
+    // Tiled accesses such as A[i * 4 + ii] and A[j * 4 + jj].
+    if (isSameIterationAccess(I1, indices1[i], w1, I2, indices2[i], w2)) {
+      sameIteration = true;
+      continue;
     }
 
     // Any other index access is disallowed. The buffers depend on each other.
@@ -72,6 +180,403 @@ bistra::DepRelationKind bistra::checkWeakSIVDependenceForIndex(
       return DepRelationKind::SomeDep;
   }
 
+  // All of the iterations access the same elements, such as A[0] and A[0].
+  if (!sameIteration)
+    return DepRelationKind::SomeDep;
+
   // The subscript dependency always overlaps for this index.
   return DepRelationKind::Equals;
 }
+
+/// \returns True if all of the accesses to the buffer \p arg in the loop \p L
+/// touch disjoint elements in different iterations of \p L.
+static bool isPartitionedByLoop(Loop *L, Argument *arg) {
+  std::vector<LoadExpr *> loads;
+  std::vector<StoreStmt *> stores;
+  collectLoadStores(L, loads, stores, arg);
+  if (stores.empty())
+    return true;
+
+  // Collect the subscripts and the width of all of the accesses.
+  std::vector<std::vector<ExprHandle> *> subscripts;
+  unsigned width = 1;
+  for (auto *ld : loads) {
+    subscripts.push_back(&ld->getIndices());
+    width = std::max(width, ld->getType().getWidth());
+  }
+  for (auto *st : stores) {
+    subscripts.push_back(&st->getIndices());
+    width = std::max(width, st->getValue()->getType().getWidth());
+  }
+
+  // Analyze the ranges of the subscripts in a single iteration of L.
+  std::set<Loop *> live;
+  for (auto *inner : collectLoops(L)) {
+    if (inner != L)
+      live.insert(inner);
+  }
+
+  // Look for a dimension that all accesses index with the same expression of
+  // the form c * L + r, where the range of r is narrower than the distance
+  // between the elements of consecutive iterations.
+  auto &first = *subscripts[0];
+  for (unsigned dim = 0; dim < first.size(); dim++) {
+    Expr *idx = first[dim].get();
+    int coefficient = getLinearCoefficient(idx, L);
+    if (coefficient <= 0)
+      continue;
+
+    bool same = true;
+    for (auto *sub : subscripts) {
+      same &= (*sub)[dim]->compare(idx);
+    }
+    if (!same)
+      continue;
+
+    std::pair<int, int> range;
+    if (!computeKnownIntegerRange(idx, range, &live))
+      continue;
+
+    int accessed = range.second - range.first + width;
+    if (accessed <= coefficient * int(L->getStride()))
+      return true;
+  }
+
+  return false;
+}
+
+/// Describes the first access to a local variable in some region.
+enum class LocalAccessKind { None, Def, Use };
+
+/// \returns the kind of the first access to the local \p var in \p s.
+static LocalAccessKind getFirstLocalAccess(Stmt *s, LocalVar *var) {
+  std::vector<LoadLocalExpr *> loads;
+  std::vector<StoreLocalStmt *> stores;
+
+  if (auto *SL = dynamic_cast<StoreLocalStmt *>(s)) {
+    collectLocals(SL->getValue().get(), loads, stores, var);
+    if (loads.size())
+      return LocalAccessKind::Use;
+    if (SL->getDest() != var)
+      return LocalAccessKind::None;
+    return SL->isAccumulate() ? LocalAccessKind::Use : LocalAccessKind::Def;
+  }
+
+  if (auto *IR = dynamic_cast<IfRange *>(s)) {
+    // The body of the 'if' may not execute, so a definition in the body does
+    // not define the local for the code that follows the 'if'.
+    collectLocals(IR, loads, stores, var);
+    if (loads.size() || stores.size())
+      return LocalAccessKind::Use;
+    return LocalAccessKind::None;
+  }
+
+  if (auto *S = dynamic_cast<Scope *>(s)) {
+    // Loops execute at least one iteration.
+    for (auto &stmt : S->getBody()) {
+      auto kind = getFirstLocalAccess(stmt.get(), var);
+      if (kind != LocalAccessKind::None)
+        return kind;
+    }
+    return LocalAccessKind::None;
+  }
+
+  collectLocals(s, loads, stores, var);
+  return loads.size() ? LocalAccessKind::Use : LocalAccessKind::None;
+}
+
+/// \returns the kind of the first access to the local tensor \p tensor in
+/// \p s. Statements that only write to the tensor, without accumulating into
+/// it, define the elements that are read by the code that follows them.
+static LocalAccessKind getFirstTensorAccess(Stmt *s, Argument *tensor) {
+  if (auto *S = dynamic_cast<Scope *>(s)) {
+    if (!dynamic_cast<IfRange *>(s)) {
+      for (auto &stmt : S->getBody()) {
+        auto kind = getFirstTensorAccess(stmt.get(), tensor);
+        if (kind != LocalAccessKind::None)
+          return kind;
+      }
+      return LocalAccessKind::None;
+    }
+  }
+
+  std::vector<LoadExpr *> loads;
+  std::vector<StoreStmt *> stores;
+  collectLoadStores(s, loads, stores, tensor);
+  if (loads.size())
+    return LocalAccessKind::Use;
+  for (auto *st : stores) {
+    if (st->isAccumulate())
+      return LocalAccessKind::Use;
+  }
+  return stores.size() ? LocalAccessKind::Def : LocalAccessKind::None;
+}
+
+bool bistra::isParallelLoop(Loop *L) {
+  // Find the program that contains the loop.
+  Stmt *root = L;
+  while (auto *parent = dynamic_cast<Stmt *>(root->getParent())) {
+    root = parent;
+  }
+  auto *prog = dynamic_cast<Program *>(root);
+  if (!prog)
+    return false;
+
+  // Calls have side effects that must execute in order.
+  for (auto *s : collectStmts(L)) {
+    if (dynamic_cast<CallStmt *>(s))
+      return false;
+  }
+
+  // Each iteration must write to its own part of the output buffers.
+  for (auto *arg : prog->getArgs()) {
+    if (!isPartitionedByLoop(L, arg))
+      return false;
+  }
+
+  // Each iteration gets a private copy of the locals. This is only valid if
+  // the locals are not used outside of the loop and are defined in each
+  // iteration before they are used.
+  for (auto *var : prog->getVars()) {
+    std::vector<LoadLocalExpr *> loads, allLoads;
+    std::vector<StoreLocalStmt *> stores, allStores;
+    collectLocals(L, loads, stores, var);
+    collectLocals(prog, allLoads, allStores, var);
+    if (loads.empty() && stores.empty())
+      continue;
+    if (loads.size() != allLoads.size() || stores.size() != allStores.size())
+      return false;
+    if (getFirstLocalAccess(L, var) != LocalAccessKind::Def)
+      return false;
+  }
+
+  // Each task also gets a private copy of the local tensors, so the tensors
+  // that the loop accesses must not be used outside of the loop. Iterations
+  // that share elements of a tensor must write the tensor before reading it.
+  for (auto *tensor : prog->getTensors()) {
+    std::vector<LoadExpr *> loads, allLoads;
+    std::vector<StoreStmt *> stores, allStores;
+    collectLoadStores(L, loads, stores, tensor);
+    collectLoadStores(prog, allLoads, allStores, tensor);
+    if (loads.empty() && stores.empty())
+      continue;
+    if (loads.size() != allLoads.size() || stores.size() != allStores.size())
+      return false;
+    if (!isPartitionedByLoop(L, tensor) &&
+        getFirstTensorAccess(L, tensor) != LocalAccessKind::Def)
+      return false;
+  }
+
+  return true;
+}
+
+/// Adds the terms of the affine subscript \p e, multiplied by \p scale, to
+/// \p coefs (the coefficient of each loop index) and \p offset (the constant
+/// part). \returns False if \p e is not an affine function of the indices.
+static bool collectAffineTerms(Expr *e, int64_t scale,
+                               std::map<Loop *, int64_t> &coefs,
+                               int64_t &offset) {
+  if (auto *IE = dynamic_cast<IndexExpr *>(e)) {
+    coefs[IE->getLoop()] += scale;
+    return true;
+  }
+  if (auto *CE = dynamic_cast<ConstantExpr *>(e)) {
+    offset += scale * CE->getValue();
+    return true;
+  }
+
+  auto *BE = dynamic_cast<BinaryExpr *>(e);
+  if (!BE)
+    return false;
+
+  switch (BE->getKind()) {
+  case BinaryExpr::Add:
+    return collectAffineTerms(BE->getLHS(), scale, coefs, offset) &&
+           collectAffineTerms(BE->getRHS(), scale, coefs, offset);
+  case BinaryExpr::Sub:
+    return collectAffineTerms(BE->getLHS(), scale, coefs, offset) &&
+           collectAffineTerms(BE->getRHS(), -scale, coefs, offset);
+  case BinaryExpr::Mul:
+    if (auto *CE = dynamic_cast<ConstantExpr *>(BE->getRHS()))
+      return collectAffineTerms(BE->getLHS(), scale * CE->getValue(), coefs,
+                                offset);
+    if (auto *CE = dynamic_cast<ConstantExpr *>(BE->getLHS()))
+      return collectAffineTerms(BE->getRHS(), scale * CE->getValue(), coefs,
+                                offset);
+    return false;
+  default:
+    return false;
+  }
+}
+
+/// \returns True if the store \p st alone writes every element of its
+/// destination. Each subscript must be an affine function of loop indices,
+/// and each loop may appear in one subscript only. The values of the loop
+/// indices, and the lanes of vector stores in the last dimension, must form
+/// a mixed-radix number that counts over the whole dimension: the smallest
+/// step is 1, and each step is the range of the smaller steps. For example,
+/// "i_tile + i * 32" with i_tile in 0..32 covers 32 * the trip count of i
+/// elements. The ifs that enclose the store may only clip a subscript to the
+/// bounds of its dimension, like the range checks that tiling inserts.
+static bool writesWholeBuffer(StoreStmt *st) {
+  auto *argTy = st->getDest()->getType();
+  unsigned numDims = argTy->getNumDims();
+  auto &indices = st->getIndices();
+
+  // The number of elements that each dimension covers, before clipping.
+  std::vector<int64_t> covered(numDims);
+  std::set<Loop *> used;
+  for (unsigned d = 0; d < numDims; d++) {
+    std::map<Loop *, int64_t> coefs;
+    int64_t offset = 0;
+    if (!collectAffineTerms(indices[d].get(), 1, coefs, offset) || offset)
+      return false;
+
+    // The step and the number of steps of each term.
+    std::vector<std::pair<int64_t, int64_t>> terms;
+    for (auto &lc : coefs) {
+      Loop *L = lc.first;
+      if (!lc.second)
+        continue;
+      if (lc.second < 0 || !used.insert(L).second ||
+          L->getEnd() % L->getStride())
+        return false;
+      terms.push_back(
+          {lc.second * L->getStride(), L->getEnd() / L->getStride()});
+    }
+    if (d + 1 == numDims)
+      terms.push_back({1, st->getValue()->getType().getWidth()});
+
+    std::sort(terms.begin(), terms.end());
+    int64_t next = 1;
+    for (auto &t : terms) {
+      if (t.second == 1)
+        continue;
+      if (t.first != next)
+        return false;
+      next *= t.second;
+    }
+    if (next < argTy->getDims()[d])
+      return false;
+    covered[d] = next;
+  }
+
+  // Check the scopes that enclose the store. Subscripts that overflow their
+  // dimension must be clipped to its bounds.
+  std::vector<bool> clipped(numDims, false);
+  for (ASTNode *S = st->getParent(); S && !dynamic_cast<Program *>(S);
+       S = S->getParent()) {
+    if (dynamic_cast<Loop *>(S))
+      continue;
+    auto *IR = dynamic_cast<IfRange *>(S);
+    if (!IR)
+      return false;
+    bool isClip = false;
+    for (unsigned d = 0; d < numDims; d++) {
+      auto range = IR->getRange();
+      if (IR->getIndex()->compare(indices[d].get()) && range.first <= 0 &&
+          range.second >= int(argTy->getDims()[d])) {
+        clipped[d] = true;
+        isClip = true;
+      }
+    }
+    if (!isClip)
+      return false;
+  }
+
+  for (unsigned d = 0; d < numDims; d++) {
+    if (covered[d] > argTy->getDims()[d] && !clipped[d])
+      return false;
+  }
+  return true;
+}
+
+bool bistra::isWriteOnlyOutput(Program *p, Argument *arg) {
+  std::vector<LoadExpr *> loads;
+  std::vector<StoreStmt *> stores;
+  collectLoadStores(p, loads, stores, arg);
+  if (loads.size() || stores.empty())
+    return false;
+
+  for (auto *st : stores) {
+    if (st->isAccumulate())
+      return false;
+  }
+
+  // Some store must write the whole buffer. Counting the iterations of the
+  // stores is not enough, because stores may write the same elements or skip
+  // some of the elements.
+  for (auto *st : stores) {
+    if (writesWholeBuffer(st))
+      return true;
+  }
+  return false;
+}
+
+bool bistra::isFusionLegal(Loop *L1, Loop *L2) {
+  // Loop range and stride must be identical.
+  if (L1->getEnd() != L2->getEnd() || L1->getStride() != L2->getStride())
+    return false;
+
+  // Calls have side effects that must execute in order.
+  for (auto *s : collectStmts(L1)) {
+    if (dynamic_cast<CallStmt *>(s))
+      return false;
+  }
+  for (auto *s : collectStmts(L2)) {
+    if (dynamic_cast<CallStmt *>(s))
+      return false;
+  }
+
+  // Check if the variable reads/writes intersect.
+  std::set<LocalVar *> varsRead1, varsWrite1, varsRead2, varsWrite2;
+  std::vector<LoadLocalExpr *> localLoads;
+  std::vector<StoreLocalStmt *> localStores;
+  collectLocals(L1, localLoads, localStores);
+  for (auto *ld : localLoads) {
+    varsRead1.insert(ld->getDest());
+  }
+  for (auto *st : localStores) {
+    varsWrite1.insert(st->getDest());
+  }
+  localLoads.clear();
+  localStores.clear();
+  collectLocals(L2, localLoads, localStores);
+  for (auto *ld : localLoads) {
+    varsRead2.insert(ld->getDest());
+  }
+  for (auto *st : localStores) {
+    varsWrite2.insert(st->getDest());
+  }
+  if (doSetsIntersect(varsWrite1, varsWrite2) ||
+      doSetsIntersect(varsWrite1, varsRead2) ||
+      doSetsIntersect(varsRead1, varsWrite2))
+    return false;
+
+  std::vector<LoadExpr *> loads1, loads2;
+  std::vector<StoreStmt *> stores1, stores2;
+  collectLoadStores(L1, loads1, stores1);
+  collectLoadStores(L2, loads2, stores2);
+
+  // 1. Test fake dependencies (writes on writes).
+  // 2. Test true dependencies (writes on reads).
+  for (auto *st1 : stores1) {
+    for (auto *st2 : stores2) {
+      if (DepRelationKind::SomeDep == depends(L1, L2, st1, st2))
+        return false;
+    }
+    for (auto *ld2 : loads2) {
+      if (DepRelationKind::SomeDep == depends(L1, L2, st1, ld2))
+        return false;
+    }
+  }
+  // 3. Test anti-dependencies (reads on writes).
+  for (auto *ld1 : loads1) {
+    for (auto *st2 : stores2) {
+      if (DepRelationKind::SomeDep == depends(L2, L1, st2, ld1))
+        return false;
+    }
+  }
+
+  return true;
+}
@@ -143,6 +143,11 @@ struct ExprSimplify : public NodeVisitor {
     if (StoreLocalStmt *SLS = dynamic_cast<StoreLocalStmt *>(S)) {
       return process(SLS->getValue());
     }
+    if (PrefetchStmt *PS = dynamic_cast<PrefetchStmt *>(S)) {
+      for (auto &E : PS->getIndices()) {
+        process(E);
+      }
+    }
     if (IfRange *IR = dynamic_cast<IfRange *>(S)) {
       return process(IR->getIndex());
     }
@@ -215,6 +220,8 @@ static bool simplifyIfs(Stmt *s) {
     // Try to assess the if index range.
     if (!computeKnownIntegerRange(ifs->getIndex(), ir))
       continue;
+    // Vectorized checks also test the lanes that follow the index.
+    ir.second += ifs->getWidth() - 1;
 
     // Compute the relationship between the index and if ranges.
     auto rel = getRangeRelation(ir, ifs->getRange());
@@ -355,6 +355,11 @@ static bool collectStoreSites(std::set<StoreStmt *> &stores,
         stores.insert(ST);
         break;
       }
+      // Stores to locals are handled as reductions. Prefetches are not
+      // vectorized.
+      if (dynamic_cast<StoreLocalStmt *>(parent) ||
+          dynamic_cast<PrefetchStmt *>(parent))
+        break;
       parent = parent->getParent();
       if (!parent)
         return false;
@@ -387,6 +392,11 @@ static bool mayVectorizeStore(StoreStmt *S, Loop *L) {
   // We must be able to vectorize the stored value.
   if (!mayVectorizeExpr(S->getValue(), L))
     return false;
+  // Vector stores write consecutive elements. Stores to the same element in
+  // all of the iterations are reductions.
+  auto kind = getIndexAccessKind(S->getIndices().back().get(), L);
+  if (kind != IndexAccessKind::Consecutive)
+    return false;
   // Check if the indices allow us to vectorize the loop.
   return mayVectorizeLoadStoreAccess(S->getIndices(), L);
 }
@@ -425,6 +435,12 @@ static Expr *vectorizeExpr(Expr *E, Loop *L, unsigned vf) {
     return new UnaryExpr(VL, UE->getKind(), UE->getLoc());
   }
 
+  // Vectorize conversions.
+  if (CastExpr *CE = dynamic_cast<CastExpr *>(E)) {
+    auto *VL = vectorizeExpr(CE->getVal(), L, vf);
+    return new CastExpr(VL, CE->getType().getElementType(), CE->getLoc());
+  }
+
   // Check that the load remains consecutive when vectorizing \p L.
   if (LoadExpr *LE = dynamic_cast<LoadExpr *>(E)) {
     std::vector<IndexExpr *> idx;
@@ -468,11 +484,287 @@ static StoreStmt *vectorizeStore(StoreStmt *S, Loop *L, unsigned vf) {
   for (auto &E : S->getIndices())
     indices.push_back(E.get());
 
-  return new StoreStmt(S->getDest(), indices, val, S->isAccumulate(),
-                       S->getLoc());
+  auto *VS = new StoreStmt(S->getDest(), indices, val, S->isAccumulate(),
+                           S->getLoc());
+  VS->setNonTemporal(S->isNonTemporal());
+  return VS;
+}
+
+namespace {
+/// A reduction of the values that a loop computes into a single scalar, such
+/// as "sum += A[i]" or "mx = max(mx, A[i])". The scalar is a local or an
+/// element that all of the iterations update.
+struct Reduction {
+  /// The statement that updates the scalar.
+  Stmt *S;
+  /// The value that is combined with the scalar.
+  Expr *operand;
+  /// The operator that combines the values: Add, Max or Min.
+  BinaryExpr::BinOpKind kind;
+};
+} // namespace
+
+/// \returns True if the expression \p e reads the scalar that the statement
+/// \p S updates.
+static bool isReducedScalar(Expr *e, Stmt *S) {
+  if (auto *SL = dynamic_cast<StoreLocalStmt *>(S)) {
+    auto *LL = dynamic_cast<LoadLocalExpr *>(e);
+    return LL && LL->getDest() == SL->getDest();
+  }
+
+  auto *ST = dynamic_cast<StoreStmt *>(S);
+  auto *LE = dynamic_cast<LoadExpr *>(e);
+  if (!ST || !LE || LE->getDest() != ST->getDest() ||
+      LE->getType().isVector())
+    return false;
+  for (unsigned i = 0; i < ST->getIndices().size(); i++) {
+    if (!LE->getIndices()[i]->compare(ST->getIndices()[i].get()))
+      return false;
+  }
+  return true;
+}
+
+/// Matches the statement \p S, that stores \p value, to a reduction such as
+/// "x += y", "x = x + y" or "x = max(x, y)".
+/// \returns the operand y and sets \p kind, or nullptr.
+static Expr *matchReduction(Stmt *S, Expr *value, bool accumulate,
+                            BinaryExpr::BinOpKind &kind) {
+  if (accumulate) {
+    kind = BinaryExpr::Add;
+    return value;
+  }
+
+  auto *BE = dynamic_cast<BinaryExpr *>(value);
+  if (!BE)
+    return nullptr;
+  kind = BE->getKind();
+  if (kind != BinaryExpr::Add && kind != BinaryExpr::Max &&
+      kind != BinaryExpr::Min)
+    return nullptr;
+  if (isReducedScalar(BE->getLHS(), S))
+    return BE->getRHS();
+  if (isReducedScalar(BE->getRHS(), S))
+    return BE->getLHS();
+  return nullptr;
+}
+
+/// Collect the reductions in the loop \p L into \p reductions. All of the
+/// locals that the loop writes must be reductions, because the vectorized
+/// loop can't keep a scalar per iteration. Stores that accumulate into the
+/// same element in all of the iterations are reductions as well.
+/// \returns False if the loop contains a local or an accumulation that can't
+/// be vectorized.
+static bool collectReductions(Loop *L, std::vector<Reduction> &reductions) {
+  auto inner = collectLoops(L);
+  std::set<Loop *> loops(inner.begin(), inner.end());
+
+  std::vector<LoadLocalExpr *> localLoads;
+  std::vector<StoreLocalStmt *> localStores;
+  collectLocals(L, localLoads, localStores);
+  for (auto *SL : localStores) {
+    auto *var = SL->getDest();
+    if (var->getType().isVector())
+      return false;
+
+    BinaryExpr::BinOpKind kind;
+    Expr *operand =
+        matchReduction(SL, SL->getValue(), SL->isAccumulate(), kind);
+    if (!operand || !(operand->getType() == var->getType()))
+      return false;
+
+    // The loop must not access the local outside of the reduction.
+    std::vector<LoadLocalExpr *> loads;
+    std::vector<StoreLocalStmt *> stores;
+    collectLocals(L, loads, stores, var);
+    if (stores.size() != 1 || loads.size() != (SL->isAccumulate() ? 0 : 1))
+      return false;
+
+    reductions.push_back({SL, operand, kind});
+  }
+
+  std::vector<LoadExpr *> loads;
+  std::vector<StoreStmt *> stores;
+  collectLoadStores(L, loads, stores);
+  for (auto *ST : stores) {
+    if (ST->getValue()->getType().isVector())
+      continue;
+
+    // The same element is updated in all of the iterations of the loop.
+    bool uniform = true;
+    for (auto &idx : ST->getIndices()) {
+      for (auto *IE : collectIndices(idx.get())) {
+        uniform &= !loops.count(IE->getLoop());
+      }
+    }
+    if (!uniform)
+      continue;
+
+    BinaryExpr::BinOpKind kind;
+    Expr *operand =
+        matchReduction(ST, ST->getValue(), ST->isAccumulate(), kind);
+    if (!operand) {
+      // Storing the same value in all of the iterations is fine. Storing the
+      // value of the last iteration is not.
+      if (collectIndices(ST, L).size())
+        return false;
+      continue;
+    }
+
+    // The loop must not access the buffer outside of the reduction.
+    std::vector<LoadExpr *> bufferLoads;
+    std::vector<StoreStmt *> bufferStores;
+    collectLoadStores(L, bufferLoads, bufferStores, ST->getDest());
+    if (bufferStores.size() != 1 ||
+        bufferLoads.size() != (ST->isAccumulate() ? 0 : 1))
+      return false;
+
+    reductions.push_back({ST, operand, kind});
+  }
+
+  for (auto &R : reductions) {
+    if (!mayVectorizeExpr(R.operand, L))
+      return false;
+  }
+  return true;
 }
 
-Loop *bistra::vectorize(Loop *L, unsigned vf) {
+/// \returns a copy of the indices of the store \p S.
+static std::vector<Expr *> cloneIndices(StoreStmt *S) {
+  CloneCtx map;
+  std::vector<Expr *> indices;
+  for (auto &idx : S->getIndices()) {
+    indices.push_back(idx->clone(map));
+  }
+  return indices;
+}
+
+/// Vectorize the reduction \p R in the loop \p L using the vectorization
+/// factor \p vf. The loop accumulates into a vector, and the lanes of the
+/// vector are reduced into the scalar after the loop.
+static void vectorizeReduction(Reduction &R, Loop *L, unsigned vf) {
+  Program *p = L->getProgram();
+  auto *parent = (Scope *)L->getParent();
+  auto loc = R.S->getLoc();
+  ExprType vecTy = R.operand->getType().asVector(vf);
+
+  auto *SL = dynamic_cast<StoreLocalStmt *>(R.S);
+  auto *ST = dynamic_cast<StoreStmt *>(R.S);
+  auto name = SL ? SL->getDest()->getName() : ST->getDest()->getName();
+  auto *acc = p->addTempVar(name + "_acc", vecTy);
+
+  // Initialize the accumulator before the loop. The lanes of the maximum and
+  // the minimum start with the current value of the scalar.
+  Expr *init;
+  if (R.kind == BinaryExpr::Add) {
+    init = getZeroExpr(vecTy);
+  } else if (SL) {
+    init = new BroadcastExpr(new LoadLocalExpr(SL->getDest(), loc), vf);
+  } else {
+    auto *ld = new LoadExpr(ST->getDest(), cloneIndices(ST), loc);
+    init = new BroadcastExpr(ld, vf);
+  }
+  parent->insertBeforeStmt(new StoreLocalStmt(acc, init, false, loc), L);
+
+  // Update the accumulator in the loop.
+  Expr *val = vectorizeExpr(R.operand, L, vf);
+  if (!val->getType().isVector()) {
+    val = new BroadcastExpr(val, vf);
+  }
+  Stmt *update;
+  if (R.kind == BinaryExpr::Add) {
+    update = new StoreLocalStmt(acc, val, true, loc);
+  } else {
+    auto *combined =
+        new BinaryExpr(new LoadLocalExpr(acc, loc), val, R.kind, loc);
+    update = new StoreLocalStmt(acc, combined, false, loc);
+  }
+
+  // Reduce the lanes of the accumulator into the scalar after the loop.
+  Expr *lanes = new ReduceExpr(new LoadLocalExpr(acc, loc), R.kind, loc);
+  bool accumulate = R.kind == BinaryExpr::Add;
+  Stmt *result;
+  if (SL) {
+    result = new StoreLocalStmt(SL->getDest(), lanes, accumulate, loc);
+  } else {
+    result = new StoreStmt(ST->getDest(), cloneIndices(ST), lanes, accumulate,
+                           loc);
+  }
+
+  R.S->getOwnerHandle()->setReference(update);
+  parent->insertAfterStmt(result, L);
+}
+
+/// \returns the range check whose index contains the expression \p E, or
+/// nullptr if \p E is not a part of the index of a range check.
+static IfRange *getRangeCheck(Expr *E) {
+  ASTNode *node = E;
+  while (dynamic_cast<Expr *>(node)) {
+    node = node->getParent();
+  }
+  return dynamic_cast<IfRange *>(node);
+}
+
+/// \returns True if the range check \p IR, that tests the index of the loop
+/// \p L, can be vectorized into a mask of the vector loads and stores in its
+/// body. The body may only contain the vectorized stores \p stores, because
+/// scalar statements would execute for all of the lanes.
+static bool mayMaskRangeCheck(IfRange *IR, Loop *L,
+                              const std::set<StoreStmt *> &stores) {
+  if (IR->getWidth() != 1)
+    return false;
+  auto kind = getIndexAccessKind(IR->getIndex().get(), L);
+  if (kind != IndexAccessKind::Consecutive)
+    return false;
+
+  for (auto *s : collectStmts(IR)) {
+    if (auto *ST = dynamic_cast<StoreStmt *>(s)) {
+      if (!stores.count(ST))
+        return false;
+      continue;
+    }
+    if (!dynamic_cast<IfRange *>(s) && !dynamic_cast<Loop *>(s) &&
+        !dynamic_cast<PrefetchStmt *>(s))
+      return false;
+  }
+  return true;
+}
+
+/// Create a copy of the vectorizable loop \p L that executes the last \p rem
+/// iterations of \p L in a single vector iteration, with the lanes past the
+/// end of the loop masked off, and insert it after \p L.
+/// \returns the new loop, or nullptr if the copy could not be vectorized.
+static Loop *createMaskedTail(Loop *L, unsigned vf, unsigned rem) {
+  unsigned start = L->getEnd() - rem;
+  auto *parent = (Scope *)L->getParent();
+
+  CloneCtx map;
+  Loop *tail = (Loop *)L->clone(map);
+  tail->setEnd(vf);
+  tail->setName(newIndexName(L->getName(), "masked", 0));
+
+  // Shift the indices of the copy to the tail of the original loop.
+  std::vector<IndexExpr *> indices;
+  collectIndices(tail, indices, tail);
+  for (auto *idx : indices) {
+    auto *expr = new BinaryExpr(new ConstantExpr(start), new IndexExpr(tail),
+                                BinaryExpr::BinOpKind::Add, L->getLoc());
+    idx->replaceUseWith(expr);
+  }
+
+  // Only the first 'rem' lanes are valid.
+  auto *IR = new IfRange(new IndexExpr(tail), 0, rem, L->getLoc());
+  IR->takeContent(tail);
+  tail->addStmt(IR);
+  parent->insertAfterStmt(tail, L);
+
+  if (!vectorize(tail, vf)) {
+    parent->removeStmt(tail);
+    return nullptr;
+  }
+  return tail;
+}
+
+Loop *bistra::vectorize(Loop *L, unsigned vf, bool masked) {
   unsigned tripCount = L->getEnd();
   // The trip count must contain the vec-width and loop must not be vectorized.
   if (tripCount < vf || L->getStride() != 1) {
@@ -484,6 +776,10 @@ Loop *bistra::vectorize(Loop *L, unsigned vf) {
   for (auto *s : stmts) {
     if (dynamic_cast<StoreStmt *>(s))
       continue;
+    if (dynamic_cast<StoreLocalStmt *>(s))
+      continue;
+    if (dynamic_cast<PrefetchStmt *>(s))
+      continue;
     if (dynamic_cast<IfRange *>(s))
       continue;
     if (dynamic_cast<Loop *>(s))
@@ -493,27 +789,61 @@ Loop *bistra::vectorize(Loop *L, unsigned vf) {
     return nullptr;
   }
 
+  std::vector<Reduction> reductions;
+  if (!collectReductions(L, reductions))
+    return nullptr;
+
   // Collect the indices in the loop L that access the index of L.
   std::vector<IndexExpr *> indices;
   collectIndices(L, indices, L);
 
+  // Range checks on the index of L become masks. Other uses of the index
+  // lead to the stores that need to be vectorized.
+  std::set<IfRange *> rangeChecks;
+  std::vector<IndexExpr *> storeIndices;
+  for (auto *idx : indices) {
+    if (auto *IR = getRangeCheck(idx)) {
+      rangeChecks.insert(IR);
+    } else {
+      storeIndices.push_back(idx);
+    }
+  }
+
   std::set<StoreStmt *> stores;
-  bool collected = collectStoreSites(stores, indices);
+  bool collected = collectStoreSites(stores, storeIndices);
   if (!collected)
     return nullptr;
 
+  // Reductions are vectorized separately.
+  for (auto &R : reductions) {
+    stores.erase(dynamic_cast<StoreStmt *>(R.S));
+  }
+
   for (auto *S : stores) {
     if (!mayVectorizeStore(S, L)) {
       return nullptr;
     }
   }
 
+  for (auto *IR : rangeChecks) {
+    if (!mayMaskRangeCheck(IR, L, stores))
+      return nullptr;
+  }
+
   // The return value of the method.
   Loop *tailOrOrig = L;
 
-  // Transform the loop to divide the loop trip count.
-  if (tripCount % vf) {
-    tailOrOrig = ::peelLoop(L, tripCount - (tripCount % vf));
+  // Transform the loop to divide the loop trip count. The remaining iterations
+  // execute in a masked vector iteration, if requested and possible, or in a
+  // scalar loop.
+  if (unsigned rem = tripCount % vf) {
+    Loop *tail = masked ? createMaskedTail(L, vf, rem) : nullptr;
+    if (tail) {
+      L->setEnd(tripCount - rem);
+      tailOrOrig = tail;
+    } else {
+      tailOrOrig = ::peelLoop(L, tripCount - rem);
+    }
   }
 
   // Update the loop stride to reflect the vectorization factor.
@@ -525,6 +855,14 @@ Loop *bistra::vectorize(Loop *L, unsigned vf) {
     handle->setReference(vectorizeStore(S, L, vf));
   }
 
+  for (auto &R : reductions) {
+    vectorizeReduction(R, L, vf);
+  }
+
+  for (auto *IR : rangeChecks) {
+    IR->setWidth(vf);
+  }
+
   return tailOrOrig;
 }
 
@@ -562,6 +900,16 @@ Loop *bistra::widen(Loop *L, unsigned wf) {
   if (lloads.size() || lstores.size())
     return nullptr;
 
+  // Local tensors that are written in the loop hold the data of a single
+  // iteration, like locals.
+  std::vector<LoadExpr *> loads;
+  std::vector<StoreStmt *> allStores;
+  collectLoadStores(L, loads, allStores);
+  for (auto *S : allStores) {
+    if (L->getProgram()->isLocalTensor(S->getDest()))
+      return nullptr;
+  }
+
   unsigned tripCount = L->getEnd();
   // The trip count must contain the vec-width and loop must not be vectorized.
   if (tripCount < (newStride)) {
@@ -603,43 +951,32 @@ Loop *bistra::widen(Loop *L, unsigned wf) {
   return tailOrOrig;
 }
 
-namespace {
-/// A visitor class that collects all uses of variables.
-struct VarUsageCollector : public NodeVisitor {
-  std::set<LocalVar *> varsRead_;
-  std::set<LocalVar *> varsWrite_;
-  VarUsageCollector() = default;
-  virtual void enter(Expr *E) override {
-    if (auto *II = dynamic_cast<LoadLocalExpr *>(E)) {
-      varsRead_.insert(II->getDest());
-    }
-  }
-  virtual void enter(Stmt *S) override {
-    if (auto *II = dynamic_cast<StoreLocalStmt *>(S)) {
-      varsWrite_.insert(II->getDest());
-    }
-  }
-};
-
-/// A visitor class that collects all uses of arguments.
-struct StorageUsageCollector : public NodeVisitor {
-  std::set<LoadExpr *> argsRead_;
-  std::set<StoreStmt *> argsWrite_;
-  StorageUsageCollector() = default;
-  virtual void enter(Expr *E) override {
-    if (auto *II = dynamic_cast<LoadExpr *>(E)) {
-      argsRead_.insert(II);
-    }
-  }
-  virtual void enter(Stmt *S) override {
-    if (auto *II = dynamic_cast<StoreStmt *>(S)) {
-      argsWrite_.insert(II);
-    }
-  }
-};
-} // namespace
+/// \returns the block size that tiles the loop \p L2 into a loop nest that
+/// has the same outer loop as the tiled loop \p L, or zero if \p L does not
+/// look like a tiled copy of \p L2. For example, "for (i in 0..4) { for (ii in
+/// 0..32) { ... } }" is a tiled copy of "for (j in 0..100) { ... }".
+static unsigned getMatchingTileSize(Loop *L, Loop *L2) {
+  if (L->getStride() != 1 || L->getBody().size() != 1)
+    return 0;
+  auto *tile = dynamic_cast<Loop *>(L->getBody()[0].get());
+  if (!tile)
+    return 0;
+
+  unsigned blockSize = tile->getEnd();
+  if (tile->getStride() != L2->getStride() || blockSize % L2->getStride() ||
+      L2->getEnd() <= blockSize)
+    return 0;
+
+  unsigned numTiles = L2->getEnd() / blockSize;
+  if (L2->getEnd() % blockSize)
+    numTiles++;
+  return numTiles == L->getEnd() ? blockSize : 0;
+}
 
 bool bistra::fuse(Loop *L, unsigned levels) {
+  if (!levels)
+    return false;
+
   // Find the parent scope.
   Scope *parent = dynamic_cast<Scope *>(L->getParent());
   if (!parent)
@@ -652,51 +989,22 @@ bool bistra::fuse(Loop *L, unsigned levels) {
   if (!L2)
     return false;
 
-  // Loop range and stride must be identical.
-  if (L->getEnd() != L2->getEnd() || L->getStride() != L2->getStride())
-    return false;
-
-  // Collect the variable and argument usage.
-  VarUsageCollector VUC1;
-  VarUsageCollector VUC2;
-  L->visit(&VUC1);
-  L2->visit(&VUC2);
-
-  /// Check if the variable reads/writes intersect.
-  if (doSetsIntersect(VUC1.varsWrite_, VUC2.varsWrite_) ||
-      doSetsIntersect(VUC1.varsWrite_, VUC2.varsRead_) ||
-      doSetsIntersect(VUC1.varsRead_, VUC2.varsWrite_))
-    return false;
-
-  StorageUsageCollector SUC1;
-  StorageUsageCollector SUC2;
-  L->visit(&SUC1);
-  L2->visit(&SUC2);
-
-  // 1. Test fake dependencies (writes on writes).
-  // 2. Test true dependencies (writes on reads).
-  for (auto &ss1 : SUC1.argsWrite_) {
-    // Check if any of the writes in the first loop conflict with the writes
-    // in the second loop.
-    for (auto &ss2 : SUC2.argsWrite_) {
-      if (DepRelationKind::SomeDep == depends(L, L2, ss1, ss2))
-        return false;
-    }
-    // Check if any of the writes in the first loop conflict with the writes
-    // in the second loop.
-    for (auto &ss2 : SUC2.argsRead_) {
-      if (DepRelationKind::SomeDep == depends(L, L2, ss1, ss2))
-        return false;
-    }
-  }
-  // 3. Test anti-dependencies (reads on writes).
-  for (auto &ss1 : SUC1.argsRead_) {
-    // Check if any of the reads in the first loop conflict with the writes
-    // in the second loop.
-    for (auto &ss2 : SUC2.argsWrite_) {
-      if (DepRelationKind::SomeDep == depends(L2, L, ss2, ss1))
-        return false;
-    }
+  if (L->getEnd() == L2->getEnd() && L->getStride() == L2->getStride()) {
+    if (!isFusionLegal(L, L2))
+      return false;
+  } else {
+    // The first loop may be tiled. Tile the second loop in the same way to
+    // fuse the tiles of the two loops. Check the legality on a tiled copy of
+    // the second loop before modifying the program.
+    unsigned blockSize = getMatchingTileSize(L, L2);
+    if (!blockSize)
+      return false;
+    CloneCtx map;
+    std::unique_ptr<Loop> copy((Loop *)L2->clone(map));
+    ::tile(copy.get(), blockSize);
+    if (!isFusionLegal(L, copy.get()))
+      return false;
+    ::tile(L2, blockSize);
   }
 
   // We are good to go. Let's perform the transformation.
@@ -826,6 +1134,348 @@ bool bistra::promoteLICM(Program *p) {
   return changed;
 }
 
+bool bistra::prefetch(Loop *L, unsigned distance) {
+  if (!distance)
+    return false;
+
+  std::vector<LoadExpr *> loads;
+  std::vector<StoreStmt *> stores;
+  collectLoadStores(L, loads, stores);
+
+  // Don't prefetch the same address twice.
+  std::vector<PrefetchStmt *> prefetches;
+  for (auto *s : collectStmts(L)) {
+    if (auto *PS = dynamic_cast<PrefetchStmt *>(s))
+      prefetches.push_back(PS);
+  }
+
+  bool changed = false;
+  for (auto *ld : loads) {
+    // The hardware prefetcher handles loads of consecutive elements.
+    if (!dependsOnLoop(ld, L) ||
+        mayVectorizeLoadStoreAccess(ld->getIndices(), L))
+      continue;
+
+    // Find the statement that contains the load.
+    ASTNode *node = ld;
+    while (dynamic_cast<Expr *>(node)) {
+      node = node->getParent();
+    }
+    auto *S = dynamic_cast<Stmt *>(node);
+    auto *parent = S ? dynamic_cast<Scope *>(S->getParent()) : nullptr;
+    if (!parent)
+      continue;
+
+    // Prefetch the address that the load accesses 'distance' iterations later.
+    CloneCtx map;
+    auto *gep = (GEPExpr *)ld->getGep()->clone(map);
+    for (auto *idx : collectIndices(gep, L)) {
+      auto *ahead = new ConstantExpr(distance * L->getStride());
+      idx->replaceUseWith(new BinaryExpr(new IndexExpr(L), ahead,
+                                         BinaryExpr::BinOpKind::Add,
+                                         ld->getLoc()));
+    }
+    auto *PS = new PrefetchStmt(gep, ld->getLoc());
+
+    bool found = false;
+    for (auto *other : prefetches) {
+      found |= PS->compare(other);
+    }
+    if (found) {
+      delete PS;
+      continue;
+    }
+
+    parent->insertBeforeStmt(PS, S);
+    prefetches.push_back(PS);
+    changed = true;
+  }
+
+  return changed;
+}
+
+bool bistra::streamStores(Loop *L, Argument *arg) {
+  if (!isWriteOnlyOutput(L->getProgram(), arg))
+    return false;
+
+  std::vector<LoadExpr *> loads;
+  std::vector<StoreStmt *> stores;
+  collectLoadStores(L, loads, stores, arg);
+
+  bool changed = false;
+  for (auto *st : stores) {
+    changed |= !st->isNonTemporal();
+    st->setNonTemporal(true);
+  }
+  return changed;
+}
+
+bool bistra::parallelize(Loop *L) {
+  // Only outermost loops are parallelized, to create large tasks.
+  if (!dynamic_cast<Program *>(L->getParent()))
+    return false;
+
+  // There is nothing to distribute in loops with a single iteration.
+  if (L->isParallel() || L->getEnd() / L->getStride() < 2)
+    return false;
+
+  if (!isParallelLoop(L))
+    return false;
+
+  L->setParallel(true);
+  return true;
+}
+
+/// The alignment of the rows of the packed tensors, in bytes.
+static constexpr unsigned kPackAlignment = 64;
+
+/// The maximal size of a packed tensor, in bytes. Packed tensors should fit in
+/// the cache.
+static constexpr unsigned kMaxPackSize = 1 << 20;
+
+/// \returns True if \p e is an affine function of the loop indices, such as
+/// "i * 4 + j + 3". Affine subscripts are the sum of terms that depend on one
+/// loop each.
+static bool isAffineIndex(Expr *e) {
+  if (dynamic_cast<IndexExpr *>(e) || dynamic_cast<ConstantExpr *>(e))
+    return true;
+
+  auto *BE = dynamic_cast<BinaryExpr *>(e);
+  if (!BE)
+    return false;
+
+  switch (BE->getKind()) {
+  case BinaryExpr::Add:
+  case BinaryExpr::Sub:
+    return isAffineIndex(BE->getLHS()) && isAffineIndex(BE->getRHS());
+  case BinaryExpr::Mul:
+    if (dynamic_cast<ConstantExpr *>(BE->getRHS()))
+      return isAffineIndex(BE->getLHS());
+    if (dynamic_cast<ConstantExpr *>(BE->getLHS()))
+      return isAffineIndex(BE->getRHS());
+    return false;
+  default:
+    return false;
+  }
+}
+
+/// \returns a copy of the terms of the affine subscript \p e that depend on
+/// the loops in \p live (if \p inner is set) or on the other loops (if
+/// \p inner is clear), or nullptr if the sum of the terms is zero. The
+/// constant terms belong to the inner part.
+static Expr *getIndexTerms(Expr *e, const std::set<Loop *> &live, bool inner) {
+  if (auto *IE = dynamic_cast<IndexExpr *>(e)) {
+    if (live.count(IE->getLoop()) != inner)
+      return nullptr;
+    return new IndexExpr(IE->getLoop());
+  }
+
+  if (auto *CE = dynamic_cast<ConstantExpr *>(e)) {
+    if (!inner || CE->getValue() == 0)
+      return nullptr;
+    return new ConstantExpr(CE->getValue());
+  }
+
+  auto *BE = dynamic_cast<BinaryExpr *>(e);
+  assert(BE && "Expected an affine subscript");
+  auto loc = BE->getLoc();
+  if (BE->getKind() == BinaryExpr::Mul) {
+    auto *CE = dynamic_cast<ConstantExpr *>(BE->getRHS());
+    Expr *other = BE->getLHS();
+    if (!CE) {
+      CE = dynamic_cast<ConstantExpr *>(BE->getLHS());
+      other = BE->getRHS();
+    }
+    auto *terms = getIndexTerms(other, live, inner);
+    if (!terms)
+      return nullptr;
+    return new BinaryExpr(terms, new ConstantExpr(CE->getValue()),
+                          BinaryExpr::Mul, loc);
+  }
+
+  auto *L = getIndexTerms(BE->getLHS(), live, inner);
+  auto *R = getIndexTerms(BE->getRHS(), live, inner);
+  if (!R)
+    return L;
+  if (!L && BE->getKind() == BinaryExpr::Add)
+    return R;
+  if (!L)
+    L = new ConstantExpr(0);
+  return new BinaryExpr(L, R, BE->getKind(), loc);
+}
+
+/// \returns the part of the affine subscript \p e that depends on the loops in
+/// \p live (if \p inner is set) or on the other loops. The sum of the two
+/// parts is \p e.
+static Expr *getIndexPart(Expr *e, const std::set<Loop *> &live, bool inner) {
+  if (auto *terms = getIndexTerms(e, live, inner))
+    return terms;
+  return new ConstantExpr(0);
+}
+
+/// \returns the expression \p e plus the constant \p offset.
+static Expr *addOffset(Expr *e, int offset, DebugLoc loc) {
+  if (offset == 0)
+    return e;
+  return new BinaryExpr(e, new ConstantExpr(offset), BinaryExpr::Add, loc);
+}
+
+/// Computes the tile of the argument \p arg that the loop \p L reads. Fills
+/// \p loads with the loads of \p arg in the loop, \p live with the loops that
+/// iterate over the tile, \p outer with the part of the subscripts that is
+/// fixed in the loop, \p range with the range of the rest of the subscripts,
+/// \p dims with the dimensions of the tile and \p packedTy with the type of
+/// the local tensor that holds the tile.
+/// \returns True if the tile can be packed.
+static bool computePackTile(Loop *L, Argument *arg,
+                            std::vector<LoadExpr *> &loads,
+                            std::set<Loop *> &live,
+                            std::vector<std::unique_ptr<Expr>> &outer,
+                            std::vector<std::pair<int, int>> &range,
+                            std::vector<unsigned> &dims, Type &packedTy) {
+  std::vector<StoreStmt *> stores;
+  collectLoadStores(L, loads, stores, arg);
+
+  // We can only pack buffers that the loop reads and does not modify.
+  if (loads.empty() || stores.size())
+    return false;
+
+  // The loops that iterate over the tile. The enclosing loops are fixed while
+  // the loop L executes.
+  std::vector<Loop *> loops = collectLoops(L);
+  live.insert(loops.begin(), loops.end());
+  live.insert(L);
+
+  auto *argTy = arg->getType();
+  unsigned numDims = argTy->getNumDims();
+
+  // The part of the subscripts that is fixed in the loop, which must be the
+  // same for all of the loads, and the range of the rest of the subscripts.
+  outer.resize(numDims);
+  range.resize(numDims);
+
+  for (unsigned i = 0; i < loads.size(); i++) {
+    auto &indices = loads[i]->getIndices();
+    for (unsigned d = 0; d < numDims; d++) {
+      Expr *idx = indices[d].get();
+      std::pair<int, int> r;
+      if (!isAffineIndex(idx) || !computeKnownIntegerRange(idx, r, &live))
+        return false;
+
+      // Vector loads access consecutive elements in the last dimension.
+      if (d + 1 == numDims)
+        r.second += loads[i]->getType().getWidth() - 1;
+
+      std::unique_ptr<Expr> fixed(getIndexPart(idx, live, false));
+      if (i == 0) {
+        range[d] = r;
+        outer[d] = std::move(fixed);
+        continue;
+      }
+
+      if (!outer[d]->compare(fixed.get()))
+        return false;
+      range[d].first = std::min(range[d].first, r.first);
+      range[d].second = std::max(range[d].second, r.second);
+    }
+  }
+
+  // Construct the type of the packed tensor. Long rows are padded to whole
+  // cache lines to keep each row aligned.
+  for (auto &r : range) {
+    dims.push_back(r.second - r.first + 1);
+  }
+  auto elemKind = argTy->getElementType();
+  unsigned lineElems = kPackAlignment / Type::getElementSizeInBytes(elemKind);
+  std::vector<unsigned> paddedDims = dims;
+  if (numDims > 1 && dims.back() >= lineElems) {
+    paddedDims.back() = (dims.back() + lineElems - 1) / lineElems * lineElems;
+  }
+  packedTy = Type(elemKind, paddedDims, argTy->getNames());
+  return packedTy.getSizeInBytes() <= kMaxPackSize;
+}
+
+bool bistra::canPack(Loop *L, Argument *arg, Type &packedTy) {
+  std::vector<LoadExpr *> loads;
+  std::set<Loop *> live;
+  std::vector<std::unique_ptr<Expr>> outer;
+  std::vector<std::pair<int, int>> range;
+  std::vector<unsigned> dims;
+  return computePackTile(L, arg, loads, live, outer, range, dims, packedTy);
+}
+
+Argument *bistra::pack(Loop *L, Argument *arg) {
+  Program *p = L->getProgram();
+  std::vector<LoadExpr *> loads;
+  std::set<Loop *> live;
+  std::vector<std::unique_ptr<Expr>> outer;
+  std::vector<std::pair<int, int>> range;
+  std::vector<unsigned> dims;
+  Type packedTy;
+  if (!computePackTile(L, arg, loads, live, outer, range, dims, packedTy))
+    return nullptr;
+
+  auto *argTy = arg->getType();
+  unsigned numDims = argTy->getNumDims();
+  auto loc = L->getLoc();
+
+  Argument *packed = p->addTempTensor(arg->getName() + "_pack", packedTy);
+
+  // Generate the loop nest that copies the tile before the loop:
+  // T[t0, t1] = A[outer0 + lo0 + t0, outer1 + lo1 + t1]
+  Loop *top = nullptr;
+  Scope *body = nullptr;
+  std::vector<Expr *> dest, src;
+  std::vector<IfRange *> checks;
+  for (unsigned d = 0; d < numDims; d++) {
+    Loop *CL = new Loop(newIndexName(packed->getName(), "copy", d), loc,
+                        dims[d]);
+    if (body) {
+      body->addStmt(CL);
+    } else {
+      top = CL;
+    }
+    body = CL;
+
+    dest.push_back(new IndexExpr(CL));
+    Expr *idx = addOffset(new IndexExpr(CL), range[d].first, loc);
+    if (!isZero(outer[d].get())) {
+      idx = new BinaryExpr(outer[d].release(), idx, BinaryExpr::Add, loc);
+    }
+    src.push_back(idx);
+
+    // The tiles at the edge of the buffer may overflow the buffer. Copy only
+    // the elements that are in the buffer.
+    std::pair<int, int> r;
+    int dimSize = argTy->getDims()[d];
+    if (!computeKnownIntegerRange(idx, r) || r.first < 0 ||
+        r.second >= dimSize) {
+      CloneCtx map;
+      checks.push_back(new IfRange(idx->clone(map), 0, dimSize, loc));
+    }
+  }
+  for (auto *IR : checks) {
+    body->addStmt(IR);
+    body = IR;
+  }
+  auto *ld = new LoadExpr(arg, src, loc);
+  body->addStmt(new StoreStmt(packed, dest, ld, false, loc));
+  ((Scope *)L->getParent())->insertBeforeStmt(top, L);
+
+  // Rewrite the loads in the loop to read from the packed tensor.
+  for (auto *ld : loads) {
+    std::vector<Expr *> indices;
+    for (unsigned d = 0; d < numDims; d++) {
+      Expr *idx = getIndexPart(ld->getIndices()[d].get(), live, true);
+      indices.push_back(addOffset(idx, -range[d].first, ld->getLoc()));
+    }
+    ld->replaceUseWith(
+        new LoadExpr(packed, indices, ld->getType(), ld->getLoc()));
+  }
+
+  return packed;
+}
+
 template <class T>
 static void swizzle(std::vector<T> &elems,
                     const std::vector<unsigned> &shuffle) {
@@ -876,7 +1526,7 @@ bool bistra::applyPragmaCommand(Program *prog, const PragmaCommand &pc) {
 
   switch (pc.kind_) {
   case PragmaCommand::PragmaKind::vectorize:
-    if (auto *L2 = vectorize(L, param)) {
+    if (auto *L2 = vectorize(L, param, pc.masked_)) {
       if (pc.newName_.size())
         L2->setName(pc.newName_);
       return true;
@@ -916,6 +1566,22 @@ bool bistra::applyPragmaCommand(Program *prog, const PragmaCommand &pc) {
     // We distribute all loops inside L, including L, so we pass the parent
     // scope.
     return ::distributeAllLoops((Scope *)L->getParent());
+  case PragmaCommand::parallelize:
+    return ::parallelize(L);
+  case PragmaCommand::prefetch:
+    return ::prefetch(L, param);
+  case PragmaCommand::pack:
+    for (auto *arg : prog->getArgs()) {
+      if (arg->getName() == pc.argName_)
+        return ::pack(L, arg);
+    }
+    return false;
+  case PragmaCommand::stream:
+    for (auto *arg : prog->getArgs()) {
+      if (arg->getName() == pc.argName_)
+        return ::streamStores(L, arg);
+    }
+    return false;
   case PragmaCommand::other:
     assert(false && "Invalid pragma");
     return false;
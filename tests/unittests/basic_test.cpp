@@ -1,6 +1,9 @@
+#include "bistra/Analysis/CostModel.h"
+#include "bistra/Analysis/Value.h"
 #include "bistra/Analysis/Visitors.h"
 #include "bistra/Backends/Backend.h"
 #include "bistra/Backends/Backends.h"
+#include "bistra/Program/Library.h"
 #include "bistra/Program/Program.h"
 #include "bistra/Program/Utils.h"
 #include "bistra/Transforms/Simplify.h"
@@ -582,3 +585,213 @@ TEST(basic, clone_hash_compare) {
   delete p2;
   delete p;
 }
+
+TEST(basic, node_allocator) {
+  // The memory of a deleted node is reused by the next node of the same size.
+  auto *idx = new ConstantExpr(3);
+  delete idx;
+  auto *idx2 = new ConstantExpr(4);
+  EXPECT_EQ((void *)idx, (void *)idx2);
+  delete idx2;
+
+  // Programs are cloned on some threads and deleted on others.
+  Program *p = generateGemm(64, 64, 64);
+  std::vector<Program *> clones(16);
+  parallelFor(clones.size(), 4, [&](unsigned i) { clones[i] = p->clone(); });
+  parallelFor(clones.size(), 4, [&](unsigned i) {
+    EXPECT_EQ(clones[i]->hash(), p->hash());
+    delete clones[i];
+    clones[i] = p->clone();
+  });
+  for (auto *c : clones) {
+    EXPECT_EQ(c->hash(), p->hash());
+    delete c;
+  }
+  delete p;
+}
+
+TEST(basic, kernel_library) {
+  KernelLibrary library("kernels");
+  EXPECT_TRUE(library.addKernel(generateGemm(64, 64, 64)));
+  EXPECT_TRUE(library.addKernel(generateGemm(128, 32, 16)));
+
+  // Kernels with the same name and shapes can't be registered twice.
+  Program *dup = generateGemm(64, 64, 64);
+  EXPECT_FALSE(library.addKernel(dup));
+  delete dup;
+
+  // The second gemm is exported with a different symbol.
+  auto &kernels = library.getKernels();
+  EXPECT_EQ(kernels.size(), 2);
+  EXPECT_EQ(kernels[0].second->getName(), "gemm");
+  EXPECT_EQ(kernels[1].first, "gemm");
+  EXPECT_EQ(kernels[1].second->getName(), "gemm_1");
+  EXPECT_EQ(library.getKernel("gemm", {128, 16, 128, 32, 32, 16}),
+            kernels[1].second.get());
+  EXPECT_EQ(library.getKernel("gemm", {128, 16}), nullptr);
+
+  // Kernels with the same dimensions and different element types or
+  // different argument boundaries are different kernels.
+  auto makeKernel = [](ElemKind kind, std::vector<unsigned> a,
+                       std::vector<unsigned> b) {
+    Program *p = new Program("copy", DebugLoc::npos());
+    p->addArgument("A", a, std::vector<std::string>(a.size(), "x"), kind);
+    p->addArgument("B", b, std::vector<std::string>(b.size(), "y"), kind);
+    return p;
+  };
+  KernelLibrary copies("copies");
+  EXPECT_TRUE(copies.addKernel(makeKernel(ElemKind::Float32Ty, {4, 8}, {2})));
+  EXPECT_TRUE(copies.addKernel(makeKernel(ElemKind::Int8Ty, {4, 8}, {2})));
+  EXPECT_TRUE(copies.addKernel(makeKernel(ElemKind::Float32Ty, {4}, {8, 2})));
+  dup = makeKernel(ElemKind::Int8Ty, {4, 8}, {2});
+  EXPECT_FALSE(copies.addKernel(dup));
+  delete dup;
+  EXPECT_EQ(copies.getKernels().size(), 3);
+  EXPECT_EQ(copies.getKernels()[1].second->getName(), "copy_1");
+
+  auto header = library.emitHeader();
+  EXPECT_NE(header.find("void gemm(float *C, float *A, float *B);"),
+            std::string::npos);
+  EXPECT_NE(header.find("void gemm_1(float *C, float *A, float *B);"),
+            std::string::npos);
+  EXPECT_NE(header.find("C: float<I:128, J:16>, aligned to 4 bytes"),
+            std::string::npos);
+  EXPECT_NE(header.find("extern const bistra_kernel_info kernels_kernels[];"),
+            std::string::npos);
+  EXPECT_NE(header.find("kernels_lookup(const char *name"), std::string::npos);
+}
+
+TEST(basic, measure_statistics) {
+  // The slow sample is rejected as an outlier.
+  auto m = computeStatistics({1.0, 1.1, 0.9, 1.0, 1.05, 0.95, 10.0});
+  EXPECT_EQ(m.samples, 7);
+  EXPECT_EQ(m.outliers, 1);
+  EXPECT_EQ(m.median, 1.0);
+  EXPECT_EQ(m.min, 0.9);
+  EXPECT_NEAR(m.mean, 1.0, 1e-9);
+
+  auto s = m.scale(10);
+  EXPECT_EQ(s.median, 0.1);
+  EXPECT_EQ(s.samples, 7);
+
+  // Measure some code and make sure that we respect the limits.
+  MeasureOptions opts;
+  opts.warmup = 3;
+  opts.minReps = 4;
+  opts.maxReps = 8;
+  opts.relativeError = 0;
+  unsigned calls = 0;
+  auto res = measure([&]() { calls++; }, opts);
+  EXPECT_EQ(res.samples, 8);
+  EXPECT_EQ(calls, 11);
+}
+
+TEST(basic, fused_multiply_add_cost) {
+  Program *p = generateGemm(8, 4, 2);
+  std::unordered_map<ASTNode *, ComputeCostTy> heatmap;
+  estimateCompute(p, heatmap);
+
+  // The accumulation of the product is a single multiply-add: one arithmetic
+  // op for each of the 8 * 4 * 2 iterations.
+  EXPECT_EQ(heatmap[p].second, 64);
+  delete p;
+}
+
+TEST(basic, known_alignment) {
+  Program *p = new Program("align", loc);
+  auto *A = p->addArgument("A", {16, 24}, {"I", "J"}, ElemKind::Float32Ty);
+  auto *I = new Loop("i", loc, 16, 1);
+  auto *J = new Loop("j", loc, 24, 8);
+  p->addStmt(I);
+  I->addStmt(J);
+
+  // A[i, j], A[i, j + 1] and A[0, 0], where 'j' jumps in steps of 8.
+  auto *ld1 = new LoadExpr(A, {new IndexExpr(I), new IndexExpr(J)}, loc);
+  auto *next = new BinaryExpr(new IndexExpr(J), new ConstantExpr(1),
+                              BinaryExpr::BinOpKind::Add, loc);
+  auto *ld2 = new LoadExpr(A, {new IndexExpr(I), next}, loc);
+  auto *ld3 = new LoadExpr(A, {new ConstantExpr(0), new ConstantExpr(0)}, loc);
+  auto *sum = new BinaryExpr(ld1, ld2, BinaryExpr::BinOpKind::Add, loc);
+  sum = new BinaryExpr(sum, ld3, BinaryExpr::BinOpKind::Add, loc);
+  J->addStmt(new StoreLocalStmt(p->addLocalVar("x", ElemKind::Float32Ty), sum,
+                                false, loc));
+
+  // Without a promise from the caller, only the element is aligned.
+  EXPECT_EQ(getKnownAlignment(A, ld1->getIndices()), 4);
+  EXPECT_EQ(getKnownAlignment(A, ld3->getIndices()), 4);
+
+  // Rows are 96 bytes and 'j' advances by 32 bytes.
+  A->setAlignment(64);
+  EXPECT_EQ(getKnownAlignment(A, ld1->getIndices()), 32);
+  EXPECT_EQ(getKnownAlignment(A, ld2->getIndices()), 4);
+  EXPECT_EQ(getKnownAlignment(A, ld3->getIndices()), 64);
+
+  // The alignment survives cloning.
+  std::unique_ptr<Program> cloned(p->clone());
+  EXPECT_EQ(cloned->getArg(0)->getAlignment(), 64);
+  delete p;
+}
+
+/// \returns the program: A[i, j] = B[j, i];
+static Program *generateTranspose(unsigned sz) {
+  Program *p = new Program("transpose", loc);
+  auto *A = p->addArgument("A", {sz, sz}, {"I", "J"}, ElemKind::Float32Ty);
+  auto *B = p->addArgument("B", {sz, sz}, {"J", "I"}, ElemKind::Float32Ty);
+  auto *I = new Loop("i", loc, sz, 1);
+  auto *J = new Loop("j", loc, sz, 1);
+  p->addStmt(I);
+  I->addStmt(J);
+  auto *ld = new LoadExpr(B, {new IndexExpr(J), new IndexExpr(I)}, loc);
+  J->addStmt(
+      new StoreStmt(A, {new IndexExpr(I), new IndexExpr(J)}, ld, false, loc));
+  return p;
+}
+
+TEST(basic, cost_model) {
+  MachineModel M;
+  M.numRegisters = 16;
+  M.vectorWidth = 8;
+
+  // Vectorization reduces the number of instructions.
+  Program *p = new Program("memset", loc);
+  auto *dest = p->addArgument("DEST", {1024}, {"len"}, ElemKind::Float32Ty);
+  auto *I = new Loop("i", loc, 1024, 1);
+  p->addStmt(I);
+  I->addStmt(new StoreStmt(dest, {new IndexExpr(I)}, new ConstantFPExpr(0.1),
+                           false, loc));
+  double scalar = estimateCycles(p, M);
+  EXPECT_TRUE(::vectorize(I, 8));
+  EXPECT_LT(estimateCycles(p, M) * 4, scalar);
+  delete p;
+
+  // Tiling the transpose keeps the columns of B in the cache.
+  p = generateTranspose(4096);
+  double naive = estimateCycles(p, M);
+  I = getLoopByName(p, "i");
+  auto *J = getLoopByName(p, "j");
+  EXPECT_TRUE(::tile(I, 64));
+  EXPECT_TRUE(::tile(J, 64));
+  EXPECT_TRUE(::hoist(J, 1));
+  EXPECT_LT(estimateCycles(p, M) * 2, naive);
+  delete p;
+
+  // Accumulate into 24 vector registers, which spill on a machine with 16.
+  p = new Program("spill", loc);
+  I = new Loop("i", loc, 1024, 1);
+  p->addStmt(I);
+  for (unsigned i = 0; i < 24; i++) {
+    auto *var = p->addLocalVar("x" + std::to_string(i),
+                               ExprType(ElemKind::Float32Ty, 8));
+    auto *one = new BroadcastExpr(new ConstantFPExpr(1.0), 8);
+    I->addStmt(new StoreLocalStmt(var, one, true, loc));
+  }
+  double spills = estimateCycles(p, M);
+  M.numRegisters = 32;
+  EXPECT_LT(estimateCycles(p, M), spills);
+  delete p;
+
+  // The host has caches.
+  auto host = MachineModel::getHost();
+  EXPECT_GT(host.cacheSize[0], 0);
+  EXPECT_GT(host.numCores, 0);
+}
@@ -1,9 +1,13 @@
+#include "bistra/Bytecode/Archive.h"
 #include "bistra/Bytecode/Bytecode.h"
 #include "bistra/Program/Program.h"
 #include "bistra/Program/Utils.h"
 
 #include "gtest/gtest.h"
 
+#include <fstream>
+#include <thread>
+
 using namespace bistra;
 
 TEST(basic, string_tables) {
@@ -147,3 +151,269 @@ TEST(basic, serialize_program) {
   EXPECT_EQ(dp->getVars().size(), p->getVars().size());
   EXPECT_EQ(dp->getArgs().size(), p->getArgs().size());
 }
+
+TEST(basic, serialize_local_tensor) {
+  auto loc = DebugLoc::npos();
+  Program *p = new Program("copy", loc);
+  auto *dest = p->addArgument("DEST", {64}, {"len"}, ElemKind::Float32Ty);
+  Type Ty(ElemKind::Float32Ty, {64}, {"len"});
+  auto *tmp = p->addTempTensor("tmp", Ty);
+  tmp->setAlignment(64);
+  auto *I = new Loop("i", loc, 64, 1);
+  auto *J = new Loop("j", loc, 64, 1);
+  p->addStmt(I);
+  p->addStmt(J);
+  I->addStmt(new StoreStmt(tmp, {new IndexExpr(I)}, new ConstantFPExpr(0.1),
+                           false, loc));
+  auto *ld = new LoadExpr(tmp, {new IndexExpr(J)}, loc);
+  J->addStmt(new StoreStmt(dest, {new IndexExpr(J)}, ld, false, loc));
+
+  auto media = Bytecode::serialize(p);
+  Program *dp = Bytecode::deserialize(media);
+
+  dp->dump();
+  EXPECT_EQ(dp->getArgs().size(), 1);
+  EXPECT_EQ(dp->getTensors().size(), 1);
+  EXPECT_EQ(dp->getTensors()[0]->getName(), tmp->getName());
+  EXPECT_EQ(dp->getTensors()[0]->getAlignment(), 64);
+  EXPECT_EQ(dp->hash(), p->hash());
+  delete p;
+  delete dp;
+}
+
+TEST(basic, serialize_if_range) {
+  auto loc = DebugLoc::npos();
+  Program *p = new Program("copy", loc);
+  auto *dest = p->addArgument("DEST", {60}, {"len"}, ElemKind::Float32Ty);
+  auto *I = new Loop("i", loc, 64, 8);
+  p->addStmt(I);
+  auto *IR = new IfRange(new IndexExpr(I), 3, 60, loc);
+  IR->setWidth(8);
+  I->addStmt(IR);
+  auto *val = new BroadcastExpr(new ConstantFPExpr(0.1), 8);
+  IR->addStmt(new StoreStmt(dest, {new IndexExpr(I)}, val, false, loc));
+
+  auto media = Bytecode::serialize(p);
+  Program *dp = Bytecode::deserialize(media);
+
+  dp->dump();
+  auto *DIR = dynamic_cast<IfRange *>(
+      dynamic_cast<Loop *>(dp->getBody()[0].get())->getBody()[0].get());
+  EXPECT_EQ(DIR->getRange(), IR->getRange());
+  EXPECT_EQ(DIR->getWidth(), 8);
+  EXPECT_EQ(dp->hash(), p->hash());
+  delete p;
+  delete dp;
+}
+
+TEST(basic, serialize_nontemporal_store) {
+  auto loc = DebugLoc::npos();
+  Program *p = new Program("fill", loc);
+  auto *dest = p->addArgument("DEST", {64}, {"len"}, ElemKind::Float32Ty);
+  auto *I = new Loop("i", loc, 64, 1);
+  p->addStmt(I);
+  auto *st = new StoreStmt(dest, {new IndexExpr(I)}, new ConstantFPExpr(0.1),
+                           false, loc);
+  st->setNonTemporal(true);
+  I->addStmt(st);
+
+  auto media = Bytecode::serialize(p);
+  Program *dp = Bytecode::deserialize(media);
+
+  dp->dump();
+  auto *DST = dynamic_cast<StoreStmt *>(
+      dynamic_cast<Loop *>(dp->getBody()[0].get())->getBody()[0].get());
+  EXPECT_TRUE(DST->isNonTemporal());
+  EXPECT_FALSE(DST->isAccumulate());
+  EXPECT_EQ(dp->hash(), p->hash());
+  delete p;
+  delete dp;
+}
+
+TEST(basic, varint_streams) {
+  std::string back;
+  StreamWriter SW(back);
+  StreamReader SR(back);
+
+  // Small numbers take one byte, and strings may be long.
+  SW.write((uint32_t)5);
+  EXPECT_EQ(back.size(), 1);
+  SW.write((uint32_t)300);
+  EXPECT_EQ(back.size(), 3);
+  SW.write((uint32_t)0xffffffff);
+  EXPECT_EQ(back.size(), 8);
+  std::string longStr(1000, 'x');
+  SW.write(longStr);
+  SW.write(0.5f);
+
+  EXPECT_EQ(SR.readU32(), 5);
+  EXPECT_EQ(SR.readU32(), 300);
+  EXPECT_EQ(SR.readU32(), 0xffffffff);
+  EXPECT_EQ(SR.readStr(), longStr);
+  EXPECT_EQ(SR.readF32(), 0.5f);
+  EXPECT_EQ(SR.hasMore(), false);
+}
+
+TEST(basic, bytecode_version_and_features) {
+  auto loc = DebugLoc::npos();
+  Program *p = new Program("fill", loc);
+  auto *dest = p->addArgument("DEST", {64}, {"len"}, ElemKind::Float32Ty);
+  auto *I = new Loop("i", loc, 64, 1);
+  p->addStmt(I);
+  I->addStmt(new StoreStmt(dest, {new IndexExpr(I)}, new ConstantFPExpr(0.1),
+                           false, loc));
+  auto media = Bytecode::serialize(p);
+
+  // Load the program from a memory-mapped file.
+  std::string path = "/tmp/bistra_bytecode_test.bc";
+  writeFile(path, media);
+  Program *dp = Bytecode::deserializeFile(path);
+  remove(path.c_str());
+  ASSERT_NE(dp, nullptr);
+  EXPECT_EQ(dp->hash(), p->hash());
+  delete dp;
+
+  // The version and the features follow the four bytes of the signature.
+  // Reject media from a newer version or with unknown features.
+  std::string newer = media;
+  newer[4] = Bytecode::kVersion + 1;
+  EXPECT_EQ(Bytecode::deserialize(newer), nullptr);
+  std::string unknown = media;
+  unknown[5] = 0x40;
+  EXPECT_EQ(Bytecode::deserialize(unknown), nullptr);
+  EXPECT_EQ(Bytecode::deserialize(media.substr(0, 12)), nullptr);
+  EXPECT_EQ(Bytecode::deserialize(""), nullptr);
+  delete p;
+}
+
+/// \returns a program named \p name that fills a buffer of \p len elements.
+static Program *makeFill(const std::string &name, unsigned len) {
+  auto loc = DebugLoc::npos();
+  Program *p = new Program(name, loc);
+  auto *dest = p->addArgument("DEST", {len}, {"len"}, ElemKind::Float32Ty);
+  auto *I = new Loop("i", loc, len, 1);
+  p->addStmt(I);
+  I->addStmt(new StoreStmt(dest, {new IndexExpr(I)}, new ConstantFPExpr(0.1),
+                           false, loc));
+  return p;
+}
+
+TEST(basic, truncated_bytecode_header) {
+  Program *p = makeFill("fill", 64);
+  auto media = Bytecode::serialize(p);
+  delete p;
+
+  // The preamble is the signature, the version, the features, the number of
+  // sections and a table with nine bytes for each of the two sections. Every
+  // prefix of it is rejected.
+  size_t preambleSize = 4 + 3 + 2 * 9;
+  ASSERT_GT(media.size(), preambleSize);
+  for (size_t len = 0; len <= preambleSize; len++) {
+    EXPECT_EQ(Bytecode::deserialize(media.data(), len), nullptr);
+  }
+
+  // A varint that continues past the end of the stream, and a varint that is
+  // longer than five bytes.
+  std::string cut = media.substr(0, 4) + "\x80";
+  EXPECT_EQ(Bytecode::deserialize(cut), nullptr);
+  std::string overlong = media.substr(0, 4) + std::string(6, '\x80') + "\x01";
+  EXPECT_EQ(Bytecode::deserialize(overlong), nullptr);
+
+  uint32_t val;
+  StreamReader SR(cut);
+  SR.skip(4);
+  EXPECT_FALSE(SR.tryReadU32(val));
+  StreamReader OR(overlong);
+  OR.skip(4);
+  EXPECT_FALSE(OR.tryReadU32(val));
+}
+
+TEST(basic, bytecode_archive) {
+  std::string path = "/tmp/bistra_bytecode_test.bca";
+  remove(path.c_str());
+
+  Program *a = makeFill("fill", 64);
+  Program *b = makeFill("fill", 32);
+  Program *c = makeFill("fill", 64);
+  c->addStmt(new Loop("j", DebugLoc::npos(), 4, 1));
+  {
+    BytecodeArchive archive(path);
+    EXPECT_EQ(archive.getEntries().size(), 0);
+    EXPECT_TRUE(archive.append(a, "x86"));
+    EXPECT_TRUE(archive.append(b, "x86"));
+    EXPECT_TRUE(archive.append(a, "arm"));
+    // Replace the first program.
+    EXPECT_TRUE(archive.append(c, "x86"));
+  }
+
+  // Reopen the archive and read the table of contents.
+  BytecodeArchive archive(path);
+  EXPECT_EQ(archive.getEntries().size(), 4);
+  EXPECT_EQ(BytecodeArchive::getShapeSignature(a), "float<64>");
+  auto *e = archive.find("fill", "float<64>", "x86");
+  ASSERT_NE(e, nullptr);
+  Program *dc = archive.load(*e);
+  ASSERT_NE(dc, nullptr);
+  EXPECT_EQ(dc->hash(), c->hash());
+  delete dc;
+  EXPECT_EQ(archive.find("fill", "float<16>", "x86"), nullptr);
+
+  auto latest = archive.getLatestEntries("x86");
+  ASSERT_EQ(latest.size(), 2);
+  EXPECT_EQ(latest[0]->shape_, "float<32>");
+  EXPECT_EQ(latest[1]->shape_, "float<64>");
+  EXPECT_EQ(archive.getLatestEntries("arm").size(), 1);
+
+  // A record that was not written completely is ignored, and is discarded by
+  // the next append.
+  {
+    std::ofstream out(path, std::ios::binary | std::ios::app);
+    out << std::string("\x04" "fill\x09" "float", 11);
+  }
+  BytecodeArchive truncated(path);
+  EXPECT_EQ(truncated.getEntries().size(), 4);
+  EXPECT_TRUE(truncated.append(b, "arm"));
+  EXPECT_EQ(BytecodeArchive(path).getEntries().size(), 5);
+  remove(path.c_str());
+
+  // Don't append to files that are not archives.
+  writeFile(path, "hello world");
+  EXPECT_FALSE(BytecodeArchive(path).append(a, "x86"));
+  remove(path.c_str());
+  delete a;
+  delete b;
+  delete c;
+}
+
+TEST(basic, bytecode_archive_concurrent_append) {
+  std::string path = "/tmp/bistra_bytecode_concurrent.bca";
+  remove(path.c_str());
+
+  // Each thread opens the archive on its own, like separate processes do,
+  // and the records must not interleave.
+  const unsigned numThreads = 4, numRecords = 16;
+  std::vector<std::thread> threads;
+  for (unsigned t = 0; t < numThreads; t++) {
+    threads.emplace_back([&path, t]() {
+      BytecodeArchive archive(path);
+      for (unsigned i = 0; i < numRecords; i++) {
+        Program *p = makeFill("fill" + std::to_string(t), 16 + i);
+        EXPECT_TRUE(archive.append(p, "x86"));
+        delete p;
+      }
+    });
+  }
+  for (auto &t : threads) {
+    t.join();
+  }
+
+  BytecodeArchive archive(path);
+  EXPECT_EQ(archive.getEntries().size(), numThreads * numRecords);
+  for (auto &e : archive.getEntries()) {
+    Program *p = archive.load(e);
+    ASSERT_NE(p, nullptr);
+    EXPECT_EQ(BytecodeArchive::getShapeSignature(p), e.shape_);
+    delete p;
+  }
+  remove(path.c_str());
+}
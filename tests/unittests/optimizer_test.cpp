@@ -1,13 +1,20 @@
+#include "bistra/Analysis/CostModel.h"
 #include "bistra/Analysis/Value.h"
 #include "bistra/Analysis/Visitors.h"
+#include "bistra/Optimizer/LearnedModel.h"
+#include "bistra/Optimizer/TuningCache.h"
 #include "bistra/Parser/Parser.h"
 #include "bistra/Program/Program.h"
 #include "bistra/Program/Utils.h"
+#include "bistra/Transforms/Dependence.h"
 #include "bistra/Transforms/Simplify.h"
 #include "bistra/Transforms/Transforms.h"
 
 #include "gtest/gtest.h"
 
+#include <cmath>
+#include <filesystem>
+
 using namespace bistra;
 
 TEST(opt, tiler) {
@@ -158,6 +165,63 @@ TEST(opt, fuse_test) {
   EXPECT_EQ(counter.expr, 10);
 }
 
+TEST(opt, fuse_legality) {
+  const char *code = R"(
+  func fuse_legality(C:float<I:64, J:64>, S:float<x:64>) {
+    for (i in 0 .. 64) {
+      for (j in 0 .. 64) { C[i, j] += 1.0 }
+    }
+    for (x in 0 .. 63) {
+      for (y in 0 .. 64) { C[x, y] = C[x + 1, y] }
+    }
+    for (r in 0 .. 64) {
+      for (c in 0 .. 64) { S[0] += C[r, c] }
+    }
+    for (t in 0 .. 64) {
+      for (u in 0 .. 64) { C[t, u] = C[t, u] * S[0] }
+    }
+  })";
+
+  ParserContext ctx(code);
+  Parser P(ctx);
+  P.parse();
+  EXPECT_EQ(ctx.getNumErrors(), 0);
+  Program *p = ctx.getProgram();
+
+  // The ranges of the loops are different.
+  EXPECT_FALSE(::fuse(::getLoopByName(p, "i"), 2));
+  // The second loop reads the next row of C, before the first loop writes it.
+  EXPECT_FALSE(::fuse(::getLoopByName(p, "x"), 2));
+  // The reduction into S must complete before S is read.
+  EXPECT_FALSE(::fuse(::getLoopByName(p, "r"), 2));
+
+  // Fuse the tiles of a tiled producer with the following loop, by tiling
+  // the consumer in the same way.
+  const char *tiled = R"(
+  func tiled(C:float<I:100, J:64>, A:float<I:100, J:64>) {
+    for (i in 0 .. 100) {
+      for (j in 0 .. 64) { C[i, j] = A[i, j] * 2.0 }
+    }
+    for (x in 0 .. 100) {
+      for (y in 0 .. 64) { C[x, y] = max(C[x, y], 0.0) }
+    }
+  })";
+
+  ParserContext ctx2(tiled);
+  Parser P2(ctx2);
+  P2.parse();
+  EXPECT_EQ(ctx2.getNumErrors(), 0);
+  p = ctx2.getProgram();
+  Loop *I = ::getLoopByName(p, "i");
+  EXPECT_TRUE(::tile(I, 32));
+  EXPECT_TRUE(::fuse(I, 1));
+  p->verify();
+  p->dump();
+  EXPECT_EQ(::getLoopByName(p, "x"), nullptr);
+  // Only the outermost loops were fused.
+  EXPECT_NE(::getLoopByName(p, "y"), nullptr);
+}
+
 TEST(opt, change_layout_test) {
   const char *code = R"(
   let m = 512
@@ -184,3 +248,170 @@ TEST(opt, change_layout_test) {
 
   p->verify();
 }
+
+TEST(opt, parallelize) {
+  const char *code = R"(
+  func par(A:float<x:64, y:32>, B:float<y:32, x:64>, C:float<x:64>) {
+    for (i in 0 .. 64) {
+      for (j in 0 .. 32) { A[i, j] = B[j, i] }
+    }
+    for (k in 0 .. 64) { C[0] += B[0, k] }
+    for (t in 0 .. 63) { C[t] = C[t + 1] }
+  })";
+
+  ParserContext ctx(code);
+  Parser P(ctx);
+  P.parse();
+  EXPECT_EQ(ctx.getNumErrors(), 0);
+  Program *p = ctx.getProgram();
+
+  // Inner loops and loops that carry a dependence are not parallelized.
+  EXPECT_FALSE(::parallelize(::getLoopByName(p, "j")));
+  EXPECT_FALSE(::parallelize(::getLoopByName(p, "k")));
+  EXPECT_FALSE(::parallelize(::getLoopByName(p, "t")));
+
+  // Each tile of the outer loop writes a different block of rows.
+  Loop *I = ::getLoopByName(p, "i");
+  EXPECT_TRUE(::tile(I, 8));
+  EXPECT_TRUE(::parallelize(I));
+  EXPECT_TRUE(I->isParallel());
+  p->dump();
+}
+
+TEST(opt, write_only_output) {
+  const char *code = R"(
+  func outputs(A:float<I:100, J:64>, D:float<I:64, J:32>,
+               E:float<I:64, J:32>, F:float<I:64, J:64>) {
+    for (i in 0 .. 100) {
+      for (j in 0 .. 64) { A[i, j] = 1.0 }
+    }
+    for (x in 0 .. 64) {
+      for (y in 0 .. 16) {
+        D[x, y] = 1.0
+        D[x, y] = 2.0
+      }
+    }
+    for (r in 0 .. 64) {
+      for (c in 0 .. 32) {
+        if (c in 0 .. 16) { E[r, c] = 0.0 }
+      }
+    }
+    for (t in 0 .. 64) { F[t, t] = 0.0 }
+  })";
+
+  ParserContext ctx(code);
+  Parser P(ctx);
+  P.parse();
+  EXPECT_EQ(ctx.getNumErrors(), 0);
+  Program *p = ctx.getProgram();
+
+  EXPECT_TRUE(::isWriteOnlyOutput(p, p->getArg(0)));
+  // The two stores write the same half of the columns.
+  EXPECT_FALSE(::isWriteOnlyOutput(p, p->getArg(1)));
+  // The range check skips half of the columns.
+  EXPECT_FALSE(::isWriteOnlyOutput(p, p->getArg(2)));
+  // Only the diagonal is written.
+  EXPECT_FALSE(::isWriteOnlyOutput(p, p->getArg(3)));
+
+  // Tiles that overflow the rows are clipped by a range check, and the lanes
+  // of the vector stores cover the columns.
+  EXPECT_TRUE(::tile(::getLoopByName(p, "i"), 32));
+  EXPECT_TRUE(::vectorize(::getLoopByName(p, "j"), 8));
+  p->verify();
+  EXPECT_TRUE(::isWriteOnlyOutput(p, p->getArg(0)));
+}
+
+TEST(opt, tuning_cache) {
+  const char *code = R"(
+  func scale(A:float<x:64>) {
+    for (i in 0 .. A.x) { A[i] = A[i] * 2.0 }
+  }
+  )";
+
+  ParserContext ctx(code);
+  Parser P(ctx);
+  P.parse();
+  EXPECT_EQ(ctx.getNumErrors(), 0);
+  Program *p = ctx.getProgram();
+
+  std::string dir = "/tmp/bistra_tuning_cache_test";
+  std::filesystem::remove_all(dir);
+
+  {
+    TuningCache cache(dir, p, "target");
+    double time;
+    EXPECT_FALSE(cache.lookupTime(1234, time));
+    cache.recordTime(1234, 0.5);
+    // The session is not completed yet.
+    cache.saveBest(p, 0.5, false);
+    EXPECT_EQ(cache.loadCompletedBest(time), nullptr);
+  }
+
+  {
+    // Reopen the database and resume the session.
+    TuningCache cache(dir, p, "target");
+    double time;
+    EXPECT_TRUE(cache.lookupTime(1234, time));
+    EXPECT_EQ(time, 0.5);
+    cache.saveBest(p, 0.25, true);
+    std::unique_ptr<Program> best(cache.loadCompletedBest(time));
+    EXPECT_NE(best.get(), nullptr);
+    EXPECT_EQ(time, 0.25);
+    EXPECT_EQ(best->hash(), p->hash());
+  }
+
+  {
+    // Results for other targets are kept separately.
+    TuningCache cache(dir, p, "another target");
+    double time;
+    EXPECT_FALSE(cache.lookupTime(1234, time));
+    EXPECT_EQ(cache.loadCompletedBest(time), nullptr);
+  }
+
+  std::filesystem::remove_all(dir);
+}
+
+TEST(opt, learned_model) {
+  // The time is a product of powers of the features.
+  std::vector<std::vector<double>> features;
+  std::vector<double> times;
+  for (unsigned i = 0; i < 64; i++) {
+    double a = i % 8, b = i / 8;
+    features.push_back({a, b, 3});
+    times.push_back(0.001 * std::exp(0.5 * a - 0.25 * b));
+  }
+
+  LearnedModel model;
+  EXPECT_FALSE(model.isTrained());
+  EXPECT_FALSE(model.train({features[0]}, {times[0]}));
+  EXPECT_TRUE(model.train(features, times, 1e-6));
+  EXPECT_NEAR(model.predict({2, 4, 3}), 0.001 * std::exp(0.0), 1e-6);
+  EXPECT_NEAR(model.predict({7, 0, 3}), 0.001 * std::exp(3.5), 1e-4);
+
+  // Train the model from a log of the features of real programs.
+  const char *code = R"(
+  func scale(A:float<x:64, y:64>) {
+    for (i in 0 .. A.x) {
+      for (j in 0 .. A.y) { A[i, j] = A[i, j] * 2.0 }
+    }
+  }
+  )";
+  ParserContext ctx(code);
+  Parser P(ctx);
+  P.parse();
+  EXPECT_EQ(ctx.getNumErrors(), 0);
+  Program *p = ctx.getProgram();
+
+  MachineModel M;
+  auto f = getProgramFeatures(p, M);
+  std::string path = "/tmp/bistra_learned_model_test.log";
+  std::filesystem::remove(path);
+  for (unsigned i = 0; i < LearnedModel::minSamples; i++) {
+    LearnedModel::appendToLog(path, 0.25, f);
+  }
+  EXPECT_EQ(model.trainFromLog(path, f.size() + 1), 0);
+  EXPECT_EQ(model.trainFromLog(path, f.size()), LearnedModel::minSamples);
+  EXPECT_NEAR(model.predict(f), 0.25, 1e-6);
+  std::filesystem::remove(path);
+  delete p;
+}
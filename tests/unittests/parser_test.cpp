@@ -2,6 +2,7 @@
 #include "bistra/Analysis/Visitors.h"
 #include "bistra/Parser/Lexer.h"
 #include "bistra/Parser/Parser.h"
+#include "bistra/Program/Dynamic.h"
 #include "bistra/Program/Program.h"
 #include "bistra/Program/Utils.h"
 
@@ -164,6 +165,7 @@ TEST(basic, pragmas) {
     vectorize "i" to 8
     vectorize "r" to 4
     tile "r" to 4 as "r_tiled"
+    parallelize "i"
   }
   )";
 
@@ -176,7 +178,7 @@ TEST(basic, pragmas) {
   p->dump();
   auto decls = ctx.getPragmaDecls();
 
-  EXPECT_EQ(decls.size(), 3);
+  EXPECT_EQ(decls.size(), 4);
   EXPECT_EQ(decls[0].kind_, PragmaCommand::PragmaKind::vectorize);
   EXPECT_EQ(decls[0].loopName_, "i");
   EXPECT_EQ(decls[0].param_, 8);
@@ -186,6 +188,130 @@ TEST(basic, pragmas) {
   EXPECT_EQ(decls[2].kind_, PragmaCommand::PragmaKind::tile);
   EXPECT_EQ(decls[2].loopName_, "r");
   EXPECT_EQ(decls[2].newName_, "r_tiled");
+  EXPECT_EQ(decls[3].kind_, PragmaCommand::PragmaKind::parallelize);
+  EXPECT_EQ(decls[3].loopName_, "i");
+}
+
+TEST(basic, pack_pragma) {
+  const char *pack_test = R"(
+  func pack_test(C:float<x:16>, B:float<x:16, y:16>) {
+    for (i in 0 .. 16) {
+      for (j in 0 .. 16) { C[j] += B[i, j] }
+    }
+  }
+
+  script for "x86" {
+    pack "i" "B"
+  }
+  )";
+
+  ParserContext ctx(pack_test);
+  Parser P(ctx);
+  P.parse();
+  EXPECT_EQ(ctx.getNumErrors(), 0);
+  auto decls = ctx.getPragmaDecls();
+  EXPECT_EQ(decls.size(), 1);
+  EXPECT_EQ(decls[0].kind_, PragmaCommand::PragmaKind::pack);
+  EXPECT_EQ(decls[0].loopName_, "i");
+  EXPECT_EQ(decls[0].argName_, "B");
+}
+
+TEST(basic, multiple_functions) {
+  const char *module = R"(
+  let size = 64
+
+  func scale(A:float<x:size>, B:float<x:size>) {
+    for (i in 0 .. size) { A[i] = B[i] * 2.0 }
+  }
+
+  script for "x86" {
+    vectorize "i" to 8
+  }
+
+  func relu(A:float<x:size>) {
+    var T : float<x:size>
+    for (i in 0 .. size) { A[i] = A[i] * A[i] }
+  }
+
+  func bias(A:float<x:size>, B:float<x:size>) {
+    for (i in 0 .. size) { A[i] += B[i] }
+  }
+
+  script for "x86" {
+    tile "i" to 16
+    parallelize "i"
+  }
+  )";
+
+  ParserContext ctx(module);
+  Parser P(ctx);
+  P.parse();
+  EXPECT_EQ(ctx.getNumErrors(), 0);
+  auto &programs = ctx.getPrograms();
+  EXPECT_EQ(programs.size(), 3);
+  EXPECT_EQ(ctx.getProgram(), programs[0]);
+  EXPECT_EQ(ctx.getProgramByName("bias"), programs[2]);
+
+  // Each function has its own arguments, locals and script.
+  EXPECT_EQ(programs[1]->getArgs().size(), 1);
+  EXPECT_EQ(programs[2]->getArgs().size(), 2);
+  EXPECT_EQ(programs[0]->getTensors().size(), 0);
+  EXPECT_EQ(programs[1]->getTensors().size(), 1);
+  EXPECT_EQ(ctx.getPragmaDecls(0).size(), 1);
+  EXPECT_EQ(ctx.getPragmaDecls(1).size(), 0);
+  EXPECT_EQ(ctx.getPragmaDecls(2).size(), 2);
+  EXPECT_EQ(ctx.getPragmaDecls(2)[1].kind_,
+            PragmaCommand::PragmaKind::parallelize);
+  for (auto *p : programs) {
+    p->verify();
+    delete p;
+  }
+
+  // Functions must have different names.
+  const char *dup = R"(
+  func f(A:float<x:4>) { for (i in 0 .. 4) { A[i] = 1.0 } }
+  func f(A:float<x:4>) { for (i in 0 .. 4) { A[i] = 2.0 } }
+  )";
+  ParserContext dupCtx(dup);
+  delete parseProgram(dupCtx);
+  EXPECT_EQ(dupCtx.getNumErrors(), 1);
+}
+
+TEST(basic, local_tensor) {
+  const char *local_tensor = R"(
+  func local_tensor(C:float<x:4, y:8>) {
+    var T : float<x:4, y:8>
+    for (i in 0 .. T.x) {
+      for (j in 0 .. T.y) { T[i, j] = C[i, j] * 2.0 }
+    }
+    for (i in 0 .. C.x) {
+      for (j in 0 .. C.y) { C[i, j] += T[i, j] }
+    }
+  })";
+
+  ParserContext ctx(local_tensor);
+  Parser P(ctx);
+  P.parse();
+  EXPECT_EQ(ctx.getNumErrors(), 0);
+  auto *prog = ctx.getProgram();
+  prog->verify();
+  prog->dump();
+  EXPECT_EQ(prog->getArgs().size(), 1);
+  EXPECT_EQ(prog->getTensors().size(), 1);
+  auto *T = prog->getTensors()[0];
+  EXPECT_EQ(T->getName(), "T");
+  EXPECT_EQ(T->getType()->size(), 32);
+  EXPECT_EQ(T->getAlignment(), 64);
+
+  // Tensors and arguments share the same namespace.
+  const char *redefinition = R"(
+  func redefinition(C:float<x:4>) {
+    var C : float<x:4>
+  })";
+  ParserContext ctx2(redefinition);
+  Parser P2(ctx2);
+  P2.parse();
+  EXPECT_NE(ctx2.getNumErrors(), 0);
 }
 
 TEST(basic, let_expr) {
@@ -301,6 +427,35 @@ TEST(basic, parse_unary_functions) {
   prog->verify();
 }
 
+TEST(basic, low_precision_types) {
+  const char *low_precision_types = R"(
+  func low_precision_types(C:int32<x:16>, A:int8<x:16>, B:bfloat16<x:16>,
+                           D:float16<x:16>) {
+    for (i in 0 .. 16) {
+      C[i] += int32(A[i]) * int32(A[i])
+      B[i] = bfloat16(float(D[i]) * 2.0)
+    }
+  })";
+  ParserContext ctx(low_precision_types);
+  Parser P(ctx);
+  P.parse();
+  EXPECT_EQ(ctx.getNumErrors(), 0);
+  auto *prog = P.getContext().getProgram();
+  prog->verify();
+  EXPECT_EQ(prog->getArg(1)->getType()->getElementType(), ElemKind::Int8Ty);
+  EXPECT_EQ(prog->getArg(2)->getType()->getSizeInBytes(), 32);
+
+  // Mixing types without a conversion is an error.
+  const char *mismatch = R"(
+  func mismatch(C:int32<x:16>, A:int8<x:16>) {
+    C[0] += A[0] * A[1]
+  })";
+  ParserContext ctx2(mismatch);
+  Parser P2(ctx2);
+  P2.parse();
+  EXPECT_NE(ctx2.getNumErrors(), 0);
+}
+
 TEST(basic, calls) {
   const char *pragmas_test = R"(
   func pragmas_test(C:float<x:10>) {
@@ -336,3 +491,121 @@ TEST(basic, vectorized_loads) {
   EXPECT_EQ(ctx.getNumErrors(), 0);
   ctx.getProgram()->dump();
 }
+
+TEST(basic, dynamic_dimension) {
+  const char *scale = R"(
+  dynamic batch = 4, 16
+  let width = 12
+
+  func scale(Out:float<N:batch, W:width>, In:float<N:batch, W:width>,
+             S:float<W:width>) {
+    for (n in 0 .. batch) {
+      for (w in 0 .. width) { Out[n, w] = In[n, w] * S[w] }
+    }
+  })";
+
+  ParserContext ctx(scale);
+  Program *p = parseProgram(ctx);
+  EXPECT_EQ(ctx.getNumErrors(), 0);
+  EXPECT_EQ(ctx.getDynamicName(), "batch");
+  EXPECT_EQ(ctx.getDynamicSizes(), std::vector<unsigned>({4, 16}));
+  // The program is specialized for the first size by default.
+  EXPECT_EQ(p->getArg(0)->getType()->getDims()[0], 4);
+
+  DynamicKernel kernel(p->getName(), ctx.getDynamicName());
+  for (unsigned size : {16, 1, 4}) {
+    ParserContext vctx(scale);
+    Program *vp = parseProgram(vctx, {"batch"}, {(int)size});
+    EXPECT_EQ(vp->getArg(1)->getType()->getDims()[0], size);
+    vp->getArg(1)->setAlignment(64);
+    kernel.addVariant(size, vp);
+  }
+  EXPECT_EQ(kernel.getVariants()[0].first, 1);
+  EXPECT_EQ(kernel.getVariant(16)->getName(), "scale_16");
+  EXPECT_TRUE(kernel.analyze());
+  EXPECT_TRUE(kernel.isDynamicArg(0));
+  EXPECT_TRUE(kernel.isDynamicArg(1));
+  EXPECT_FALSE(kernel.isDynamicArg(2));
+  EXPECT_EQ(kernel.getArgRowSize(1), 12 * 4);
+  // The chunks of In start at multiples of 48 bytes.
+  EXPECT_EQ(kernel.getVariant(4)->getArg(1)->getAlignment(), 16);
+  kernel.dump();
+  delete p;
+
+  // The sum over the batch can't be split into chunks.
+  const char *sum = R"(
+  dynamic batch = 8
+
+  func sum(Out:float<W:12>, In:float<N:batch, W:12>) {
+    for (w in 0 .. 12) {
+      Out[w] = 0.0
+      for (n in 0 .. batch) { Out[w] += In[n, w] }
+    }
+  })";
+
+  DynamicKernel sumKernel("sum", "batch");
+  for (unsigned size : {1, 8}) {
+    ParserContext vctx(sum);
+    sumKernel.addVariant(size, parseProgram(vctx, {"batch"}, {(int)size}));
+  }
+  EXPECT_FALSE(sumKernel.analyze());
+
+  // Reductions into one row, reads of other rows and nested loops over the
+  // dimension cross the chunks, even though all of the written buffers have
+  // the dynamic dimension.
+  const char *crossRow[] = {R"(
+  dynamic batch = 8
+
+  func reduce(Out:float<N:batch, W:12>, In:float<N:batch, W:12>) {
+    for (n in 0 .. batch) {
+      for (w in 0 .. 12) { Out[0, w] += In[n, w] }
+    }
+  })",
+                            R"(
+  dynamic batch = 8
+
+  func shift(Out:float<N:batch, W:12>, In:float<N:batch, W:12>) {
+    for (n in 0 .. 7) {
+      for (w in 0 .. 12) { Out[n, w] = In[n + 1, w] }
+    }
+  })",
+                            R"(
+  dynamic batch = 8
+
+  func prefix(Out:float<N:batch, W:12>, In:float<N:batch, W:12>) {
+    for (n in 0 .. batch) {
+      for (w in 0 .. 12) { Out[n, w] = In[n, w] + Out[0, w] }
+    }
+  })",
+                            R"(
+  dynamic batch = 8
+
+  func nested(Out:float<N:batch, W:12>, In:float<N:batch, W:12>) {
+    for (n in 0 .. batch) {
+      for (m in 0 .. batch) {
+        for (w in 0 .. 12) { Out[n, w] += In[m, w] }
+      }
+    }
+  })",
+                            R"(
+  dynamic batch = 8
+
+  func count(Out:float<N:batch, W:12>) {
+    for (n in 0 .. batch) {
+      for (m in 0 .. batch) {
+        for (w in 0 .. 12) { Out[n, w] += 1.0 }
+      }
+    }
+  })"};
+
+  for (auto *src : crossRow) {
+    ParserContext ctx(src);
+    DynamicKernel kernel(parseProgram(ctx)->getName(), "batch");
+    EXPECT_EQ(ctx.getNumErrors(), 0);
+    for (unsigned size : {1, 8}) {
+      ParserContext vctx(src);
+      kernel.addVariant(size, parseProgram(vctx, {"batch"}, {(int)size}));
+    }
+    EXPECT_FALSE(kernel.analyze());
+  }
+}
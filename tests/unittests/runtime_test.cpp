@@ -1,7 +1,9 @@
 #include "bistra/Analysis/Value.h"
 #include "bistra/Backends/Backend.h"
 #include "bistra/Backends/Backends.h"
+#include "bistra/Optimizer/Optimizer.h"
 #include "bistra/Parser/Parser.h"
+#include "bistra/Program/Dynamic.h"
 #include "bistra/Program/Program.h"
 #include "bistra/Program/Utils.h"
 #include "bistra/Transforms/Transforms.h"
@@ -203,6 +205,101 @@ TEST(runtime, gemm) {
 #undef GET
 }
 
+TEST(runtime, int8_gemm) {
+  const char *qgemm = R"(
+  func qgemm(C:int32<I:4, J:16>, A:int8<I:4, K:8>, B:int8<K:8, J:16>) {
+    for (i in 0 .. C.I) {
+      for (j in 0 .. C.J) {
+        C[i,j] = int32(0);
+      }
+      for (k in 0 .. A.K) {
+        for (j in 0 .. C.J) {
+          C[i,j] += int32(A[i,k]) * int32(B[k,j]);
+        }
+      }
+    }
+  })";
+
+  ParserContext ctx(qgemm);
+  Parser P(ctx);
+  P.parse();
+  EXPECT_EQ(ctx.getNumErrors(), 0);
+  auto *prog = ctx.getProgram();
+
+  // The tensors are stored consecutively: C, A, B.
+  struct {
+    int32_t C[4][16];
+    int8_t A[4][8];
+    int8_t B[8][16];
+  } data;
+
+  for (int i = 0; i < 4; i++) {
+    for (int k = 0; k < 8; k++) {
+      data.A[i][k] = (i * 8 + k) % 255 - 127;
+    }
+  }
+  for (int k = 0; k < 8; k++) {
+    for (int j = 0; j < 16; j++) {
+      data.B[k][j] = 100 - (k * 16 + j) % 200;
+    }
+  }
+
+  // Run both the original and the vectorized program.
+  auto backend = getBackend("llvm");
+  auto vectorized = optimizeStatic(backend.get(), prog);
+  for (auto *p : {prog, vectorized.get()}) {
+    memset(data.C, 0xff, sizeof(data.C));
+    backend->runOnce(p, &data);
+
+    for (int i = 0; i < 4; i++) {
+      for (int j = 0; j < 16; j++) {
+        int32_t expected = 0;
+        for (int k = 0; k < 8; k++) {
+          expected += data.A[i][k] * data.B[k][j];
+        }
+        EXPECT_EQ(data.C[i][j], expected);
+      }
+    }
+  }
+}
+
+TEST(runtime, half_precision) {
+  const char *convert = R"(
+  func convert(O:float<x:16>, H:bfloat16<x:16>, I:float16<x:16>) {
+    for (i in 0 .. 16) {
+      H[i] = bfloat16(float(I[i]) * 2.0);
+      O[i] = float(H[i]) + 1.0;
+    }
+  })";
+
+  ParserContext ctx(convert);
+  Parser P(ctx);
+  P.parse();
+  EXPECT_EQ(ctx.getNumErrors(), 0);
+  auto *prog = ctx.getProgram();
+
+  struct {
+    float O[16];
+    uint16_t H[16];
+    uint16_t I[16];
+  } data;
+
+  // Small integers are exact in all of the formats: 0x3c00 is 1.0 in
+  // float16, and 0x4000 is 2.0.
+  for (int i = 0; i < 16; i++) {
+    data.I[i] = (i % 2) ? 0x3c00 : 0x4000;
+  }
+
+  auto backend = getBackend("llvm");
+  backend->runOnce(prog, &data);
+
+  for (int i = 0; i < 16; i++) {
+    EXPECT_EQ(data.O[i], (i % 2) ? 3.0 : 5.0);
+    // 0x4000 is 2.0 and 0x4080 is 4.0 in bfloat16.
+    EXPECT_EQ(data.H[i], (i % 2) ? 0x4000 : 0x4080);
+  }
+}
+
 TEST(runtime, softmax) {
   const char *softmax = R"(
   let size = 7;
@@ -250,3 +347,566 @@ TEST(runtime, softmax) {
     EXPECT_NEAR(data[7 + i], result[i], 0.001);
   }
 }
+
+TEST(runtime, parallel_loop) {
+  const char *rowsum = R"(
+  func rowsum(Out:float<x:64>, In:float<x:64, y:16>) {
+    for (i in 0 .. 64) {
+      var sum : float = 0.0
+      for (j in 0 .. 16) {
+        sum += In[i, j]
+      }
+      Out[i] = sum
+    }
+  })";
+
+  ParserContext ctx(rowsum);
+  Parser P(ctx);
+  P.parse();
+  EXPECT_EQ(ctx.getNumErrors(), 0);
+  auto *prog = ctx.getProgram();
+  EXPECT_TRUE(::parallelize(::getLoopByName(prog, "i")));
+  prog->dump();
+
+  float data[64 + 64 * 16] = {
+      0,
+  };
+  for (int i = 0; i < 64 * 16; i++) {
+    data[64 + i] = i % 7;
+  }
+
+  auto backend = getBackend("llvm");
+  backend->runOnce(prog, data);
+
+  for (int i = 0; i < 64; i++) {
+    float sum = 0;
+    for (int j = 0; j < 16; j++) {
+      sum += data[64 + i * 16 + j];
+    }
+    EXPECT_EQ(data[i], sum);
+  }
+}
+
+TEST(runtime, parallel_candidate) {
+  const char *rowmax = R"(
+  func rowmax(Out:float<x:64>, In:float<x:64, y:16>) {
+    for (i in 0 .. 64) {
+      var m : float = 0.0
+      for (j in 0 .. 16) {
+        m = max(m, In[i, j])
+      }
+      Out[i] = m
+    }
+  })";
+
+  ParserContext ctx(rowmax);
+  Parser P(ctx);
+  P.parse();
+  EXPECT_EQ(ctx.getNumErrors(), 0);
+  auto *prog = ctx.getProgram();
+  EXPECT_TRUE(::parallelize(::getLoopByName(prog, "i")));
+
+  // Tuning candidates are loaded into their own dylib, and must resolve the
+  // runtime functions that the JIT defines.
+  auto backend = getBackend("llvm");
+  MeasureOptions opts;
+  opts.warmup = 0;
+  opts.minReps = 1;
+  opts.maxReps = 1;
+  auto binary = backend->compileBenchmark(prog, 1);
+  for (int i = 0; i < 2; i++) {
+    EXPECT_GT(backend->evaluateBinary(prog, binary, 1, opts).samples, 0);
+  }
+  delete prog;
+}
+
+TEST(runtime, target_registers) {
+  auto host = getBackend("llvm");
+  EXPECT_GE(host->getNumRegisters(), 1);
+  EXPECT_GE(host->getRegisterWidth(), 1);
+
+#if defined(__x86_64__)
+  auto avx2 = getBackend("llvm", "haswell");
+  EXPECT_EQ(avx2->getNumRegisters(), 16);
+  EXPECT_EQ(avx2->getRegisterWidth(), 8);
+
+  auto avx512 = getBackend("llvm", "skylake-avx512");
+  EXPECT_EQ(avx512->getNumRegisters(), 32);
+  EXPECT_EQ(avx512->getRegisterWidth(), 16);
+#endif
+}
+
+TEST(runtime, search_budget) {
+  const char *add = R"(
+  func add(A:float<I:64, J:64>, B:float<I:64, J:64>) {
+    for (i in 0 .. A.I) {
+      for (j in 0 .. A.J) {
+        A[i,j] += B[i,j] * 2.0;
+      }
+    }
+  })";
+
+  ParserContext ctx(add);
+  Parser P(ctx);
+  P.parse();
+  EXPECT_EQ(ctx.getNumErrors(), 0);
+  auto *prog = ctx.getProgram();
+  auto backend = getBackend("llvm");
+
+  TuningOptions options;
+  options.measure.warmup = 0;
+  options.measure.minReps = 1;
+  options.measure.maxReps = 1;
+
+  // Each strategy finds some program within a budget of a few candidates.
+  for (auto kind : {SearchKind::Exhaustive, SearchKind::Random,
+                    SearchKind::Beam, SearchKind::Genetic}) {
+    options.search = kind;
+    options.maxCandidates = 4;
+    options.beamWidth = 2;
+    EXPECT_TRUE(optimizeEvaluate(*backend, prog, "", false, false, options));
+  }
+  delete prog;
+}
+
+TEST(runtime, pack) {
+  // A tiled matrix multiplication where the tiles don't divide the matrices.
+  const char *gemm = R"(
+  func gemm(C:float<I:40, J:70>, A:float<I:40, K:50>, B:float<K:50, J:70>) {
+    for (j in 0 .. 3) {
+      for (k in 0 .. 4) {
+        for (i in 0 .. 40) {
+          for (jj in 0 .. 32) {
+            if (j * 32 + jj in 0 .. 70) {
+              for (kk in 0 .. 16) {
+                if (k * 16 + kk in 0 .. 50) {
+                  C[i, j * 32 + jj] +=
+                    A[i, k * 16 + kk] * B[k * 16 + kk, j * 32 + jj]
+                }
+              }
+            }
+          }
+        }
+      }
+    }
+  }
+
+  script for "x86" {
+    pack "i" "B"
+  }
+  )";
+
+  ParserContext ctx(gemm);
+  Parser P(ctx);
+  P.parse();
+  EXPECT_EQ(ctx.getNumErrors(), 0);
+  auto *prog = ctx.getProgram();
+  for (auto &pc : ctx.getPragmaDecls()) {
+    EXPECT_TRUE(applyPragmaCommand(prog, pc));
+  }
+  EXPECT_TRUE(::parallelize(::getLoopByName(prog, "j")));
+  prog->verify();
+  prog->dump();
+
+  // The tile of B is packed into a buffer with aligned rows.
+  EXPECT_EQ(prog->getTensors().size(), 1);
+  auto *packed = prog->getTensors()[0]->getType();
+  EXPECT_EQ(packed->getDims()[0], 16);
+  EXPECT_EQ(packed->getDims()[1], 32);
+
+  std::vector<float> data(40 * 70 + 40 * 50 + 50 * 70, 0);
+  float *C = &data[0];
+  float *A = C + 40 * 70;
+  float *B = A + 40 * 50;
+  for (int i = 0; i < 40 * 50; i++) {
+    A[i] = i % 7 - 3;
+  }
+  for (int i = 0; i < 50 * 70; i++) {
+    B[i] = i % 5 - 2;
+  }
+
+  auto backend = getBackend("llvm");
+  backend->runOnce(prog, data.data());
+
+  for (int i = 0; i < 40; i++) {
+    for (int j = 0; j < 70; j++) {
+      float sum = 0;
+      for (int k = 0; k < 50; k++) {
+        sum += A[i * 50 + k] * B[k * 70 + j];
+      }
+      EXPECT_EQ(C[i * 70 + j], sum);
+    }
+  }
+}
+
+TEST(runtime, local_tensor) {
+  // The tensor T is too large for the stack, and is allocated on the heap.
+  const char *transpose = R"(
+  func transpose(Out:float<I:128, J:160>, In:float<J:160, I:128>) {
+    var T : float<I:128, J:160>
+    var row : float<J:160>
+    for (j in 0 .. In.J) {
+      for (i in 0 .. In.I) { T[i, j] = In[j, i] }
+    }
+    for (i in 0 .. T.I) {
+      for (j in 0 .. T.J) { row[j] = T[i, j] * 2.0 }
+      for (j in 0 .. T.J) { Out[i, j] = row[j] + 1.0 }
+    }
+  })";
+
+  ParserContext ctx(transpose);
+  Parser P(ctx);
+  P.parse();
+  EXPECT_EQ(ctx.getNumErrors(), 0);
+  auto *prog = ctx.getProgram();
+  prog->verify();
+  EXPECT_EQ(prog->getTensors().size(), 2);
+
+  // Each task would read its own uninitialized copy of T.
+  EXPECT_FALSE(::parallelize(::getLoopByName(prog, "i")));
+
+  std::vector<float> data(2 * 128 * 160, 0);
+  float *Out = &data[0];
+  float *In = Out + 128 * 160;
+  for (int i = 0; i < 128 * 160; i++) {
+    In[i] = i % 13;
+  }
+
+  auto backend = getBackend("llvm");
+  backend->runOnce(prog, data.data());
+
+  for (int i = 0; i < 128; i++) {
+    for (int j = 0; j < 160; j++) {
+      EXPECT_EQ(Out[i * 160 + j], In[j * 128 + i] * 2 + 1);
+    }
+  }
+}
+
+TEST(runtime, fuse_epilogue) {
+  // A matrix multiplication followed by a bias and a relu.
+  const char *gemm = R"(
+  func gemm(C:float<I:50, J:64>, A:float<I:50, K:32>, B:float<K:32, J:64>,
+            Bias:float<J:64>) {
+    for (i in 0 .. C.I) {
+      for (j in 0 .. C.J) {
+        C[i, j] = 0.0
+        for (k in 0 .. A.K) { C[i, j] += A[i, k] * B[k, j] }
+      }
+    }
+    for (x in 0 .. C.I) {
+      for (y in 0 .. C.J) { C[x, y] += Bias[y] }
+    }
+    for (u in 0 .. C.I) {
+      for (v in 0 .. C.J) { C[u, v] = max(C[u, v], 0.0) }
+    }
+  }
+
+  script for "x86" {
+    tile "i" to 16 as "ii"
+    fuse "i" 3 times
+  }
+  )";
+
+  ParserContext ctx(gemm);
+  Parser P(ctx);
+  P.parse();
+  EXPECT_EQ(ctx.getNumErrors(), 0);
+  auto *prog = ctx.getProgram();
+  auto &pragmas = ctx.getPragmaDecls();
+  EXPECT_TRUE(applyPragmaCommand(prog, pragmas[0]));
+  EXPECT_TRUE(applyPragmaCommand(prog, pragmas[1]));
+  EXPECT_TRUE(applyPragmaCommand(prog, pragmas[1]));
+  prog->verify();
+  prog->dump();
+  EXPECT_EQ(::getLoopByName(prog, "x"), nullptr);
+  EXPECT_EQ(::getLoopByName(prog, "u"), nullptr);
+
+  std::vector<float> data(50 * 64 + 50 * 32 + 32 * 64 + 64, 0);
+  float *C = &data[0];
+  float *A = C + 50 * 64;
+  float *B = A + 50 * 32;
+  float *Bias = B + 32 * 64;
+  for (int i = 0; i < 50 * 32; i++) {
+    A[i] = i % 7 - 3;
+  }
+  for (int i = 0; i < 32 * 64; i++) {
+    B[i] = i % 5 - 2;
+  }
+  for (int i = 0; i < 64; i++) {
+    Bias[i] = i % 3 - 1;
+  }
+
+  auto backend = getBackend("llvm");
+  backend->runOnce(prog, data.data());
+
+  for (int i = 0; i < 50; i++) {
+    for (int j = 0; j < 64; j++) {
+      float sum = Bias[j];
+      for (int k = 0; k < 32; k++) {
+        sum += A[i * 32 + k] * B[k * 64 + j];
+      }
+      EXPECT_EQ(C[i * 64 + j], std::max(sum, 0.0f));
+    }
+  }
+}
+
+TEST(runtime, vectorize_reductions) {
+  const char *reductions = R"(
+  func reductions(Out:float<x:16>, Stats:float<s:3>, In:float<x:16, y:100>) {
+    var mx : float
+    var sum : float = 0.
+    mx = In[0, 0]
+    for (i in 0 .. 100) { mx = max(mx, In[3, i]) }
+    for (j in 0 .. 100) { sum += In[5, j] * 2.0 }
+    Stats[0] = mx
+    Stats[1] = sum
+    for (r in 0 .. 16) {
+      for (c in 0 .. 100) { Out[r] += In[r, c] }
+    }
+    for (k in 0 .. 100) { Stats[2] = min(Stats[2], In[7, k]) }
+  })";
+
+  ParserContext ctx(reductions);
+  Parser P(ctx);
+  P.parse();
+  EXPECT_EQ(ctx.getNumErrors(), 0);
+  auto *prog = ctx.getProgram();
+  for (auto *name : {"i", "j", "c", "k"}) {
+    EXPECT_NE(::vectorize(::getLoopByName(prog, name), 8), nullptr);
+  }
+  prog->verify();
+  prog->dump();
+
+  std::vector<float> data(16 + 3 + 16 * 100, 0);
+  float *Out = &data[0];
+  float *Stats = Out + 16;
+  float *In = Stats + 3;
+  for (int i = 0; i < 16 * 100; i++) {
+    In[i] = (i * 37) % 101 - 50;
+  }
+  Stats[2] = 1000;
+
+  auto backend = getBackend("llvm");
+  backend->runOnce(prog, data.data());
+
+  float mx = In[0], sum = 0, mn = 1000;
+  for (int i = 0; i < 100; i++) {
+    mx = std::max(mx, In[3 * 100 + i]);
+    sum += In[5 * 100 + i] * 2;
+    mn = std::min(mn, In[7 * 100 + i]);
+  }
+  EXPECT_EQ(Stats[0], mx);
+  EXPECT_EQ(Stats[1], sum);
+  EXPECT_EQ(Stats[2], mn);
+  for (int r = 0; r < 16; r++) {
+    float rowSum = 0;
+    for (int c = 0; c < 100; c++) {
+      rowSum += In[r * 100 + c];
+    }
+    EXPECT_EQ(Out[r], rowSum);
+  }
+}
+
+TEST(runtime, masked_tail) {
+  const char *masked = R"(
+  func masked_tail(Out:float<x:10, y:28>, A:float<x:10, y:28>, B:float<y:28>) {
+    for (i in 0 .. 10) {
+      for (j in 0 .. 28) { Out[i, j] += A[i, j] * B[j] + 1.0 }
+      for (k in 0 .. 28) {
+        if (k in 3 .. 21) { Out[i, k] += 2.0 }
+      }
+    }
+  }
+
+  script for "x86" {
+    vectorize "j" to 8 masked as "jm"
+    vectorize "k" to 8
+  })";
+
+  ParserContext ctx(masked);
+  Parser P(ctx);
+  P.parse();
+  EXPECT_EQ(ctx.getNumErrors(), 0);
+  auto *prog = ctx.getProgram();
+  auto &pragmas = ctx.getPragmaDecls();
+  EXPECT_TRUE(pragmas[0].masked_);
+  EXPECT_FALSE(pragmas[1].masked_);
+  for (auto &pc : pragmas) {
+    EXPECT_TRUE(applyPragmaCommand(prog, pc));
+  }
+  prog->verify();
+  prog->dump();
+
+  // The tail of "j" is a single masked vector iteration.
+  auto *tail = ::getLoopByName(prog, "jm");
+  EXPECT_EQ(tail->getStride(), 8);
+  EXPECT_EQ(tail->getEnd(), 8);
+
+  std::vector<float> data(10 * 28 * 2 + 28, 0);
+  float *Out = &data[0];
+  float *A = Out + 10 * 28;
+  float *B = A + 10 * 28;
+  for (int i = 0; i < 10 * 28; i++) {
+    A[i] = i % 7;
+  }
+  for (int j = 0; j < 28; j++) {
+    B[j] = j;
+  }
+
+  auto backend = getBackend("llvm");
+  backend->runOnce(prog, data.data());
+
+  for (int i = 0; i < 10; i++) {
+    for (int j = 0; j < 28; j++) {
+      float expected = A[i * 28 + j] * B[j] + 1 + (j >= 3 && j < 21 ? 2 : 0);
+      EXPECT_EQ(Out[i * 28 + j], expected);
+    }
+  }
+}
+
+TEST(runtime, prefetch) {
+  const char *transpose = R"(
+  func transpose_prefetch(Out:float<x:64, y:48>, In:float<y:48, x:64>) {
+    for (i in 0 .. 64) {
+      for (j in 0 .. 48) { Out[i, j] = In[j, i] }
+    }
+  }
+
+  script for "x86" {
+    prefetch "j" distance 8
+  })";
+
+  ParserContext ctx(transpose);
+  Parser P(ctx);
+  P.parse();
+  EXPECT_EQ(ctx.getNumErrors(), 0);
+  auto *prog = ctx.getProgram();
+  auto &pragmas = ctx.getPragmaDecls();
+  EXPECT_EQ(pragmas[0].kind_, PragmaCommand::PragmaKind::prefetch);
+  EXPECT_EQ(pragmas[0].param_, 8);
+  EXPECT_TRUE(applyPragmaCommand(prog, pragmas[0]));
+  // The column of In is prefetched once.
+  EXPECT_FALSE(::prefetch(::getLoopByName(prog, "j"), 8));
+  // The loads are consecutive along "i".
+  EXPECT_FALSE(::prefetch(::getLoopByName(prog, "i"), 8));
+  prog->verify();
+  prog->dump();
+
+  unsigned numPrefetches = 0;
+  for (auto *s : collectStmts(prog)) {
+    numPrefetches += (bool)dynamic_cast<PrefetchStmt *>(s);
+  }
+  EXPECT_EQ(numPrefetches, 1);
+
+  std::vector<float> data(64 * 48 * 2, 0);
+  float *Out = &data[0];
+  float *In = Out + 64 * 48;
+  for (int i = 0; i < 64 * 48; i++) {
+    In[i] = i;
+  }
+
+  auto backend = getBackend("llvm");
+  backend->runOnce(prog, data.data());
+
+  for (int i = 0; i < 64; i++) {
+    for (int j = 0; j < 48; j++) {
+      EXPECT_EQ(Out[i * 48 + j], In[j * 64 + i]);
+    }
+  }
+}
+
+TEST(runtime, stream) {
+  const char *scale = R"(
+  func scale_stream(Out:float<x:64, y:48>, In:float<x:64, y:48>) {
+    for (i in 0 .. 64) {
+      for (j in 0 .. 48) { Out[i, j] = In[i, j] * 2.0 }
+    }
+  }
+
+  script for "x86" {
+    vectorize "j" to 8
+    stream "i" "Out"
+  })";
+
+  ParserContext ctx(scale);
+  Parser P(ctx);
+  P.parse();
+  EXPECT_EQ(ctx.getNumErrors(), 0);
+  auto *prog = ctx.getProgram();
+  auto &pragmas = ctx.getPragmaDecls();
+  EXPECT_EQ(pragmas[1].kind_, PragmaCommand::PragmaKind::stream);
+  EXPECT_EQ(pragmas[1].argName_, "Out");
+  for (auto &pc : pragmas) {
+    EXPECT_TRUE(applyPragmaCommand(prog, pc));
+  }
+  // The input is read, so its stores can't stream.
+  EXPECT_FALSE(::streamStores(::getLoopByName(prog, "i"), prog->getArg(1)));
+  prog->verify();
+  prog->dump();
+
+  std::vector<LoadExpr *> loads;
+  std::vector<StoreStmt *> stores;
+  collectLoadStores(prog, loads, stores, prog->getArg(0));
+  EXPECT_EQ(stores.size(), 1);
+  EXPECT_TRUE(stores[0]->isNonTemporal());
+
+  std::vector<float> data(64 * 48 * 2, 0);
+  float *Out = &data[0];
+  float *In = Out + 64 * 48;
+  for (int i = 0; i < 64 * 48; i++) {
+    In[i] = i;
+  }
+
+  auto backend = getBackend("llvm");
+  backend->runOnce(prog, data.data());
+
+  for (int i = 0; i < 64; i++) {
+    for (int j = 0; j < 48; j++) {
+      EXPECT_EQ(Out[i * 48 + j], In[i * 48 + j] * 2);
+    }
+  }
+}
+
+TEST(runtime, dynamic_kernel) {
+  const char *scale = R"(
+  dynamic batch = 4
+
+  func scale(Out:float<N:batch, W:12>, In:float<N:batch, W:12>, S:float<W:12>) {
+    for (n in 0 .. batch) {
+      for (w in 0 .. 12) { Out[n, w] = In[n, w] * S[w] }
+    }
+  })";
+
+  DynamicKernel kernel("scale", "batch");
+  for (unsigned size : {1, 4}) {
+    ParserContext ctx(scale);
+    Program *p = parseProgram(ctx, {"batch"}, {(int)size});
+    EXPECT_EQ(ctx.getNumErrors(), 0);
+    kernel.addVariant(size, p);
+  }
+  EXPECT_TRUE(kernel.analyze());
+
+  auto backend = getBackend("llvm");
+  // Sizes that have a specialized program, and sizes that are split into
+  // chunks.
+  for (unsigned size : {1, 4, 6, 11}) {
+    std::vector<float> data(size * 12 * 2 + 12, 0);
+    float *Out = &data[0];
+    float *In = Out + size * 12;
+    float *S = In + size * 12;
+    for (unsigned i = 0; i < size * 12; i++) {
+      In[i] = i;
+    }
+    for (unsigned i = 0; i < 12; i++) {
+      S[i] = i % 3;
+    }
+
+    backend->runOnce(kernel, size, data.data());
+
+    for (unsigned n = 0; n < size; n++) {
+      for (unsigned w = 0; w < 12; w++) {
+        EXPECT_EQ(Out[n * 12 + w], In[n * 12 + w] * S[w]);
+      }
+    }
+  }
+}
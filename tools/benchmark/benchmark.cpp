@@ -8,6 +8,7 @@
 #include "bistra/Transforms/Simplify.h"
 #include "bistra/Transforms/Transforms.h"
 
+#include <chrono>
 #include <iostream>
 #include <sstream>
 
@@ -152,7 +153,22 @@ func concat(O:float<height:sx2, width:sy>,
 }
 )";
 
-void parseOptimizeAndRun(std::stringstream &report, const char *src,
+/// \returns the average time, in nanoseconds, of cloning and deleting the
+/// program \p p. The tuner clones the program for every variant it explores,
+/// so this is dominated by the allocation of the nodes of the AST.
+double measureCloneTime(Program *p) {
+  const unsigned numClones = 10000;
+  auto start = std::chrono::steady_clock::now();
+  for (unsigned i = 0; i < numClones; i++) {
+    delete p->clone();
+  }
+  std::chrono::duration<double, std::nano> elapsed =
+      std::chrono::steady_clock::now() - start;
+  return elapsed.count() / numClones;
+}
+
+void parseOptimizeAndRun(std::stringstream &report,
+                         std::stringstream &cloneReport, const char *src,
                          const std::vector<std::string> &letNames,
                          const std::vector<int> &letValues) {
   auto BE = getBackend("llvm");
@@ -173,22 +189,29 @@ void parseOptimizeAndRun(std::stringstream &report, const char *src,
   np->dump();
   auto timeSec = BE->evaluateCode(np.get(), 10);
   report << timeSec << ", " << program->getName() << "\n";
+  cloneReport << measureCloneTime(np.get()) << " ns, " << program->getName()
+              << "\n";
 }
 
 int main() {
   std::stringstream report;
-  parseOptimizeAndRun(report, gemmSource, {"szI", "szJ", "szK"},
+  std::stringstream cloneReport;
+  parseOptimizeAndRun(report, cloneReport, gemmSource, {"szI", "szJ", "szK"},
                       {1024, 1024, 512});
-  parseOptimizeAndRun(report, batchedAddSource, {"sx", "sy", "batch"},
-                      {512, 1024, 64});
-  parseOptimizeAndRun(report, transposeSource, {"sx", "sy"}, {2048, 2048});
-  parseOptimizeAndRun(report, saxpySource, {"sx"}, {1024 * 1024 * 10});
-  parseOptimizeAndRun(report, maxpool2dSource,
+  parseOptimizeAndRun(report, cloneReport, batchedAddSource,
+                      {"sx", "sy", "batch"}, {512, 1024, 64});
+  parseOptimizeAndRun(report, cloneReport, transposeSource, {"sx", "sy"},
+                      {2048, 2048});
+  parseOptimizeAndRun(report, cloneReport, saxpySource, {"sx"},
+                      {1024 * 1024 * 10});
+  parseOptimizeAndRun(report, cloneReport, maxpool2dSource,
                       {"kernel", "stride", "batch", "channels", "size_out"},
                       {3, 2, 16, 128, 64});
-  parseOptimizeAndRun(report, batchnormSource, {"batch", "channel", "hw"},
-                      {32, 128, 128});
-  parseOptimizeAndRun(report, concatSource, {"sx", "sy"}, {1024, 2048});
+  parseOptimizeAndRun(report, cloneReport, batchnormSource,
+                      {"batch", "channel", "hw"}, {32, 128, 128});
+  parseOptimizeAndRun(report, cloneReport, concatSource, {"sx", "sy"},
+                      {1024, 2048});
 
   std::cout << "-- report -- \n" << report.str() << "\n";
+  std::cout << "-- clone time -- \n" << cloneReport.str() << "\n";
 }
@@ -1,10 +1,14 @@
+#include "bistra/Analysis/CostModel.h"
 #include "bistra/Analysis/Program.h"
 #include "bistra/Analysis/Value.h"
 #include "bistra/Backends/Backend.h"
 #include "bistra/Backends/Backends.h"
+#include "bistra/Bytecode/Archive.h"
 #include "bistra/Bytecode/Bytecode.h"
 #include "bistra/Optimizer/Optimizer.h"
 #include "bistra/Parser/Parser.h"
+#include "bistra/Program/Dynamic.h"
+#include "bistra/Program/Library.h"
 #include "bistra/Program/Program.h"
 #include "bistra/Program/Utils.h"
 #include "bistra/Transforms/Simplify.h"
@@ -13,8 +17,13 @@
 #define STRIP_FLAG_HELP 0
 #include "gflags/gflags.h"
 
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
 #include <fstream>
 #include <iostream>
+#include <memory>
+#include <utility>
 
 using namespace bistra;
 
@@ -26,7 +35,55 @@ DEFINE_bool(time, false, "Executes and times the program.");
 DEFINE_bool(textual, false, "Emit the textual representation of the output.");
 DEFINE_bool(bytecode, false, "Emit the bytecode representation.");
 DEFINE_string(out, "", "Output destination file to save the compiled program.");
+DEFINE_string(archive, "",
+              "Append the compiled programs to the bytecode archive at this "
+              "path.");
+DEFINE_string(library, "",
+              "Compile all of the input programs into one object file with a "
+              "registry of the kernels, and write a C header next to it. The "
+              "value is the name of the library.");
 DEFINE_string(backend, "llvm", "The backend to use [C/llvm]");
+DEFINE_string(mcpu, "", "The target CPU (default: the host CPU).");
+DEFINE_string(mattr, "",
+              "The target CPU features, such as +avx2,-avx512f (default: the "
+              "features of the host CPU).");
+DEFINE_int32(align, 0,
+             "The alignment in bytes of the buffers that are passed to the "
+             "program (0 - the alignment of the element type).");
+DEFINE_int32(tune_threads, 0,
+             "The number of threads that compile candidates during tuning "
+             "(0 - use all of the cores).");
+DEFINE_string(tune_cache, "",
+              "A directory that caches tuning results between runs.");
+DEFINE_int32(tune_top_k, 0,
+             "Measure only the candidates with the best predicted execution "
+             "time (0 - measure all of the candidates).");
+DEFINE_string(tune_search, "exhaustive",
+              "The search strategy of the tuner [exhaustive/random/beam/"
+              "genetic].");
+DEFINE_string(tune_budget, "",
+              "Stop tuning after some time (such as 60s or 5m) or after a "
+              "number of candidates (such as 500).");
+DEFINE_int32(tune_patience, 0,
+             "Stop tuning after this number of results that don't improve "
+             "the best result (0 - never).");
+DEFINE_int32(tune_beam_width, 8,
+             "The number of programs that the beam search keeps.");
+DEFINE_string(tune_log, "",
+              "A file that records the features and the execution time of "
+              "the measured candidates.");
+DEFINE_bool(tune_learned, false,
+            "Rank the candidates with a model that is trained on the "
+            "results in --tune_log.");
+DEFINE_int32(cache_l1, 0, "The size of the L1 cache in KB (0 - detect).");
+DEFINE_int32(cache_l2, 0, "The size of the L2 cache in KB (0 - detect).");
+DEFINE_int32(cache_l3, 0, "The size of the L3 cache in KB (0 - detect).");
+DEFINE_int32(bench_warmup, 2, "The number of warmup runs before timing.");
+DEFINE_int32(bench_max_reps, 100, "The maximal number of timed runs.");
+DEFINE_double(bench_error, 0.02,
+              "Stop timing when the confidence interval of the mean is "
+              "narrower than this fraction of the mean.");
+DEFINE_bool(bench_tsc, false, "Use the time-stamp counter for timing.");
 
 /// \returns the most expensive operation in the program and it's costt.
 std::pair<Expr *, uint64_t> getExpensiveOp(Scope *S) {
@@ -175,6 +232,68 @@ void analyzeProgram(Program *p, ParserContext &ctx) {
   detectOverflow(p, ctx);
 }
 
+/// \returns the measurement options that are selected by the flags.
+static MeasureOptions getMeasureOptions() {
+  MeasureOptions opts;
+  opts.warmup = std::max(0, FLAGS_bench_warmup);
+  opts.maxReps = std::max(1, FLAGS_bench_max_reps);
+  opts.minReps = std::min(opts.minReps, opts.maxReps);
+  opts.relativeError = FLAGS_bench_error;
+  opts.useTSC = FLAGS_bench_tsc;
+  return opts;
+}
+
+/// \returns the model of the host, with the cache sizes from the flags.
+static MachineModel getMachineModel() {
+  MachineModel M = MachineModel::getHost();
+  int sizes[3] = {FLAGS_cache_l1, FLAGS_cache_l2, FLAGS_cache_l3};
+  for (unsigned i = 0; i < 3; i++) {
+    if (sizes[i] > 0)
+      M.cacheSize[i] = uint64_t(sizes[i]) << 10;
+  }
+  return M;
+}
+
+/// Parse the search strategy \p name into \p kind.
+/// \returns True if the name is valid.
+static bool parseSearchKind(const std::string &name, SearchKind &kind) {
+  if (name == "exhaustive") {
+    kind = SearchKind::Exhaustive;
+  } else if (name == "random") {
+    kind = SearchKind::Random;
+  } else if (name == "beam") {
+    kind = SearchKind::Beam;
+  } else if (name == "genetic") {
+    kind = SearchKind::Genetic;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+/// Parse the tuning budget \p budget, which is a number of seconds (60s),
+/// minutes (5m) or candidates (500), into \p options.
+/// \returns True if the budget is valid.
+static bool parseBudget(const std::string &budget, TuningOptions &options) {
+  if (budget.empty())
+    return true;
+  char *end = nullptr;
+  double value = strtod(budget.c_str(), &end);
+  std::string unit(end);
+  if (end == budget.c_str() || value <= 0)
+    return false;
+  if (unit == "s") {
+    options.maxSeconds = value;
+  } else if (unit == "m") {
+    options.maxSeconds = value * 60;
+  } else if (unit.empty()) {
+    options.maxCandidates = value;
+  } else {
+    return false;
+  }
+  return true;
+}
+
 /// Checks if \p str ends with \p suffix.
 static bool endsWith(const std::string &str, const std::string &suffix) {
   if (str.size() < suffix.size())
@@ -182,55 +301,368 @@ static bool endsWith(const std::string &str, const std::string &suffix) {
   return 0 == str.compare(str.size() - suffix.size(), suffix.size(), suffix);
 }
 
-Program *parseAndOptimize(ParserContext &ctx) {
-  Parser P(ctx);
-  P.parse();
+/// Apply the pragma commands of each function in \p ctx. Pragmas that can't be
+/// applied are reported as errors in \p ctx.
+static void applyPragmas(ParserContext &ctx) {
+  auto &programs = ctx.getPrograms();
+  for (unsigned i = 0; i < programs.size(); i++) {
+    for (auto &pc : ctx.getPragmaDecls(i)) {
+      bool res = applyPragmaCommand(programs[i], pc);
+      if (!res) {
+        programs[i]->dump();
+        ctx.diagnose(ParserContext::DiagnoseKind::Error, pc.loc_,
+                     "unable to apply the pragma");
+        break;
+      }
+    }
+  }
+}
+
+/// Parse the functions in \p ctx and apply the pragma commands of each
+/// function. \returns the first program, or nullptr if there were errors. The
+/// programs of the other functions are available in \p ctx.
+Program *parseAndOptimize(ParserContext &ctx,
+                          const std::vector<std::string> &letNames = {},
+                          const std::vector<int> &letValues = {}) {
+  Program *program = parseProgram(ctx, letNames, letValues);
 
   // Abort the program if there were any errors.
   if (ctx.getNumErrors() > 0) {
     return nullptr;
   }
 
-  Program *program = ctx.getProgram();
+  applyPragmas(ctx);
+  return program;
+}
+
+/// Sets the tuning options from the flags.
+/// \returns True if the flags are valid.
+static bool getTuningOptions(TuningOptions &options) {
+  options.numThreads = std::max(0, FLAGS_tune_threads);
+  options.cacheDir = FLAGS_tune_cache;
+  options.measure = getMeasureOptions();
+  options.topK = std::max(0, FLAGS_tune_top_k);
+  options.machine = getMachineModel();
+  options.beamWidth = std::max(1, FLAGS_tune_beam_width);
+  options.patience = std::max(0, FLAGS_tune_patience);
+  options.featureLog = FLAGS_tune_log;
+  options.useLearnedModel = FLAGS_tune_learned;
+  if (!parseSearchKind(FLAGS_tune_search, options.search)) {
+    std::cout << "Unknown search strategy: " << FLAGS_tune_search << "\n";
+    return false;
+  }
+  if (!parseBudget(FLAGS_tune_budget, options)) {
+    std::cout << "Invalid tuning budget: " << FLAGS_tune_budget << "\n";
+    return false;
+  }
+  if (FLAGS_tune_learned && FLAGS_tune_log.empty()) {
+    std::cout << "The learned model (--tune_learned) requires a log of "
+                 "results (--tune_log).\n";
+    return false;
+  }
+  return true;
+}
 
-  // Apply the pragma commands.
-  for (auto &pc : ctx.getPragmaDecls()) {
-    bool res = applyPragmaCommand(program, pc);
-    if (!res) {
-      program->dump();
-      ctx.diagnose(ParserContext::DiagnoseKind::Error, pc.loc_,
-                   "unable to apply the pragma");
-      return program;
+/// Sets the alignment of the arguments of \p program according to the flags.
+static void alignArguments(Program *program) {
+  if (FLAGS_align > 0) {
+    for (auto *arg : program->getArgs()) {
+      arg->setAlignment(FLAGS_align);
     }
   }
+}
+
+/// Tune and optimize the program \p program according to the flags, with the
+/// tuning options \p options. Takes ownership of \p program.
+/// \returns the optimized program.
+static Program *optimizeProgram(Backend &backend, Program *program,
+                                const TuningOptions &options) {
+  if (FLAGS_tune) {
+    auto *best = optimizeEvaluate(backend, program, "", false, false, options);
+    delete program;
+    program = (Program *)best->clone();
+  }
+
+  if (FLAGS_opt) {
+    auto np = ::optimizeStatic(&backend, program);
+    delete program;
+    program = np.release();
+  }
 
   return program;
 }
 
+/// Align, tune and optimize the program \p program according to the flags,
+/// with the tuning options \p options. Takes ownership of \p program.
+/// \returns the prepared program.
+static Program *prepareProgram(Backend &backend, Program *program,
+                               const TuningOptions &options) {
+  alignArguments(program);
+  return optimizeProgram(backend, program, options);
+}
+
+/// Compile the program in \p content, which has a dynamic dimension, into a
+/// kernel with a program that is specialized for each of the sizes in \p ctx.
+/// The program for size 1 handles the other sizes. The kernel is checked
+/// before the pragmas are applied, and then the programs are tuned or
+/// optimized according to the flags.
+/// \returns the exit code of the compiler.
+static int compileDynamicKernel(Backend &backend, ParserContext &ctx,
+                                const std::string &content,
+                                const std::string &inFile) {
+  if (ctx.getPrograms().size() > 1) {
+    std::cout << "Files with a dynamic dimension may only contain one "
+                 "function.\n";
+    return 1;
+  }
+
+  auto sizes = ctx.getDynamicSizes();
+  if (std::find(sizes.begin(), sizes.end(), 1) == sizes.end()) {
+    sizes.push_back(1);
+  }
+
+  TuningOptions options;
+  if (FLAGS_tune && !getTuningOptions(options))
+    return 1;
+
+  // The contexts of the variants, which hold their pragma commands.
+  std::vector<std::pair<unsigned, std::unique_ptr<ParserContext>>> contexts;
+  DynamicKernel kernel(ctx.getProgram()->getName(), ctx.getDynamicName());
+  for (unsigned size : sizes) {
+    if (kernel.getVariant(size))
+      continue;
+
+    auto vctx = std::make_unique<ParserContext>(content.c_str(), inFile);
+    Program *program = parseProgram(*vctx, {ctx.getDynamicName()}, {(int)size});
+    if (vctx->getNumErrors())
+      return 1;
+
+    alignArguments(program);
+    kernel.addVariant(size, program);
+    contexts.emplace_back(size, std::move(vctx));
+  }
+
+  if (!kernel.analyze()) {
+    std::cout << "The dynamic dimension \"" << ctx.getDynamicName()
+              << "\" must be the outermost dimension of the arguments that "
+                 "have it, the program may only write to these arguments, "
+                 "and each iteration of the dimension may only access its own "
+                 "row.\n";
+    return 1;
+  }
+
+  for (auto &c : contexts) {
+    applyPragmas(*c.second);
+    if (c.second->getNumErrors())
+      return 1;
+
+    if (FLAGS_tune) {
+      std::cout << "Tuning the program for " << ctx.getDynamicName() << " = "
+                << c.first << ".\n";
+    }
+    Program *program = kernel.getVariant(c.first)->clone();
+    delete kernel.replaceVariant(c.first,
+                                 optimizeProgram(backend, program, options));
+  }
+
+  if (FLAGS_dump) {
+    kernel.dump();
+  }
+
+  if (FLAGS_out.size()) {
+    if (FLAGS_bytecode) {
+      std::cout << "Programs with a dynamic dimension can't be saved as "
+                   "bytecode.\n";
+      return 1;
+    }
+    backend.emitDynamicCode(kernel, FLAGS_out, FLAGS_textual);
+  }
+
+  return 0;
+}
+
+/// \returns True if \p name is a valid C identifier.
+static bool isIdentifier(const std::string &name) {
+  if (name.empty() || isdigit(name[0]))
+    return false;
+  for (char c : name) {
+    if (!isalnum(c) && c != '_')
+      return false;
+  }
+  return true;
+}
+
+/// \returns the path of the header of the library whose object file is saved
+/// at \p path, which is the path with the extension replaced by ".h".
+static std::string getHeaderPath(const std::string &path) {
+  auto dot = path.rfind('.');
+  auto slash = path.rfind('/');
+  if (dot == std::string::npos || (slash != std::string::npos && dot < slash))
+    return path + ".h";
+  return path.substr(0, dot) + ".h";
+}
+
+/// \returns the name of the library that is compiled from the file \p path,
+/// which is the name of the file without the extension, as a C identifier.
+static std::string getLibraryName(const std::string &path) {
+  auto slash = path.rfind('/');
+  std::string name = path.substr(slash == std::string::npos ? 0 : slash + 1);
+  name = name.substr(0, name.find('.'));
+  for (auto &c : name) {
+    if (!isalnum(c))
+      c = '_';
+  }
+  if (name.empty() || isdigit(name[0]))
+    name = "_" + name;
+  return name;
+}
+
+/// Append the program \p p, which was compiled by \p backend, to the archive
+/// in the archive flag, if the flag is set.
+/// \returns False if the program could not be appended.
+static bool appendToArchive(Backend &backend, Program *p) {
+  if (FLAGS_archive.empty())
+    return true;
+  BytecodeArchive archive(FLAGS_archive);
+  if (archive.append(p, backend.getTargetDescription()))
+    return true;
+  std::cout << "Unable to append the program to the archive " << FLAGS_archive
+            << "\n";
+  return false;
+}
+
+/// Compile the functions in the source, bytecode or archive files \p inFiles
+/// into the library \p name. Archives contribute the latest programs for the
+/// target of \p backend. The programs are tuned or optimized according to the
+/// flags. Save the object file of the library at the output path and the
+/// header of the library next to it. If \p parsed is set then it holds the
+/// functions of the first input file, which were already parsed and
+/// optimized by the pragmas, and the file is not parsed again.
+/// \returns the exit code of the compiler.
+static int compileLibrary(Backend &backend, const std::string &name,
+                          const std::vector<std::string> &inFiles,
+                          ParserContext *parsed = nullptr) {
+  if (!isIdentifier(name)) {
+    std::cout << "The name of the library must be a C identifier.\n";
+    return 1;
+  }
+  if (FLAGS_out.empty()) {
+    std::cout << "The output flag (--out) must be set for libraries.\n";
+    return 1;
+  }
+  if (FLAGS_bytecode) {
+    std::cout << "Libraries can't be saved as bytecode.\n";
+    return 1;
+  }
+
+  TuningOptions options;
+  if (FLAGS_tune && !getTuningOptions(options))
+    return 1;
+
+  KernelLibrary library(name);
+  for (auto &inFile : inFiles) {
+    bool isParsed = parsed && &inFile == &inFiles.front();
+    auto content = isParsed ? std::string() : readFile(inFile);
+    ParserContext fileCtx(content.c_str(), inFile);
+    auto &ctx = isParsed ? *parsed : fileCtx;
+    std::vector<Program *> programs;
+    if (isParsed) {
+      programs = ctx.getPrograms();
+    } else if (endsWith(inFile, ".bca")) {
+      BytecodeArchive archive(inFile);
+      auto target = backend.getTargetDescription();
+      for (auto *entry : archive.getLatestEntries(target)) {
+        programs.push_back(archive.load(*entry));
+      }
+      if (programs.empty()) {
+        std::cout << "No programs for the target " << target << " in "
+                  << inFile << "\n";
+        return 1;
+      }
+    } else if (endsWith(inFile, ".bc")) {
+      programs.push_back(Bytecode::deserializeFile(inFile));
+    } else if (parseAndOptimize(ctx)) {
+      programs = ctx.getPrograms();
+    }
+    if (programs.empty() ||
+        std::find(programs.begin(), programs.end(), nullptr) != programs.end())
+      return 1;
+
+    if (ctx.getDynamicName().size()) {
+      std::cout << "Programs with a dynamic dimension can't be added to a "
+                   "library: "
+                << inFile << "\n";
+      return 1;
+    }
+
+    for (auto *program : programs) {
+      if (FLAGS_tune) {
+        std::cout << "Tuning the program \"" << program->getName() << "\".\n";
+      }
+      program = prepareProgram(backend, program, options);
+
+      if (FLAGS_dump) {
+        program->dump();
+      }
+
+      if (!appendToArchive(backend, program)) {
+        delete program;
+        return 1;
+      }
+
+      if (!library.addKernel(program)) {
+        std::cout << "The kernel \"" << program->getName()
+                  << "\" is defined twice with the same argument types.\n";
+        delete program;
+        return 1;
+      }
+    }
+  }
+
+  if (!backend.emitLibraryCode(library, FLAGS_out, FLAGS_textual)) {
+    std::cout << "Unable to emit the library " << name << "\n";
+    return 1;
+  }
+  writeFile(getHeaderPath(FLAGS_out), library.emitHeader());
+  return 0;
+}
+
 int main(int argc, char *argv[]) {
   gflags::SetUsageMessage("Bistra compiler driver.");
   gflags::SetVersionString("0.0.1");
   gflags::ParseCommandLineFlags(&argc, &argv, true);
 
-  if (argc != 2) {
+  if (argc < 2 || (argc != 2 && FLAGS_library.empty())) {
     std::cout << "Usage: bistrac [...] program.m\n";
+    std::cout << "       bistrac --library=name --out=name.o [...] a.m b.m\n";
     std::cout << "See --help for more details.\n";
     return 0;
   }
-  std::string inFile = argv[1];
+  std::vector<std::string> inFiles(argv + 1, argv + argc);
+  std::string inFile = inFiles[0];
 
   gflags::ShutDownCommandLineFlags();
 
+  if (FLAGS_align > 0 && (FLAGS_align & (FLAGS_align - 1))) {
+    std::cout << "The alignment must be a power of two.\n";
+    return 1;
+  }
+
   // Get the backend.
-  auto backend = getBackend(FLAGS_backend);
+  auto backend = getBackend(FLAGS_backend, FLAGS_mcpu, FLAGS_mattr);
   assert(backend.get() && "Invalid backend");
 
+  // Compile all of the input programs into a library.
+  if (FLAGS_library.size()) {
+    return compileLibrary(*backend.get(), FLAGS_library, inFiles);
+  }
+
   Program *program;
   auto content = readFile(inFile);
   ParserContext ctx(content.c_str(), inFile);
 
   if (endsWith(inFile, ".bc")) {
-    program = Bytecode::deserialize(content);
+    program = Bytecode::deserializeFile(inFile);
   } else {
     program = parseAndOptimize(ctx);
   }
@@ -239,6 +671,27 @@ int main(int argc, char *argv[]) {
   if (!program)
     return 1;
 
+  // Programs with a dynamic dimension are compiled into a kernel.
+  if (ctx.getDynamicName().size()) {
+    int res = compileDynamicKernel(*backend.get(), ctx, content, inFile);
+    delete program;
+    return res;
+  }
+
+  // Files with several functions are compiled into a library that is named
+  // after the file. The functions were already parsed and optimized by the
+  // pragmas, so they are handed over as they are.
+  if (ctx.getPrograms().size() > 1) {
+    return compileLibrary(*backend.get(), getLibraryName(inFile), inFiles,
+                          &ctx);
+  }
+
+  if (FLAGS_align > 0) {
+    for (auto *arg : program->getArgs()) {
+      arg->setAlignment(FLAGS_align);
+    }
+  }
+
   if (FLAGS_tune) {
     std::string outFile = "/tmp/file.s";
     if (FLAGS_out.size()) {
@@ -248,8 +701,13 @@ int main(int argc, char *argv[]) {
                 << outFile << "\n";
     }
 
-    optimizeEvaluate(*backend.get(), program, outFile, FLAGS_textual,
-                     FLAGS_bytecode);
+    TuningOptions options;
+    if (!getTuningOptions(options))
+      return 1;
+    auto *best = optimizeEvaluate(*backend.get(), program, outFile,
+                                  FLAGS_textual, FLAGS_bytecode, options);
+    delete program;
+    program = (Program *)best->clone();
   }
 
   if (FLAGS_opt) {
@@ -263,15 +721,22 @@ int main(int argc, char *argv[]) {
   }
 
   if (FLAGS_time) {
-    auto res = backend->evaluateCode(program, 10);
+    auto binary = backend->compileBenchmark(program, 10);
+    auto res =
+        backend->evaluateBinary(program, binary, 10, getMeasureOptions());
     std::cout << "The program \"" << program->getName() << "\" completed in "
-              << res << " seconds. \n";
+              << res.median << " seconds (min: " << res.min
+              << ", stddev: " << res.stddev << ", samples: " << res.samples
+              << ", outliers: " << res.outliers << "). \n";
   }
 
   if (FLAGS_warn) {
     analyzeProgram(program, ctx);
   }
 
+  if (!appendToArchive(*backend.get(), program))
+    return 1;
+
   if (FLAGS_out.size()) {
     // Emit bytecode.
     if (FLAGS_bytecode) {